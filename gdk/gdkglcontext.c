@@ -98,6 +98,7 @@
 #endif
 
 #include <epoxy/gl.h>
+#include <string.h>
 
 typedef struct {
   GdkGLContext *shared_context;
@@ -145,7 +146,7 @@ gdk_gl_context_clear_old_updated_area (GdkGLContext *context)
 {
   int i;
 
-  for (i = 0; i < 2; i++)
+  for (i = 0; i < GDK_GL_MAX_TRACKED_BUFFERS; i++)
     {
       g_clear_pointer (&context->old_updated_area[i], cairo_region_destroy);
     }
@@ -326,6 +327,41 @@ gdk_gl_context_real_realize (GdkGLContext  *self,
   return FALSE;
 }
 
+/*< private >
+ * gdk_gl_context_get_buffer_age_damage:
+ * @context: a #GdkGLContext
+ * @buffer_age: the age of the back buffer, as reported by the
+ *   windowing system
+ *
+ * Computes the area of a back buffer of age @buffer_age that is
+ * out of date, from the areas updated in the previous frames.
+ *
+ * Returns: (nullable): the damaged area, or %NULL if the buffer
+ *   is older than the frames we keep track of
+ */
+cairo_region_t *
+gdk_gl_context_get_buffer_age_damage (GdkGLContext *context,
+                                      int           buffer_age)
+{
+  cairo_region_t *damage;
+  int i;
+
+  if (buffer_age < 1 || buffer_age > GDK_GL_MAX_TRACKED_BUFFERS + 1)
+    return NULL;
+
+  for (i = 0; i < buffer_age - 1; i++)
+    {
+      if (context->old_updated_area[i] == NULL)
+        return NULL;
+    }
+
+  damage = cairo_region_create ();
+  for (i = 0; i < buffer_age - 1; i++)
+    cairo_region_union (damage, context->old_updated_area[i]);
+
+  return damage;
+}
+
 static cairo_region_t *
 gdk_gl_context_real_get_damage (GdkGLContext *context)
 {
@@ -357,9 +393,11 @@ gdk_gl_context_real_begin_frame (GdkDrawContext *draw_context,
 
   damage = GDK_GL_CONTEXT_GET_CLASS (context)->get_damage (context);
 
-  if (context->old_updated_area[1])
-    cairo_region_destroy (context->old_updated_area[1]);
-  context->old_updated_area[1] = context->old_updated_area[0];
+  if (context->old_updated_area[GDK_GL_MAX_TRACKED_BUFFERS - 1])
+    cairo_region_destroy (context->old_updated_area[GDK_GL_MAX_TRACKED_BUFFERS - 1]);
+  memmove (&context->old_updated_area[1],
+           &context->old_updated_area[0],
+           (GDK_GL_MAX_TRACKED_BUFFERS - 1) * sizeof (cairo_region_t *));
   context->old_updated_area[0] = cairo_region_copy (region);
 
   cairo_region_union (region, damage);
@@ -33,12 +33,16 @@ G_BEGIN_DECLS
 
 typedef struct _GdkGLContextClass       GdkGLContextClass;
 
+/* Swap chains are usually 2 or 3 buffers deep, but some drivers
+ * keep more buffers around when under load */
+#define GDK_GL_MAX_TRACKED_BUFFERS 4
+
 struct _GdkGLContext
 {
   GdkDrawContext parent_instance;
 
   /* We store the old drawn areas to support buffer-age optimizations */
-  cairo_region_t *old_updated_area[2];
+  cairo_region_t *old_updated_area[GDK_GL_MAX_TRACKED_BUFFERS];
 };
 
 struct _GdkGLContextClass
@@ -106,6 +110,9 @@ gboolean                gdk_gl_context_has_debug                (GdkGLContext
 
 gboolean                gdk_gl_context_use_es_bgra              (GdkGLContext    *context);
 
+cairo_region_t *        gdk_gl_context_get_buffer_age_damage    (GdkGLContext    *context,
+                                                                 int              buffer_age);
+
 typedef struct {
   float x1, y1, x2, y2;
   float u1, v1, u2, v2;
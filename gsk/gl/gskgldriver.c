@@ -12,6 +12,14 @@
 #include <gdk/gdk.h>
 #include <epoxy/gl.h>
 
+/* Cached textures are kept this many frames after they were last used */
+#define TEXTURE_KEEP_FRAMES 5
+
+/* Textures nobody uses anymore are pooled for reuse. They are deleted
+ * after this many frames, or earlier when the pool gets too big */
+#define POOL_KEEP_FRAMES 30
+#define POOL_MAX_BYTES   (64 * 1024 * 1024)
+
  typedef struct {
   GLuint fbo_id;
   GLuint depth_stencil_id;
@@ -25,8 +33,15 @@ typedef struct {
   GLuint mag_filter;
   Fbo fbo;
   GdkTexture *user;
+  GskTextureKey *key; /* owned by pointer_textures */
+  guint64 last_used_frame;
   guint in_use : 1;
   guint permanent : 1;
+  guint allocated : 1;
+
+  /* Only used while in the pool */
+  GList pool_link;
+  GList bucket_link;
 
   /* TODO: Make this optional and not for every texture... */
   TextureSlice *slices;
@@ -42,6 +57,9 @@ struct _GskGLDriver
   struct {
     GQuark created_textures;
     GQuark reused_textures;
+    GQuark reused_render_targets;
+    GQuark pooled_textures;
+    GQuark pooled_bytes;
     GQuark surface_uploads;
   } counters;
 
@@ -50,6 +68,13 @@ struct _GskGLDriver
   GHashTable *textures;         /* texture_id -> Texture */
   GHashTable *pointer_textures; /* pointer -> texture_id */
 
+  /* Unused textures, most recently released first */
+  GQueue pool;
+  GHashTable *pool_buckets;     /* size -> GQueue of Texture */
+  gsize pool_bytes;
+
+  guint64 frame_counter;
+
   const Texture *bound_source_texture;
 
   int max_texture_size;
@@ -149,6 +174,79 @@ texture_free (gpointer data)
   g_slice_free (Texture, t);
 }
 
+static inline gsize
+texture_bytes (const Texture *t)
+{
+  return (gsize) t->width * t->height * 4;
+}
+
+/* All our textures are GL_RGBA8, so the size is all that matters */
+static inline gpointer
+pool_bucket_key (int width,
+                 int height)
+{
+  return GSIZE_TO_POINTER (((gsize) width << 16) | (gsize) height);
+}
+
+static void
+gsk_gl_driver_pool_texture (GskGLDriver *self,
+                            Texture     *t)
+{
+  gpointer bucket_key = pool_bucket_key (t->width, t->height);
+  GQueue *bucket;
+
+  g_assert (t->texture_id != 0);
+  g_assert (t->key == NULL);
+
+  bucket = g_hash_table_lookup (self->pool_buckets, bucket_key);
+  if (bucket == NULL)
+    {
+      bucket = g_queue_new ();
+      g_hash_table_insert (self->pool_buckets, bucket_key, bucket);
+    }
+
+  t->last_used_frame = self->frame_counter;
+  t->pool_link.data = t;
+  t->bucket_link.data = t;
+  g_queue_push_head_link (&self->pool, &t->pool_link);
+  g_queue_push_head_link (bucket, &t->bucket_link);
+  self->pool_bytes += texture_bytes (t);
+}
+
+static void
+gsk_gl_driver_unpool_texture (GskGLDriver *self,
+                              Texture     *t)
+{
+  gpointer bucket_key = pool_bucket_key (t->width, t->height);
+  GQueue *bucket;
+
+  bucket = g_hash_table_lookup (self->pool_buckets, bucket_key);
+  g_assert (bucket != NULL);
+
+  g_queue_unlink (&self->pool, &t->pool_link);
+  g_queue_unlink (bucket, &t->bucket_link);
+  if (g_queue_is_empty (bucket))
+    g_hash_table_remove (self->pool_buckets, bucket_key);
+
+  self->pool_bytes -= texture_bytes (t);
+}
+
+static void
+gsk_gl_driver_trim_pool (GskGLDriver *self)
+{
+  while (self->pool.tail != NULL)
+    {
+      Texture *t = self->pool.tail->data;
+
+      if (self->frame_counter - t->last_used_frame <= POOL_KEEP_FRAMES &&
+          self->pool_bytes <= POOL_MAX_BYTES)
+        break;
+
+      gsk_gl_driver_unpool_texture (self, t);
+      texture_free (t);
+    }
+}
+
 static void
 gsk_gl_driver_set_texture_parameters (GskGLDriver *self,
                                       int          min_filter,
@@ -168,6 +266,15 @@ gsk_gl_driver_finalize (GObject *gobject)
 
   gdk_gl_context_make_current (self->gl_context);
 
+  while (self->pool.head != NULL)
+    {
+      Texture *t = self->pool.head->data;
+
+      gsk_gl_driver_unpool_texture (self, t);
+      texture_free (t);
+    }
+  g_clear_pointer (&self->pool_buckets, g_hash_table_unref);
+
   g_clear_pointer (&self->textures, g_hash_table_unref);
   g_clear_pointer (&self->pointer_textures, g_hash_table_unref);
   g_clear_object (&self->profiler);
@@ -190,6 +297,7 @@ static void
 gsk_gl_driver_init (GskGLDriver *self)
 {
   self->textures = g_hash_table_new_full (NULL, NULL, NULL, texture_free);
+  self->pool_buckets = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify) g_queue_free);
 
   self->max_texture_size = -1;
 
@@ -203,6 +311,18 @@ gsk_gl_driver_init (GskGLDriver *self)
                                                              "reused_textures",
                                                              "Textures reused this frame",
                                                              TRUE);
+  self->counters.reused_render_targets = gsk_profiler_add_counter (self->profiler,
+                                                                   "reused_render_targets",
+                                                                   "Framebuffers reused this frame",
+                                                                   TRUE);
+  self->counters.pooled_textures = gsk_profiler_add_counter (self->profiler,
+                                                             "pooled_textures",
+                                                             "Textures in the pool",
+                                                             FALSE);
+  self->counters.pooled_bytes = gsk_profiler_add_counter (self->profiler,
+                                                          "pooled_bytes",
+                                                          "Bytes of textures in the pool",
+                                                          FALSE);
   self->counters.surface_uploads = gsk_profiler_add_counter (self->profiler,
                                                              "surface_uploads",
                                                              "Texture uploads from surfaces this frame",
@@ -274,15 +394,19 @@ gsk_gl_driver_end_frame (GskGLDriver *self)
   GSK_NOTE (OPENGL,
             g_message ("Textures created: %" G_GINT64_FORMAT "\n"
                      " Textures reused: %" G_GINT64_FORMAT "\n"
+                     " Framebuffers reused: %" G_GINT64_FORMAT "\n"
                      " Surface uploads: %" G_GINT64_FORMAT,
                      gsk_profiler_counter_get (self->profiler, self->counters.created_textures),
                      gsk_profiler_counter_get (self->profiler, self->counters.reused_textures),
+                     gsk_profiler_counter_get (self->profiler, self->counters.reused_render_targets),
                      gsk_profiler_counter_get (self->profiler, self->counters.surface_uploads)));
 #endif
 
   GSK_NOTE (OPENGL,
-            g_message ("*** Frame end: textures=%d",
-                     g_hash_table_size (self->textures)));
+            g_message ("*** Frame end: textures=%d pooled=%u (%" G_GSIZE_FORMAT " bytes)",
+                     g_hash_table_size (self->textures),
+                     self->pool.length,
+                     self->pool_bytes));
 
   self->in_frame = FALSE;
 }
@@ -297,6 +421,8 @@ gsk_gl_driver_collect_textures (GskGLDriver *self)
   g_return_val_if_fail (GSK_IS_GL_DRIVER (self), 0);
   g_return_val_if_fail (!self->in_frame, 0);
 
+  self->frame_counter++;
+
   old_size = g_hash_table_size (self->textures);
 
   g_hash_table_iter_init (&iter, self->textures);
@@ -310,38 +436,29 @@ gsk_gl_driver_collect_textures (GskGLDriver *self)
       if (t->in_use)
         {
           t->in_use = FALSE;
-
-          if (t->fbo.fbo_id != 0)
-            {
-              fbo_clear (&t->fbo);
-              t->fbo.fbo_id = 0;
-            }
+          t->last_used_frame = self->frame_counter;
         }
-      else
+      else if (t->key == NULL ||
+               self->frame_counter - t->last_used_frame > TEXTURE_KEEP_FRAMES)
         {
-          /* Remove from self->pointer_textures. */
-          /* TODO: Is there a better way for this? */
-          if (self->pointer_textures)
-            {
-              GHashTableIter pointer_iter;
-              gpointer value;
-              gpointer p;
-
-              g_hash_table_iter_init (&pointer_iter, self->pointer_textures);
-              while (g_hash_table_iter_next (&pointer_iter, &p, &value))
-                {
-                  if (GPOINTER_TO_INT (value) == t->texture_id)
-                    {
-                      g_hash_table_iter_remove (&pointer_iter);
-                      break;
-                    }
-                }
-            }
-
-          g_hash_table_iter_remove (&iter);
+          if (t->key != NULL)
+            g_hash_table_remove (self->pointer_textures, t->key);
+          t->key = NULL;
+
+          g_hash_table_iter_steal (&iter);
+
+          /* Sliced textures are never in self->textures */
+          gsk_gl_driver_pool_texture (self, t);
         }
     }
 
+  gsk_gl_driver_trim_pool (self);
+
+#ifdef G_ENABLE_DEBUG
+  gsk_profiler_counter_set (self->profiler, self->counters.pooled_textures, self->pool.length);
+  gsk_profiler_counter_set (self->profiler, self->counters.pooled_bytes, self->pool_bytes);
+#endif
+
   return old_size - g_hash_table_size (self->textures);
 }
 
@@ -385,6 +502,7 @@ create_texture (GskGLDriver *self,
 {
   guint texture_id;
   Texture *t;
+  GQueue *bucket;
   int width = ceilf (fwidth);
   int height = ceilf (fheight);
 
@@ -402,6 +520,21 @@ create_texture (GskGLDriver *self,
       height = MIN (height, self->max_texture_size);
     }
 
+  bucket = g_hash_table_lookup (self->pool_buckets, pool_bucket_key (width, height));
+  if (bucket != NULL)
+    {
+      t = bucket->head->data;
+      gsk_gl_driver_unpool_texture (self, t);
+
+      t->in_use = TRUE;
+      g_hash_table_insert (self->textures, GINT_TO_POINTER (t->texture_id), t);
+#ifdef G_ENABLE_DEBUG
+      gsk_profiler_counter_inc (self->profiler, self->counters.reused_textures);
+#endif
+
+      return t;
+    }
+
   glGenTextures (1, &texture_id);
   t = texture_new ();
   t->texture_id = texture_id;
@@ -586,6 +719,7 @@ texture_key_hash (gconstpointer v)
   const GskTextureKey *k = (GskTextureKey *)v;
 
   return GPOINTER_TO_UINT (k->pointer)
+         + k->serial
          + (guint)(k->scale_x * 100)
          + (guint)(k->scale_y * 100)
          + (guint)k->filter * 2 +
@@ -599,6 +733,7 @@ texture_key_equal (gconstpointer v1, gconstpointer v2)
   const GskTextureKey *k2 = (GskTextureKey *)v2;
 
   return k1->pointer == k2->pointer &&
+         k1->serial == k2->serial &&
          k1->scale_x == k2->scale_x &&
          k1->scale_y == k2->scale_y &&
          k1->filter == k2->filter &&
@@ -624,7 +759,15 @@ gsk_gl_driver_get_texture_for_key (GskGLDriver   *self,
       t = g_hash_table_lookup (self->textures, GINT_TO_POINTER (id));
 
       if (t != NULL)
-        t->in_use = TRUE;
+        {
+          t->in_use = TRUE;
+        }
+      else
+        {
+          /* The texture has been destroyed behind our back */
+          g_hash_table_remove (self->pointer_textures, key);
+          id = 0;
+        }
     }
 
   return id;
@@ -636,14 +779,33 @@ gsk_gl_driver_set_texture_for_key (GskGLDriver   *self,
                                    int            texture_id)
 {
   GskTextureKey *k;
+  Texture *t;
+  int old_id;
 
   if (G_UNLIKELY (self->pointer_textures == NULL))
     self->pointer_textures = g_hash_table_new_full (texture_key_hash, texture_key_equal, g_free, NULL);
 
+  /* Keep the reverse index in sync */
+  old_id = GPOINTER_TO_INT (g_hash_table_lookup (self->pointer_textures, key));
+  if (old_id != 0)
+    {
+      t = gsk_gl_driver_get_texture (self, old_id);
+      if (t != NULL && t->key != NULL && texture_key_equal (t->key, key))
+        t->key = NULL;
+    }
+
   k = g_new (GskTextureKey, 1);
   *k = *key;
 
-  g_hash_table_insert (self->pointer_textures, k, GINT_TO_POINTER (texture_id));
+  g_hash_table_replace (self->pointer_textures, k, GINT_TO_POINTER (texture_id));
+
+  t = gsk_gl_driver_get_texture (self, texture_id);
+  if (t != NULL)
+    {
+      if (t->key != NULL)
+        g_hash_table_remove (self->pointer_textures, t->key);
+      t->key = k;
+    }
 }
 
 int
@@ -678,6 +840,17 @@ gsk_gl_driver_create_render_target (GskGLDriver *self,
   gsk_gl_driver_bind_source_texture (self, texture->texture_id);
   gsk_gl_driver_init_texture_empty (self, texture->texture_id, min_filter, mag_filter);
 
+  /* Pooled textures keep their framebuffer */
+  if (texture->fbo.fbo_id != 0)
+    {
+#ifdef G_ENABLE_DEBUG
+      gsk_profiler_counter_inc (self->profiler, self->counters.reused_render_targets);
+#endif
+      *out_texture_id = texture->texture_id;
+      *out_render_target_id = texture->fbo.fbo_id;
+      return;
+    }
+
   glGenFramebuffers (1, &fbo_id);
   glBindFramebuffer (GL_FRAMEBUFFER, fbo_id);
   glFramebufferTexture2D (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture->texture_id, 0);
@@ -764,8 +937,14 @@ void
 gsk_gl_driver_destroy_texture (GskGLDriver *self,
                                int          texture_id)
 {
+  Texture *t;
+
   g_return_if_fail (GSK_IS_GL_DRIVER (self));
 
+  t = gsk_gl_driver_get_texture (self, texture_id);
+  if (t != NULL && t->key != NULL)
+    g_hash_table_remove (self->pointer_textures, t->key);
+
   g_hash_table_remove (self->textures, GINT_TO_POINTER (texture_id));
 }
 
@@ -798,10 +977,16 @@ gsk_gl_driver_init_texture_empty (GskGLDriver *self,
 
   gsk_gl_driver_set_texture_parameters (self, t->min_filter, t->mag_filter);
 
-  if (gdk_gl_context_get_use_es (self->gl_context))
-    glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA8, t->width, t->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-  else
-    glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA8, t->width, t->height, 0, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+  /* Textures from the pool already have storage of the right size */
+  if (!t->allocated)
+    {
+      if (gdk_gl_context_get_use_es (self->gl_context))
+        glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA8, t->width, t->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+      else
+        glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA8, t->width, t->height, 0, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+
+      t->allocated = TRUE;
+    }
 
   glBindTexture (GL_TEXTURE_2D, 0);
 }
@@ -840,6 +1025,9 @@ gsk_gl_driver_init_texture (GskGLDriver     *self,
 
   upload_gdk_texture (texture, GL_TEXTURE_2D, 0, 0, t->width, t->height);
 
+  /* The upload may have picked a different internal format */
+  t->allocated = FALSE;
+
 #ifdef G_ENABLE_DEBUG
   gsk_profiler_counter_inc (self->profiler, self->counters.surface_uploads);
 #endif
@@ -23,6 +23,7 @@ typedef struct {
 
 typedef struct {
   gpointer pointer;
+  guint serial; /* of the render node at pointer */
   float scale_x;
   float scale_y;
   int filter;
@@ -12,6 +12,7 @@
 #include <graphene.h>
 #include <cairo.h>
 #include <epoxy/gl.h>
+#include <math.h>
 #include <string.h>
 
 /* Cache eviction strategy
@@ -22,8 +23,11 @@
  *
  * We keep count of the pixels of each atlas that are
  * taken up by old data. When the fraction of old pixels
- * gets too high, we drop the atlas and all the items it
- * contained.
+ * gets too high, the atlas starts draining: every frame,
+ * we copy some of the glyphs that are still in use over
+ * to other atlases on the GPU, and drop the old ones.
+ * This avoids re-rendering and re-uploading everything
+ * that was on the atlas at once. See gskgltextureatlas.c.
  *
  * Big glyphs are not stored in the atlas, they get their
  * own texture, but they are still cached.
@@ -31,6 +35,7 @@
 
 #define MAX_FRAME_AGE (60)
 #define MAX_GLYPH_SIZE 128 /* Will get its own texture if bigger */
+#define DEFAULT_MAX_COMPACT_BYTES (256 * 1024)
 
 static guint    glyph_cache_hash       (gconstpointer v);
 static gboolean glyph_cache_equal      (gconstpointer v1,
@@ -43,10 +48,16 @@ gsk_gl_glyph_cache_new (GdkDisplay *display,
                         GskGLTextureAtlases *atlases)
 {
   GskGLGlyphCache *glyph_cache;
+  const char *max_compact_bytes;
 
   glyph_cache = g_new0 (GskGLGlyphCache, 1);
 
   glyph_cache->display = display;
+  glyph_cache->max_compact_bytes = DEFAULT_MAX_COMPACT_BYTES;
+  max_compact_bytes = g_getenv ("GSK_GLYPH_COMPACT_BYTES");
+  if (max_compact_bytes)
+    glyph_cache->max_compact_bytes = g_ascii_strtoull (max_compact_bytes, NULL, 10);
+
   glyph_cache->hash_table = g_hash_table_new_full (glyph_cache_hash, glyph_cache_equal,
                                                    glyph_cache_key_free, glyph_cache_value_free);
 
@@ -183,7 +194,8 @@ render_glyph (GlyphCacheKey    *key,
 }
 
 static void
-upload_glyph (GlyphCacheKey    *key,
+upload_glyph (GskGLGlyphCache  *self,
+              GlyphCacheKey    *key,
               GskGLCachedGlyph *value)
 {
   GskImageRegion r;
@@ -221,6 +233,7 @@ upload_glyph (GlyphCacheKey    *key,
       glTexSubImage2D (GL_TEXTURE_2D, 0, r.x, r.y, r.width, r.height,
                        gl_format, gl_type, pixel_data);
       glPixelStorei (GL_UNPACK_ROW_LENGTH, 0);
+      self->upload_bytes += r.width * r.height * 4;
       g_free (r.data);
       g_free (free_data);
     }
@@ -269,7 +282,7 @@ add_to_cache (GskGLGlyphCache  *self,
       value->th = 1.0f;
     }
 
-  upload_glyph (key, value);
+  upload_glyph (self, key, value);
 }
 
 void
@@ -334,6 +347,122 @@ gsk_gl_glyph_cache_lookup_or_add (GskGLGlyphCache         *cache,
   }
 }
 
+/* Copies a glyph, including its padding, from its draining atlas
+ * to a fresh spot. The source atlas must be attached to the
+ * read framebuffer.
+ */
+static void
+move_glyph (GskGLGlyphCache  *self,
+            GlyphCacheKey    *key,
+            GskGLCachedGlyph *value)
+{
+  const int width = value->draw_width * key->data.scale / 1024;
+  const int height = value->draw_height * key->data.scale / 1024;
+  GskGLTextureAtlas *old_atlas = value->atlas;
+  GskGLTextureAtlas *atlas = NULL;
+  int src_x, src_y;
+  int packed_x = 0;
+  int packed_y = 0;
+
+  src_x = (int) roundf (value->tx * old_atlas->width) - 1;
+  src_y = (int) roundf (value->ty * old_atlas->height) - 1;
+
+  gsk_gl_texture_atlases_pack (self->atlases, width + 2, height + 2, &atlas, &packed_x, &packed_y);
+
+  glBindTexture (GL_TEXTURE_2D, atlas->texture_id);
+  glCopyTexSubImage2D (GL_TEXTURE_2D, 0,
+                       packed_x, packed_y,
+                       src_x, src_y,
+                       width + 2, height + 2);
+
+  value->tx = (float)(packed_x + 1) / atlas->width;
+  value->ty = (float)(packed_y + 1) / atlas->height;
+  value->tw = (float)width / atlas->width;
+  value->th = (float)height / atlas->height;
+
+  value->atlas = atlas;
+  value->texture_id = atlas->texture_id;
+
+  self->compact_bytes += (width + 2) * (height + 2) * 4;
+}
+
+static guint
+compact_atlases (GskGLGlyphCache *self)
+{
+  GHashTableIter iter;
+  GlyphCacheKey *key;
+  GskGLCachedGlyph *value;
+  GskGLTextureAtlas *attached = NULL;
+  GLint old_framebuffer_id = 0;
+  guint framebuffer_id = 0;
+  guint dropped = 0;
+  guint i;
+
+  if (self->atlases->draining->len == 0)
+    return 0;
+
+  /* Whatever is still on an atlas after this clears the flag again */
+  for (i = 0; i < self->atlases->draining->len; i++)
+    {
+      GskGLTextureAtlas *atlas = g_ptr_array_index (self->atlases->draining, i);
+      atlas->drained = TRUE;
+    }
+
+  gdk_gl_context_push_debug_group (gdk_gl_context_get_current (), "Compacting glyph atlases");
+
+  glGetIntegerv (GL_FRAMEBUFFER_BINDING, &old_framebuffer_id);
+
+  g_hash_table_iter_init (&iter, self->hash_table);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&key, (gpointer *)&value))
+    {
+      if (value->atlas == NULL || !value->atlas->draining)
+        continue;
+
+      /* Old glyphs are not worth moving */
+      if (!value->used)
+        {
+          g_hash_table_iter_remove (&iter);
+          dropped++;
+          continue;
+        }
+
+      if (self->compact_bytes >= self->max_compact_bytes)
+        {
+          value->atlas->drained = FALSE;
+          continue;
+        }
+
+      /* The cache is shared between contexts, framebuffers are not */
+      if (attached != value->atlas)
+        {
+          if (framebuffer_id == 0)
+            glGenFramebuffers (1, &framebuffer_id);
+
+          glBindFramebuffer (GL_FRAMEBUFFER, framebuffer_id);
+          glFramebufferTexture2D (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                  GL_TEXTURE_2D, value->atlas->texture_id, 0);
+          attached = value->atlas;
+        }
+
+      move_glyph (self, key, value);
+    }
+
+  if (framebuffer_id != 0)
+    {
+      glBindFramebuffer (GL_FRAMEBUFFER, old_framebuffer_id);
+      glDeleteFramebuffers (1, &framebuffer_id);
+    }
+
+  gdk_gl_context_pop_debug_group (gdk_gl_context_get_current ());
+
+  GSK_NOTE(GLYPH_CACHE,
+           if (self->compact_bytes > 0)
+             g_message ("Moved %" G_GSIZE_FORMAT " bytes of glyphs out of draining atlases",
+                        self->compact_bytes));
+
+  return dropped;
+}
+
 void
 gsk_gl_glyph_cache_begin_frame (GskGLGlyphCache *self,
                                 GskGLDriver     *driver,
@@ -345,6 +474,8 @@ gsk_gl_glyph_cache_begin_frame (GskGLGlyphCache *self,
   guint dropped = 0;
 
   self->timestamp++;
+  self->upload_bytes = 0;
+  self->compact_bytes = 0;
 
   if (removed_atlases->len > 0)
     {
@@ -359,6 +490,8 @@ gsk_gl_glyph_cache_begin_frame (GskGLGlyphCache *self,
         }
     }
 
+  dropped += compact_atlases (self);
+
   if (self->timestamp % MAX_FRAME_AGE == 30)
     {
       g_hash_table_iter_init (&iter, self->hash_table);
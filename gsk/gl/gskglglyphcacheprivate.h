@@ -16,6 +16,13 @@ typedef struct
   GskGLTextureAtlases *atlases;
 
   int timestamp;
+
+  /* Bound for the glyph data moved out of draining atlases per frame */
+  gsize max_compact_bytes;
+
+  /* Per-frame statistics, reset by gsk_gl_glyph_cache_begin_frame() */
+  gsize upload_bytes;
+  gsize compact_bytes;
 } GskGLGlyphCache;
 
 struct _CacheKeyData
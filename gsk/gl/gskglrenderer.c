@@ -29,6 +29,7 @@
 #include "gdk/gdkrgbaprivate.h"
 
 #include <epoxy/gl.h>
+#include <string.h>
 
 #define SHADER_VERSION_GLES             100
 #define SHADER_VERSION_GL2_LEGACY       110
@@ -42,6 +43,12 @@
 
 #define SHADOW_EXTRA_SIZE  4
 
+/* Damage is rendered in at most MAX_RENDER_RECTS passes. Regions with
+ * more than MAX_DAMAGE_RECTS rectangles are rendered as their extents */
+#define MAX_RENDER_RECTS         8
+#define MAX_DAMAGE_RECTS         32
+#define RENDER_RECT_MERGE_SLACK  (64 * 64)
+
 #if DEBUG_OPS
 #define OP_PRINT(format, ...) g_print(format, ## __VA_ARGS__)
 #else
@@ -546,14 +553,29 @@ struct _GskGLRenderer
 #ifdef G_ENABLE_DEBUG
   struct {
     GQuark frames;
+    GQuark pixels;
+    GQuark draws_recorded;
+    GQuark draws;
+    GQuark glyph_upload_bytes;
+    GQuark glyph_compact_bytes;
+    GQuark atlas_bytes;
   } profile_counters;
   struct {
     GQuark cpu_time;
     GQuark gpu_time;
   } profile_timers;
+  /* Accumulated over all passes of the current frame */
+  guint n_draws_recorded;
+  guint n_draws;
 #endif
 
-  cairo_region_t *render_region;
+  /* The areas to redraw, in surface coordinates. None means
+   * redrawing everything */
+  cairo_rectangle_int_t render_rects[MAX_RENDER_RECTS];
+  guint n_render_rects;
+
+  /* The one currently being drawn, or NULL */
+  const cairo_rectangle_int_t *render_rect;
 };
 
 struct _GskGLRendererClass
@@ -663,6 +685,7 @@ render_fallback_node (GskGLRenderer   *self,
     return;
 
   key.pointer = node;
+  key.serial = node->serial;
   key.pointer_is_child = FALSE;
   key.scale_x = scale_x;
   key.scale_y = scale_y;
@@ -1989,6 +2012,7 @@ render_blur_node (GskGLRenderer   *self,
     }
 
   key.pointer = node;
+  key.serial = node->serial;
   key.pointer_is_child = FALSE;
   key.scale_x = builder->scale_x;
   key.scale_y = builder->scale_y;
@@ -2053,6 +2077,7 @@ render_inset_shadow_node (GskGLRenderer   *self,
   texture_height = ceilf ((node_outline->bounds.size.height + blur_extra) * scale_y);
 
   key.pointer = node;
+  key.serial = node->serial;
   key.pointer_is_child = FALSE;
   key.scale_x = scale_x;
   key.scale_y = scale_y;
@@ -3306,6 +3331,7 @@ gsk_gl_renderer_create_programs (GskGLRenderer  *self,
 {
   GskGLShaderBuilder shader_builder;
   GskGLRendererPrograms *programs = NULL;
+  gint64 start_time G_GNUC_UNUSED = GDK_PROFILER_CURRENT_TIME;
   int i;
   static const struct {
     const char *resource_path;
@@ -3337,6 +3363,15 @@ gsk_gl_renderer_create_programs (GskGLRenderer  *self,
 
   init_shader_builder (self, &shader_builder);
 
+  /* Custom shaders are not cached, there is no telling how many
+   * of them an application creates. */
+  if (!g_getenv ("GSK_NO_PROGRAM_CACHE"))
+    {
+      char *cache_dir = g_build_filename (g_get_user_cache_dir (), "gtk-4.0", "gsk", "gl-programs", NULL);
+      gsk_gl_shader_builder_set_cache_dir (&shader_builder, cache_dir);
+      g_free (cache_dir);
+    }
+
   programs = gsk_gl_renderer_programs_new ();
 
   for (i = 0; i < GL_N_PROGRAMS; i ++)
@@ -3440,6 +3475,12 @@ gsk_gl_renderer_create_programs (GskGLRenderer  *self,
     }
 
 out:
+  gdk_profiler_end_markf (start_time, "create GL programs", "%u cached, %u compiled",
+                          shader_builder.n_cache_hits, shader_builder.n_compiled);
+  GSK_RENDERER_NOTE (GSK_RENDERER (self), SHADERS,
+                     g_message ("GL programs: %u loaded from cache, %u compiled",
+                                shader_builder.n_cache_hits, shader_builder.n_compiled));
+
   gsk_gl_shader_builder_finish (&shader_builder);
 
   /* Check we indeed emitted an error if there was one */
@@ -3640,26 +3681,74 @@ gsk_gl_renderer_clear (GskGLRenderer *self)
 static void
 gsk_gl_renderer_setup_render_mode (GskGLRenderer *self)
 {
-  if (self->render_region == NULL)
+  if (self->render_rect == NULL)
     {
       glDisable (GL_SCISSOR_TEST);
     }
   else
     {
       GdkSurface *surface = gsk_renderer_get_surface (GSK_RENDERER (self));
-      cairo_rectangle_int_t extents;
+      const cairo_rectangle_int_t *extents = self->render_rect;
       int surface_height;
 
-      g_assert (cairo_region_num_rectangles (self->render_region) == 1);
-
       surface_height = gdk_surface_get_height (surface) * self->scale_factor;
-      cairo_region_get_rectangle (self->render_region, 0, &extents);
 
       glEnable (GL_SCISSOR_TEST);
-      glScissor (extents.x * self->scale_factor,
-                 surface_height - (extents.height * self->scale_factor) - (extents.y * self->scale_factor),
-                 extents.width * self->scale_factor,
-                 extents.height * self->scale_factor);
+      glScissor (extents->x * self->scale_factor,
+                 surface_height - (extents->height * self->scale_factor) - (extents->y * self->scale_factor),
+                 extents->width * self->scale_factor,
+                 extents->height * self->scale_factor);
+    }
+}
+
+typedef struct {
+  GskGLRenderer *self;
+  RenderOpBuilder *builder;
+} RenderChildData;
+
+static void
+render_container_child (GskRenderNode *child,
+                        gpointer       user_data)
+{
+  RenderChildData *data = user_data;
+
+  gsk_gl_renderer_add_render_ops (data->self, child, data->builder);
+}
+
+static inline void
+render_container_node (GskGLRenderer   *self,
+                       GskRenderNode   *node,
+                       RenderOpBuilder *builder)
+{
+  RenderChildData data = { self, builder };
+  GskTransform *inverse;
+  graphene_rect_t clip;
+  guint i, p;
+
+  /* Map the clip back into the coordinate space of the children so the
+   * container can skip the ones outside of it without visiting them.
+   * This is only possible for invertible 2D transforms, where the
+   * transformed bounds are a superset of the actual area. */
+  if (gsk_transform_get_category (builder->current_modelview) >= GSK_TRANSFORM_CATEGORY_2D)
+    {
+      inverse = gsk_transform_invert (gsk_transform_ref (builder->current_modelview));
+      if (inverse != NULL || builder->current_modelview == NULL)
+        {
+          gsk_transform_transform_bounds (inverse, &builder->current_clip->bounds, &clip);
+          clip.origin.x -= builder->dx;
+          clip.origin.y -= builder->dy;
+          gsk_transform_unref (inverse);
+
+          gsk_container_node_foreach_in_rect (node, &clip, render_container_child, &data);
+          return;
+        }
+    }
+
+  for (i = 0, p = gsk_container_node_get_n_children (node); i < p; i ++)
+    {
+      GskRenderNode *child = gsk_container_node_get_child (node, i);
+
+      gsk_gl_renderer_add_render_ops (self, child, builder);
     }
 }
 
@@ -3693,16 +3782,7 @@ gsk_gl_renderer_add_render_ops (GskGLRenderer   *self,
       g_assert_not_reached ();
 
     case GSK_CONTAINER_NODE:
-      {
-        guint i, p;
-
-        for (i = 0, p = gsk_container_node_get_n_children (node); i < p; i ++)
-          {
-            GskRenderNode *child = gsk_container_node_get_child (node, i);
-
-            gsk_gl_renderer_add_render_ops (self, child, builder);
-          }
-      }
+      render_container_node (self, node, builder);
     break;
 
     case GSK_DEBUG_NODE:
@@ -3866,6 +3946,7 @@ add_offscreen_ops (GskGLRenderer         *self,
 
   /* Check if we've already cached the drawn texture. */
   key.pointer = child_node;
+  key.serial = child_node->serial;
   key.pointer_is_child = TRUE; /* Don't conflict with the child using the cache too */
   key.parent_rect = *bounds;
   key.scale_x = builder->scale_x;
@@ -3992,8 +4073,9 @@ static void
 gsk_gl_renderer_render_ops (GskGLRenderer *self)
 {
   const Program *program = NULL;
-  const gsize vertex_data_size = self->op_builder.vertices->len * sizeof (GskQuadVertex);
-  const float *vertex_data = (float *)self->op_builder.vertices->data;
+  gsize vertex_data_size;
+  const float *vertex_data;
+  guint n_draws_before, n_draws_after;
   OpBufferIter iter;
   OpKind kind;
   gpointer ptr;
@@ -4003,6 +4085,17 @@ gsk_gl_renderer_render_ops (GskGLRenderer *self)
   g_print ("============================================\n");
 #endif
 
+  /* This may lay out the vertices again, so do it first */
+  ops_merge_draws (&self->op_builder, &n_draws_before, &n_draws_after);
+
+#ifdef G_ENABLE_DEBUG
+  self->n_draws_recorded += n_draws_before;
+  self->n_draws += n_draws_after;
+#endif
+
+  vertex_data_size = self->op_builder.vertices->len * sizeof (GskQuadVertex);
+  vertex_data = (float *)self->op_builder.vertices->data;
+
   glGenVertexArrays (1, &vao_id);
   glBindVertexArray (vao_id);
 
@@ -4158,6 +4251,10 @@ gsk_gl_renderer_render_ops (GskGLRenderer *self)
           {
             const OpDraw *op = ptr;
 
+            /* Merged into an earlier draw */
+            if (op->vao_size == 0)
+              break;
+
             OP_PRINT (" -> draw %ld, size %ld and program %d: %s",
                       op->vao_offset, op->vao_size, program->index,
                       program->name ?: "");
@@ -4199,39 +4296,13 @@ gsk_gl_renderer_render_ops (GskGLRenderer *self)
 }
 
 static void
-gsk_gl_renderer_do_render (GskRenderer           *renderer,
-                           GskRenderNode         *root,
-                           const graphene_rect_t *viewport,
-                           int                    fbo_id,
-                           int                    scale_factor)
+gsk_gl_renderer_render_pass (GskGLRenderer         *self,
+                             GskRenderNode         *root,
+                             const graphene_rect_t *viewport,
+                             int                    fbo_id,
+                             int                    scale_factor)
 {
-  GskGLRenderer *self = GSK_GL_RENDERER (renderer);
   graphene_matrix_t projection;
-#ifdef G_ENABLE_DEBUG
-  GskProfiler *profiler;
-  gint64 gpu_time, cpu_time;
-  gint64 start_time G_GNUC_UNUSED;
-#endif
-  GPtrArray *removed;
-
-#ifdef G_ENABLE_DEBUG
-  profiler = gsk_renderer_get_profiler (renderer);
-#endif
-
-  if (self->gl_context == NULL)
-    {
-      GSK_RENDERER_NOTE (renderer, OPENGL, g_message ("No valid GL context associated to the renderer"));
-      return;
-    }
-
-  g_assert (gsk_gl_driver_in_frame (self->gl_driver));
-
-  removed = g_ptr_array_new ();
-  gsk_gl_texture_atlases_begin_frame (self->atlases, removed);
-  gsk_gl_glyph_cache_begin_frame (self->glyph_cache, self->gl_driver, removed);
-  gsk_gl_icon_cache_begin_frame (self->icon_cache, removed);
-  gsk_gl_shadow_cache_begin_frame (&self->shadow_cache, self->gl_driver);
-  g_ptr_array_unref (removed);
 
   /* Set up the modelview and projection matrices to fit our viewport */
   init_projection_matrix (&projection, viewport);
@@ -4239,25 +4310,22 @@ gsk_gl_renderer_do_render (GskRenderer           *renderer,
   ops_set_viewport (&self->op_builder, viewport);
   ops_set_modelview (&self->op_builder, gsk_transform_scale (NULL, scale_factor, scale_factor));
 
-  /* Initial clip is self->render_region! */
-  if (self->render_region != NULL)
+  /* Initial clip is self->render_rect! */
+  if (self->render_rect != NULL)
     {
-      graphene_rect_t transformed_render_region;
-      cairo_rectangle_int_t render_extents;
-
-      cairo_region_get_extents (self->render_region, &render_extents);
+      graphene_rect_t transformed_render_rect;
 
       ops_transform_bounds_modelview (&self->op_builder,
-                                      &GRAPHENE_RECT_INIT (render_extents.x,
-                                                           render_extents.y,
-                                                           render_extents.width,
-                                                           render_extents.height),
-                                      &transformed_render_region);
+                                      &GRAPHENE_RECT_INIT (self->render_rect->x,
+                                                           self->render_rect->y,
+                                                           self->render_rect->width,
+                                                           self->render_rect->height),
+                                      &transformed_render_rect);
       ops_push_clip (&self->op_builder,
-                     &GSK_ROUNDED_RECT_INIT (transformed_render_region.origin.x,
-                                             transformed_render_region.origin.y,
-                                             transformed_render_region.size.width,
-                                             transformed_render_region.size.height));
+                     &GSK_ROUNDED_RECT_INIT (transformed_render_rect.origin.x,
+                                             transformed_render_rect.origin.y,
+                                             transformed_render_rect.size.width,
+                                             transformed_render_rect.size.height));
     }
   else
     {
@@ -4283,12 +4351,6 @@ gsk_gl_renderer_do_render (GskRenderer           *renderer,
 
   /*g_message ("Ops: %u", self->render_ops->len);*/
 
-  /* Now actually draw things... */
-#ifdef G_ENABLE_DEBUG
-  gsk_gl_profiler_begin_gpu_region (self->gl_profiler);
-  gsk_profiler_timer_begin (profiler, self->profile_timers.cpu_time);
-#endif
-
   /* Actually do the rendering */
   if (fbo_id != 0)
     glBindFramebuffer (GL_FRAMEBUFFER, fbo_id);
@@ -4309,8 +4371,91 @@ gsk_gl_renderer_do_render (GskRenderer           *renderer,
   gsk_gl_renderer_render_ops (self);
   gdk_gl_context_pop_debug_group (self->gl_context);
 
+  ops_reset (&self->op_builder);
+}
+
+static void
+gsk_gl_renderer_do_render (GskRenderer           *renderer,
+                           GskRenderNode         *root,
+                           const graphene_rect_t *viewport,
+                           int                    fbo_id,
+                           int                    scale_factor)
+{
+  GskGLRenderer *self = GSK_GL_RENDERER (renderer);
 #ifdef G_ENABLE_DEBUG
+  GskProfiler *profiler;
+  gint64 gpu_time, cpu_time;
+  gint64 start_time G_GNUC_UNUSED;
+  gint64 pixels;
+#endif
+  GPtrArray *removed;
+  guint i;
+
+#ifdef G_ENABLE_DEBUG
+  profiler = gsk_renderer_get_profiler (renderer);
+#endif
+
+  if (self->gl_context == NULL)
+    {
+      GSK_RENDERER_NOTE (renderer, OPENGL, g_message ("No valid GL context associated to the renderer"));
+      return;
+    }
+
+  g_assert (gsk_gl_driver_in_frame (self->gl_driver));
+
+  removed = g_ptr_array_new_with_free_func ((GDestroyNotify) gsk_gl_texture_atlas_destroy);
+  gsk_gl_texture_atlases_begin_frame (self->atlases, removed);
+  gsk_gl_glyph_cache_begin_frame (self->glyph_cache, self->gl_driver, removed);
+  gsk_gl_icon_cache_begin_frame (self->icon_cache, removed);
+  gsk_gl_shadow_cache_begin_frame (&self->shadow_cache, self->gl_driver);
+  g_ptr_array_unref (removed);
+
+  /* Now actually draw things... */
+#ifdef G_ENABLE_DEBUG
+  gsk_gl_profiler_begin_gpu_region (self->gl_profiler);
+  gsk_profiler_timer_begin (profiler, self->profile_timers.cpu_time);
+  self->n_draws_recorded = 0;
+  self->n_draws = 0;
+#endif
+
+  /* Every damage rectangle gets its own pass, with its own
+   * scissor and an op list culled to that rectangle */
+  if (self->n_render_rects == 0)
+    {
+      self->render_rect = NULL;
+      gsk_gl_renderer_render_pass (self, root, viewport, fbo_id, scale_factor);
+    }
+  else
+    {
+      for (i = 0; i < self->n_render_rects; i++)
+        {
+          self->render_rect = &self->render_rects[i];
+          gsk_gl_renderer_render_pass (self, root, viewport, fbo_id, scale_factor);
+        }
+
+      self->render_rect = NULL;
+    }
+
+#ifdef G_ENABLE_DEBUG
+  if (self->n_render_rects == 0)
+    {
+      pixels = ceilf (viewport->size.width) * ceilf (viewport->size.height);
+    }
+  else
+    {
+      pixels = 0;
+      for (i = 0; i < self->n_render_rects; i++)
+        pixels += (gint64) self->render_rects[i].width * self->render_rects[i].height
+                  * scale_factor * scale_factor;
+    }
+
   gsk_profiler_counter_inc (profiler, self->profile_counters.frames);
+  gsk_profiler_counter_set (profiler, self->profile_counters.pixels, pixels);
+  gsk_profiler_counter_set (profiler, self->profile_counters.draws_recorded, self->n_draws_recorded);
+  gsk_profiler_counter_set (profiler, self->profile_counters.draws, self->n_draws);
+  gsk_profiler_counter_set (profiler, self->profile_counters.glyph_upload_bytes, self->glyph_cache->upload_bytes);
+  gsk_profiler_counter_set (profiler, self->profile_counters.glyph_compact_bytes, self->glyph_cache->compact_bytes);
+  gsk_profiler_counter_set (profiler, self->profile_counters.atlas_bytes, gsk_gl_texture_atlases_get_bytes (self->atlases));
 
   start_time = gsk_profiler_timer_get_start (profiler, self->profile_timers.cpu_time);
   cpu_time = gsk_profiler_timer_end (profiler, self->profile_timers.cpu_time);
@@ -4450,6 +4595,94 @@ gsk_gl_renderer_render_texture (GskRenderer           *renderer,
   return texture;
 }
 
+static inline gint64
+rect_area (const cairo_rectangle_int_t *rect)
+{
+  return (gint64) rect->width * rect->height;
+}
+
+/* Turns the damage region into at most MAX_RENDER_RECTS rectangles,
+ * merging the ones that are close to each other. Every rectangle
+ * costs a pass over the node tree, so merging is worth it as long
+ * as the union doesn't cover many more pixels.
+ */
+static void
+gsk_gl_renderer_set_render_rects (GskGLRenderer        *self,
+                                  const cairo_region_t *damage)
+{
+  GdkSurface *surface = gsk_renderer_get_surface (GSK_RENDERER (self));
+  cairo_rectangle_int_t *rects = self->render_rects;
+  GdkRectangle surface_rect;
+  int n_rects;
+  int i, j;
+
+  surface_rect = (GdkRectangle) {
+                     0, 0,
+                     gdk_surface_get_width (surface),
+                     gdk_surface_get_height (surface)
+                 };
+
+  self->n_render_rects = 0;
+
+  if (cairo_region_contains_rectangle (damage, &surface_rect) == CAIRO_REGION_OVERLAP_IN)
+    return;
+
+  n_rects = cairo_region_num_rectangles (damage);
+  if (n_rects == 0)
+    return;
+
+  /* Don't bother for regions made of lots of small pieces */
+  if (n_rects > MAX_DAMAGE_RECTS)
+    {
+      cairo_region_get_extents (damage, &rects[0]);
+      n_rects = 1;
+    }
+  else
+    {
+      cairo_rectangle_int_t *damage_rects = g_newa (cairo_rectangle_int_t, n_rects);
+
+      for (i = 0; i < n_rects; i++)
+        cairo_region_get_rectangle (damage, i, &damage_rects[i]);
+
+      while (n_rects > 1)
+        {
+          cairo_rectangle_int_t merged;
+          gint64 best_waste = G_MAXINT64;
+          int best_i = 0, best_j = 1;
+
+          for (i = 0; i < n_rects; i++)
+            for (j = i + 1; j < n_rects; j++)
+              {
+                gint64 waste;
+
+                gdk_rectangle_union (&damage_rects[i], &damage_rects[j], &merged);
+                waste = rect_area (&merged) - rect_area (&damage_rects[i]) - rect_area (&damage_rects[j]);
+
+                if (waste < best_waste)
+                  {
+                    best_waste = waste;
+                    best_i = i;
+                    best_j = j;
+                  }
+              }
+
+          if (n_rects <= MAX_RENDER_RECTS && best_waste > RENDER_RECT_MERGE_SLACK)
+            break;
+
+          gdk_rectangle_union (&damage_rects[best_i], &damage_rects[best_j], &damage_rects[best_i]);
+          damage_rects[best_j] = damage_rects[n_rects - 1];
+          n_rects--;
+        }
+
+      memcpy (rects, damage_rects, n_rects * sizeof (cairo_rectangle_int_t));
+    }
+
+  if (n_rects == 1 && gdk_rectangle_equal (&rects[0], &surface_rect))
+    return;
+
+  self->n_render_rects = n_rects;
+}
+
 static void
 gsk_gl_renderer_render (GskRenderer          *renderer,
                         GskRenderNode        *root,
@@ -4481,22 +4714,7 @@ gsk_gl_renderer_render (GskRenderer          *renderer,
                                 update_area);
 
   damage = gdk_draw_context_get_frame_region (GDK_DRAW_CONTEXT (self->gl_context));
-
-  if (cairo_region_contains_rectangle (damage, &whole_surface) == CAIRO_REGION_OVERLAP_IN)
-    {
-      self->render_region = NULL;
-    }
-  else
-    {
-      GdkRectangle extents;
-
-      cairo_region_get_extents (damage, &extents);
-
-      if (gdk_rectangle_equal (&extents, &whole_surface))
-        self->render_region = NULL;
-      else
-        self->render_region = cairo_region_create_rectangle (&extents);
-    }
+  gsk_gl_renderer_set_render_rects (self, damage);
 
   gdk_gl_context_make_current (self->gl_context);
 
@@ -4516,7 +4734,7 @@ gsk_gl_renderer_render (GskRenderer          *renderer,
 
   gdk_gl_context_pop_debug_group (self->gl_context);
 
-  g_clear_pointer (&self->render_region, cairo_region_destroy);
+  self->n_render_rects = 0;
 }
 
 static void
@@ -4546,6 +4764,12 @@ gsk_gl_renderer_init (GskGLRenderer *self)
     GskProfiler *profiler = gsk_renderer_get_profiler (GSK_RENDERER (self));
 
     self->profile_counters.frames = gsk_profiler_add_counter (profiler, "frames", "Frames", FALSE);
+    self->profile_counters.pixels = gsk_profiler_add_counter (profiler, "pixels", "Pixels rendered", FALSE);
+    self->profile_counters.draws_recorded = gsk_profiler_add_counter (profiler, "draws-recorded", "Draws recorded", FALSE);
+    self->profile_counters.draws = gsk_profiler_add_counter (profiler, "draws", "Draw calls", FALSE);
+    self->profile_counters.glyph_upload_bytes = gsk_profiler_add_counter (profiler, "glyph-upload-bytes", "Glyph bytes uploaded", FALSE);
+    self->profile_counters.glyph_compact_bytes = gsk_profiler_add_counter (profiler, "glyph-compact-bytes", "Glyph bytes moved between atlases", FALSE);
+    self->profile_counters.atlas_bytes = gsk_profiler_add_counter (profiler, "atlas-bytes", "Texture atlas memory", FALSE);
 
     self->profile_timers.cpu_time = gsk_profiler_add_timer (profiler, "cpu-time", "CPU time", FALSE, TRUE);
     self->profile_timers.gpu_time = gsk_profiler_add_timer (profiler, "gpu-time", "GPU time", FALSE, TRUE);
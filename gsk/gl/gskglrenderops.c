@@ -763,9 +763,14 @@ ops_draw (RenderOpBuilder     *builder,
     }
   else
     {
+      graphene_matrix_t modelview;
+
       op = op_buffer_add (&builder->render_ops, OP_DRAW);
       op->vao_offset = builder->vertices->len;
       op->vao_size = GL_N_VERTICES;
+
+      gsk_transform_to_matrix (builder->current_modelview, &modelview);
+      graphene_matrix_multiply (&modelview, &builder->current_projection, &op->transform);
     }
 
   if (vertex_data)
@@ -810,6 +815,306 @@ ops_get_buffer (RenderOpBuilder *builder)
   return &builder->render_ops;
 }
 
+/* Draw merging.
+ *
+ * The op list is recorded in paint order, so every node that switches
+ * program or texture ends the current OP_DRAW, even when an identical
+ * draw follows a few ops later (text runs interleaved with backgrounds
+ * are the classic case). ops_merge_draws() moves such a later draw back
+ * into the earlier one when doing so cannot be observed: the GL state
+ * at both draws must be identical, and the later draw must not overlap
+ * anything painted in between.
+ *
+ * State ops are deltas, so they all stay where they are; only the
+ * vertices move. Uniform state is tracked as a per-program epoch that
+ * changes whenever an op touches that program, which is conservative
+ * but cheap. Render target changes, clears and debug ops end the window
+ * of draws that can be merged into.
+ */
+#define MERGE_WINDOW 32
+
+typedef struct
+{
+  gsize offset;
+  gsize size;
+  guint next;
+} VertexRange;
+
+typedef struct
+{
+  OpDraw *op;
+  const Program *program;
+  guint program_epoch;
+  int texture_id;
+  guint extra_texture_epoch;
+  guint first_range;
+  guint last_range;
+  graphene_rect_t bounds; /* In clip space */
+  guint bounded : 1;
+} DrawBatch;
+
+static gboolean
+get_draw_bounds (const OpDraw        *op,
+                 const GskQuadVertex *vertices,
+                 graphene_rect_t     *out_bounds)
+{
+  float min_x = G_MAXFLOAT, min_y = G_MAXFLOAT;
+  float max_x = -G_MAXFLOAT, max_y = -G_MAXFLOAT;
+  float corners[4][2];
+  float x1, y1, x2, y2;
+  gsize i;
+
+  for (i = op->vao_offset; i < op->vao_offset + op->vao_size; i++)
+    {
+      min_x = MIN (min_x, vertices[i].position[0]);
+      min_y = MIN (min_y, vertices[i].position[1]);
+      max_x = MAX (max_x, vertices[i].position[0]);
+      max_y = MAX (max_y, vertices[i].position[1]);
+    }
+
+  corners[0][0] = min_x; corners[0][1] = min_y;
+  corners[1][0] = max_x; corners[1][1] = min_y;
+  corners[2][0] = min_x; corners[2][1] = max_y;
+  corners[3][0] = max_x; corners[3][1] = max_y;
+
+  x1 = y1 = G_MAXFLOAT;
+  x2 = y2 = -G_MAXFLOAT;
+
+  for (i = 0; i < 4; i++)
+    {
+      graphene_vec4_t v;
+      float w;
+
+      graphene_vec4_init (&v, corners[i][0], corners[i][1], 0, 1);
+      graphene_matrix_transform_vec4 (&op->transform, &v, &v);
+
+      /* Behind the viewer; don't try to be clever */
+      w = graphene_vec4_get_w (&v);
+      if (w <= 0.0001f)
+        return FALSE;
+
+      x1 = MIN (x1, graphene_vec4_get_x (&v) / w);
+      y1 = MIN (y1, graphene_vec4_get_y (&v) / w);
+      x2 = MAX (x2, graphene_vec4_get_x (&v) / w);
+      y2 = MAX (y2, graphene_vec4_get_y (&v) / w);
+    }
+
+  graphene_rect_init (out_bounds, x1, y1, x2 - x1, y2 - y1);
+
+  return TRUE;
+}
+
+static inline gboolean
+draw_batch_overlaps (const DrawBatch       *batch,
+                     gboolean               bounded,
+                     const graphene_rect_t *bounds)
+{
+  if (!batch->bounded || !bounded)
+    return TRUE;
+
+  return graphene_rect_intersection (&batch->bounds, bounds, NULL);
+}
+
+/**
+ * ops_merge_draws:
+ * @builder: a `RenderOpBuilder` with a finished op list
+ * @n_draws_before: (out): the number of draws that were recorded
+ * @n_draws_after: (out): the number of draws that will be submitted
+ *
+ * Merges draws that share all of their GL state into one draw call
+ * and rewrites the vertex array so that each remaining draw covers a
+ * contiguous range. Draws that got merged away are left with a size
+ * of 0.
+ */
+void
+ops_merge_draws (RenderOpBuilder *builder,
+                 guint           *n_draws_before,
+                 guint           *n_draws_after)
+{
+  const GskQuadVertex *vertices = (const GskQuadVertex *) builder->vertices->data;
+  const Program *program = NULL;
+  guint program_epochs[GL_N_PROGRAMS] = { 0, };
+  guint epoch = 0;
+  guint extra_texture_epoch = 0;
+  int texture_id = 0;
+  GArray *batches;
+  GArray *ranges;
+  guint window_start = 0;
+  guint n_draws = 0;
+  OpBufferIter iter;
+  OpKind kind;
+  gpointer ptr;
+  guint i;
+
+  batches = g_array_new (FALSE, FALSE, sizeof (DrawBatch));
+  ranges = g_array_new (FALSE, FALSE, sizeof (VertexRange));
+
+  op_buffer_iter_init (&iter, &builder->render_ops);
+  while ((ptr = op_buffer_iter_next (&iter, &kind)))
+    {
+      switch (kind)
+        {
+        case OP_NONE:
+          break;
+
+        case OP_CHANGE_PROGRAM:
+          program = ((const OpProgram *) ptr)->program;
+          break;
+
+        case OP_CHANGE_RENDER_TARGET:
+        case OP_CLEAR:
+        case OP_DUMP_FRAMEBUFFER:
+        case OP_PUSH_DEBUG_GROUP:
+        case OP_POP_DEBUG_GROUP:
+          window_start = batches->len;
+          break;
+
+        case OP_CHANGE_SOURCE_TEXTURE:
+          if (program != NULL)
+            texture_id = ((const OpTexture *) ptr)->texture_id;
+          break;
+
+        case OP_CHANGE_EXTRA_SOURCE_TEXTURE:
+          if (program != NULL)
+            extra_texture_epoch = ++epoch;
+          break;
+
+        case OP_DRAW:
+          {
+            OpDraw *op = ptr;
+            graphene_rect_t bounds;
+            gboolean bounded;
+            VertexRange range;
+            DrawBatch *batch = NULL;
+
+            if (program == NULL || op->vao_size == 0)
+              break;
+
+            n_draws++;
+
+            range.offset = op->vao_offset;
+            range.size = op->vao_size;
+            range.next = G_MAXUINT;
+            g_array_append_val (ranges, range);
+
+            bounded = get_draw_bounds (op, vertices, &bounds);
+
+            /* Custom shaders have no slot to track their state in */
+            if (program->index >= 0)
+              {
+                for (i = batches->len; i > window_start && batches->len - i < MERGE_WINDOW; i--)
+                  {
+                    DrawBatch *candidate = &g_array_index (batches, DrawBatch, i - 1);
+
+                    if (candidate->program == program &&
+                        candidate->program_epoch == program_epochs[program->index] &&
+                        candidate->texture_id == texture_id &&
+                        candidate->extra_texture_epoch == extra_texture_epoch)
+                      {
+                        batch = candidate;
+                        break;
+                      }
+
+                    if (draw_batch_overlaps (candidate, bounded, &bounds))
+                      break;
+                  }
+              }
+
+            if (batch != NULL)
+              {
+                g_array_index (ranges, VertexRange, batch->last_range).next = ranges->len - 1;
+                batch->last_range = ranges->len - 1;
+                if (batch->bounded && bounded)
+                  graphene_rect_union (&batch->bounds, &bounds, &batch->bounds);
+                else
+                  batch->bounded = FALSE;
+
+                op->vao_size = 0;
+              }
+            else
+              {
+                DrawBatch new_batch;
+
+                new_batch.op = op;
+                new_batch.program = program;
+                new_batch.program_epoch = program->index >= 0 ? program_epochs[program->index] : 0;
+                new_batch.texture_id = texture_id;
+                new_batch.extra_texture_epoch = extra_texture_epoch;
+                new_batch.first_range = ranges->len - 1;
+                new_batch.last_range = ranges->len - 1;
+                new_batch.bounds = bounds;
+                new_batch.bounded = bounded;
+                g_array_append_val (batches, new_batch);
+              }
+          }
+          break;
+
+        case OP_CHANGE_OPACITY:
+        case OP_CHANGE_COLOR:
+        case OP_CHANGE_PROJECTION:
+        case OP_CHANGE_MODELVIEW:
+        case OP_CHANGE_CLIP:
+        case OP_CHANGE_VIEWPORT:
+        case OP_CHANGE_REPEAT:
+        case OP_CHANGE_LINEAR_GRADIENT:
+        case OP_CHANGE_RADIAL_GRADIENT:
+        case OP_CHANGE_COLOR_MATRIX:
+        case OP_CHANGE_BLUR:
+        case OP_CHANGE_INSET_SHADOW:
+        case OP_CHANGE_OUTSET_SHADOW:
+        case OP_CHANGE_BORDER:
+        case OP_CHANGE_BORDER_COLOR:
+        case OP_CHANGE_BORDER_WIDTH:
+        case OP_CHANGE_CROSS_FADE:
+        case OP_CHANGE_UNBLURRED_OUTSET_SHADOW:
+        case OP_CHANGE_BLEND:
+        case OP_CHANGE_GL_SHADER_ARGS:
+        case OP_CHANGE_CONIC_GRADIENT:
+          if (program != NULL && program->index >= 0)
+            program_epochs[program->index] = ++epoch;
+          break;
+
+        case OP_LAST:
+        default:
+          g_assert_not_reached ();
+        }
+    }
+
+  /* Lay the vertices out again so that every batch is contiguous */
+  if (batches->len < n_draws)
+    {
+      GArray *merged;
+
+      merged = g_array_sized_new (FALSE, FALSE, sizeof (GskQuadVertex), builder->vertices->len);
+
+      for (i = 0; i < batches->len; i++)
+        {
+          DrawBatch *batch = &g_array_index (batches, DrawBatch, i);
+          gsize offset = merged->len;
+          guint r;
+
+          for (r = batch->first_range; r != G_MAXUINT; r = g_array_index (ranges, VertexRange, r).next)
+            {
+              const VertexRange *range = &g_array_index (ranges, VertexRange, r);
+
+              g_array_append_vals (merged, &vertices[range->offset], range->size);
+            }
+
+          batch->op->vao_offset = offset;
+          batch->op->vao_size = merged->len - offset;
+        }
+
+      g_array_unref (builder->vertices);
+      builder->vertices = merged;
+    }
+
+  *n_draws_before = n_draws;
+  *n_draws_after = batches->len;
+
+  g_array_unref (batches);
+  g_array_unref (ranges);
+}
+
 void
 ops_set_inset_shadow (RenderOpBuilder      *self,
                       const GskRoundedRect  outline,
@@ -349,5 +349,8 @@ void              ops_offset             (RenderOpBuilder        *builder,
 gpointer          ops_begin              (RenderOpBuilder        *builder,
                                           OpKind                  kind);
 OpBuffer         *ops_get_buffer         (RenderOpBuilder        *builder);
+void              ops_merge_draws        (RenderOpBuilder        *builder,
+                                          guint                  *n_draws_before,
+                                          guint                  *n_draws_after);
 
 #endif
@@ -4,8 +4,25 @@
 
 #include "gskdebugprivate.h"
 
+#include "gdk/gdkprofilerprivate.h"
+
 #include <gdk/gdk.h>
+#include <glib/gstdio.h>
 #include <epoxy/gl.h>
+#include <errno.h>
+#include <string.h>
+
+/* Bump this when the way programs are built changes in a way
+ * that is not reflected in the shader sources
+ */
+#define PROGRAM_CACHE_VERSION 1
+#define PROGRAM_CACHE_MAGIC   0x50475347 /* "GSGP" */
+
+typedef struct
+{
+  guint32 magic;
+  guint32 format;
+} ProgramCacheHeader;
 
 void
 gsk_gl_shader_builder_init (GskGLShaderBuilder *self,
@@ -30,6 +47,7 @@ gsk_gl_shader_builder_finish (GskGLShaderBuilder *self)
   g_bytes_unref (self->preamble);
   g_bytes_unref (self->vs_preamble);
   g_bytes_unref (self->fs_preamble);
+  g_free (self->cache_dir);
 }
 
 void
@@ -39,6 +57,160 @@ gsk_gl_shader_builder_set_glsl_version (GskGLShaderBuilder *self,
   self->version = version;
 }
 
+/*
+ * gsk_gl_shader_builder_set_cache_dir:
+ * @cache_dir: the directory to keep program binaries in
+ *
+ * Makes gsk_gl_shader_builder_create_program() look for a linked
+ * binary of the program in @cache_dir before compiling it, and store
+ * newly linked programs there. This is a no-op if the GL context
+ * does not support program binaries.
+ *
+ * Must be called with the GL context current.
+ */
+void
+gsk_gl_shader_builder_set_cache_dir (GskGLShaderBuilder *self,
+                                     const char         *cache_dir)
+{
+  gboolean supported;
+  int n_formats = 0;
+
+  g_clear_pointer (&self->cache_dir, g_free);
+
+  if (epoxy_is_desktop_gl ())
+    supported = epoxy_gl_version () >= 41 || epoxy_has_gl_extension ("GL_ARB_get_program_binary");
+  else
+    supported = epoxy_gl_version () >= 30;
+
+  if (supported)
+    glGetIntegerv (GL_NUM_PROGRAM_BINARY_FORMATS, &n_formats);
+
+  if (n_formats > 0)
+    self->cache_dir = g_strdup (cache_dir);
+}
+
+static char *
+get_program_cache_path (GskGLShaderBuilder *self,
+                        GBytes             *source_bytes,
+                        const char         *extra_fragment_snippet,
+                        gsize               extra_fragment_length)
+{
+  GChecksum *checksum;
+  guint32 flags;
+  char *filename;
+  char *path;
+
+  flags = PROGRAM_CACHE_VERSION << 8 |
+          self->debugging << 3 |
+          self->legacy << 2 |
+          self->gl3 << 1 |
+          self->gles;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+
+  /* A driver update invalidates the binaries, and the version
+   * string is where most drivers put their own version
+   */
+  g_checksum_update (checksum, glGetString (GL_VENDOR), -1);
+  g_checksum_update (checksum, glGetString (GL_RENDERER), -1);
+  g_checksum_update (checksum, glGetString (GL_VERSION), -1);
+  g_checksum_update (checksum, (const guchar *) &self->version, sizeof (self->version));
+  g_checksum_update (checksum, (const guchar *) &flags, sizeof (flags));
+
+  g_checksum_update (checksum, g_bytes_get_data (self->preamble, NULL), g_bytes_get_size (self->preamble));
+  g_checksum_update (checksum, g_bytes_get_data (self->vs_preamble, NULL), g_bytes_get_size (self->vs_preamble));
+  g_checksum_update (checksum, g_bytes_get_data (self->fs_preamble, NULL), g_bytes_get_size (self->fs_preamble));
+  g_checksum_update (checksum, g_bytes_get_data (source_bytes, NULL), g_bytes_get_size (source_bytes));
+  if (extra_fragment_snippet)
+    g_checksum_update (checksum, (const guchar *) extra_fragment_snippet, extra_fragment_length);
+
+  filename = g_strconcat (g_checksum_get_string (checksum), ".bin", NULL);
+  path = g_build_filename (self->cache_dir, filename, NULL);
+
+  g_free (filename);
+  g_checksum_free (checksum);
+
+  return path;
+}
+
+static int
+load_cached_program (const char *path)
+{
+  ProgramCacheHeader header;
+  char *contents;
+  gsize length;
+  int program_id;
+  int status;
+
+  if (!g_file_get_contents (path, &contents, &length, NULL))
+    return -1;
+
+  if (length <= sizeof (header))
+    goto invalid;
+
+  memcpy (&header, contents, sizeof (header));
+  if (header.magic != PROGRAM_CACHE_MAGIC)
+    goto invalid;
+
+  program_id = glCreateProgram ();
+  glProgramBinary (program_id, header.format, contents + sizeof (header), length - sizeof (header));
+  glGetProgramiv (program_id, GL_LINK_STATUS, &status);
+
+  if (status == GL_FALSE)
+    {
+      /* The driver rejected the binary, e.g. because the format is no
+       * longer supported. Swallow the error and recompile.
+       */
+      glDeleteProgram (program_id);
+      while (glGetError () != GL_NO_ERROR)
+        ;
+      goto invalid;
+    }
+
+  g_free (contents);
+
+  return program_id;
+
+invalid:
+  g_unlink (path);
+  g_free (contents);
+
+  return -1;
+}
+
+static void
+save_cached_program (GskGLShaderBuilder *self,
+                     int                 program_id,
+                     const char         *path)
+{
+  ProgramCacheHeader header;
+  GError *error = NULL;
+  GLenum format;
+  int length = 0;
+  char *contents;
+
+  glGetProgramiv (program_id, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0)
+    return;
+
+  contents = g_malloc (sizeof (header) + length);
+  glGetProgramBinary (program_id, length, &length, &format, contents + sizeof (header));
+
+  header.magic = PROGRAM_CACHE_MAGIC;
+  header.format = format;
+  memcpy (contents, &header, sizeof (header));
+
+  if (g_mkdir_with_parents (self->cache_dir, 0700) != 0 ||
+      !g_file_set_contents (path, contents, sizeof (header) + length, &error))
+    {
+      GSK_NOTE (SHADERS, g_message ("Failed to cache program binary in %s: %s",
+                                    path, error ? error->message : g_strerror (errno)));
+      g_clear_error (&error);
+    }
+
+  g_free (contents);
+}
+
 static void
 prepend_line_numbers (char    *code,
                       GString *s)
@@ -135,6 +307,8 @@ gsk_gl_shader_builder_create_program (GskGLShaderBuilder  *self,
 {
 
   GBytes *source_bytes = g_resources_lookup_data (resource_path, 0, NULL);
+  gint64 start_time G_GNUC_UNUSED = GDK_PROFILER_CURRENT_TIME;
+  char *cache_path = NULL;
   char version_buffer[64];
   const char *source;
   const char *vertex_shader_start;
@@ -146,6 +320,19 @@ gsk_gl_shader_builder_create_program (GskGLShaderBuilder  *self,
 
   g_assert (source_bytes);
 
+  if (self->cache_dir)
+    {
+      cache_path = get_program_cache_path (self, source_bytes,
+                                           extra_fragment_snippet, extra_fragment_length);
+      program_id = load_cached_program (cache_path);
+      if (program_id >= 0)
+        {
+          self->n_cache_hits++;
+          gdk_profiler_end_mark (start_time, "load GL program", resource_path);
+          goto out;
+        }
+    }
+
   source = g_bytes_get_data (source_bytes, NULL);
   vertex_shader_start = strstr (source, "VERTEX_SHADER");
   fragment_shader_start = strstr (source, "FRAGMENT_SHADER");
@@ -231,6 +418,8 @@ gsk_gl_shader_builder_create_program (GskGLShaderBuilder  *self,
   glAttachShader (program_id, fragment_id);
   glBindAttribLocation (program_id, 0, "aPosition");
   glBindAttribLocation (program_id, 1, "vUv");
+  if (cache_path)
+    glProgramParameteri (program_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
   glLinkProgram (program_id);
 
   glGetProgramiv (program_id, GL_LINK_STATUS, &status);
@@ -262,8 +451,15 @@ gsk_gl_shader_builder_create_program (GskGLShaderBuilder  *self,
   glDetachShader (program_id, fragment_id);
   glDeleteShader (fragment_id);
 
+  if (cache_path)
+    save_cached_program (self, program_id, cache_path);
+
+  self->n_compiled++;
+  gdk_profiler_end_mark (start_time, "compile GL program", resource_path);
+
 out:
   g_bytes_unref (source_bytes);
+  g_free (cache_path);
 
   return program_id;
 }
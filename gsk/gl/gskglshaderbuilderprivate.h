@@ -14,6 +14,11 @@ typedef struct
 
   int version;
 
+  /* Where linked program binaries are cached, or %NULL */
+  char *cache_dir;
+  guint n_cache_hits;
+  guint n_compiled;
+
   guint debugging: 1;
   guint gles: 1;
   guint gl3: 1;
@@ -30,6 +35,8 @@ void   gsk_gl_shader_builder_finish           (GskGLShaderBuilder  *self);
 
 void   gsk_gl_shader_builder_set_glsl_version (GskGLShaderBuilder  *self,
                                                int                  version);
+void   gsk_gl_shader_builder_set_cache_dir    (GskGLShaderBuilder  *self,
+                                               const char          *cache_dir);
 
 int    gsk_gl_shader_builder_create_program   (GskGLShaderBuilder  *self,
                                                const char          *resource_path,
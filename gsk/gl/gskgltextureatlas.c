@@ -7,24 +7,42 @@
 
 #define ATLAS_SIZE (512)
 #define MAX_OLD_RATIO 0.5
+#define MAX_DRAIN_FRAMES 60
+#define DEFAULT_MAX_BYTES (32 * 1024 * 1024)
+
+/* Atlases are never repacked in place; stb_rect_pack can only add.
+ *
+ * When too much of an atlas is taken up by old data, it is moved to
+ * the draining list. Nothing gets packed into it anymore, but it stays
+ * alive so that the glyph cache can copy the glyphs that are still in
+ * use over to other atlases, a few every frame. Once the glyph cache
+ * marks it as drained, or after MAX_DRAIN_FRAMES, it is handed out in
+ * the removed array and whatever is left on it gets dropped.
+ *
+ * On top of that, all atlases together are kept below max_bytes by
+ * dropping whole atlases, the ones with the most old data first.
+ */
 
 static void
 free_atlas (gpointer v)
 {
-  GskGLTextureAtlas *atlas = v;
-
-  gsk_gl_texture_atlas_free (atlas);
-
-  g_free (atlas);
+  gsk_gl_texture_atlas_destroy (v);
 }
 
 GskGLTextureAtlases *
 gsk_gl_texture_atlases_new (void)
 {
   GskGLTextureAtlases *self;
+  const char *max_bytes;
 
   self = g_new (GskGLTextureAtlases, 1);
   self->atlases = g_ptr_array_new_with_free_func (free_atlas);
+  self->draining = g_ptr_array_new_with_free_func (free_atlas);
+
+  self->max_bytes = DEFAULT_MAX_BYTES;
+  max_bytes = g_getenv ("GSK_ATLAS_MAX_BYTES");
+  if (max_bytes)
+    self->max_bytes = MAX (g_ascii_strtoull (max_bytes, NULL, 10), ATLAS_SIZE * ATLAS_SIZE * 4);
 
   self->ref_count = 1;
 
@@ -47,6 +65,7 @@ gsk_gl_texture_atlases_unref (GskGLTextureAtlases *self)
   if (self->ref_count == 1)
     {
       g_ptr_array_unref (self->atlases);
+      g_ptr_array_unref (self->draining);
       g_free (self);
       return;
     }
@@ -73,12 +92,42 @@ write_atlas_to_png (GskGLTextureAtlas *atlas,
 }
 #endif
 
+gsize
+gsk_gl_texture_atlases_get_bytes (GskGLTextureAtlases *self)
+{
+  return (gsize) (self->atlases->len + self->draining->len) * ATLAS_SIZE * ATLAS_SIZE * 4;
+}
+
+/*< private >
+ * gsk_gl_texture_atlases_begin_frame:
+ * @removed: (element-type GskGLTextureAtlas): return location for
+ *   atlases that must not be used anymore
+ *
+ * Retires fragmented atlases and enforces the memory budget.
+ *
+ * The caller owns the atlases added to @removed. Their textures stay
+ * valid until they are freed with gsk_gl_texture_atlas_destroy(), so
+ * that the caches get a chance to look at them first.
+ */
 void
 gsk_gl_texture_atlases_begin_frame (GskGLTextureAtlases *self,
                                     GPtrArray           *removed)
 {
   int i;
 
+  for (i = self->draining->len - 1; i >= 0; i--)
+    {
+      GskGLTextureAtlas *atlas = g_ptr_array_index (self->draining, i);
+
+      atlas->drain_age++;
+      if (atlas->drained || atlas->drain_age > MAX_DRAIN_FRAMES)
+        {
+          GSK_NOTE(GLYPH_CACHE,
+                   g_message ("Dropping %s atlas", atlas->drained ? "drained" : "stale"));
+          g_ptr_array_add (removed, g_ptr_array_steal_index (self->draining, i));
+        }
+    }
+
   for (i = self->atlases->len - 1; i >= 0; i--)
     {
       GskGLTextureAtlas *atlas = g_ptr_array_index (self->atlases, i);
@@ -86,24 +135,53 @@ gsk_gl_texture_atlases_begin_frame (GskGLTextureAtlases *self,
       if (gsk_gl_texture_atlas_get_unused_ratio (atlas) > MAX_OLD_RATIO)
         {
           GSK_NOTE(GLYPH_CACHE,
-                   g_message ("Dropping atlas %d (%g.2%% old)", i,
+                   g_message ("Draining atlas %d (%g.2%% old)", i,
                               100.0 * gsk_gl_texture_atlas_get_unused_ratio (atlas)));
 
-          if (atlas->texture_id != 0)
+          atlas->draining = TRUE;
+          atlas->drain_age = 0;
+          g_ptr_array_add (self->draining, g_ptr_array_steal_index (self->atlases, i));
+       }
+    }
+
+  /* Over budget: the draining atlases go first, then the ones with
+   * the most old data. Leave at least one atlas to pack into.
+   */
+  while (gsk_gl_texture_atlases_get_bytes (self) > self->max_bytes)
+    {
+      GskGLTextureAtlas *victim = NULL;
+      guint victim_index = 0;
+
+      if (self->draining->len > 0)
+        {
+          g_ptr_array_add (removed, g_ptr_array_steal_index (self->draining, 0));
+          continue;
+        }
+
+      if (self->atlases->len <= 1)
+        break;
+
+      for (i = 0; i < self->atlases->len; i++)
+        {
+          GskGLTextureAtlas *atlas = g_ptr_array_index (self->atlases, i);
+
+          if (victim == NULL || atlas->unused_pixels > victim->unused_pixels)
             {
-              glDeleteTextures (1, &atlas->texture_id);
-              atlas->texture_id = 0;
+              victim = atlas;
+              victim_index = i;
             }
+        }
 
-          g_ptr_array_add (removed, atlas);
-          g_ptr_array_remove_index (self->atlases, i);
-       }
+      GSK_NOTE(GLYPH_CACHE,
+               g_message ("Over budget, dropping atlas %u (%g.2%% old)", victim_index,
+                          100.0 * gsk_gl_texture_atlas_get_unused_ratio (victim)));
+      g_ptr_array_add (removed, g_ptr_array_steal_index (self->atlases, victim_index));
     }
 
   GSK_NOTE(GLYPH_CACHE, {
     static guint timestamp;
     if (timestamp++ % 60 == 0)
-      g_message ("%d atlases", self->atlases->len);
+      g_message ("%d atlases, %d draining", self->atlases->len, self->draining->len);
   });
 
 
@@ -213,6 +291,14 @@ gsk_gl_texture_atlas_free (GskGLTextureAtlas *self)
   g_clear_pointer (&self->nodes, g_free);
 }
 
+void
+gsk_gl_texture_atlas_destroy (GskGLTextureAtlas *self)
+{
+  gsk_gl_texture_atlas_free (self);
+
+  g_free (self);
+}
+
 void
 gsk_gl_texture_atlas_mark_unused (GskGLTextureAtlas *self,
                                   int                width,
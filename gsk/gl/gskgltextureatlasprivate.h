@@ -19,6 +19,10 @@ struct _GskGLTextureAtlas
   int unused_pixels; /* Pixels of rects that have been used at some point,
                         But are now unused. */
 
+  int drain_age;       /* Frames spent in GskGLTextureAtlases.draining */
+  guint draining : 1;  /* No longer packed into, contents are moving out */
+  guint drained  : 1;  /* Set by the glyph cache once nothing moved is left */
+
   void *user_data;
 };
 typedef struct _GskGLTextureAtlas GskGLTextureAtlas;
@@ -28,6 +32,9 @@ struct _GskGLTextureAtlases
   int ref_count;
 
   GPtrArray *atlases;
+  GPtrArray *draining;
+
+  gsize max_bytes;
 };
 typedef struct _GskGLTextureAtlases GskGLTextureAtlases;
 
@@ -37,6 +44,7 @@ void                 gsk_gl_texture_atlases_unref       (GskGLTextureAtlases *at
 
 void                 gsk_gl_texture_atlases_begin_frame (GskGLTextureAtlases *atlases,
                                                          GPtrArray           *removed);
+gsize                gsk_gl_texture_atlases_get_bytes   (GskGLTextureAtlases *atlases);
 gboolean             gsk_gl_texture_atlases_pack        (GskGLTextureAtlases *atlases,
                                                          int                  width,
                                                          int                  height,
@@ -49,6 +57,7 @@ void        gsk_gl_texture_atlas_init              (GskGLTextureAtlas       *sel
                                                     int                      height);
 
 void        gsk_gl_texture_atlas_free              (GskGLTextureAtlas       *self);
+void        gsk_gl_texture_atlas_destroy           (GskGLTextureAtlas       *self);
 
 void        gsk_gl_texture_atlas_realize           (GskGLTextureAtlas       *self);
 
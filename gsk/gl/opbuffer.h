@@ -137,6 +137,7 @@ typedef struct
 {
   gsize vao_offset;
   gsize vao_size;
+  graphene_matrix_t transform; /* modelview * projection, for ops_merge_draws() */
 } OpDraw;
 
 typedef struct
@@ -22,26 +22,69 @@
 
 #include "gskcairorenderer.h"
 
+#include "gskcairoblurprivate.h"
 #include "gskdebugprivate.h"
 #include "gskrendererprivate.h"
 #include "gskrendernodeprivate.h"
 #include "gdk/gdktextureprivate.h"
 
+#include <pango/pangocairo.h>
+
+/* Size of the tiles, in application pixels, that the damage region is
+ * split into when rendering with multiple threads.
+ */
+#define TILE_SIZE 128
+
+/* Don't bother with threads if the region doesn't cover at least this
+ * many tiles.
+ */
+#define MIN_TILES 4
+
 #ifdef G_ENABLE_DEBUG
 typedef struct {
   GQuark cpu_time;
   GQuark gpu_time;
 } ProfileTimers;
+
+typedef struct {
+  GQuark tiles;
+} ProfileCounters;
 #endif
 
+typedef struct {
+  GskRenderNode *root;
+  cairo_matrix_t ctm;
+  double scale_x;
+  double scale_y;
+
+  /* GdkTexture => cairo_surface_t, downloaded once for all tiles */
+  GHashTable *surfaces;
+
+  GMutex lock;
+  GCond cond;
+  guint n_pending;
+} TileFrame;
+
+typedef struct {
+  TileFrame *frame;
+  cairo_rectangle_int_t area;
+  cairo_rectangle_int_t padded;
+  cairo_surface_t *surface;
+} Tile;
+
 struct _GskCairoRenderer
 {
   GskRenderer parent_instance;
 
   GdkCairoContext *cairo_context;
 
+  GThreadPool *tile_pool;
+
+  guint tiled : 1;
+
 #ifdef G_ENABLE_DEBUG
   ProfileTimers profile_timers;
+  ProfileCounters profile_counters;
 #endif
 };
 
@@ -50,6 +93,15 @@ struct _GskCairoRendererClass
   GskRendererClass parent_class;
 };
 
+enum {
+  PROP_0,
+  PROP_TILED,
+
+  N_PROPS
+};
+
+static GParamSpec *gsk_cairo_renderer_properties[N_PROPS];
+
 G_DEFINE_TYPE (GskCairoRenderer, gsk_cairo_renderer, GSK_TYPE_RENDERER)
 
 static gboolean
@@ -69,16 +121,351 @@ gsk_cairo_renderer_unrealize (GskRenderer *renderer)
 {
   GskCairoRenderer *self = GSK_CAIRO_RENDERER (renderer);
 
+  if (self->tile_pool)
+    {
+      g_thread_pool_free (self->tile_pool, FALSE, TRUE);
+      self->tile_pool = NULL;
+    }
+
   g_clear_object (&self->cairo_context);
 }
 
+/* Checks if @node can be drawn from a worker thread and computes how far
+ * outside of a clip region its drawing reads back pixels, for the nodes
+ * that blur an intermediate group. Tiles are rendered with that padding
+ * so that their visible area is identical to rendering the whole region.
+ *
+ * This also runs the lazy initialization of fonts on the main thread and
+ * downloads textures, so that every tile doesn't have to do it again.
+ */
+static gboolean
+gsk_cairo_renderer_prepare_node (GskRenderNode *node,
+                                 TileFrame     *frame,
+                                 float         *padding)
+{
+  float child_padding, other_padding;
+  guint i;
+
+  *padding = 0;
+
+  switch (gsk_render_node_get_node_type (node))
+    {
+    case GSK_COLOR_NODE:
+    case GSK_LINEAR_GRADIENT_NODE:
+    case GSK_REPEATING_LINEAR_GRADIENT_NODE:
+    case GSK_RADIAL_GRADIENT_NODE:
+    case GSK_REPEATING_RADIAL_GRADIENT_NODE:
+    case GSK_CONIC_GRADIENT_NODE:
+    case GSK_BORDER_NODE:
+    case GSK_CAIRO_NODE:
+    case GSK_GL_SHADER_NODE:
+    /* these use the clip extents to size their blur surfaces */
+    case GSK_INSET_SHADOW_NODE:
+    case GSK_OUTSET_SHADOW_NODE:
+      return TRUE;
+
+    case GSK_TEXTURE_NODE:
+      {
+        GdkTexture *texture = gsk_texture_node_get_texture (node);
+        cairo_surface_t *surface;
+
+        /* downloading GL textures needs the GL context */
+        if (GDK_IS_GL_TEXTURE (texture))
+          return FALSE;
+
+        surface = g_hash_table_lookup (frame->surfaces, texture);
+        if (surface == NULL)
+          {
+            surface = gdk_texture_download_surface (texture);
+            g_hash_table_insert (frame->surfaces, g_object_ref (texture), surface);
+          }
+      }
+      return TRUE;
+
+    case GSK_TEXT_NODE:
+      {
+        PangoFont *font = gsk_text_node_get_font (node);
+
+        if (!PANGO_IS_CAIRO_FONT (font))
+          return FALSE;
+
+        pango_cairo_font_get_scaled_font (PANGO_CAIRO_FONT (font));
+      }
+      return TRUE;
+
+    case GSK_CONTAINER_NODE:
+      for (i = 0; i < gsk_container_node_get_n_children (node); i++)
+        {
+          if (!gsk_cairo_renderer_prepare_node (gsk_container_node_get_child (node, i), frame, &child_padding))
+            return FALSE;
+          *padding = MAX (*padding, child_padding);
+        }
+      return TRUE;
+
+    case GSK_TRANSFORM_NODE:
+      {
+        GskTransform *transform = gsk_transform_node_get_transform (node);
+        float scale_x, scale_y, dx, dy;
+
+        if (!gsk_cairo_renderer_prepare_node (gsk_transform_node_get_child (node), frame, &child_padding))
+          return FALSE;
+
+        if (child_padding == 0)
+          return TRUE;
+
+        if (gsk_transform_get_category (transform) < GSK_TRANSFORM_CATEGORY_2D_AFFINE)
+          return FALSE;
+
+        gsk_transform_to_affine (transform, &scale_x, &scale_y, &dx, &dy);
+        *padding = child_padding * MAX (fabsf (scale_x), fabsf (scale_y));
+      }
+      return TRUE;
+
+    case GSK_OPACITY_NODE:
+      return gsk_cairo_renderer_prepare_node (gsk_opacity_node_get_child (node), frame, padding);
+
+    case GSK_COLOR_MATRIX_NODE:
+      return gsk_cairo_renderer_prepare_node (gsk_color_matrix_node_get_child (node), frame, padding);
+
+    case GSK_CLIP_NODE:
+      return gsk_cairo_renderer_prepare_node (gsk_clip_node_get_child (node), frame, padding);
+
+    case GSK_ROUNDED_CLIP_NODE:
+      return gsk_cairo_renderer_prepare_node (gsk_rounded_clip_node_get_child (node), frame, padding);
+
+    case GSK_DEBUG_NODE:
+      return gsk_cairo_renderer_prepare_node (gsk_debug_node_get_child (node), frame, padding);
+
+    case GSK_REPEAT_NODE:
+      /* the child is always drawn completely into its own surface */
+      return gsk_cairo_renderer_prepare_node (gsk_repeat_node_get_child (node), frame, &child_padding);
+
+    case GSK_BLEND_NODE:
+      if (!gsk_cairo_renderer_prepare_node (gsk_blend_node_get_bottom_child (node), frame, &child_padding) ||
+          !gsk_cairo_renderer_prepare_node (gsk_blend_node_get_top_child (node), frame, &other_padding))
+        return FALSE;
+      *padding = MAX (child_padding, other_padding);
+      return TRUE;
+
+    case GSK_CROSS_FADE_NODE:
+      if (!gsk_cairo_renderer_prepare_node (gsk_cross_fade_node_get_start_child (node), frame, &child_padding) ||
+          !gsk_cairo_renderer_prepare_node (gsk_cross_fade_node_get_end_child (node), frame, &other_padding))
+        return FALSE;
+      *padding = MAX (child_padding, other_padding);
+      return TRUE;
+
+    case GSK_SHADOW_NODE:
+      if (!gsk_cairo_renderer_prepare_node (gsk_shadow_node_get_child (node), frame, &child_padding))
+        return FALSE;
+      for (i = 0; i < gsk_shadow_node_get_n_shadows (node); i++)
+        {
+          const GskShadow *shadow = gsk_shadow_node_get_shadow (node, i);
+
+          other_padding = MAX (fabsf (shadow->dx), fabsf (shadow->dy))
+                          + gsk_cairo_blur_compute_pixels (shadow->radius);
+          *padding = MAX (*padding, other_padding);
+        }
+      *padding += child_padding;
+      return TRUE;
+
+    case GSK_BLUR_NODE:
+      if (!gsk_cairo_renderer_prepare_node (gsk_blur_node_get_child (node), frame, &child_padding))
+        return FALSE;
+      /* blur_image_surface() does 3 box blur passes */
+      *padding = child_padding + 3 * ceilf (gsk_blur_node_get_radius (node));
+      return TRUE;
+
+    case GSK_NOT_A_RENDER_NODE:
+    default:
+      return FALSE;
+    }
+}
+
 static void
-gsk_cairo_renderer_do_render (GskRenderer   *renderer,
-                              cairo_t       *cr,
-                              GskRenderNode *root)
+gsk_cairo_renderer_render_tile (gpointer data,
+                                gpointer user_data)
+{
+  Tile *tile = data;
+  TileFrame *frame = tile->frame;
+  cairo_t *cr;
+
+  tile->surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                              ceil (tile->padded.width * frame->scale_x),
+                                              ceil (tile->padded.height * frame->scale_y));
+  cairo_surface_set_device_scale (tile->surface, frame->scale_x, frame->scale_y);
+
+  cr = cairo_create (tile->surface);
+  cairo_translate (cr, - tile->padded.x, - tile->padded.y);
+  cairo_transform (cr, &frame->ctm);
+
+  gsk_render_node_draw_with_texture_surfaces (frame->root, cr, frame->surfaces);
+
+  cairo_destroy (cr);
+
+  g_mutex_lock (&frame->lock);
+  frame->n_pending--;
+  if (frame->n_pending == 0)
+    g_cond_signal (&frame->cond);
+  g_mutex_unlock (&frame->lock);
+}
+
+static void
+tile_frame_init (TileFrame     *frame,
+                 GskRenderNode *root)
+{
+  frame->root = root;
+  frame->surfaces = g_hash_table_new_full (NULL, NULL, g_object_unref, (GDestroyNotify) cairo_surface_destroy);
+  g_mutex_init (&frame->lock);
+  g_cond_init (&frame->cond);
+  frame->n_pending = 0;
+}
+
+static void
+tile_frame_clear (TileFrame *frame)
+{
+  g_hash_table_unref (frame->surfaces);
+  g_cond_clear (&frame->cond);
+  g_mutex_clear (&frame->lock);
+}
+
+static void
+gsk_cairo_renderer_add_tiles (GArray                      *tiles,
+                              const cairo_rectangle_int_t *rect,
+                              int                          padding)
+{
+  int x, y;
+
+  for (y = rect->y; y < rect->y + rect->height; y += TILE_SIZE)
+    {
+      for (x = rect->x; x < rect->x + rect->width; x += TILE_SIZE)
+        {
+          Tile tile = { NULL, };
+
+          tile.area.x = x;
+          tile.area.y = y;
+          tile.area.width = MIN (TILE_SIZE, rect->x + rect->width - x);
+          tile.area.height = MIN (TILE_SIZE, rect->y + rect->height - y);
+          tile.padded.x = tile.area.x - padding;
+          tile.padded.y = tile.area.y - padding;
+          tile.padded.width = tile.area.width + 2 * padding;
+          tile.padded.height = tile.area.height + 2 * padding;
+
+          g_array_append_val (tiles, tile);
+        }
+    }
+}
+
+/* Renders @root by splitting @region, which is given in the untransformed
+ * coordinate space of @cr, into tiles that are drawn in parallel into
+ * separate image surfaces and then copied into place.
+ *
+ * The target is expected to be cleared inside @region.
+ *
+ * Returns: %FALSE if the tree can't be rendered that way and nothing
+ *   was drawn.
+ */
+static gboolean
+gsk_cairo_renderer_render_tiled (GskCairoRenderer     *self,
+                                 cairo_t              *cr,
+                                 GskRenderNode        *root,
+                                 const cairo_region_t *region)
 {
+  TileFrame frame;
+  GArray *tiles;
+  float padding;
+  guint i;
+  int j;
+
+  tile_frame_init (&frame, root);
+
+  if (!gsk_cairo_renderer_prepare_node (root, &frame, &padding))
+    {
+      GSK_RENDERER_NOTE (GSK_RENDERER (self), CAIRO,
+                         g_message ("Node tree can't be rendered in tiles, using a single thread"));
+      tile_frame_clear (&frame);
+      return FALSE;
+    }
+
+  tiles = g_array_new (FALSE, FALSE, sizeof (Tile));
+  for (j = 0; j < cairo_region_num_rectangles (region); j++)
+    {
+      cairo_rectangle_int_t rect;
+
+      cairo_region_get_rectangle (region, j, &rect);
+      gsk_cairo_renderer_add_tiles (tiles, &rect, ceilf (padding));
+    }
+
+  if (tiles->len < MIN_TILES)
+    {
+      tile_frame_clear (&frame);
+      g_array_unref (tiles);
+      return FALSE;
+    }
+
+  if (self->tile_pool == NULL)
+    self->tile_pool = g_thread_pool_new (gsk_cairo_renderer_render_tile,
+                                         self,
+                                         g_get_num_processors (),
+                                         FALSE,
+                                         NULL);
+
+  cairo_get_matrix (cr, &frame.ctm);
+  cairo_surface_get_device_scale (cairo_get_target (cr), &frame.scale_x, &frame.scale_y);
+  frame.n_pending = tiles->len;
+
+  for (i = 0; i < tiles->len; i++)
+    {
+      Tile *tile = &g_array_index (tiles, Tile, i);
+
+      tile->frame = &frame;
+      g_thread_pool_push (self->tile_pool, tile, NULL);
+    }
+
+  g_mutex_lock (&frame.lock);
+  while (frame.n_pending > 0)
+    g_cond_wait (&frame.cond, &frame.lock);
+  g_mutex_unlock (&frame.lock);
+
+  cairo_save (cr);
+  cairo_identity_matrix (cr);
+  cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+
+  for (i = 0; i < tiles->len; i++)
+    {
+      Tile *tile = &g_array_index (tiles, Tile, i);
+
+      cairo_set_source_surface (cr, tile->surface, tile->padded.x, tile->padded.y);
+      cairo_rectangle (cr, tile->area.x, tile->area.y, tile->area.width, tile->area.height);
+      cairo_fill (cr);
+
+      cairo_surface_destroy (tile->surface);
+    }
+
+  cairo_restore (cr);
+
+  GSK_RENDERER_NOTE (GSK_RENDERER (self), CAIRO,
+                     g_message ("Rendered %u tiles with %g pixels of padding", tiles->len, ceilf (padding)));
+
 #ifdef G_ENABLE_DEBUG
+  gsk_profiler_counter_set (gsk_renderer_get_profiler (GSK_RENDERER (self)),
+                            self->profile_counters.tiles,
+                            tiles->len);
+#endif
+
+  tile_frame_clear (&frame);
+  g_array_unref (tiles);
+
+  return TRUE;
+}
+
+static void
+gsk_cairo_renderer_do_render (GskRenderer          *renderer,
+                              cairo_t              *cr,
+                              GskRenderNode        *root,
+                              const cairo_region_t *region)
+{
   GskCairoRenderer *self = GSK_CAIRO_RENDERER (renderer);
+#ifdef G_ENABLE_DEBUG
   GskProfiler *profiler;
   gint64 cpu_time;
 #endif
@@ -88,7 +475,9 @@ gsk_cairo_renderer_do_render (GskRenderer   *renderer,
   gsk_profiler_timer_begin (profiler, self->profile_timers.cpu_time);
 #endif
 
-  gsk_render_node_draw (root, cr);
+  if (!self->tiled ||
+      !gsk_cairo_renderer_render_tiled (self, cr, root, region))
+    gsk_render_node_draw (root, cr);
 
 #ifdef G_ENABLE_DEBUG
   cpu_time = gsk_profiler_timer_end (profiler, self->profile_timers.cpu_time);
@@ -105,15 +494,22 @@ gsk_cairo_renderer_render_texture (GskRenderer           *renderer,
 {
   GdkTexture *texture;
   cairo_surface_t *surface;
+  cairo_region_t *region;
   cairo_t *cr;
 
   surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, ceil (viewport->size.width), ceil (viewport->size.height));
   cr = cairo_create (surface);
+  region = cairo_region_create_rectangle (&(cairo_rectangle_int_t) {
+                                              0, 0,
+                                              cairo_image_surface_get_width (surface),
+                                              cairo_image_surface_get_height (surface)
+                                          });
 
   cairo_translate (cr, - viewport->origin.x, - viewport->origin.y);
 
-  gsk_cairo_renderer_do_render (renderer, cr, root);
+  gsk_cairo_renderer_do_render (renderer, cr, root, region);
 
+  cairo_region_destroy (region);
   cairo_destroy (cr);
 
   texture = gdk_texture_new_for_surface (surface);
@@ -136,7 +532,10 @@ gsk_cairo_renderer_render (GskRenderer          *renderer,
 
   g_return_if_fail (cr != NULL);
 
+  gsk_cairo_renderer_do_render (renderer, cr, root, region);
+
 #ifdef G_ENABLE_DEBUG
+  /* drawn last, tiles are copied into place with CAIRO_OPERATOR_SOURCE */
   if (GSK_RENDERER_DEBUG_CHECK (renderer, GEOMETRY))
     {
       GdkSurface *surface = gsk_renderer_get_surface (renderer);
@@ -152,22 +551,90 @@ gsk_cairo_renderer_render (GskRenderer          *renderer,
     }
 #endif
 
-  gsk_cairo_renderer_do_render (renderer, cr, root);
-
   cairo_destroy (cr);
 
   gdk_draw_context_end_frame (GDK_DRAW_CONTEXT (self->cairo_context));
 }
 
+static void
+gsk_cairo_renderer_set_property (GObject      *gobject,
+                                 guint         prop_id,
+                                 const GValue *value,
+                                 GParamSpec   *pspec)
+{
+  GskCairoRenderer *self = GSK_CAIRO_RENDERER (gobject);
+
+  switch (prop_id)
+    {
+    case PROP_TILED:
+      if (self->tiled != g_value_get_boolean (value))
+        {
+          self->tiled = g_value_get_boolean (value);
+          g_object_notify_by_pspec (gobject, pspec);
+        }
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (gobject, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+gsk_cairo_renderer_get_property (GObject    *gobject,
+                                 guint       prop_id,
+                                 GValue     *value,
+                                 GParamSpec *pspec)
+{
+  GskCairoRenderer *self = GSK_CAIRO_RENDERER (gobject);
+
+  switch (prop_id)
+    {
+    case PROP_TILED:
+      g_value_set_boolean (value, self->tiled);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (gobject, prop_id, pspec);
+      break;
+    }
+}
+
 static void
 gsk_cairo_renderer_class_init (GskCairoRendererClass *klass)
 {
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
   GskRendererClass *renderer_class = GSK_RENDERER_CLASS (klass);
 
+  gobject_class->set_property = gsk_cairo_renderer_set_property;
+  gobject_class->get_property = gsk_cairo_renderer_get_property;
+
   renderer_class->realize = gsk_cairo_renderer_realize;
   renderer_class->unrealize = gsk_cairo_renderer_unrealize;
   renderer_class->render = gsk_cairo_renderer_render;
   renderer_class->render_texture = gsk_cairo_renderer_render_texture;
+
+  /**
+   * GskCairoRenderer:tiled:
+   *
+   * Whether the renderer splits the area to redraw into tiles that are
+   * rendered in parallel on multiple threads.
+   *
+   * The result is identical to rendering on a single thread. Trees that
+   * cannot be drawn from other threads, such as those containing GL
+   * textures, are always rendered on a single thread.
+   *
+   * This property defaults to %TRUE if `cairo-tiled` is included in the
+   * `GSK_DEBUG` environment variable.
+   */
+  gsk_cairo_renderer_properties[PROP_TILED] =
+    g_param_spec_boolean ("tiled",
+                          "Tiled",
+                          "Render in tiles on multiple threads",
+                          FALSE,
+                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  g_object_class_install_properties (gobject_class, N_PROPS, gsk_cairo_renderer_properties);
 }
 
 static void
@@ -177,7 +644,10 @@ gsk_cairo_renderer_init (GskCairoRenderer *self)
   GskProfiler *profiler = gsk_renderer_get_profiler (GSK_RENDERER (self));
 
   self->profile_timers.cpu_time = gsk_profiler_add_timer (profiler, "cpu-time", "CPU time", FALSE, TRUE);
+  self->profile_counters.tiles = gsk_profiler_add_counter (profiler, "tiles", "Tiles", TRUE);
 #endif
+
+  self->tiled = (gsk_renderer_get_debug_flags (GSK_RENDERER (self)) & GSK_DEBUG_CAIRO_TILED) != 0;
 }
 
 /**
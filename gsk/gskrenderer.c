@@ -81,6 +81,11 @@ typedef struct
 
   GskProfiler *profiler;
 
+  struct {
+    GQuark nodes;
+    GQuark node_bytes;
+  } profile_counters;
+
   GskDebugFlags debug_flags;
 
   gboolean is_realized : 1;
@@ -210,6 +215,15 @@ gsk_renderer_init (GskRenderer *self)
 
   priv->profiler = gsk_profiler_new ();
   priv->debug_flags = gsk_get_debug_flags ();
+
+  priv->profile_counters.nodes = gsk_profiler_add_counter (priv->profiler,
+                                                           "nodes",
+                                                           "Render nodes allocated in the process since the last frame",
+                                                           FALSE);
+  priv->profile_counters.node_bytes = gsk_profiler_add_counter (priv->profiler,
+                                                                "node-bytes",
+                                                                "Render node bytes allocated in the process since the last frame",
+                                                                FALSE);
 }
 
 /**
@@ -411,12 +425,18 @@ gsk_renderer_render (GskRenderer          *renderer,
 {
   GskRendererPrivate *priv = gsk_renderer_get_instance_private (renderer);
   cairo_region_t *clip;
+  gint64 n_nodes, n_bytes;
 
   g_return_if_fail (GSK_IS_RENDERER (renderer));
   g_return_if_fail (priv->is_realized);
   g_return_if_fail (GSK_IS_RENDER_NODE (root));
   g_return_if_fail (priv->root_node == NULL);
 
+  /* Nodes allocated by the whole process since the last frame of any
+   * renderer, that is mostly while snapshotting this one. Take them
+   * before returning early, so they aren't added to the next frame. */
+  gsk_render_node_steal_alloc_stats (&n_nodes, &n_bytes);
+
   if (region == NULL || priv->prev_node == NULL || GSK_RENDERER_DEBUG_CHECK (renderer, FULL_REDRAW))
     {
       clip = cairo_region_create_rectangle (&(GdkRectangle) {
@@ -441,6 +461,9 @@ gsk_renderer_render (GskRenderer          *renderer,
 
   GSK_RENDERER_GET_CLASS (renderer)->render (renderer, root, clip);
 
+  gsk_profiler_counter_set (priv->profiler, priv->profile_counters.nodes, n_nodes);
+  gsk_profiler_counter_set (priv->profiler, priv->profile_counters.node_bytes, n_bytes);
+
 #ifdef G_ENABLE_DEBUG
   if (GSK_RENDERER_DEBUG_CHECK (renderer, RENDERER))
     {
@@ -43,10 +43,12 @@
 #include "gskdebugprivate.h"
 #include "gskrendererprivate.h"
 #include "gskrendernodeparserprivate.h"
+#include "gskrendernodebinaryprivate.h"
 
 #include <graphene-gobject.h>
 
 #include <math.h>
+#include <string.h>
 
 #include <gobject/gvaluecollector.h>
 
@@ -139,10 +141,15 @@ value_render_node_lcopy_value (const GValue *value,
   return NULL;
 }
 
+static void gsk_arena_block_unref (gpointer data);
+
 static void
 gsk_render_node_finalize (GskRenderNode *self)
 {
-  g_type_free_instance ((GTypeInstance *) self);
+  if (self->arena_block)
+    gsk_arena_block_unref (self->arena_block);
+  else
+    g_type_free_instance ((GTypeInstance *) self);
 }
 
 static void
@@ -178,7 +185,10 @@ gsk_render_node_class_init (GskRenderNodeClass *klass)
 static void
 gsk_render_node_init (GskRenderNode *self)
 {
+  static int next_serial;
+
   g_atomic_ref_count_init (&self->ref_count);
+  self->serial = (guint) g_atomic_int_add (&next_serial, 1);
 }
 
 GType
@@ -325,6 +335,148 @@ gsk_render_node_type_register_static (const char                  *node_name,
   return g_type_register_static (GSK_TYPE_RENDER_NODE, node_name, &info, 0);
 }
 
+/*** Arena ***/
+
+#define GSK_ARENA_BLOCK_SIZE (32 * 1024)
+#define GSK_ARENA_ALIGN_SIZE(size) (((size) + 15) & ~(gsize) 15)
+
+typedef struct
+{
+  /* one per live node, plus one while the arena allocates from it */
+  int ref_count;
+  /* holds nodes moved out of an arena by gsk_render_node_promote() */
+  gboolean promoted;
+} GskArenaBlock;
+
+#define GSK_ARENA_BLOCK_HEADER_SIZE GSK_ARENA_ALIGN_SIZE (sizeof (GskArenaBlock))
+
+typedef struct
+{
+  guint depth;
+
+  GskArenaBlock *block;
+  gsize used;
+} GskArena;
+
+static struct {
+  int n_nodes;
+  int n_bytes;
+} alloc_stats;
+
+static gsize node_instance_sizes[GSK_RENDER_NODE_TYPE_N_TYPES];
+
+static void
+gsk_arena_block_unref (gpointer data)
+{
+  GskArenaBlock *block = data;
+
+  if (g_atomic_int_dec_and_test (&block->ref_count))
+    g_free (block);
+}
+
+static void
+gsk_arena_free (gpointer data)
+{
+  GskArena *arena = data;
+
+  if (arena->block)
+    gsk_arena_block_unref (arena->block);
+
+  g_free (arena);
+}
+
+static GPrivate arena_private = G_PRIVATE_INIT (gsk_arena_free);
+
+static GskArena *
+gsk_arena_get (void)
+{
+  GskArena *arena = g_private_get (&arena_private);
+
+  if (G_UNLIKELY (arena == NULL))
+    {
+      arena = g_new0 (GskArena, 1);
+      g_private_set (&arena_private, arena);
+    }
+
+  return arena;
+}
+
+static int
+gsk_atomic_int_steal (int *atomic)
+{
+  int value;
+
+  do
+    value = g_atomic_int_get (atomic);
+  while (!g_atomic_int_compare_and_exchange (atomic, value, 0));
+
+  return value;
+}
+
+static gsize
+gsk_render_node_get_instance_size (GskRenderNodeType node_type)
+{
+  gsize size = GPOINTER_TO_SIZE (g_atomic_pointer_get ((gpointer *) &node_instance_sizes[node_type]));
+
+  if (G_UNLIKELY (size == 0))
+    {
+      GTypeQuery query;
+
+      g_type_query (gsk_render_node_types[node_type], &query);
+      size = query.instance_size;
+      g_atomic_pointer_set ((gpointer *) &node_instance_sizes[node_type], GSIZE_TO_POINTER (size));
+    }
+
+  return size;
+}
+
+static GskRenderNode *
+gsk_render_node_arena_alloc (GskRenderNodeType node_type,
+                             gsize             size)
+{
+  GskArena *arena;
+  GTypeClass *klass;
+  GskRenderNode *node;
+
+  arena = g_private_get (&arena_private);
+  if (arena == NULL || arena->depth == 0)
+    return NULL;
+
+  size = GSK_ARENA_ALIGN_SIZE (size);
+  if (size > (GSK_ARENA_BLOCK_SIZE - GSK_ARENA_BLOCK_HEADER_SIZE) / 4)
+    return NULL;
+
+  /* The class gets created with the first instance, which
+   * g_type_create_instance() has to allocate */
+  klass = g_type_class_peek_static (gsk_render_node_types[node_type]);
+  if (klass == NULL)
+    return NULL;
+
+  if (arena->block == NULL || arena->used + size > GSK_ARENA_BLOCK_SIZE)
+    {
+      if (arena->block)
+        gsk_arena_block_unref (arena->block);
+
+      arena->block = g_malloc (GSK_ARENA_BLOCK_SIZE);
+      arena->block->ref_count = 1;
+      arena->block->promoted = FALSE;
+      arena->used = GSK_ARENA_BLOCK_HEADER_SIZE;
+    }
+
+  node = (GskRenderNode *) ((guchar *) arena->block + arena->used);
+  arena->used += size;
+  g_atomic_int_inc (&arena->block->ref_count);
+
+  /* What g_type_create_instance() would do */
+  memset (node, 0, size);
+  node->parent_instance.g_class = klass;
+  gsk_render_node_init (node);
+
+  node->arena_block = arena->block;
+
+  return node;
+}
+
 /*< private >
  * gsk_render_node_alloc:
  * @node_type: the #GskRenderNodeType to instantiate
@@ -336,11 +488,192 @@ gsk_render_node_type_register_static (const char                  *node_name,
 gpointer
 gsk_render_node_alloc (GskRenderNodeType node_type)
 {
+  GskRenderNode *node;
+  gsize size;
+
   g_return_val_if_fail (node_type > GSK_NOT_A_RENDER_NODE, NULL);
   g_return_val_if_fail (node_type < GSK_RENDER_NODE_TYPE_N_TYPES, NULL);
 
   g_assert (gsk_render_node_types[node_type] != G_TYPE_INVALID);
-  return g_type_create_instance (gsk_render_node_types[node_type]);
+
+  size = gsk_render_node_get_instance_size (node_type);
+
+  node = gsk_render_node_arena_alloc (node_type, size);
+  if (node == NULL)
+    node = (GskRenderNode *) g_type_create_instance (gsk_render_node_types[node_type]);
+
+  g_atomic_int_inc (&alloc_stats.n_nodes);
+  g_atomic_int_add (&alloc_stats.n_bytes, size);
+
+  return node;
+}
+
+/*< private >
+ * gsk_render_node_arena_push:
+ *
+ * Starts allocating render nodes created by the calling thread from
+ * a per-thread arena, until the matching gsk_render_node_arena_pop().
+ *
+ * This is meant for the nodes created while snapshotting and rendering
+ * a frame: instead of one allocation per node, nodes are bump-allocated
+ * from large blocks. A block is freed once all nodes allocated from it
+ * have been finalized. Nodes that are kept around, like the render nodes
+ * cached by widgets, should be moved out of the arena with
+ * gsk_render_node_promote(), or they keep their whole block alive.
+ *
+ * Calls can be nested.
+ */
+void
+gsk_render_node_arena_push (void)
+{
+  GskArena *arena = gsk_arena_get ();
+
+  arena->depth++;
+}
+
+/*< private >
+ * gsk_render_node_arena_pop:
+ *
+ * Undoes the effect of gsk_render_node_arena_push().
+ */
+void
+gsk_render_node_arena_pop (void)
+{
+  GskArena *arena = gsk_arena_get ();
+
+  g_return_if_fail (arena->depth > 0);
+
+  arena->depth--;
+}
+
+typedef struct
+{
+  GskArenaBlock *block;
+  gsize used;
+  guint n_nodes;
+} GskPromotion;
+
+/* Nodes can be moved if they are in an arena block and the only
+ * reference is the one held by the tree that is being promoted.
+ */
+static gboolean
+gsk_render_node_can_promote (GskRenderNode *node)
+{
+  GskArenaBlock *block = node->arena_block;
+
+  return block != NULL &&
+         !block->promoted &&
+         g_atomic_ref_count_compare (&node->ref_count, 1);
+}
+
+static void
+gsk_render_node_measure_promotion (GskRenderNode **slot,
+                                   gpointer        data)
+{
+  GskPromotion *promotion = data;
+  GskRenderNode *node = *slot;
+
+  if (!gsk_render_node_can_promote (node))
+    return;
+
+  promotion->used += GSK_ARENA_ALIGN_SIZE (gsk_render_node_get_instance_size (gsk_render_node_get_node_type (node)));
+  promotion->n_nodes++;
+
+  gsk_render_node_foreach_child_slot (node, gsk_render_node_measure_promotion, data);
+}
+
+static void
+gsk_render_node_move (GskRenderNode **slot,
+                      gpointer        data)
+{
+  GskPromotion *promotion = data;
+  GskRenderNode *node = *slot;
+  GskRenderNode *copy;
+  gsize size;
+
+  if (!gsk_render_node_can_promote (node))
+    return;
+
+  size = gsk_render_node_get_instance_size (gsk_render_node_get_node_type (node));
+  copy = (GskRenderNode *) ((guchar *) promotion->block + promotion->used);
+  promotion->used += GSK_ARENA_ALIGN_SIZE (size);
+
+  /* The copy takes over everything the node owns, so the node
+   * itself must not be finalized, only its memory released */
+  memcpy (copy, node, size);
+  copy->arena_block = promotion->block;
+
+  if (copy->hash != 0)
+    gsk_render_node_replace_interned (node, copy);
+
+  gsk_arena_block_unref (node->arena_block);
+
+  *slot = copy;
+
+  gsk_render_node_foreach_child_slot (copy, gsk_render_node_move, data);
+}
+
+/*< private >
+ * gsk_render_node_promote:
+ * @node: (transfer full): a #GskRenderNode
+ *
+ * Moves the nodes of the tree starting at @node out of the arena
+ * blocks they were allocated from into a single block that is sized
+ * to fit them, so that keeping the tree around does not keep the
+ * arena blocks alive.
+ *
+ * Only nodes that are not referenced from anywhere else are moved,
+ * the others keep their address and their children stay where they
+ * are.
+ *
+ * Returns: (transfer full): a node with the same contents as @node,
+ *   which replaces it
+ */
+GskRenderNode *
+gsk_render_node_promote (GskRenderNode *node)
+{
+  GskPromotion promotion = { NULL, GSK_ARENA_BLOCK_HEADER_SIZE, 0 };
+
+  g_return_val_if_fail (GSK_IS_RENDER_NODE (node), NULL);
+
+  /* Interning may hand out new references to moved nodes */
+  gsk_render_node_lock_interned ();
+
+  gsk_render_node_measure_promotion (&node, &promotion);
+
+  if (promotion.n_nodes > 0)
+    {
+      promotion.block = g_malloc (promotion.used);
+      promotion.block->ref_count = promotion.n_nodes;
+      promotion.block->promoted = TRUE;
+      promotion.used = GSK_ARENA_BLOCK_HEADER_SIZE;
+
+      gsk_render_node_move (&node, &promotion);
+    }
+
+  gsk_render_node_unlock_interned ();
+
+  return node;
+}
+
+/*< private >
+ * gsk_render_node_steal_alloc_stats:
+ * @n_nodes: (out): return location for the number of nodes
+ * @n_bytes: (out): return location for the number of bytes
+ *
+ * Gets the number of render nodes and the number of bytes used
+ * by them that have been allocated since the last call, and
+ * resets the counts.
+ *
+ * The counts are shared by the whole process, not kept per
+ * renderer or per thread.
+ */
+void
+gsk_render_node_steal_alloc_stats (gint64 *n_nodes,
+                                   gint64 *n_bytes)
+{
+  *n_nodes = gsk_atomic_int_steal (&alloc_stats.n_nodes);
+  *n_bytes = gsk_atomic_int_steal (&alloc_stats.n_bytes);
 }
 
 /**
@@ -376,7 +709,14 @@ gsk_render_node_unref (GskRenderNode *node)
   g_return_if_fail (GSK_IS_RENDER_NODE (node));
 
   if (g_atomic_ref_count_dec (&node->ref_count))
-    GSK_RENDER_NODE_GET_CLASS (node)->finalize (node);
+    {
+      /* Must happen before finalize frees the contents that
+       * the intern table compares */
+      if (node->hash != 0)
+        gsk_render_node_unintern (node);
+
+      GSK_RENDER_NODE_GET_CLASS (node)->finalize (node);
+    }
 }
 
 
@@ -551,6 +891,10 @@ gsk_render_node_diff (GskRenderNode  *node1,
   if (_gsk_render_node_get_node_type (node1) != _gsk_render_node_get_node_type (node2))
     return gsk_render_node_diff_impossible (node1, node2, region);
 
+  /* Interned nodes with equal contents are the same node */
+  if (node1->hash != 0 && node2->hash != 0)
+    return gsk_render_node_diff_impossible (node1, node2, region);
+
   return GSK_RENDER_NODE_GET_CLASS (node1)->diff (node1, node2, region);
 }
 
@@ -597,8 +941,9 @@ gsk_render_node_write_to_file (GskRenderNode *node,
  * @error_func: (nullable) (scope call): Callback on parsing errors or %NULL
  * @user_data: (closure error_func): user_data for @error_func
  *
- * Loads data previously created via gsk_render_node_serialize(). For a
- * discussion of the supported format, see that function.
+ * Loads data previously created via gsk_render_node_serialize() or
+ * gsk_render_node_serialize_binary(). The format is detected automatically.
+ * For a discussion of the supported formats, see those functions.
  *
  * Returns: (nullable) (transfer full): a new #GskRenderNode or %NULL on
  *     error.
@@ -610,7 +955,10 @@ gsk_render_node_deserialize (GBytes            *bytes,
 {
   GskRenderNode *node = NULL;
 
-  node = gsk_render_node_deserialize_from_bytes (bytes, error_func, user_data);
+  if (gsk_render_node_bytes_are_binary (bytes))
+    node = gsk_render_node_deserialize_binary (bytes, error_func, user_data);
+  else
+    node = gsk_render_node_deserialize_from_bytes (bytes, error_func, user_data);
 
   return node;
 }
@@ -0,0 +1,1534 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The binary node format
+ *
+ * The binary format is meant to be loaded from a mapped file without
+ * tokenizing anything. It consists of a header followed by three tables
+ * of fixed-size records and a data area that the records point into via
+ * offsets:
+ *
+ * - The string table, holding deduplicated strings such as font names,
+ *   transforms, debug messages and shader sources.
+ * - The texture table, holding deduplicated textures as premultiplied
+ *   ARGB32 pixels. These are not copied when loading.
+ * - The node table, one record per distinct node, in an order where
+ *   children always come before their parents. The last node is the root.
+ *
+ * The type-specific data of every node is a sequence of 32bit words in
+ * the data area. Nodes refer to their children, strings and textures by
+ * their index in the respective table.
+ *
+ * All values are stored in host byte order and the format is versioned.
+ * Just like the text format, it is not meant as a permanent storage format.
+ */
+
+#include "config.h"
+
+#include "gskrendernodebinaryprivate.h"
+
+#include "gskrendernodeprivate.h"
+#include "gsktransformprivate.h"
+
+#include "gdk/gdkmemorytextureprivate.h"
+#include "gdk/gdktextureprivate.h"
+
+#include <pango/pangocairo.h>
+#include <string.h>
+
+#define GSK_BINARY_VERSION 1
+#define GSK_BINARY_BYTE_ORDER 0x01020304
+
+#define NO_INDEX G_MAXUINT32
+
+static const char gsk_binary_magic[8] = { '\x89', 'G', 'S', 'K', '\r', '\n', '\x1a', '\n' };
+
+typedef struct {
+  char magic[8];
+  guint32 version;
+  guint32 byte_order;
+  guint32 n_strings;
+  guint32 n_textures;
+  guint32 n_nodes;
+  guint32 strings_offset;
+  guint32 textures_offset;
+  guint32 nodes_offset;
+  guint32 data_offset;
+  guint32 data_size;
+} FileHeader;
+
+typedef struct {
+  guint32 offset;
+  guint32 length;
+} StringRecord;
+
+typedef struct {
+  guint32 width;
+  guint32 height;
+  guint32 stride;
+  guint32 offset;
+} TextureRecord;
+
+typedef struct {
+  guint32 type;
+  guint32 offset;
+  guint32 n_words;
+  float bounds[4];
+} NodeRecord;
+
+G_STATIC_ASSERT (sizeof (FileHeader) % 4 == 0);
+G_STATIC_ASSERT (sizeof (NodeRecord) == 7 * 4);
+
+/* {{{ Writing */
+
+typedef struct {
+  GArray *strings;
+  GArray *textures;
+  GArray *nodes;
+  GByteArray *data;
+
+  GHashTable *string_indices;
+  GHashTable *texture_indices;
+  GHashTable *node_indices;
+} Writer;
+
+static void
+writer_init (Writer *self)
+{
+  self->strings = g_array_new (FALSE, FALSE, sizeof (StringRecord));
+  self->textures = g_array_new (FALSE, FALSE, sizeof (TextureRecord));
+  self->nodes = g_array_new (FALSE, FALSE, sizeof (NodeRecord));
+  self->data = g_byte_array_new ();
+
+  self->string_indices = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  self->texture_indices = g_hash_table_new (NULL, NULL);
+  self->node_indices = g_hash_table_new (NULL, NULL);
+}
+
+static void
+writer_clear (Writer *self)
+{
+  g_array_unref (self->strings);
+  g_array_unref (self->textures);
+  g_array_unref (self->nodes);
+  g_byte_array_unref (self->data);
+
+  g_hash_table_unref (self->string_indices);
+  g_hash_table_unref (self->texture_indices);
+  g_hash_table_unref (self->node_indices);
+}
+
+static guint32
+writer_append_data (Writer       *self,
+                    gconstpointer data,
+                    gsize         size)
+{
+  static const guint8 zeroes[4] = { 0, };
+  guint32 offset;
+
+  if (self->data->len % 4)
+    g_byte_array_append (self->data, zeroes, 4 - self->data->len % 4);
+
+  offset = self->data->len;
+  g_byte_array_append (self->data, data, size);
+
+  return offset;
+}
+
+static guint32
+writer_add_string (Writer     *self,
+                   const char *string)
+{
+  StringRecord record;
+  gpointer index;
+
+  if (g_hash_table_lookup_extended (self->string_indices, string, NULL, &index))
+    return GPOINTER_TO_UINT (index);
+
+  record.length = strlen (string);
+  record.offset = writer_append_data (self, string, record.length + 1);
+  g_array_append_val (self->strings, record);
+
+  g_hash_table_insert (self->string_indices, g_strdup (string), GUINT_TO_POINTER (self->strings->len - 1));
+
+  return self->strings->len - 1;
+}
+
+static guint32
+writer_add_texture (Writer     *self,
+                    GdkTexture *texture)
+{
+  TextureRecord record;
+  gpointer index;
+  guchar *pixels;
+
+  if (g_hash_table_lookup_extended (self->texture_indices, texture, NULL, &index))
+    return GPOINTER_TO_UINT (index);
+
+  record.width = gdk_texture_get_width (texture);
+  record.height = gdk_texture_get_height (texture);
+  record.stride = record.width * 4;
+
+  pixels = g_malloc (record.stride * record.height);
+  gdk_texture_download (texture, pixels, record.stride);
+  record.offset = writer_append_data (self, pixels, record.stride * record.height);
+  g_free (pixels);
+
+  g_array_append_val (self->textures, record);
+  g_hash_table_insert (self->texture_indices, texture, GUINT_TO_POINTER (self->textures->len - 1));
+
+  return self->textures->len - 1;
+}
+
+static inline void
+words_add_uint (GArray  *words,
+                guint32  value)
+{
+  g_array_append_val (words, value);
+}
+
+static inline void
+words_add_float (GArray *words,
+                 float   value)
+{
+  guint32 u;
+
+  memcpy (&u, &value, sizeof (float));
+  g_array_append_val (words, u);
+}
+
+static void
+words_add_point (GArray                 *words,
+                 const graphene_point_t *point)
+{
+  words_add_float (words, point->x);
+  words_add_float (words, point->y);
+}
+
+static void
+words_add_rect (GArray                *words,
+                const graphene_rect_t *rect)
+{
+  words_add_float (words, rect->origin.x);
+  words_add_float (words, rect->origin.y);
+  words_add_float (words, rect->size.width);
+  words_add_float (words, rect->size.height);
+}
+
+static void
+words_add_rounded_rect (GArray               *words,
+                        const GskRoundedRect *rect)
+{
+  guint i;
+
+  words_add_rect (words, &rect->bounds);
+  for (i = 0; i < 4; i++)
+    {
+      words_add_float (words, rect->corner[i].width);
+      words_add_float (words, rect->corner[i].height);
+    }
+}
+
+static void
+words_add_rgba (GArray        *words,
+                const GdkRGBA *rgba)
+{
+  words_add_float (words, rgba->red);
+  words_add_float (words, rgba->green);
+  words_add_float (words, rgba->blue);
+  words_add_float (words, rgba->alpha);
+}
+
+static void
+words_add_stops (GArray             *words,
+                 const GskColorStop *stops,
+                 gsize               n_stops)
+{
+  gsize i;
+
+  words_add_uint (words, n_stops);
+  for (i = 0; i < n_stops; i++)
+    {
+      words_add_float (words, stops[i].offset);
+      words_add_rgba (words, &stops[i].color);
+    }
+}
+
+static guint32 writer_add_node (Writer        *self,
+                                GskRenderNode *node);
+
+static void
+words_add_node (Writer        *self,
+                GArray        *words,
+                GskRenderNode *node)
+{
+  words_add_uint (words, writer_add_node (self, node));
+}
+
+static GdkTexture *
+cairo_node_to_texture (GskRenderNode *node)
+{
+  cairo_surface_t *surface;
+  GdkTexture *texture;
+  cairo_t *cr;
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                        ceil (node->bounds.size.width),
+                                        ceil (node->bounds.size.height));
+  cr = cairo_create (surface);
+  cairo_translate (cr, - node->bounds.origin.x, - node->bounds.origin.y);
+  gsk_render_node_draw (node, cr);
+  cairo_destroy (cr);
+
+  texture = gdk_texture_new_for_surface (surface);
+  cairo_surface_destroy (surface);
+
+  return texture;
+}
+
+static void
+writer_add_node_data (Writer        *self,
+                      GArray        *words,
+                      GskRenderNode *node)
+{
+  guint i;
+
+  switch (gsk_render_node_get_node_type (node))
+    {
+    case GSK_CONTAINER_NODE:
+      words_add_uint (words, gsk_container_node_get_n_children (node));
+      for (i = 0; i < gsk_container_node_get_n_children (node); i++)
+        words_add_node (self, words, gsk_container_node_get_child (node, i));
+      break;
+
+    case GSK_CAIRO_NODE:
+      if (gsk_cairo_node_get_surface (node) != NULL &&
+          node->bounds.size.width >= 1 && node->bounds.size.height >= 1)
+        {
+          GdkTexture *texture = cairo_node_to_texture (node);
+
+          words_add_uint (words, writer_add_texture (self, texture));
+          /* the pointer is only valid while the texture lives */
+          g_hash_table_remove (self->texture_indices, texture);
+          g_object_unref (texture);
+        }
+      else
+        {
+          words_add_uint (words, NO_INDEX);
+        }
+      break;
+
+    case GSK_COLOR_NODE:
+      words_add_rgba (words, gsk_color_node_get_color (node));
+      break;
+
+    case GSK_LINEAR_GRADIENT_NODE:
+    case GSK_REPEATING_LINEAR_GRADIENT_NODE:
+      words_add_point (words, gsk_linear_gradient_node_get_start (node));
+      words_add_point (words, gsk_linear_gradient_node_get_end (node));
+      words_add_stops (words,
+                       gsk_linear_gradient_node_get_color_stops (node, NULL),
+                       gsk_linear_gradient_node_get_n_color_stops (node));
+      break;
+
+    case GSK_RADIAL_GRADIENT_NODE:
+    case GSK_REPEATING_RADIAL_GRADIENT_NODE:
+      words_add_point (words, gsk_radial_gradient_node_get_center (node));
+      words_add_float (words, gsk_radial_gradient_node_get_hradius (node));
+      words_add_float (words, gsk_radial_gradient_node_get_vradius (node));
+      words_add_float (words, gsk_radial_gradient_node_get_start (node));
+      words_add_float (words, gsk_radial_gradient_node_get_end (node));
+      words_add_stops (words,
+                       gsk_radial_gradient_node_get_color_stops (node, NULL),
+                       gsk_radial_gradient_node_get_n_color_stops (node));
+      break;
+
+    case GSK_CONIC_GRADIENT_NODE:
+      words_add_point (words, gsk_conic_gradient_node_get_center (node));
+      words_add_float (words, gsk_conic_gradient_node_get_rotation (node));
+      words_add_stops (words,
+                       gsk_conic_gradient_node_get_color_stops (node, NULL),
+                       gsk_conic_gradient_node_get_n_color_stops (node));
+      break;
+
+    case GSK_BORDER_NODE:
+      {
+        const float *widths = gsk_border_node_get_widths (node);
+        const GdkRGBA *colors = gsk_border_node_get_colors (node);
+
+        words_add_rounded_rect (words, gsk_border_node_get_outline (node));
+        for (i = 0; i < 4; i++)
+          words_add_float (words, widths[i]);
+        for (i = 0; i < 4; i++)
+          words_add_rgba (words, &colors[i]);
+      }
+      break;
+
+    case GSK_TEXTURE_NODE:
+      words_add_uint (words, writer_add_texture (self, gsk_texture_node_get_texture (node)));
+      break;
+
+    case GSK_INSET_SHADOW_NODE:
+      words_add_rounded_rect (words, gsk_inset_shadow_node_get_outline (node));
+      words_add_rgba (words, gsk_inset_shadow_node_get_color (node));
+      words_add_float (words, gsk_inset_shadow_node_get_dx (node));
+      words_add_float (words, gsk_inset_shadow_node_get_dy (node));
+      words_add_float (words, gsk_inset_shadow_node_get_spread (node));
+      words_add_float (words, gsk_inset_shadow_node_get_blur_radius (node));
+      break;
+
+    case GSK_OUTSET_SHADOW_NODE:
+      words_add_rounded_rect (words, gsk_outset_shadow_node_get_outline (node));
+      words_add_rgba (words, gsk_outset_shadow_node_get_color (node));
+      words_add_float (words, gsk_outset_shadow_node_get_dx (node));
+      words_add_float (words, gsk_outset_shadow_node_get_dy (node));
+      words_add_float (words, gsk_outset_shadow_node_get_spread (node));
+      words_add_float (words, gsk_outset_shadow_node_get_blur_radius (node));
+      break;
+
+    case GSK_TRANSFORM_NODE:
+      {
+        char *string = gsk_transform_to_string (gsk_transform_node_get_transform (node));
+
+        words_add_node (self, words, gsk_transform_node_get_child (node));
+        words_add_uint (words, writer_add_string (self, string));
+        g_free (string);
+      }
+      break;
+
+    case GSK_OPACITY_NODE:
+      words_add_node (self, words, gsk_opacity_node_get_child (node));
+      words_add_float (words, gsk_opacity_node_get_opacity (node));
+      break;
+
+    case GSK_COLOR_MATRIX_NODE:
+      {
+        float matrix[16], offset[4];
+
+        graphene_matrix_to_float (gsk_color_matrix_node_get_color_matrix (node), matrix);
+        graphene_vec4_to_float (gsk_color_matrix_node_get_color_offset (node), offset);
+
+        words_add_node (self, words, gsk_color_matrix_node_get_child (node));
+        for (i = 0; i < 16; i++)
+          words_add_float (words, matrix[i]);
+        for (i = 0; i < 4; i++)
+          words_add_float (words, offset[i]);
+      }
+      break;
+
+    case GSK_REPEAT_NODE:
+      words_add_node (self, words, gsk_repeat_node_get_child (node));
+      words_add_rect (words, gsk_repeat_node_get_child_bounds (node));
+      break;
+
+    case GSK_CLIP_NODE:
+      words_add_node (self, words, gsk_clip_node_get_child (node));
+      words_add_rect (words, gsk_clip_node_get_clip (node));
+      break;
+
+    case GSK_ROUNDED_CLIP_NODE:
+      words_add_node (self, words, gsk_rounded_clip_node_get_child (node));
+      words_add_rounded_rect (words, gsk_rounded_clip_node_get_clip (node));
+      break;
+
+    case GSK_SHADOW_NODE:
+      words_add_node (self, words, gsk_shadow_node_get_child (node));
+      words_add_uint (words, gsk_shadow_node_get_n_shadows (node));
+      for (i = 0; i < gsk_shadow_node_get_n_shadows (node); i++)
+        {
+          const GskShadow *shadow = gsk_shadow_node_get_shadow (node, i);
+
+          words_add_rgba (words, &shadow->color);
+          words_add_float (words, shadow->dx);
+          words_add_float (words, shadow->dy);
+          words_add_float (words, shadow->radius);
+        }
+      break;
+
+    case GSK_BLEND_NODE:
+      words_add_node (self, words, gsk_blend_node_get_bottom_child (node));
+      words_add_node (self, words, gsk_blend_node_get_top_child (node));
+      words_add_uint (words, gsk_blend_node_get_blend_mode (node));
+      break;
+
+    case GSK_CROSS_FADE_NODE:
+      words_add_node (self, words, gsk_cross_fade_node_get_start_child (node));
+      words_add_node (self, words, gsk_cross_fade_node_get_end_child (node));
+      words_add_float (words, gsk_cross_fade_node_get_progress (node));
+      break;
+
+    case GSK_TEXT_NODE:
+      {
+        const PangoGlyphInfo *glyphs;
+        PangoFontDescription *desc;
+        char *font_name;
+        guint n_glyphs;
+
+        desc = pango_font_describe (gsk_text_node_get_font (node));
+        font_name = pango_font_description_to_string (desc);
+        words_add_uint (words, writer_add_string (self, font_name));
+        g_free (font_name);
+        pango_font_description_free (desc);
+
+        words_add_rgba (words, gsk_text_node_get_color (node));
+        words_add_point (words, gsk_text_node_get_offset (node));
+
+        glyphs = gsk_text_node_get_glyphs (node, &n_glyphs);
+        words_add_uint (words, n_glyphs);
+        for (i = 0; i < n_glyphs; i++)
+          {
+            words_add_uint (words, glyphs[i].glyph);
+            words_add_uint (words, glyphs[i].geometry.width);
+            words_add_uint (words, glyphs[i].geometry.x_offset);
+            words_add_uint (words, glyphs[i].geometry.y_offset);
+            words_add_uint (words, glyphs[i].attr.is_cluster_start);
+          }
+      }
+      break;
+
+    case GSK_BLUR_NODE:
+      words_add_node (self, words, gsk_blur_node_get_child (node));
+      words_add_float (words, gsk_blur_node_get_radius (node));
+      break;
+
+    case GSK_DEBUG_NODE:
+      words_add_node (self, words, gsk_debug_node_get_child (node));
+      words_add_uint (words, writer_add_string (self, gsk_debug_node_get_message (node)));
+      break;
+
+    case GSK_GL_SHADER_NODE:
+      {
+        GskGLShader *shader = gsk_gl_shader_node_get_shader (node);
+        GBytes *source = gsk_gl_shader_get_source (shader);
+        GBytes *args = gsk_gl_shader_node_get_args (node);
+        char *source_string;
+
+        source_string = g_strndup (g_bytes_get_data (source, NULL), g_bytes_get_size (source));
+        words_add_uint (words, writer_add_string (self, source_string));
+        g_free (source_string);
+
+        words_add_uint (words, g_bytes_get_size (args));
+        words_add_uint (words, writer_append_data (self,
+                                                   g_bytes_get_data (args, NULL),
+                                                   g_bytes_get_size (args)));
+
+        words_add_uint (words, gsk_gl_shader_node_get_n_children (node));
+        for (i = 0; i < gsk_gl_shader_node_get_n_children (node); i++)
+          words_add_node (self, words, gsk_gl_shader_node_get_child (node, i));
+      }
+      break;
+
+    case GSK_NOT_A_RENDER_NODE:
+    default:
+      g_error ("Unhandled node: %s", g_type_name_from_instance ((GTypeInstance *) node));
+      break;
+    }
+}
+
+static guint32
+writer_add_node (Writer        *self,
+                 GskRenderNode *node)
+{
+  NodeRecord record;
+  gpointer index;
+  GArray *words;
+
+  if (g_hash_table_lookup_extended (self->node_indices, node, NULL, &index))
+    return GPOINTER_TO_UINT (index);
+
+  /* This recurses into the children first, so they end up before us */
+  words = g_array_new (FALSE, FALSE, sizeof (guint32));
+  writer_add_node_data (self, words, node);
+
+  record.type = gsk_render_node_get_node_type (node);
+  record.n_words = words->len;
+  record.offset = writer_append_data (self, words->data, words->len * sizeof (guint32));
+  record.bounds[0] = node->bounds.origin.x;
+  record.bounds[1] = node->bounds.origin.y;
+  record.bounds[2] = node->bounds.size.width;
+  record.bounds[3] = node->bounds.size.height;
+  g_array_append_val (self->nodes, record);
+
+  g_array_unref (words);
+
+  g_hash_table_insert (self->node_indices, node, GUINT_TO_POINTER (self->nodes->len - 1));
+
+  return self->nodes->len - 1;
+}
+
+static GBytes *
+writer_finish (Writer *self)
+{
+  FileHeader header;
+  GByteArray *result;
+
+  memset (&header, 0, sizeof (FileHeader));
+  memcpy (header.magic, gsk_binary_magic, sizeof (gsk_binary_magic));
+  header.version = GSK_BINARY_VERSION;
+  header.byte_order = GSK_BINARY_BYTE_ORDER;
+  header.n_strings = self->strings->len;
+  header.n_textures = self->textures->len;
+  header.n_nodes = self->nodes->len;
+  header.strings_offset = sizeof (FileHeader);
+  header.textures_offset = header.strings_offset + self->strings->len * sizeof (StringRecord);
+  header.nodes_offset = header.textures_offset + self->textures->len * sizeof (TextureRecord);
+  header.data_offset = header.nodes_offset + self->nodes->len * sizeof (NodeRecord);
+  header.data_size = self->data->len;
+
+  result = g_byte_array_sized_new (header.data_offset + header.data_size);
+  g_byte_array_append (result, (guint8 *) &header, sizeof (FileHeader));
+  g_byte_array_append (result, (guint8 *) self->strings->data, self->strings->len * sizeof (StringRecord));
+  g_byte_array_append (result, (guint8 *) self->textures->data, self->textures->len * sizeof (TextureRecord));
+  g_byte_array_append (result, (guint8 *) self->nodes->data, self->nodes->len * sizeof (NodeRecord));
+  g_byte_array_append (result, self->data->data, self->data->len);
+
+  return g_byte_array_free_to_bytes (result);
+}
+
+/**
+ * gsk_render_node_serialize_binary:
+ * @node: a #GskRenderNode
+ *
+ * Serializes the @node into a compact binary format.
+ *
+ * Compared to gsk_render_node_serialize(), the binary format is a lot
+ * faster to create and load, in particular for large trees. Identical
+ * strings, textures and nodes are only stored once, and textures are
+ * not copied when loading.
+ *
+ * The result can be loaded with gsk_render_node_deserialize(), which
+ * detects the format automatically. To avoid reading the whole file,
+ * use g_mapped_file_get_bytes() on a #GMappedFile.
+ *
+ * The same caveats as for gsk_render_node_serialize() apply: the format
+ * is only meant to be read by the same version of GTK on the same
+ * architecture, and is not meant for permanent storage.
+ *
+ * Returns: a #GBytes representing the node.
+ **/
+GBytes *
+gsk_render_node_serialize_binary (GskRenderNode *node)
+{
+  Writer writer;
+  GBytes *result;
+
+  g_return_val_if_fail (GSK_IS_RENDER_NODE (node), NULL);
+
+  writer_init (&writer);
+
+  writer_add_node (&writer, node);
+  result = writer_finish (&writer);
+
+  writer_clear (&writer);
+
+  return result;
+}
+
+/* }}} */
+/* {{{ Reading */
+
+typedef struct {
+  GBytes *bytes;
+  const guchar *data;
+  const FileHeader *header;
+  const StringRecord *strings;
+  const TextureRecord *textures;
+  const NodeRecord *nodes;
+
+  GskRenderNode **built_nodes;
+  GdkTexture **built_textures;
+  PangoFont **built_fonts;
+  GskGLShader **built_shaders;
+
+  GskParseErrorFunc error_func;
+  gpointer user_data;
+} Reader;
+
+typedef struct {
+  const guint32 *words;
+  guint32 n_words;
+  guint32 pos;
+  gboolean failed;
+} NodeData;
+
+static void
+reader_error (Reader     *self,
+              gsize       offset,
+              const char *format,
+              ...) G_GNUC_PRINTF (3, 4);
+
+static void
+reader_error (Reader     *self,
+              gsize       offset,
+              const char *format,
+              ...)
+{
+  GskParseLocation location = { offset, offset, 0, offset, offset };
+  GError *error;
+  va_list args;
+
+  if (self->error_func == NULL)
+    return;
+
+  va_start (args, format);
+  error = g_error_new_valist (GSK_SERIALIZATION_ERROR,
+                              GSK_SERIALIZATION_INVALID_DATA,
+                              format, args);
+  va_end (args);
+
+  self->error_func (&location, &location, error, self->user_data);
+
+  g_error_free (error);
+}
+
+static gboolean
+range_is_valid (guint64 offset,
+                guint64 size,
+                guint64 total)
+{
+  return offset <= total && size <= total - offset;
+}
+
+static gboolean
+reader_init (Reader            *self,
+             GBytes            *bytes,
+             GskParseErrorFunc  error_func,
+             gpointer           user_data)
+{
+  const FileHeader *header;
+  gsize size;
+
+  memset (self, 0, sizeof (Reader));
+  self->error_func = error_func;
+  self->user_data = user_data;
+  self->data = g_bytes_get_data (bytes, &size);
+
+  if (size < sizeof (FileHeader) || ((gsize) self->data) % 4 != 0)
+    {
+      reader_error (self, 0, "Truncated or misaligned data");
+      return FALSE;
+    }
+
+  header = (const FileHeader *) self->data;
+
+  if (header->version != GSK_BINARY_VERSION || header->byte_order != GSK_BINARY_BYTE_ORDER)
+    {
+      GskParseLocation location = { 0, };
+      GError *error;
+
+      if (error_func)
+        {
+          error = g_error_new (GSK_SERIALIZATION_ERROR,
+                               GSK_SERIALIZATION_UNSUPPORTED_VERSION,
+                               "Unsupported binary format version");
+          error_func (&location, &location, error, user_data);
+          g_error_free (error);
+        }
+      return FALSE;
+    }
+
+  if (header->strings_offset % 4 || header->textures_offset % 4 ||
+      header->nodes_offset % 4 || header->data_offset % 4 ||
+      !range_is_valid (header->strings_offset, (guint64) header->n_strings * sizeof (StringRecord), size) ||
+      !range_is_valid (header->textures_offset, (guint64) header->n_textures * sizeof (TextureRecord), size) ||
+      !range_is_valid (header->nodes_offset, (guint64) header->n_nodes * sizeof (NodeRecord), size) ||
+      !range_is_valid (header->data_offset, header->data_size, size))
+    {
+      reader_error (self, 0, "Invalid header");
+      return FALSE;
+    }
+
+  if (header->n_nodes == 0)
+    {
+      reader_error (self, 0, "No nodes");
+      return FALSE;
+    }
+
+  self->bytes = g_bytes_ref (bytes);
+  self->header = header;
+  self->strings = (const StringRecord *) (self->data + header->strings_offset);
+  self->textures = (const TextureRecord *) (self->data + header->textures_offset);
+  self->nodes = (const NodeRecord *) (self->data + header->nodes_offset);
+
+  self->built_nodes = g_new0 (GskRenderNode *, header->n_nodes);
+  self->built_textures = g_new0 (GdkTexture *, header->n_textures);
+  self->built_fonts = g_new0 (PangoFont *, header->n_strings);
+  self->built_shaders = g_new0 (GskGLShader *, header->n_strings);
+
+  return TRUE;
+}
+
+static void
+reader_clear (Reader *self)
+{
+  guint i;
+
+  for (i = 0; i < self->header->n_nodes; i++)
+    g_clear_pointer (&self->built_nodes[i], gsk_render_node_unref);
+  for (i = 0; i < self->header->n_textures; i++)
+    g_clear_object (&self->built_textures[i]);
+  for (i = 0; i < self->header->n_strings; i++)
+    {
+      g_clear_object (&self->built_fonts[i]);
+      g_clear_object (&self->built_shaders[i]);
+    }
+
+  g_free (self->built_nodes);
+  g_free (self->built_textures);
+  g_free (self->built_fonts);
+  g_free (self->built_shaders);
+  g_bytes_unref (self->bytes);
+}
+
+static const char *
+reader_get_string (Reader  *self,
+                   guint32  index)
+{
+  const StringRecord *record;
+  const char *string;
+
+  if (index >= self->header->n_strings)
+    return NULL;
+
+  record = &self->strings[index];
+  if (!range_is_valid (record->offset, (guint64) record->length + 1, self->header->data_size))
+    return NULL;
+
+  string = (const char *) self->data + self->header->data_offset + record->offset;
+  if (string[record->length] != '\0')
+    return NULL;
+
+  return string;
+}
+
+static GdkTexture *
+reader_get_texture (Reader  *self,
+                    guint32  index)
+{
+  const TextureRecord *record;
+  GBytes *pixels;
+
+  if (index >= self->header->n_textures)
+    return NULL;
+
+  if (self->built_textures[index])
+    return self->built_textures[index];
+
+  record = &self->textures[index];
+  if (record->width == 0 || record->height == 0 ||
+      record->width > G_MAXINT / 4 || record->height > G_MAXINT ||
+      record->stride < record->width * 4 ||
+      !range_is_valid (record->offset, (guint64) record->stride * record->height, self->header->data_size))
+    return NULL;
+
+  pixels = g_bytes_new_from_bytes (self->bytes,
+                                   self->header->data_offset + record->offset,
+                                   (gsize) record->stride * record->height);
+  self->built_textures[index] = gdk_memory_texture_new (record->width,
+                                                        record->height,
+                                                        GDK_MEMORY_DEFAULT,
+                                                        pixels,
+                                                        record->stride);
+  g_bytes_unref (pixels);
+
+  return self->built_textures[index];
+}
+
+static PangoFont *
+reader_get_font (Reader  *self,
+                 guint32  index)
+{
+  PangoFontDescription *desc;
+  PangoFontMap *font_map;
+  PangoContext *context;
+  const char *name;
+
+  name = reader_get_string (self, index);
+  if (name == NULL)
+    return NULL;
+
+  if (self->built_fonts[index])
+    return self->built_fonts[index];
+
+  desc = pango_font_description_from_string (name);
+  font_map = pango_cairo_font_map_get_default ();
+  context = pango_font_map_create_context (font_map);
+  self->built_fonts[index] = pango_font_map_load_font (font_map, context, desc);
+  pango_font_description_free (desc);
+  g_object_unref (context);
+
+  return self->built_fonts[index];
+}
+
+static GskGLShader *
+reader_get_shader (Reader  *self,
+                   guint32  index)
+{
+  const char *source;
+  GBytes *bytes;
+
+  source = reader_get_string (self, index);
+  if (source == NULL)
+    return NULL;
+
+  if (self->built_shaders[index])
+    return self->built_shaders[index];
+
+  bytes = g_bytes_new (source, strlen (source));
+  self->built_shaders[index] = gsk_gl_shader_new_from_bytes (bytes);
+  g_bytes_unref (bytes);
+
+  return self->built_shaders[index];
+}
+
+static guint32
+data_get_uint (NodeData *data)
+{
+  if (data->pos >= data->n_words)
+    {
+      data->failed = TRUE;
+      return 0;
+    }
+
+  return data->words[data->pos++];
+}
+
+static float
+data_get_float (NodeData *data)
+{
+  guint32 u = data_get_uint (data);
+  float f;
+
+  memcpy (&f, &u, sizeof (float));
+
+  return f;
+}
+
+static void
+data_get_point (NodeData         *data,
+                graphene_point_t *point)
+{
+  point->x = data_get_float (data);
+  point->y = data_get_float (data);
+}
+
+static void
+data_get_rect (NodeData        *data,
+               graphene_rect_t *rect)
+{
+  rect->origin.x = data_get_float (data);
+  rect->origin.y = data_get_float (data);
+  rect->size.width = data_get_float (data);
+  rect->size.height = data_get_float (data);
+}
+
+static void
+data_get_rounded_rect (NodeData       *data,
+                       GskRoundedRect *rect)
+{
+  guint i;
+
+  data_get_rect (data, &rect->bounds);
+  for (i = 0; i < 4; i++)
+    {
+      rect->corner[i].width = data_get_float (data);
+      rect->corner[i].height = data_get_float (data);
+    }
+}
+
+static void
+data_get_rgba (NodeData *data,
+               GdkRGBA  *rgba)
+{
+  rgba->red = data_get_float (data);
+  rgba->green = data_get_float (data);
+  rgba->blue = data_get_float (data);
+  rgba->alpha = data_get_float (data);
+}
+
+/* Returns the number of items that fit into the remaining data, to not
+ * allocate huge arrays for corrupt counts.
+ */
+static guint32
+data_get_count (NodeData *data,
+                guint     words_per_item)
+{
+  guint32 count = data_get_uint (data);
+
+  if (count > (data->n_words - data->pos) / words_per_item)
+    {
+      data->failed = TRUE;
+      return 0;
+    }
+
+  return count;
+}
+
+static GskColorStop *
+data_get_stops (NodeData *data,
+                gsize    *n_stops)
+{
+  GskColorStop *stops;
+  gsize i;
+
+  *n_stops = data_get_count (data, 5);
+  if (*n_stops < 2)
+    {
+      data->failed = TRUE;
+      return NULL;
+    }
+
+  stops = g_new (GskColorStop, *n_stops);
+  for (i = 0; i < *n_stops; i++)
+    {
+      stops[i].offset = data_get_float (data);
+      data_get_rgba (data, &stops[i].color);
+
+      /* offsets must be increasing and in [0, 1], written so that
+       * NaN fails, too */
+      if (!(stops[i].offset >= (i > 0 ? stops[i - 1].offset : 0)) ||
+          !(stops[i].offset <= 1))
+        {
+          data->failed = TRUE;
+          g_free (stops);
+          return NULL;
+        }
+    }
+
+  return stops;
+}
+
+static GskRenderNode *
+data_get_node (Reader   *self,
+               NodeData *data,
+               guint32   parent)
+{
+  guint32 index = data_get_uint (data);
+
+  /* children must come before their parents */
+  if (index >= parent)
+    {
+      data->failed = TRUE;
+      return NULL;
+    }
+
+  return self->built_nodes[index];
+}
+
+static GskRenderNode *
+reader_create_node (Reader   *self,
+                    guint32   index,
+                    NodeData *data)
+{
+  const NodeRecord *record = &self->nodes[index];
+  graphene_rect_t bounds;
+  GskRenderNode *result = NULL;
+  guint i;
+
+  graphene_rect_init (&bounds, record->bounds[0], record->bounds[1], record->bounds[2], record->bounds[3]);
+
+  switch (record->type)
+    {
+    case GSK_CONTAINER_NODE:
+      {
+        guint32 n_children = data_get_count (data, 1);
+        GskRenderNode **children = g_new (GskRenderNode *, MAX (n_children, 1));
+
+        for (i = 0; i < n_children; i++)
+          children[i] = data_get_node (self, data, index);
+
+        if (!data->failed)
+          result = gsk_container_node_new (children, n_children);
+
+        g_free (children);
+      }
+      break;
+
+    case GSK_CAIRO_NODE:
+      {
+        guint32 texture_index = data_get_uint (data);
+
+        result = gsk_cairo_node_new (&bounds);
+
+        if (texture_index != NO_INDEX)
+          {
+            GdkTexture *texture = reader_get_texture (self, texture_index);
+            cairo_surface_t *surface;
+            cairo_t *cr;
+
+            if (texture == NULL)
+              {
+                data->failed = TRUE;
+                break;
+              }
+
+            surface = gdk_texture_download_surface (texture);
+            cr = gsk_cairo_node_get_draw_context (result);
+            cairo_set_source_surface (cr, surface, bounds.origin.x, bounds.origin.y);
+            cairo_paint (cr);
+            cairo_destroy (cr);
+            cairo_surface_destroy (surface);
+          }
+      }
+      break;
+
+    case GSK_COLOR_NODE:
+      {
+        GdkRGBA color;
+
+        data_get_rgba (data, &color);
+        result = gsk_color_node_new (&color, &bounds);
+      }
+      break;
+
+    case GSK_LINEAR_GRADIENT_NODE:
+    case GSK_REPEATING_LINEAR_GRADIENT_NODE:
+      {
+        graphene_point_t start, end;
+        GskColorStop *stops;
+        gsize n_stops;
+
+        data_get_point (data, &start);
+        data_get_point (data, &end);
+        stops = data_get_stops (data, &n_stops);
+        if (data->failed)
+          break;
+
+        if (record->type == GSK_REPEATING_LINEAR_GRADIENT_NODE)
+          result = gsk_repeating_linear_gradient_node_new (&bounds, &start, &end, stops, n_stops);
+        else
+          result = gsk_linear_gradient_node_new (&bounds, &start, &end, stops, n_stops);
+
+        g_free (stops);
+      }
+      break;
+
+    case GSK_RADIAL_GRADIENT_NODE:
+    case GSK_REPEATING_RADIAL_GRADIENT_NODE:
+      {
+        graphene_point_t center;
+        float hradius, vradius, start, end;
+        GskColorStop *stops;
+        gsize n_stops;
+
+        data_get_point (data, &center);
+        hradius = data_get_float (data);
+        vradius = data_get_float (data);
+        start = data_get_float (data);
+        end = data_get_float (data);
+        if (!(hradius > 0) || !(vradius > 0) || !(start >= 0) || !(end > start))
+          {
+            data->failed = TRUE;
+            break;
+          }
+
+        stops = data_get_stops (data, &n_stops);
+        if (data->failed)
+          break;
+
+        if (record->type == GSK_REPEATING_RADIAL_GRADIENT_NODE)
+          result = gsk_repeating_radial_gradient_node_new (&bounds, &center, hradius, vradius, start, end, stops, n_stops);
+        else
+          result = gsk_radial_gradient_node_new (&bounds, &center, hradius, vradius, start, end, stops, n_stops);
+
+        g_free (stops);
+      }
+      break;
+
+    case GSK_CONIC_GRADIENT_NODE:
+      {
+        graphene_point_t center;
+        float rotation;
+        GskColorStop *stops;
+        gsize n_stops;
+
+        data_get_point (data, &center);
+        rotation = data_get_float (data);
+        stops = data_get_stops (data, &n_stops);
+        if (data->failed)
+          break;
+
+        result = gsk_conic_gradient_node_new (&bounds, &center, rotation, stops, n_stops);
+
+        g_free (stops);
+      }
+      break;
+
+    case GSK_BORDER_NODE:
+      {
+        GskRoundedRect outline;
+        float widths[4];
+        GdkRGBA colors[4];
+
+        data_get_rounded_rect (data, &outline);
+        for (i = 0; i < 4; i++)
+          widths[i] = data_get_float (data);
+        for (i = 0; i < 4; i++)
+          data_get_rgba (data, &colors[i]);
+
+        result = gsk_border_node_new (&outline, widths, colors);
+      }
+      break;
+
+    case GSK_TEXTURE_NODE:
+      {
+        GdkTexture *texture = reader_get_texture (self, data_get_uint (data));
+
+        if (texture == NULL)
+          data->failed = TRUE;
+        else
+          result = gsk_texture_node_new (texture, &bounds);
+      }
+      break;
+
+    case GSK_INSET_SHADOW_NODE:
+    case GSK_OUTSET_SHADOW_NODE:
+      {
+        GskRoundedRect outline;
+        GdkRGBA color;
+        float dx, dy, spread, blur_radius;
+
+        data_get_rounded_rect (data, &outline);
+        data_get_rgba (data, &color);
+        dx = data_get_float (data);
+        dy = data_get_float (data);
+        spread = data_get_float (data);
+        blur_radius = data_get_float (data);
+
+        if (record->type == GSK_INSET_SHADOW_NODE)
+          result = gsk_inset_shadow_node_new (&outline, &color, dx, dy, spread, blur_radius);
+        else
+          result = gsk_outset_shadow_node_new (&outline, &color, dx, dy, spread, blur_radius);
+      }
+      break;
+
+    case GSK_TRANSFORM_NODE:
+      {
+        GskRenderNode *child = data_get_node (self, data, index);
+        const char *string = reader_get_string (self, data_get_uint (data));
+        GskTransform *transform = NULL;
+
+        if (data->failed || string == NULL || !gsk_transform_parse (string, &transform))
+          {
+            data->failed = TRUE;
+            break;
+          }
+
+        /* identity transforms are written as "none" */
+        if (transform == NULL)
+          transform = gsk_transform_new ();
+
+        result = gsk_transform_node_new (child, transform);
+        gsk_transform_unref (transform);
+      }
+      break;
+
+    case GSK_OPACITY_NODE:
+      {
+        GskRenderNode *child = data_get_node (self, data, index);
+        float opacity = data_get_float (data);
+
+        if (!data->failed)
+          result = gsk_opacity_node_new (child, opacity);
+      }
+      break;
+
+    case GSK_COLOR_MATRIX_NODE:
+      {
+        GskRenderNode *child = data_get_node (self, data, index);
+        graphene_matrix_t matrix;
+        graphene_vec4_t offset;
+        float values[16];
+
+        for (i = 0; i < 16; i++)
+          values[i] = data_get_float (data);
+        graphene_matrix_init_from_float (&matrix, values);
+        for (i = 0; i < 4; i++)
+          values[i] = data_get_float (data);
+        graphene_vec4_init_from_float (&offset, values);
+
+        if (!data->failed)
+          result = gsk_color_matrix_node_new (child, &matrix, &offset);
+      }
+      break;
+
+    case GSK_REPEAT_NODE:
+      {
+        GskRenderNode *child = data_get_node (self, data, index);
+        graphene_rect_t child_bounds;
+
+        data_get_rect (data, &child_bounds);
+
+        if (!data->failed)
+          result = gsk_repeat_node_new (&bounds, child, &child_bounds);
+      }
+      break;
+
+    case GSK_CLIP_NODE:
+      {
+        GskRenderNode *child = data_get_node (self, data, index);
+        graphene_rect_t clip;
+
+        data_get_rect (data, &clip);
+
+        if (!data->failed)
+          result = gsk_clip_node_new (child, &clip);
+      }
+      break;
+
+    case GSK_ROUNDED_CLIP_NODE:
+      {
+        GskRenderNode *child = data_get_node (self, data, index);
+        GskRoundedRect clip;
+
+        data_get_rounded_rect (data, &clip);
+
+        if (!data->failed)
+          result = gsk_rounded_clip_node_new (child, &clip);
+      }
+      break;
+
+    case GSK_SHADOW_NODE:
+      {
+        GskRenderNode *child = data_get_node (self, data, index);
+        guint32 n_shadows = data_get_count (data, 7);
+        GskShadow *shadows;
+
+        if (data->failed || n_shadows == 0)
+          {
+            data->failed = TRUE;
+            break;
+          }
+
+        shadows = g_new (GskShadow, n_shadows);
+        for (i = 0; i < n_shadows; i++)
+          {
+            data_get_rgba (data, &shadows[i].color);
+            shadows[i].dx = data_get_float (data);
+            shadows[i].dy = data_get_float (data);
+            shadows[i].radius = data_get_float (data);
+          }
+
+        result = gsk_shadow_node_new (child, shadows, n_shadows);
+
+        g_free (shadows);
+      }
+      break;
+
+    case GSK_BLEND_NODE:
+      {
+        GskRenderNode *bottom = data_get_node (self, data, index);
+        GskRenderNode *top = data_get_node (self, data, index);
+        guint32 mode = data_get_uint (data);
+
+        if (mode > GSK_BLEND_MODE_LUMINOSITY)
+          data->failed = TRUE;
+
+        if (!data->failed)
+          result = gsk_blend_node_new (bottom, top, mode);
+      }
+      break;
+
+    case GSK_CROSS_FADE_NODE:
+      {
+        GskRenderNode *start = data_get_node (self, data, index);
+        GskRenderNode *end = data_get_node (self, data, index);
+        float progress = data_get_float (data);
+
+        if (!data->failed)
+          result = gsk_cross_fade_node_new (start, end, progress);
+      }
+      break;
+
+    case GSK_TEXT_NODE:
+      {
+        PangoFont *font = reader_get_font (self, data_get_uint (data));
+        PangoGlyphString *glyphs;
+        graphene_point_t offset;
+        GdkRGBA color;
+        guint32 n_glyphs;
+
+        data_get_rgba (data, &color);
+        data_get_point (data, &offset);
+        n_glyphs = data_get_count (data, 5);
+
+        if (data->failed || font == NULL)
+          {
+            data->failed = TRUE;
+            break;
+          }
+
+        glyphs = pango_glyph_string_new ();
+        pango_glyph_string_set_size (glyphs, n_glyphs);
+        for (i = 0; i < n_glyphs; i++)
+          {
+            glyphs->glyphs[i].glyph = data_get_uint (data);
+            glyphs->glyphs[i].geometry.width = (gint32) data_get_uint (data);
+            glyphs->glyphs[i].geometry.x_offset = (gint32) data_get_uint (data);
+            glyphs->glyphs[i].geometry.y_offset = (gint32) data_get_uint (data);
+            glyphs->glyphs[i].attr.is_cluster_start = data_get_uint (data) ? 1 : 0;
+          }
+
+        result = gsk_text_node_new (font, glyphs, &color, &offset);
+        if (result == NULL)
+          data->failed = TRUE;
+
+        pango_glyph_string_free (glyphs);
+      }
+      break;
+
+    case GSK_BLUR_NODE:
+      {
+        GskRenderNode *child = data_get_node (self, data, index);
+        float radius = data_get_float (data);
+
+        if (!data->failed)
+          result = gsk_blur_node_new (child, radius);
+      }
+      break;
+
+    case GSK_DEBUG_NODE:
+      {
+        GskRenderNode *child = data_get_node (self, data, index);
+        const char *message = reader_get_string (self, data_get_uint (data));
+
+        if (data->failed || message == NULL)
+          {
+            data->failed = TRUE;
+            break;
+          }
+
+        result = gsk_debug_node_new (child, g_strdup (message));
+      }
+      break;
+
+    case GSK_GL_SHADER_NODE:
+      {
+        GskGLShader *shader = reader_get_shader (self, data_get_uint (data));
+        guint32 args_size = data_get_uint (data);
+        guint32 args_offset = data_get_uint (data);
+        guint32 n_children = data_get_count (data, 1);
+        GskRenderNode **children;
+        GBytes *args;
+
+        if (data->failed || shader == NULL ||
+            !range_is_valid (args_offset, args_size, self->header->data_size) ||
+            args_size != gsk_gl_shader_get_args_size (shader) ||
+            n_children != gsk_gl_shader_get_n_textures (shader))
+          {
+            data->failed = TRUE;
+            break;
+          }
+
+        children = g_new (GskRenderNode *, MAX (n_children, 1));
+        for (i = 0; i < n_children; i++)
+          children[i] = data_get_node (self, data, index);
+
+        if (!data->failed)
+          {
+            args = g_bytes_new_from_bytes (self->bytes, self->header->data_offset + args_offset, args_size);
+            result = gsk_gl_shader_node_new (shader, &bounds, args, children, n_children);
+            g_bytes_unref (args);
+          }
+
+        g_free (children);
+      }
+      break;
+
+    case GSK_NOT_A_RENDER_NODE:
+    default:
+      data->failed = TRUE;
+      break;
+    }
+
+  if (data->failed)
+    g_clear_pointer (&result, gsk_render_node_unref);
+
+  return result;
+}
+
+gboolean
+gsk_render_node_bytes_are_binary (GBytes *bytes)
+{
+  gsize size;
+  const guchar *data = g_bytes_get_data (bytes, &size);
+
+  return size >= sizeof (gsk_binary_magic) &&
+         memcmp (data, gsk_binary_magic, sizeof (gsk_binary_magic)) == 0;
+}
+
+GskRenderNode *
+gsk_render_node_deserialize_binary (GBytes            *bytes,
+                                    GskParseErrorFunc  error_func,
+                                    gpointer           user_data)
+{
+  GskRenderNode *root = NULL;
+  Reader reader;
+  GBytes *aligned = NULL;
+  guint32 i;
+
+  /* We read the tables in place, so they need to be aligned */
+  if (((gsize) g_bytes_get_data (bytes, NULL)) % 4 != 0)
+    {
+      gsize size;
+      gconstpointer data = g_bytes_get_data (bytes, &size);
+
+      aligned = g_bytes_new (data, size);
+      bytes = aligned;
+    }
+
+  if (!reader_init (&reader, bytes, error_func, user_data))
+    {
+      g_clear_pointer (&aligned, g_bytes_unref);
+      return NULL;
+    }
+
+  for (i = 0; i < reader.header->n_nodes; i++)
+    {
+      const NodeRecord *record = &reader.nodes[i];
+      NodeData data;
+
+      if (record->offset % 4 != 0 ||
+          !range_is_valid (record->offset, (guint64) record->n_words * 4, reader.header->data_size))
+        {
+          reader_error (&reader, reader.header->nodes_offset + i * sizeof (NodeRecord),
+                        "Invalid data range for node %u", i);
+          break;
+        }
+
+      data.words = (const guint32 *) (reader.data + reader.header->data_offset + record->offset);
+      data.n_words = record->n_words;
+      data.pos = 0;
+      data.failed = FALSE;
+
+      reader.built_nodes[i] = reader_create_node (&reader, i, &data);
+      if (reader.built_nodes[i] == NULL)
+        {
+          reader_error (&reader, reader.header->data_offset + record->offset,
+                        "Invalid data for node %u", i);
+          break;
+        }
+    }
+
+  if (i == reader.header->n_nodes)
+    root = gsk_render_node_ref (reader.built_nodes[i - 1]);
+
+  reader_clear (&reader);
+  g_clear_pointer (&aligned, g_bytes_unref);
+
+  return root;
+}
+
+/* }}} */
@@ -30,6 +30,32 @@
 #include "gdk/gdktextureprivate.h"
 #include <cairo-ft.h>
 
+static GskRenderNode *  gsk_render_node_intern  (GskRenderNode *node);
+
+#define GSK_HASH_INIT 2166136261u
+
+static guint
+gsk_hash_bytes (guint         hash,
+                gconstpointer data,
+                gsize         size)
+{
+  const guchar *p = data;
+  gsize i;
+
+  /* FNV-1a */
+  for (i = 0; i < size; i++)
+    hash = (hash ^ p[i]) * 16777619u;
+
+  return hash;
+}
+
+static inline guint
+gsk_hash_finish (guint hash)
+{
+  /* 0 marks nodes that are not interned */
+  return hash ? hash : 1;
+}
+
 static inline void
 gsk_cairo_rectangle (cairo_t               *cr,
                      const graphene_rect_t *rect)
@@ -134,7 +160,11 @@ gsk_color_node_new (const GdkRGBA         *rgba,
   self->color = *rgba;
   graphene_rect_init_from_rect (&node->bounds, bounds);
 
-  return node;
+  node->hash = gsk_hash_bytes (GSK_HASH_INIT, &node->bounds, sizeof (graphene_rect_t));
+  node->hash = gsk_hash_bytes (node->hash, &self->color, sizeof (GdkRGBA));
+  node->hash = gsk_hash_finish (node->hash);
+
+  return gsk_render_node_intern (node);
 }
 
 /*** GSK_LINEAR_GRADIENT_NODE ***/
@@ -161,6 +191,19 @@ struct _GskLinearGradientNode
   GskColorStop *stops;
 };
 
+static guint
+gsk_linear_gradient_node_hash (GskLinearGradientNode *self)
+{
+  guint hash;
+
+  hash = gsk_hash_bytes (GSK_HASH_INIT, &self->render_node.bounds, sizeof (graphene_rect_t));
+  hash = gsk_hash_bytes (hash, &self->start, sizeof (graphene_point_t));
+  hash = gsk_hash_bytes (hash, &self->end, sizeof (graphene_point_t));
+  hash = gsk_hash_bytes (hash, self->stops, self->n_stops * sizeof (GskColorStop));
+
+  return gsk_hash_finish (hash);
+}
+
 static void
 gsk_linear_gradient_node_finalize (GskRenderNode *node)
 {
@@ -283,7 +326,9 @@ gsk_linear_gradient_node_new (const graphene_rect_t  *bounds,
   self->stops = g_malloc_n (n_color_stops, sizeof (GskColorStop));
   memcpy (self->stops, color_stops, n_color_stops * sizeof (GskColorStop));
 
-  return node;
+  node->hash = gsk_linear_gradient_node_hash (self);
+
+  return gsk_render_node_intern (node);
 }
 
 /**
@@ -334,7 +379,9 @@ gsk_repeating_linear_gradient_node_new (const graphene_rect_t  *bounds,
   memcpy (self->stops, color_stops, n_color_stops * sizeof (GskColorStop));
   self->n_stops = n_color_stops;
 
-  return node;
+  node->hash = gsk_linear_gradient_node_hash (self);
+
+  return gsk_render_node_intern (node);
 }
 
 /**
@@ -1365,10 +1412,14 @@ gsk_border_node_new (const GskRoundedRect *outline,
   else
     self->uniform = FALSE;
 
-
   graphene_rect_init_from_rect (&node->bounds, &self->outline.bounds);
 
-  return node;
+  node->hash = gsk_hash_bytes (GSK_HASH_INIT, &self->outline, sizeof (GskRoundedRect));
+  node->hash = gsk_hash_bytes (node->hash, self->border_width, sizeof (self->border_width));
+  node->hash = gsk_hash_bytes (node->hash, self->border_color, sizeof (self->border_color));
+  node->hash = gsk_hash_finish (node->hash);
+
+  return gsk_render_node_intern (node);
 }
 
 /* Private */
@@ -1392,6 +1443,9 @@ struct _GskTextureNode
   GdkTexture *texture;
 };
 
+/* GdkTexture => cairo_surface_t, for the draw running on this thread */
+static GPrivate texture_surfaces;
+
 static void
 gsk_texture_node_finalize (GskRenderNode *node)
 {
@@ -1408,11 +1462,18 @@ gsk_texture_node_draw (GskRenderNode *node,
                        cairo_t       *cr)
 {
   GskTextureNode *self = (GskTextureNode *) node;
-  cairo_surface_t *surface;
+  GHashTable *surfaces;
+  cairo_surface_t *surface = NULL;
   cairo_pattern_t *pattern;
   cairo_matrix_t matrix;
 
-  surface = gdk_texture_download_surface (self->texture);
+  surfaces = g_private_get (&texture_surfaces);
+  if (surfaces)
+    surface = g_hash_table_lookup (surfaces, self->texture);
+  if (surface)
+    cairo_surface_reference (surface);
+  else
+    surface = gdk_texture_download_surface (self->texture);
   pattern = cairo_pattern_create_for_surface (surface);
   cairo_pattern_set_extend (pattern, CAIRO_EXTEND_PAD);
 
@@ -1465,6 +1526,34 @@ gsk_texture_node_get_texture (GskRenderNode *node)
   return self->texture;
 }
 
+/*< private >
+ * gsk_render_node_draw_with_texture_surfaces:
+ * @node: a `GskRenderNode`
+ * @cr: cairo context to draw to
+ * @surfaces: (element-type GdkTexture cairo_surface_t): the downloaded
+ *   contents of textures
+ *
+ * Like gsk_render_node_draw(), but texture nodes use the surfaces
+ * in @surfaces instead of downloading their texture again.
+ *
+ * This is used by renderers that draw the same tree from multiple
+ * threads. @surfaces must not be changed while drawing.
+ */
+void
+gsk_render_node_draw_with_texture_surfaces (GskRenderNode *node,
+                                            cairo_t       *cr,
+                                            GHashTable    *surfaces)
+{
+  gpointer old_surfaces;
+
+  old_surfaces = g_private_get (&texture_surfaces);
+  g_private_set (&texture_surfaces, surfaces);
+
+  gsk_render_node_draw (node, cr);
+
+  g_private_set (&texture_surfaces, old_surfaces);
+}
+
 /**
  * gsk_texture_node_new:
  * @texture: the #GdkTexture
@@ -2521,8 +2610,15 @@ struct _GskContainerNode
 
   guint n_children;
   GskRenderNode **children;
+
+  /* Lazily created bounds hierarchy, see gsk_container_node_ensure_bvh() */
+  graphene_rect_t *bvh;
+  guint bvh_size;
 };
 
+/* Containers with fewer children are just walked linearly */
+#define BVH_MIN_CHILDREN 32
+
 static void
 gsk_container_node_finalize (GskRenderNode *node)
 {
@@ -2533,21 +2629,129 @@ gsk_container_node_finalize (GskRenderNode *node)
     gsk_render_node_unref (container->children[i]);
 
   g_free (container->children);
+  g_free (container->bvh);
 
   parent_class->finalize (node);
 }
 
+/* The bounds hierarchy is a complete binary tree over the children in
+ * drawing order, stored like a heap: entry 1 is the root, the children
+ * of entry i are 2i and 2i+1, and the leaves start at bvh_size. Every
+ * entry holds the union of the bounds of the children below it.
+ *
+ * Since every entry covers a contiguous range of children, a query
+ * returns the children in drawing order. For the common case of
+ * children laid out in order, like the rows of a list, the ranges are
+ * spatially compact and queries only touch a logarithmic number of
+ * entries.
+ *
+ * The hierarchy is created on first use, possibly from multiple threads.
+ */
 static void
-gsk_container_node_draw (GskRenderNode *node,
-                         cairo_t       *cr)
+gsk_container_node_ensure_bvh (GskContainerNode *self)
 {
-  GskContainerNode *container = (GskContainerNode *) node;
+  graphene_rect_t *bvh;
+  guint size, i;
+
+  if (g_once_init_enter (&self->bvh))
+    {
+      for (size = 1; size < self->n_children; size *= 2)
+        ;
+
+      bvh = g_new (graphene_rect_t, 2 * size);
+      for (i = 0; i < size; i++)
+        {
+          if (i < self->n_children)
+            bvh[size + i] = self->children[i]->bounds;
+          else
+            bvh[size + i] = bvh[size + self->n_children - 1];
+        }
+      for (i = size - 1; i > 0; i--)
+        graphene_rect_union (&bvh[2 * i], &bvh[2 * i + 1], &bvh[i]);
+
+      self->bvh_size = size;
+      g_once_init_leave (&self->bvh, bvh);
+    }
+}
+
+static void
+gsk_container_node_foreach_in_bvh (GskContainerNode         *self,
+                                   guint                     idx,
+                                   guint                     start,
+                                   guint                     end,
+                                   const graphene_rect_t    *rect,
+                                   GskRenderNodeForeachFunc  func,
+                                   gpointer                  user_data)
+{
+  guint mid;
+
+  if (start >= self->n_children ||
+      !graphene_rect_intersection (&self->bvh[idx], rect, NULL))
+    return;
+
+  if (end - start == 1)
+    {
+      func (self->children[start], user_data);
+      return;
+    }
+
+  mid = (start + end) / 2;
+  gsk_container_node_foreach_in_bvh (self, 2 * idx, start, mid, rect, func, user_data);
+  gsk_container_node_foreach_in_bvh (self, 2 * idx + 1, mid, end, rect, func, user_data);
+}
+
+/*
+ * gsk_container_node_foreach_in_rect:
+ * @node: (type GskContainerNode): a container #GskRenderNode
+ * @rect: the area to query
+ * @func: function to call for each child
+ * @user_data: user data for @func
+ *
+ * Calls @func for all children of @node whose bounds intersect @rect,
+ * in drawing order.
+ */
+void
+gsk_container_node_foreach_in_rect (GskRenderNode            *node,
+                                    const graphene_rect_t    *rect,
+                                    GskRenderNodeForeachFunc  func,
+                                    gpointer                  user_data)
+{
+  GskContainerNode *self = (GskContainerNode *) node;
   guint i;
 
-  for (i = 0; i < container->n_children; i++)
+  if (self->n_children < BVH_MIN_CHILDREN)
     {
-      gsk_render_node_draw (container->children[i], cr);
+      for (i = 0; i < self->n_children; i++)
+        {
+          if (graphene_rect_intersection (&self->children[i]->bounds, rect, NULL))
+            func (self->children[i], user_data);
+        }
+      return;
     }
+
+  gsk_container_node_ensure_bvh (self);
+  gsk_container_node_foreach_in_bvh (self, 1, 0, self->bvh_size, rect, func, user_data);
+}
+
+static void
+gsk_container_node_draw_child (GskRenderNode *child,
+                               gpointer       cr)
+{
+  gsk_render_node_draw (child, cr);
+}
+
+static void
+gsk_container_node_draw (GskRenderNode *node,
+                         cairo_t       *cr)
+{
+  graphene_rect_t clip;
+  double x1, y1, x2, y2;
+
+  /* skip children that are entirely clipped away */
+  cairo_clip_extents (cr, &x1, &y1, &x2, &y2);
+  graphene_rect_init (&clip, x1, y1, x2 - x1, y2 - y1);
+
+  gsk_container_node_foreach_in_rect (node, &clip, gsk_container_node_draw_child, cr);
 }
 
 static void
@@ -4275,6 +4479,31 @@ struct _GskTextNode
   PangoGlyphInfo *glyphs;
 };
 
+static guint
+gsk_text_node_hash (GskTextNode *self)
+{
+  guint hash;
+  guint i;
+
+  hash = gsk_hash_bytes (GSK_HASH_INIT, &self->font, sizeof (PangoFont *));
+  hash = gsk_hash_bytes (hash, &self->color, sizeof (GdkRGBA));
+  hash = gsk_hash_bytes (hash, &self->offset, sizeof (graphene_point_t));
+
+  /* Not hashing the whole PangoGlyphInfo, the attr bitfield
+   * may contain unset bits */
+  for (i = 0; i < self->num_glyphs; i++)
+    {
+      const PangoGlyphInfo *info = &self->glyphs[i];
+      guint cluster_start = info->attr.is_cluster_start;
+
+      hash = gsk_hash_bytes (hash, &info->glyph, sizeof (PangoGlyph));
+      hash = gsk_hash_bytes (hash, &info->geometry, sizeof (PangoGlyphGeometry));
+      hash = gsk_hash_bytes (hash, &cluster_start, sizeof (guint));
+    }
+
+  return gsk_hash_finish (hash);
+}
+
 static void
 gsk_text_node_finalize (GskRenderNode *node)
 {
@@ -4408,7 +4637,9 @@ gsk_text_node_new (PangoFont              *font,
                       ink_rect.width + 2,
                       ink_rect.height + 2);
 
-  return node;
+  node->hash = gsk_text_node_hash (self);
+
+  return gsk_render_node_intern (node);
 }
 
 /**
@@ -5175,6 +5406,312 @@ gsk_gl_shader_node_get_args (GskRenderNode *node)
   return self->args;
 }
 
+/*** Interning ***/
+
+/* Leaf nodes that get recreated with the same contents every frame,
+ * like CSS backgrounds and borders, are interned: creating a node that
+ * is equal to a live one returns a reference to that one instead.
+ *
+ * So two interned nodes are equal if and only if they are the same
+ * node, which lets gsk_render_node_diff() skip comparing them.
+ *
+ * Interned nodes are the ones with a nonzero hash. The table does not
+ * hold a reference, nodes remove themselves when their last reference
+ * is dropped.
+ */
+
+G_LOCK_DEFINE_STATIC (interned_nodes);
+static GHashTable *interned_nodes;
+
+static guint
+gsk_render_node_intern_hash (gconstpointer data)
+{
+  const GskRenderNode *node = data;
+
+  return node->hash;
+}
+
+static gboolean
+gsk_render_node_intern_equal (gconstpointer data1,
+                              gconstpointer data2)
+{
+  GskRenderNode *node1 = (GskRenderNode *) data1;
+  GskRenderNode *node2 = (GskRenderNode *) data2;
+
+  if (node1->hash != node2->hash)
+    return FALSE;
+
+  if (gsk_render_node_get_node_type (node1) != gsk_render_node_get_node_type (node2))
+    return FALSE;
+
+  /* The contents are compared bitwise, like they are hashed */
+  if (memcmp (&node1->bounds, &node2->bounds, sizeof (graphene_rect_t)) != 0)
+    return FALSE;
+
+  switch (gsk_render_node_get_node_type (node1))
+    {
+    case GSK_COLOR_NODE:
+      {
+        GskColorNode *self1 = (GskColorNode *) node1;
+        GskColorNode *self2 = (GskColorNode *) node2;
+
+        return memcmp (&self1->color, &self2->color, sizeof (GdkRGBA)) == 0;
+      }
+
+    case GSK_LINEAR_GRADIENT_NODE:
+    case GSK_REPEATING_LINEAR_GRADIENT_NODE:
+      {
+        GskLinearGradientNode *self1 = (GskLinearGradientNode *) node1;
+        GskLinearGradientNode *self2 = (GskLinearGradientNode *) node2;
+
+        return memcmp (&self1->start, &self2->start, sizeof (graphene_point_t)) == 0 &&
+               memcmp (&self1->end, &self2->end, sizeof (graphene_point_t)) == 0 &&
+               self1->n_stops == self2->n_stops &&
+               memcmp (self1->stops, self2->stops, self1->n_stops * sizeof (GskColorStop)) == 0;
+      }
+
+    case GSK_BORDER_NODE:
+      {
+        GskBorderNode *self1 = (GskBorderNode *) node1;
+        GskBorderNode *self2 = (GskBorderNode *) node2;
+
+        return memcmp (&self1->outline, &self2->outline, sizeof (GskRoundedRect)) == 0 &&
+               memcmp (self1->border_width, self2->border_width, sizeof (self1->border_width)) == 0 &&
+               memcmp (self1->border_color, self2->border_color, sizeof (self1->border_color)) == 0;
+      }
+
+    case GSK_TEXT_NODE:
+      {
+        GskTextNode *self1 = (GskTextNode *) node1;
+        GskTextNode *self2 = (GskTextNode *) node2;
+        guint i;
+
+        if (self1->font != self2->font ||
+            memcmp (&self1->color, &self2->color, sizeof (GdkRGBA)) != 0 ||
+            memcmp (&self1->offset, &self2->offset, sizeof (graphene_point_t)) != 0 ||
+            self1->num_glyphs != self2->num_glyphs)
+          return FALSE;
+
+        for (i = 0; i < self1->num_glyphs; i++)
+          {
+            const PangoGlyphInfo *info1 = &self1->glyphs[i];
+            const PangoGlyphInfo *info2 = &self2->glyphs[i];
+
+            if (info1->glyph != info2->glyph ||
+                memcmp (&info1->geometry, &info2->geometry, sizeof (PangoGlyphGeometry)) != 0 ||
+                info1->attr.is_cluster_start != info2->attr.is_cluster_start)
+              return FALSE;
+          }
+
+        return TRUE;
+      }
+
+    default:
+      g_assert_not_reached ();
+      return FALSE;
+    }
+}
+
+/* Takes a reference unless the node is already being finalized */
+static gboolean
+gsk_render_node_try_ref (GskRenderNode *node)
+{
+  int count;
+
+  do
+    {
+      count = g_atomic_int_get ((int *) &node->ref_count);
+      if (count <= 0)
+        return FALSE;
+    }
+  while (!g_atomic_int_compare_and_exchange ((int *) &node->ref_count, count, count + 1));
+
+  return TRUE;
+}
+
+/* Consumes @node, which must have its hash set, and returns either
+ * it or a new reference to an equal node that is already alive.
+ */
+static GskRenderNode *
+gsk_render_node_intern (GskRenderNode *node)
+{
+  GskRenderNode *existing;
+
+  g_assert (node->hash != 0);
+
+  G_LOCK (interned_nodes);
+
+  if (G_UNLIKELY (interned_nodes == NULL))
+    interned_nodes = g_hash_table_new (gsk_render_node_intern_hash,
+                                       gsk_render_node_intern_equal);
+
+  existing = g_hash_table_lookup (interned_nodes, node);
+  if (existing && gsk_render_node_try_ref (existing))
+    {
+      G_UNLOCK (interned_nodes);
+
+      /* not in the table, so no need to unintern it */
+      node->hash = 0;
+      gsk_render_node_unref (node);
+
+      return existing;
+    }
+
+  /* If there is an existing node, it is being finalized.
+   * Replace it, it will not remove us from the table. */
+  g_hash_table_add (interned_nodes, node);
+
+  G_UNLOCK (interned_nodes);
+
+  return node;
+}
+
+void
+gsk_render_node_unintern (GskRenderNode *node)
+{
+  gpointer stored;
+
+  G_LOCK (interned_nodes);
+
+  if (g_hash_table_lookup_extended (interned_nodes, node, &stored, NULL) &&
+      stored == node)
+    g_hash_table_remove (interned_nodes, node);
+
+  G_UNLOCK (interned_nodes);
+}
+
+/* Must be called with the interned_nodes lock held, see
+ * gsk_render_node_lock_interned()
+ */
+void
+gsk_render_node_replace_interned (GskRenderNode *node,
+                                  GskRenderNode *copy)
+{
+  gpointer stored;
+
+  /* Adding an equal key replaces the stored one */
+  if (g_hash_table_lookup_extended (interned_nodes, node, &stored, NULL) &&
+      stored == node)
+    g_hash_table_add (interned_nodes, copy);
+}
+
+void
+gsk_render_node_lock_interned (void)
+{
+  G_LOCK (interned_nodes);
+}
+
+void
+gsk_render_node_unlock_interned (void)
+{
+  G_UNLOCK (interned_nodes);
+}
+
+/*< private >
+ * gsk_render_node_foreach_child_slot:
+ * @node: a #GskRenderNode
+ * @func: function to call for each child
+ * @user_data: user data for @func
+ *
+ * Calls @func with the location of every child pointer of @node.
+ *
+ * @func may replace the child with a node that has the same contents,
+ * this is used to move nodes in memory.
+ */
+void
+gsk_render_node_foreach_child_slot (GskRenderNode                *node,
+                                    GskRenderNodeForeachSlotFunc  func,
+                                    gpointer                      user_data)
+{
+  guint i;
+
+  switch (gsk_render_node_get_node_type (node))
+    {
+    case GSK_CONTAINER_NODE:
+      {
+        GskContainerNode *self = (GskContainerNode *) node;
+
+        for (i = 0; i < self->n_children; i++)
+          func (&self->children[i], user_data);
+      }
+      break;
+
+    case GSK_GL_SHADER_NODE:
+      {
+        GskGLShaderNode *self = (GskGLShaderNode *) node;
+
+        for (i = 0; i < self->n_children; i++)
+          func (&self->children[i], user_data);
+      }
+      break;
+
+    case GSK_TRANSFORM_NODE:
+      func (&((GskTransformNode *) node)->child, user_data);
+      break;
+
+    case GSK_OPACITY_NODE:
+      func (&((GskOpacityNode *) node)->child, user_data);
+      break;
+
+    case GSK_COLOR_MATRIX_NODE:
+      func (&((GskColorMatrixNode *) node)->child, user_data);
+      break;
+
+    case GSK_REPEAT_NODE:
+      func (&((GskRepeatNode *) node)->child, user_data);
+      break;
+
+    case GSK_CLIP_NODE:
+      func (&((GskClipNode *) node)->child, user_data);
+      break;
+
+    case GSK_ROUNDED_CLIP_NODE:
+      func (&((GskRoundedClipNode *) node)->child, user_data);
+      break;
+
+    case GSK_SHADOW_NODE:
+      func (&((GskShadowNode *) node)->child, user_data);
+      break;
+
+    case GSK_BLUR_NODE:
+      func (&((GskBlurNode *) node)->child, user_data);
+      break;
+
+    case GSK_DEBUG_NODE:
+      func (&((GskDebugNode *) node)->child, user_data);
+      break;
+
+    case GSK_BLEND_NODE:
+      func (&((GskBlendNode *) node)->bottom, user_data);
+      func (&((GskBlendNode *) node)->top, user_data);
+      break;
+
+    case GSK_CROSS_FADE_NODE:
+      func (&((GskCrossFadeNode *) node)->start, user_data);
+      func (&((GskCrossFadeNode *) node)->end, user_data);
+      break;
+
+    case GSK_COLOR_NODE:
+    case GSK_LINEAR_GRADIENT_NODE:
+    case GSK_REPEATING_LINEAR_GRADIENT_NODE:
+    case GSK_RADIAL_GRADIENT_NODE:
+    case GSK_REPEATING_RADIAL_GRADIENT_NODE:
+    case GSK_CONIC_GRADIENT_NODE:
+    case GSK_BORDER_NODE:
+    case GSK_TEXTURE_NODE:
+    case GSK_INSET_SHADOW_NODE:
+    case GSK_OUTSET_SHADOW_NODE:
+    case GSK_CAIRO_NODE:
+    case GSK_TEXT_NODE:
+      break;
+
+    case GSK_NOT_A_RENDER_NODE:
+    default:
+      g_assert_not_reached ();
+      break;
+    }
+}
+
 GType gsk_render_node_types[GSK_RENDER_NODE_TYPE_N_TYPES];
 
 #ifndef I_
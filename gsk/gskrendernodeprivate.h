@@ -26,6 +26,16 @@ struct _GskRenderNode
 
   gatomicrefcount ref_count;
 
+  /* content hash of interned nodes, 0 otherwise */
+  guint hash;
+
+  /* identifies the node in caches keyed by its address, which
+   * may be reused by a new node once this one is freed */
+  guint serial;
+
+  /* arena block the node was allocated from, or NULL */
+  gpointer arena_block;
+
   graphene_rect_t bounds;
 };
 
@@ -85,6 +95,12 @@ GType           gsk_render_node_type_register_static    (const char
 
 gpointer        gsk_render_node_alloc                   (GskRenderNodeType            node_type);
 
+void            gsk_render_node_arena_push              (void);
+void            gsk_render_node_arena_pop               (void);
+GskRenderNode * gsk_render_node_promote                 (GskRenderNode               *node);
+void            gsk_render_node_steal_alloc_stats       (gint64                      *n_nodes,
+                                                         gint64                      *n_bytes);
+
 gboolean        gsk_render_node_can_diff                (const GskRenderNode         *node1,
                                                          const GskRenderNode         *node2) G_GNUC_PURE;
 void            gsk_render_node_diff                    (GskRenderNode               *node1,
@@ -94,8 +110,32 @@ void            gsk_render_node_diff_impossible         (GskRenderNode
                                                          GskRenderNode               *node2,
                                                          cairo_region_t              *region);
 
+void            gsk_render_node_unintern                (GskRenderNode               *node);
+void            gsk_render_node_lock_interned           (void);
+void            gsk_render_node_unlock_interned         (void);
+void            gsk_render_node_replace_interned        (GskRenderNode               *node,
+                                                         GskRenderNode               *copy);
+
 bool            gsk_border_node_get_uniform             (GskRenderNode               *self);
 
+void            gsk_render_node_draw_with_texture_surfaces (GskRenderNode            *node,
+                                                            cairo_t                  *cr,
+                                                            GHashTable               *surfaces);
+
+typedef void (* GskRenderNodeForeachFunc) (GskRenderNode *child,
+                                           gpointer       user_data);
+typedef void (* GskRenderNodeForeachSlotFunc) (GskRenderNode **child,
+                                               gpointer        user_data);
+
+void            gsk_render_node_foreach_child_slot      (GskRenderNode               *node,
+                                                         GskRenderNodeForeachSlotFunc func,
+                                                         gpointer                     user_data);
+
+void            gsk_container_node_foreach_in_rect      (GskRenderNode               *node,
+                                                         const graphene_rect_t       *rect,
+                                                         GskRenderNodeForeachFunc     func,
+                                                         gpointer                     user_data);
+
 G_END_DECLS
 
 #endif /* __GSK_RENDER_NODE_PRIVATE_H__ */
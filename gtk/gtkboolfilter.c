@@ -73,6 +73,40 @@ gtk_bool_filter_match (GtkFilter *filter,
   return result;
 }
 
+static GtkBitset *
+gtk_bool_filter_match_items (GtkFilter  *filter,
+                             GListModel *model,
+                             GtkBitset  *positions)
+{
+  GtkBoolFilter *self = GTK_BOOL_FILTER (filter);
+  GtkBitset *result;
+  GtkBitsetIter iter;
+  guint pos;
+
+  result = gtk_bitset_new_empty ();
+  if (self->expression == NULL)
+    return result;
+
+  for (gtk_bitset_iter_init_first (&iter, positions, &pos);
+       gtk_bitset_iter_is_valid (&iter);
+       gtk_bitset_iter_next (&iter, &pos))
+    {
+      GValue value = G_VALUE_INIT;
+      gpointer item;
+
+      item = g_list_model_get_item (model, pos);
+      if (gtk_expression_evaluate (self->expression, item, &value))
+        {
+          if (g_value_get_boolean (&value) ? !self->invert : self->invert)
+            gtk_bitset_add (result, pos);
+          g_value_unset (&value);
+        }
+      g_object_unref (item);
+    }
+
+  return result;
+}
+
 static GtkFilterMatch
 gtk_bool_filter_get_strictness (GtkFilter *filter)
 {
@@ -149,6 +183,7 @@ gtk_bool_filter_class_init (GtkBoolFilterClass *class)
   GObjectClass *object_class = G_OBJECT_CLASS (class);
 
   filter_class->match = gtk_bool_filter_match;
+  filter_class->match_items = gtk_bool_filter_match_items;
   filter_class->get_strictness = gtk_bool_filter_get_strictness;
 
   object_class->get_property = gtk_bool_filter_get_property;
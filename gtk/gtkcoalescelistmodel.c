@@ -0,0 +1,593 @@
+/*
+ * Copyright © 2020 Benjamin Otte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Benjamin Otte <otte@gnome.org>
+ */
+
+#include "config.h"
+
+#include "gtkcoalescelistmodel.h"
+
+#include "gtkintl.h"
+#include "gtkprivate.h"
+
+/**
+ * SECTION:gtkcoalescelistmodel
+ * @title: GtkCoalesceListModel
+ * @short_description: A list model that merges changes of another model
+ * @see_also: #GListModel
+ *
+ * #GtkCoalesceListModel is a list model that presents the items of another
+ * model, but does not forward every change of that model right away.
+ *
+ * Instead, it collects the changes and emits the smallest set of merged
+ * #GListModel::items-changed signals at most once per frame, right before
+ * GTK redraws. Until then, it keeps presenting the items as they were.
+ *
+ * This is useful when a model is changed very often, like one item at a
+ * time from a data feed, and is used as the source of a chain of models
+ * like #GtkFilterListModel, #GtkSortListModel and a selection model. Put
+ * the #GtkCoalesceListModel directly after the changing model, so that
+ * the rest of the chain only has to process one change per frame.
+ */
+
+/* usual frame length, don't flush more often than that */
+#define FLUSH_INTERVAL (16 * G_TIME_SPAN_MILLISECOND)
+
+/* run right before the frame clock paints */
+#define FLUSH_PRIORITY (GDK_PRIORITY_REDRAW - 1)
+
+#define NEW_ITEMS G_MAXUINT
+
+enum {
+  PROP_0,
+  PROP_MODEL,
+  PROP_PENDING,
+  NUM_PROPERTIES
+};
+
+/* A run of items in the model as it currently is.
+ * Either a range of items we are presenting, or items that were added
+ * and not announced yet. Items we present that aren't part of any run
+ * have been removed. */
+typedef struct _Run Run;
+
+struct _Run
+{
+  guint start; /* position in items or NEW_ITEMS */
+  guint n_items;
+};
+
+#define GDK_ARRAY_ELEMENT_TYPE Run
+#define GDK_ARRAY_NAME runs
+#define GDK_ARRAY_TYPE_NAME Runs
+#define GDK_ARRAY_BY_VALUE 1
+#define GDK_ARRAY_NO_MEMSET 1
+#include "gdk/gdkarrayimpl.c"
+
+#define GDK_ARRAY_ELEMENT_TYPE GObject *
+#define GDK_ARRAY_NAME objects
+#define GDK_ARRAY_TYPE_NAME Objects
+#define GDK_ARRAY_FREE_FUNC g_object_unref
+#include "gdk/gdkarrayimpl.c"
+
+struct _GtkCoalesceListModel
+{
+  GObject parent_instance;
+
+  GListModel *model;
+
+  Objects items; /* the items we present */
+  Runs runs; /* how to get from items to the items of model */
+  guint flush_cb;
+  gint64 last_flush;
+  gboolean flushing;
+};
+
+struct _GtkCoalesceListModelClass
+{
+  GObjectClass parent_class;
+};
+
+static GParamSpec *properties[NUM_PROPERTIES] = { NULL, };
+
+static GType
+gtk_coalesce_list_model_get_item_type (GListModel *list)
+{
+  return G_TYPE_OBJECT;
+}
+
+static guint
+gtk_coalesce_list_model_get_n_items (GListModel *list)
+{
+  GtkCoalesceListModel *self = GTK_COALESCE_LIST_MODEL (list);
+
+  return objects_get_size (&self->items);
+}
+
+static gpointer
+gtk_coalesce_list_model_get_item (GListModel *list,
+                                  guint       position)
+{
+  GtkCoalesceListModel *self = GTK_COALESCE_LIST_MODEL (list);
+
+  if (position >= objects_get_size (&self->items))
+    return NULL;
+
+  return g_object_ref (objects_get (&self->items, position));
+}
+
+static void
+gtk_coalesce_list_model_model_init (GListModelInterface *iface)
+{
+  iface->get_item_type = gtk_coalesce_list_model_get_item_type;
+  iface->get_n_items = gtk_coalesce_list_model_get_n_items;
+  iface->get_item = gtk_coalesce_list_model_get_item;
+}
+
+G_DEFINE_TYPE_WITH_CODE (GtkCoalesceListModel, gtk_coalesce_list_model, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_LIST_MODEL, gtk_coalesce_list_model_model_init))
+
+static void
+gtk_coalesce_list_model_reset_runs (GtkCoalesceListModel *self)
+{
+  runs_set_size (&self->runs, 0);
+
+  if (!objects_is_empty (&self->items))
+    runs_append (&self->runs, &(Run) { 0, objects_get_size (&self->items) });
+}
+
+/* Makes sure a run starts at position and returns its index */
+static guint
+gtk_coalesce_list_model_split_run (GtkCoalesceListModel *self,
+                                   guint                 position)
+{
+  guint i;
+
+  for (i = 0; i < runs_get_size (&self->runs); i++)
+    {
+      Run *run = runs_get (&self->runs, i);
+      Run split;
+
+      if (position == 0)
+        return i;
+
+      if (position < run->n_items)
+        {
+          split.start = run->start == NEW_ITEMS ? NEW_ITEMS : run->start + position;
+          split.n_items = run->n_items - position;
+          run->n_items = position;
+          runs_splice (&self->runs, i + 1, 0, &split, 1);
+          return i + 1;
+        }
+
+      position -= run->n_items;
+    }
+
+  g_assert (position == 0);
+
+  return i;
+}
+
+/* Merges the runs at index - 1 and index if possible */
+static void
+gtk_coalesce_list_model_merge_runs (GtkCoalesceListModel *self,
+                                    guint                 index)
+{
+  Run *prev, *run;
+
+  if (index == 0 || index >= runs_get_size (&self->runs))
+    return;
+
+  prev = runs_get (&self->runs, index - 1);
+  run = runs_get (&self->runs, index);
+
+  if (prev->start == NEW_ITEMS && run->start == NEW_ITEMS)
+    { }
+  else if (prev->start != NEW_ITEMS && run->start != NEW_ITEMS &&
+           prev->start + prev->n_items == run->start)
+    { }
+  else
+    return;
+
+  prev->n_items += run->n_items;
+  runs_splice (&self->runs, index, 1, NULL, 0);
+}
+
+static void
+gtk_coalesce_list_model_apply (GtkCoalesceListModel *self,
+                               guint                 position,
+                               guint                 removed,
+                               GObject             **added_items,
+                               guint                 added)
+{
+  objects_splice (&self->items, position, removed, added_items, added);
+
+  g_list_model_items_changed (G_LIST_MODEL (self), position, removed, added);
+}
+
+static gboolean
+gtk_coalesce_list_model_flush_cb (gpointer data)
+{
+  GtkCoalesceListModel *self = data;
+  GPtrArray *added_items;
+  Runs runs;
+  guint i, old, position, added, n_added;
+
+  /* try again once the current flush is done */
+  if (self->flushing)
+    return G_SOURCE_CONTINUE;
+
+  self->flush_cb = 0;
+  self->last_flush = g_get_monotonic_time ();
+  self->flushing = TRUE;
+
+  /* Take the runs and get all new items before emitting anything, so
+   * changes to the model from inside signal handlers are recorded
+   * relative to the state we are about to present. */
+  runs = self->runs;
+  runs_init (&self->runs);
+  added_items = g_ptr_array_new ();
+  position = 0;
+  for (i = 0; i < runs_get_size (&runs); i++)
+    {
+      Run *run = runs_get (&runs, i);
+
+      if (run->start == NEW_ITEMS)
+        {
+          guint j;
+
+          for (j = 0; j < run->n_items; j++)
+            g_ptr_array_add (added_items, g_list_model_get_item (self->model, position + j));
+        }
+      position += run->n_items;
+    }
+  if (position > 0)
+    runs_append (&self->runs, &(Run) { 0, position });
+
+  old = 0;
+  position = 0;
+  added = 0;
+  n_added = 0;
+  for (i = 0; i < runs_get_size (&runs); i++)
+    {
+      Run *run = runs_get (&runs, i);
+
+      if (run->start == NEW_ITEMS)
+        {
+          added += run->n_items;
+          continue;
+        }
+
+      if (run->start > old || added > 0)
+        {
+          gtk_coalesce_list_model_apply (self,
+                                         position,
+                                         run->start - old,
+                                         (GObject **) added_items->pdata + n_added,
+                                         added);
+          position += added;
+          n_added += added;
+          added = 0;
+        }
+
+      old = run->start + run->n_items;
+      position += run->n_items;
+    }
+
+  if (objects_get_size (&self->items) > position || added > 0)
+    {
+      gtk_coalesce_list_model_apply (self,
+                                     position,
+                                     objects_get_size (&self->items) - position,
+                                     (GObject **) added_items->pdata + n_added,
+                                     added);
+    }
+
+  runs_clear (&runs);
+  /* the references were transferred to self->items */
+  g_ptr_array_unref (added_items);
+
+  self->flushing = FALSE;
+
+  g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_PENDING]);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+gtk_coalesce_list_model_queue_flush (GtkCoalesceListModel *self)
+{
+  gint64 delay;
+
+  if (self->flush_cb != 0)
+    return;
+
+  delay = self->last_flush + FLUSH_INTERVAL - g_get_monotonic_time ();
+  if (delay > 0)
+    self->flush_cb = g_timeout_add_full (FLUSH_PRIORITY,
+                                         MAX (delay / G_TIME_SPAN_MILLISECOND, 1),
+                                         gtk_coalesce_list_model_flush_cb,
+                                         self, NULL);
+  else
+    self->flush_cb = g_idle_add_full (FLUSH_PRIORITY,
+                                      gtk_coalesce_list_model_flush_cb,
+                                      self, NULL);
+  g_source_set_name_by_id (self->flush_cb, "[gtk] gtk_coalesce_list_model_flush_cb");
+
+  g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_PENDING]);
+}
+
+static void
+gtk_coalesce_list_model_items_changed_cb (GListModel           *model,
+                                          guint                 position,
+                                          guint                 removed,
+                                          guint                 added,
+                                          GtkCoalesceListModel *self)
+{
+  guint start, end;
+
+  start = gtk_coalesce_list_model_split_run (self, position);
+  end = gtk_coalesce_list_model_split_run (self, position + removed);
+  runs_splice (&self->runs, start, end - start, NULL, 0);
+
+  if (added > 0)
+    {
+      runs_splice (&self->runs, start, 0, &(Run) { NEW_ITEMS, added }, 1);
+      gtk_coalesce_list_model_merge_runs (self, start + 1);
+    }
+  gtk_coalesce_list_model_merge_runs (self, start);
+
+  gtk_coalesce_list_model_queue_flush (self);
+}
+
+static void
+gtk_coalesce_list_model_set_property (GObject      *object,
+                                      guint         prop_id,
+                                      const GValue *value,
+                                      GParamSpec   *pspec)
+{
+  GtkCoalesceListModel *self = GTK_COALESCE_LIST_MODEL (object);
+
+  switch (prop_id)
+    {
+    case PROP_MODEL:
+      gtk_coalesce_list_model_set_model (self, g_value_get_object (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+gtk_coalesce_list_model_get_property (GObject     *object,
+                                      guint        prop_id,
+                                      GValue      *value,
+                                      GParamSpec  *pspec)
+{
+  GtkCoalesceListModel *self = GTK_COALESCE_LIST_MODEL (object);
+
+  switch (prop_id)
+    {
+    case PROP_MODEL:
+      g_value_set_object (value, self->model);
+      break;
+
+    case PROP_PENDING:
+      g_value_set_boolean (value, gtk_coalesce_list_model_get_pending (self));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+gtk_coalesce_list_model_clear_model (GtkCoalesceListModel *self)
+{
+  g_clear_handle_id (&self->flush_cb, g_source_remove);
+
+  if (self->model == NULL)
+    return;
+
+  g_signal_handlers_disconnect_by_func (self->model, gtk_coalesce_list_model_items_changed_cb, self);
+  g_clear_object (&self->model);
+}
+
+static void
+gtk_coalesce_list_model_dispose (GObject *object)
+{
+  GtkCoalesceListModel *self = GTK_COALESCE_LIST_MODEL (object);
+
+  gtk_coalesce_list_model_clear_model (self);
+  objects_clear (&self->items);
+  runs_clear (&self->runs);
+
+  G_OBJECT_CLASS (gtk_coalesce_list_model_parent_class)->dispose (object);
+}
+
+static void
+gtk_coalesce_list_model_class_init (GtkCoalesceListModelClass *class)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (class);
+
+  gobject_class->set_property = gtk_coalesce_list_model_set_property;
+  gobject_class->get_property = gtk_coalesce_list_model_get_property;
+  gobject_class->dispose = gtk_coalesce_list_model_dispose;
+
+  /**
+   * GtkCoalesceListModel:model:
+   *
+   * The model whose changes are coalesced
+   */
+  properties[PROP_MODEL] =
+      g_param_spec_object ("model",
+                           P_("Model"),
+                           P_("The model whose changes are coalesced"),
+                           G_TYPE_LIST_MODEL,
+                           GTK_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY);
+
+  /**
+   * GtkCoalesceListModel:pending:
+   *
+   * If there are changes that have not been emitted yet
+   */
+  properties[PROP_PENDING] =
+      g_param_spec_boolean ("pending",
+                            P_("Pending"),
+                            P_("If there are changes that have not been emitted yet"),
+                            FALSE,
+                            GTK_PARAM_READABLE | G_PARAM_EXPLICIT_NOTIFY);
+
+  g_object_class_install_properties (gobject_class, NUM_PROPERTIES, properties);
+}
+
+static void
+gtk_coalesce_list_model_init (GtkCoalesceListModel *self)
+{
+  objects_init (&self->items);
+  runs_init (&self->runs);
+}
+
+/**
+ * gtk_coalesce_list_model_new:
+ * @model: (transfer full) (allow-none): The model to use, or %NULL
+ *
+ * Creates a new model that coalesces the changes of @model.
+ *
+ * Returns: A new #GtkCoalesceListModel
+ **/
+GtkCoalesceListModel *
+gtk_coalesce_list_model_new (GListModel *model)
+{
+  GtkCoalesceListModel *self;
+
+  g_return_val_if_fail (model == NULL || G_IS_LIST_MODEL (model), NULL);
+
+  self = g_object_new (GTK_TYPE_COALESCE_LIST_MODEL,
+                       "model", model,
+                       NULL);
+
+  /* consume the reference */
+  g_clear_object (&model);
+
+  return self;
+}
+
+/**
+ * gtk_coalesce_list_model_set_model:
+ * @self: a #GtkCoalesceListModel
+ * @model: (allow-none): The model to use
+ *
+ * Sets the model whose changes should be coalesced.
+ *
+ * Changes that were not emitted yet are dropped and the items
+ * of @model are presented right away.
+ **/
+void
+gtk_coalesce_list_model_set_model (GtkCoalesceListModel *self,
+                                   GListModel           *model)
+{
+  guint removed, added, i;
+  gboolean was_pending;
+
+  g_return_if_fail (GTK_IS_COALESCE_LIST_MODEL (self));
+  g_return_if_fail (model == NULL || G_IS_LIST_MODEL (model));
+
+  if (self->model == model)
+    return;
+
+  was_pending = self->flush_cb != 0;
+  removed = objects_get_size (&self->items);
+  gtk_coalesce_list_model_clear_model (self);
+  objects_set_size (&self->items, 0);
+
+  if (model)
+    {
+      self->model = g_object_ref (model);
+      g_signal_connect (model, "items-changed", G_CALLBACK (gtk_coalesce_list_model_items_changed_cb), self);
+      added = g_list_model_get_n_items (model);
+      for (i = 0; i < added; i++)
+        objects_append (&self->items, g_list_model_get_item (model, i));
+    }
+  else
+    {
+      added = 0;
+    }
+  gtk_coalesce_list_model_reset_runs (self);
+
+  if (removed > 0 || added > 0)
+    g_list_model_items_changed (G_LIST_MODEL (self), 0, removed, added);
+
+  g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_MODEL]);
+  if (was_pending)
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_PENDING]);
+}
+
+/**
+ * gtk_coalesce_list_model_get_model:
+ * @self: a #GtkCoalesceListModel
+ *
+ * Gets the model that is currently being used or %NULL if none.
+ *
+ * Returns: (nullable) (transfer none): The model in use
+ **/
+GListModel *
+gtk_coalesce_list_model_get_model (GtkCoalesceListModel *self)
+{
+  g_return_val_if_fail (GTK_IS_COALESCE_LIST_MODEL (self), NULL);
+
+  return self->model;
+}
+
+/**
+ * gtk_coalesce_list_model_flush:
+ * @self: a #GtkCoalesceListModel
+ *
+ * Emits all pending changes right away, so that @self presents the
+ * same items as its model.
+ **/
+void
+gtk_coalesce_list_model_flush (GtkCoalesceListModel *self)
+{
+  g_return_if_fail (GTK_IS_COALESCE_LIST_MODEL (self));
+
+  if (self->flush_cb == 0 || self->flushing)
+    return;
+
+  g_clear_handle_id (&self->flush_cb, g_source_remove);
+  gtk_coalesce_list_model_flush_cb (self);
+}
+
+/**
+ * gtk_coalesce_list_model_get_pending:
+ * @self: a #GtkCoalesceListModel
+ *
+ * Returns whether @self has changes of its model that have not been
+ * emitted yet.
+ *
+ * Returns: %TRUE if changes are pending
+ **/
+gboolean
+gtk_coalesce_list_model_get_pending (GtkCoalesceListModel *self)
+{
+  g_return_val_if_fail (GTK_IS_COALESCE_LIST_MODEL (self), FALSE);
+
+  return self->flush_cb != 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GTK_CSS_BINARY_PRIVATE_H__
+#define __GTK_CSS_BINARY_PRIVATE_H__
+
+#include <glib.h>
+#include <string.h>
+
+G_BEGIN_DECLS
+
+/* Helpers for the precompiled stylesheet format.
+ *
+ * Data is a sequence of 32bit words in host byte order. Strings are
+ * stored as their length followed by the string including its
+ * terminating NUL, padded to a multiple of 4 bytes.
+ *
+ * The reader does not require any alignment and never reads past the
+ * end of the data. Once it encountered an error, all further reads fail.
+ */
+typedef struct _GtkCssBinaryReader GtkCssBinaryReader;
+
+struct _GtkCssBinaryReader
+{
+  const guint8 *data;
+  gsize size;
+  gsize pos;
+  gboolean error;
+};
+
+static inline void
+gtk_css_binary_write_uint (GByteArray *data,
+                           guint32     value)
+{
+  g_byte_array_append (data, (const guint8 *) &value, sizeof (guint32));
+}
+
+static inline void
+gtk_css_binary_write_string (GByteArray *data,
+                             const char *string)
+{
+  static const guint8 zeros[4] = { 0, };
+  gsize len = strlen (string);
+
+  gtk_css_binary_write_uint (data, len);
+  g_byte_array_append (data, (const guint8 *) string, len);
+  g_byte_array_append (data, zeros, 4 - len % 4);
+}
+
+static inline void
+gtk_css_binary_reader_init (GtkCssBinaryReader *self,
+                            const guint8       *data,
+                            gsize               size)
+{
+  self->data = data;
+  self->size = size;
+  self->pos = 0;
+  self->error = FALSE;
+}
+
+static inline guint32
+gtk_css_binary_reader_read_uint (GtkCssBinaryReader *self)
+{
+  guint32 result;
+
+  if (self->error || self->size - self->pos < sizeof (guint32))
+    {
+      self->error = TRUE;
+      return 0;
+    }
+
+  memcpy (&result, self->data + self->pos, sizeof (guint32));
+  self->pos += sizeof (guint32);
+
+  return result;
+}
+
+static inline const char *
+gtk_css_binary_reader_read_string (GtkCssBinaryReader *self)
+{
+  const char *result;
+  gsize len, padded;
+
+  len = gtk_css_binary_reader_read_uint (self);
+  if (self->error)
+    return NULL;
+
+  padded = len + 4 - len % 4;
+  if (self->size - self->pos < padded ||
+      self->data[self->pos + len] != '\0')
+    {
+      self->error = TRUE;
+      return NULL;
+    }
+
+  result = (const char *) self->data + self->pos;
+  self->pos += padded;
+
+  return result;
+}
+
+G_END_DECLS
+
+#endif /* __GTK_CSS_BINARY_PRIVATE_H__ */
@@ -21,10 +21,13 @@
 
 #include "gtkcssstaticstyleprivate.h"
 #include "gtkcssanimatedstyleprivate.h"
+#include "gtkcsslookupprivate.h"
 #include "gtkcssstylepropertyprivate.h"
+#include "gtkdebug.h"
 #include "gtkintl.h"
 #include "gtkmarshalers.h"
 #include "gtksettingsprivate.h"
+#include "gtkstyleproviderprivate.h"
 #include "gtktypebuiltins.h"
 #include "gtkprivate.h"
 #include "gdkprofilerprivate.h"
@@ -126,8 +129,60 @@ gtk_css_node_get_style_provider_or_null (GtkCssNode *cssnode)
 
 static int invalidated_nodes;
 static int created_styles;
+static int shared_styles;
+static int prefetched_nodes;
+static gint64 prefetch_time;
 static guint invalidated_nodes_counter;
 static guint created_styles_counter;
+static guint shared_styles_counter;
+
+/* Selector matching for the children of a node can be done on worker
+ * threads, because it only reads node declarations and style sheets.
+ * Computing values is not thread-safe (value refcounts are not atomic),
+ * so the matched lookups are kept in prefetched_matches until
+ * gtk_css_node_create_style() resolves them on the main thread.
+ *
+ * Anything that can change the outcome of matching - declarations,
+ * tree structure, visibility or style providers - bumps match_generation,
+ * which turns all prefetched lookups stale.
+ */
+#define GTK_CSS_NODE_MATCH_THRESHOLD 32
+#define GTK_CSS_NODE_MATCH_CHUNK_SIZE 8
+
+typedef struct _GtkCssNodeMatch GtkCssNodeMatch;
+typedef struct _GtkCssMatchJobs GtkCssMatchJobs;
+typedef struct _GtkCssMatchJob GtkCssMatchJob;
+
+struct _GtkCssNodeMatch
+{
+  GtkCssNode *node;
+  GtkStyleProvider *provider;
+  guint generation;
+  guint has_change : 1;
+  GtkCssChange change;
+  GtkCssLookup lookup;
+};
+
+struct _GtkCssMatchJob
+{
+  GtkCssMatchJobs *jobs;
+  guint index;
+};
+
+struct _GtkCssMatchJobs
+{
+  GMutex mutex;
+  GCond cond;
+  guint n_pending;
+
+  const GtkCountingBloomFilter *filter;
+  GtkCssNodeMatch **matches;
+  guint n_matches;
+  guint n_chunks;
+};
+
+static guint match_generation;
+static GHashTable *prefetched_matches; /* GtkCssNode => GtkCssNodeMatch */
 
 static void
 gtk_css_node_set_invalid (GtkCssNode *node,
@@ -250,6 +305,9 @@ gtk_css_node_finalize (GObject *object)
 {
   GtkCssNode *cssnode = GTK_CSS_NODE (object);
 
+  if (prefetched_matches)
+    g_hash_table_remove (prefetched_matches, cssnode);
+
   if (cssnode->style)
     g_object_unref (cssnode->style);
   gtk_css_node_declaration_unref (cssnode->decl);
@@ -355,6 +413,78 @@ store_in_global_parent_cache (GtkCssNode                  *node,
                                                  style);
 }
 
+static gboolean
+may_use_shared_cache (GtkCssNode *node)
+{
+  if (!may_use_global_parent_cache (node))
+    return FALSE;
+
+  /* Animated styles are recreated every frame, they'd only
+   * pollute the cache */
+  return gtk_css_style_is_static (node->parent->style);
+}
+
+static GtkCssStyle *
+lookup_in_shared_cache (GtkCssNode                  *node,
+                        GtkStyleProvider            *provider,
+                        const GtkCssNodeDeclaration *decl)
+{
+  if (!may_use_shared_cache (node))
+    return NULL;
+
+  return gtk_css_node_style_cache_lookup_shared (provider,
+                                                 node->parent->style,
+                                                 decl,
+                                                 gtk_css_node_is_first_child (node),
+                                                 gtk_css_node_is_last_child (node));
+}
+
+static void
+store_in_shared_cache (GtkCssNode                  *node,
+                       GtkStyleProvider            *provider,
+                       const GtkCssNodeDeclaration *decl,
+                       GtkCssStyle                 *style)
+{
+  if (!may_use_shared_cache (node))
+    return;
+
+  gtk_css_node_style_cache_insert_shared (provider,
+                                          node->parent->style,
+                                          (GtkCssNodeDeclaration *) decl,
+                                          gtk_css_node_is_first_child (node),
+                                          gtk_css_node_is_last_child (node),
+                                          style);
+}
+
+static void
+gtk_css_node_match_free (gpointer data)
+{
+  GtkCssNodeMatch *match = data;
+
+  _gtk_css_lookup_destroy (&match->lookup);
+  g_free (match);
+}
+
+/* Returns the lookup prefetched by gtk_css_node_prefetch_matches()
+ * if it is still valid */
+static GtkCssNodeMatch *
+gtk_css_node_steal_match (GtkCssNode *cssnode)
+{
+  GtkCssNodeMatch *match;
+
+  if (prefetched_matches == NULL ||
+      !g_hash_table_steal_extended (prefetched_matches, cssnode, NULL, (gpointer *) &match))
+    return NULL;
+
+  if (match->generation != match_generation)
+    {
+      gtk_css_node_match_free (match);
+      return NULL;
+    }
+
+  return match;
+}
+
 static GtkCssStyle *
 gtk_css_node_create_style (GtkCssNode                   *cssnode,
                            const GtkCountingBloomFilter *filter,
@@ -363,12 +493,28 @@ gtk_css_node_create_style (GtkCssNode                   *cssnode,
   const GtkCssNodeDeclaration *decl;
   GtkCssStyle *style;
   GtkCssChange style_change;
+  GtkStyleProvider *provider;
+  GtkCssNodeMatch *match;
 
   decl = gtk_css_node_get_declaration (cssnode);
+  match = gtk_css_node_steal_match (cssnode);
+  provider = gtk_css_node_get_style_provider (cssnode);
 
   style = lookup_in_global_parent_cache (cssnode, decl);
   if (style)
-    return g_object_ref (style);
+    {
+      g_clear_pointer (&match, gtk_css_node_match_free);
+      return g_object_ref (style);
+    }
+
+  style = lookup_in_shared_cache (cssnode, provider, decl);
+  if (style)
+    {
+      shared_styles++;
+      g_clear_pointer (&match, gtk_css_node_match_free);
+      store_in_global_parent_cache (cssnode, decl, style);
+      return g_object_ref (style);
+    }
 
   created_styles++;
 
@@ -382,12 +528,24 @@ gtk_css_node_create_style (GtkCssNode                   *cssnode,
       style_change = gtk_css_static_style_get_change (gtk_css_style_get_static_style (cssnode->style));
     }
 
-  style = gtk_css_static_style_new_compute (gtk_css_node_get_style_provider (cssnode),
-                                            filter,
-                                            cssnode,
-                                            style_change);
+  if (match &&
+      match->provider == provider &&
+      (style_change != 0 || match->has_change))
+    {
+      style = gtk_css_static_style_new_for_lookup (provider,
+                                                   cssnode,
+                                                   &match->lookup,
+                                                   style_change != 0 ? style_change : match->change);
+    }
+  else
+    {
+      style = gtk_css_static_style_new_compute (provider, filter, cssnode, style_change);
+    }
+
+  g_clear_pointer (&match, gtk_css_node_match_free);
 
   store_in_global_parent_cache (cssnode, decl, style);
+  store_in_shared_cache (cssnode, provider, decl, style);
 
   return style;
 }
@@ -631,6 +789,7 @@ gtk_css_node_class_init (GtkCssNodeClass *klass)
     {
       invalidated_nodes_counter = gdk_profiler_define_int_counter ("invalidated-nodes", "CSS Node Invalidations");
       created_styles_counter = gdk_profiler_define_int_counter ("created-styles", "CSS Style Creations");
+      shared_styles_counter = gdk_profiler_define_int_counter ("shared-styles", "CSS Shared Style Cache Hits");
     }
 }
 
@@ -915,6 +1074,23 @@ gtk_css_node_set_style (GtkCssNode  *cssnode,
   return style_changed;
 }
 
+static void
+gtk_css_node_invalidate_internal (GtkCssNode   *cssnode,
+                                  GtkCssChange  change)
+{
+  if (!cssnode->invalid)
+    change &= ~GTK_CSS_CHANGE_TIMESTAMP;
+
+  if (change == 0)
+    return;
+
+  cssnode->pending_changes |= change;
+
+  if (cssnode->parent)
+    cssnode->parent->needs_propagation = TRUE;
+  gtk_css_node_invalidate_style (cssnode);
+}
+
 static void
 gtk_css_node_propagate_pending_changes (GtkCssNode *cssnode,
                                         gboolean    style_changed)
@@ -934,7 +1110,9 @@ gtk_css_node_propagate_pending_changes (GtkCssNode *cssnode,
        child = gtk_css_node_get_next_sibling (child))
     {
       child_change = child->pending_changes;
-      gtk_css_node_invalidate (child, change);
+      /* Propagated changes don't change matching, so this doesn't
+       * need to discard prefetched matches */
+      gtk_css_node_invalidate_internal (child, change);
       if (child->visible)
         change |= _gtk_css_change_for_sibling (child_change);
     }
@@ -1306,17 +1484,238 @@ void
 gtk_css_node_invalidate (GtkCssNode   *cssnode,
                          GtkCssChange  change)
 {
-  if (!cssnode->invalid)
-    change &= ~GTK_CSS_CHANGE_TIMESTAMP;
+  if (change & (GTK_CSS_CHANGE_ANY_SELF | GTK_CSS_CHANGE_SOURCE))
+    gtk_css_node_invalidate_prefetched_matches ();
 
-  if (change == 0)
+  gtk_css_node_invalidate_internal (cssnode, change);
+}
+
+/*
+ * gtk_css_node_invalidate_prefetched_matches:
+ *
+ * Discards all selector matches that were done ahead of time
+ * by gtk_css_node_validate(). This needs to be called whenever
+ * the result of matching might change, like when style sheets
+ * are modified.
+ */
+void
+gtk_css_node_invalidate_prefetched_matches (void)
+{
+  match_generation++;
+}
+
+static void
+gtk_css_match_job_run (gpointer data,
+                       gpointer unused)
+{
+  GtkCssMatchJob *job = data;
+  GtkCssMatchJobs *jobs = job->jobs;
+  guint i;
+
+  for (i = jobs->n_matches * job->index / jobs->n_chunks;
+       i < jobs->n_matches * (job->index + 1) / jobs->n_chunks;
+       i++)
+    {
+      GtkCssNodeMatch *match = jobs->matches[i];
+
+      gtk_style_provider_lookup (match->provider,
+                                 jobs->filter,
+                                 match->node,
+                                 &match->lookup,
+                                 match->has_change ? &match->change : NULL);
+    }
+
+  if (job->index == 0)
     return;
 
-  cssnode->pending_changes |= change;
+  g_mutex_lock (&jobs->mutex);
+  jobs->n_pending--;
+  if (jobs->n_pending == 0)
+    g_cond_signal (&jobs->cond);
+  g_mutex_unlock (&jobs->mutex);
+}
 
-  if (cssnode->parent)
-    cssnode->parent->needs_propagation = TRUE;
-  gtk_css_node_invalidate_style (cssnode);
+static GThreadPool *
+gtk_css_match_jobs_get_thread_pool (void)
+{
+  static GThreadPool *pool = NULL;
+
+  if (g_once_init_enter (&pool))
+    {
+      GThreadPool *new_pool;
+
+      new_pool = g_thread_pool_new (gtk_css_match_job_run,
+                                    NULL,
+                                    MAX (1, g_get_num_processors () - 1),
+                                    FALSE,
+                                    NULL);
+      g_once_init_leave (&pool, new_pool);
+    }
+
+  return pool;
+}
+
+static void
+gtk_css_match_jobs_run (GtkCssMatchJobs *jobs)
+{
+  GtkCssMatchJob *job_data;
+  GThreadPool *pool;
+  guint i;
+
+  pool = gtk_css_match_jobs_get_thread_pool ();
+  job_data = g_new (GtkCssMatchJob, jobs->n_chunks);
+  jobs->n_pending = jobs->n_chunks - 1;
+
+  for (i = 0; i < jobs->n_chunks; i++)
+    {
+      job_data[i].jobs = jobs;
+      job_data[i].index = i;
+      if (i > 0)
+        g_thread_pool_push (pool, &job_data[i], NULL);
+    }
+
+  /* Do our share while waiting */
+  gtk_css_match_job_run (&job_data[0], NULL);
+
+  g_mutex_lock (&jobs->mutex);
+  while (jobs->n_pending > 0)
+    g_cond_wait (&jobs->cond, &jobs->mutex);
+  g_mutex_unlock (&jobs->mutex);
+
+  g_free (job_data);
+}
+
+static gboolean
+gtk_css_node_needs_match (GtkCssNode *child)
+{
+  GtkCssStyle *static_style;
+
+  if (!child->visible || !child->invalid || !child->style_is_invalid)
+    return FALSE;
+
+  static_style = GTK_CSS_STYLE (gtk_css_style_get_static_style (child->style));
+
+  return gtk_css_style_needs_recreation (static_style, child->pending_changes);
+}
+
+/*
+ * Matches selectors for all children of @cssnode that will get a new
+ * style on worker threads. The children's pending changes must have
+ * been propagated and @filter must contain @cssnode's ancestors and
+ * @cssnode itself.
+ *
+ * Returns: (nullable) (transfer container): the children that got
+ *   a lookup. Pass them to gtk_css_node_clear_matches() when done.
+ *   The children are not referenced, finalized nodes drop their
+ *   match themselves.
+ */
+static GPtrArray *
+gtk_css_node_prefetch_matches (GtkCssNode                   *cssnode,
+                               const GtkCountingBloomFilter *filter)
+{
+  GtkCssMatchJobs jobs;
+  GPtrArray *children, *matches;
+  GHashTable *seen;
+  GtkCssNode *child;
+  guint n_candidates;
+  gint64 before G_GNUC_UNUSED;
+
+#ifdef G_ENABLE_DEBUG
+  if (GTK_DEBUG_CHECK (CSS_SERIAL))
+    return NULL;
+#endif
+
+  if (g_get_num_processors () < 2)
+    return NULL;
+
+  n_candidates = 0;
+  for (child = cssnode->first_child; child; child = child->next_sibling)
+    {
+      if (gtk_css_node_needs_match (child))
+        n_candidates++;
+    }
+
+  if (n_candidates < GTK_CSS_NODE_MATCH_THRESHOLD)
+    return NULL;
+
+  if (prefetched_matches == NULL)
+    prefetched_matches = g_hash_table_new_full (NULL, NULL, NULL, gtk_css_node_match_free);
+
+  children = g_ptr_array_sized_new (n_candidates);
+  matches = g_ptr_array_sized_new (n_candidates);
+  /* Siblings with equal declarations will share a style via the parent
+   * cache, so only the first of them needs to be matched. */
+  seen = g_hash_table_new (gtk_css_node_declaration_hash, gtk_css_node_declaration_equal);
+
+  for (child = cssnode->first_child; child; child = child->next_sibling)
+    {
+      GtkCssNodeMatch *match;
+
+      if (!gtk_css_node_needs_match (child))
+        continue;
+
+      if (may_use_global_parent_cache (child) &&
+          !gtk_css_node_is_first_child (child) &&
+          !gtk_css_node_is_last_child (child))
+        {
+          if (g_hash_table_contains (seen, child->decl))
+            continue;
+
+          g_hash_table_add (seen, child->decl);
+        }
+
+      match = g_new (GtkCssNodeMatch, 1);
+      match->node = child;
+      match->provider = gtk_css_node_get_style_provider (child);
+      match->generation = match_generation;
+      /* Same condition as in gtk_css_node_create_style() */
+      match->has_change = (child->pending_changes & GTK_CSS_CHANGE_NEEDS_RECOMPUTE) ||
+                          gtk_css_static_style_get_change (gtk_css_style_get_static_style (child->style)) == 0;
+      match->change = 0;
+      _gtk_css_lookup_init (&match->lookup);
+
+      g_hash_table_insert (prefetched_matches, child, match);
+      g_ptr_array_add (children, child);
+      g_ptr_array_add (matches, match);
+    }
+
+  g_hash_table_unref (seen);
+
+  g_mutex_init (&jobs.mutex);
+  g_cond_init (&jobs.cond);
+  jobs.filter = filter;
+  jobs.matches = (GtkCssNodeMatch **) matches->pdata;
+  jobs.n_matches = matches->len;
+  jobs.n_chunks = CLAMP (matches->len / GTK_CSS_NODE_MATCH_CHUNK_SIZE, 1, g_get_num_processors ());
+
+  before = GDK_PROFILER_IS_RUNNING ? GDK_PROFILER_CURRENT_TIME : 0;
+
+  gtk_css_match_jobs_run (&jobs);
+
+  /* This is the wall-clock time of matching on all threads */
+  if (GDK_PROFILER_IS_RUNNING)
+    {
+      prefetch_time += GDK_PROFILER_CURRENT_TIME - before;
+      prefetched_nodes += matches->len;
+    }
+
+  g_mutex_clear (&jobs.mutex);
+  g_cond_clear (&jobs.cond);
+
+  g_ptr_array_unref (matches);
+
+  return children;
+}
+
+static void
+gtk_css_node_clear_matches (GPtrArray *children)
+{
+  guint i;
+
+  for (i = 0; i < children->len; i++)
+    g_hash_table_remove (prefetched_matches, g_ptr_array_index (children, i));
+
+  g_ptr_array_unref (children);
 }
 
 static void
@@ -1325,6 +1724,7 @@ gtk_css_node_validate_internal (GtkCssNode             *cssnode,
                                 gint64                  timestamp)
 {
   GtkCssNode *child;
+  GPtrArray *prefetched = NULL;
   gboolean bloomed = FALSE;
 
   if (!cssnode->invalid)
@@ -1350,15 +1750,41 @@ gtk_css_node_validate_internal (GtkCssNode             *cssnode,
         {
           gtk_css_node_declaration_add_bloom_hashes (cssnode->decl, filter);
           bloomed = TRUE;
+          prefetched = gtk_css_node_prefetch_matches (cssnode, filter);
         }
 
       gtk_css_node_validate_internal (child, filter, timestamp);
     }
 
+  if (prefetched)
+    gtk_css_node_clear_matches (prefetched);
+
   if (bloomed)
     gtk_css_node_declaration_remove_bloom_hashes (cssnode->decl, filter);
 }
 
+#ifdef G_ENABLE_DEBUG
+static void
+gtk_css_node_print_cache_statistics (void)
+{
+  static guint last_lookups = 0;
+  guint n_hits, n_misses, n_entries;
+
+  gtk_css_node_style_cache_get_statistics (&n_hits, &n_misses, &n_entries);
+
+  /* Only print when something happened since the last time */
+  if (n_hits + n_misses == last_lookups)
+    return;
+
+  last_lookups = n_hits + n_misses;
+
+  g_message ("CSS shared style cache: %u hits, %u misses (%.1f%%), %u entries",
+             n_hits, n_misses,
+             100.0 * n_hits / (n_hits + n_misses),
+             n_entries);
+}
+#endif
+
 void
 gtk_css_node_validate (GtkCssNode *cssnode)
 {
@@ -1374,13 +1800,29 @@ gtk_css_node_validate (GtkCssNode *cssnode)
 
   gtk_css_node_validate_internal (cssnode, &filter, timestamp);
 
+  GTK_NOTE (CSS, gtk_css_node_print_cache_statistics ());
+
   if (GDK_PROFILER_IS_RUNNING)
     {
+      gint64 matching_time;
+      guint matched_nodes;
+
       gdk_profiler_end_mark (before,  "css validation", "");
+      /* The duration is the time spent matching selectors, which
+       * allows measuring the cost per node */
+      matching_time = gtk_css_static_style_take_matching_time (&matched_nodes);
+      if (matched_nodes > 0)
+        gdk_profiler_add_markf (before, matching_time, "css matching", "%u nodes", matched_nodes);
+      if (prefetched_nodes > 0)
+        gdk_profiler_add_markf (before, prefetch_time, "css prefetch matching", "%d nodes", prefetched_nodes);
       gdk_profiler_set_int_counter (invalidated_nodes_counter, invalidated_nodes);
       gdk_profiler_set_int_counter (created_styles_counter, created_styles);
+      gdk_profiler_set_int_counter (shared_styles_counter, shared_styles);
       invalidated_nodes = 0;
       created_styles = 0;
+      shared_styles = 0;
+      prefetched_nodes = 0;
+      prefetch_time = 0;
     }
 }
 
@@ -148,6 +148,8 @@ void                    gtk_css_node_invalidate_frame_clock
                                                          gboolean               just_timestamp);
 void                    gtk_css_node_invalidate         (GtkCssNode            *cssnode,
                                                          GtkCssChange           change);
+void                    gtk_css_node_invalidate_prefetched_matches
+                                                        (void);
 void                    gtk_css_node_validate           (GtkCssNode            *cssnode);
 
 GtkStyleProvider *      gtk_css_node_get_style_provider (GtkCssNode            *cssnode) G_GNUC_PURE;
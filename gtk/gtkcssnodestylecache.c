@@ -32,6 +32,28 @@ struct _GtkCssNodeStyleCache {
 #define UNPACK_FLAGS(packed) (GPOINTER_TO_SIZE (packed) & 0x3)
 #define PACK(decl, first_child, last_child) GSIZE_TO_POINTER (GPOINTER_TO_SIZE (decl) | ((first_child) ? 0x2 : 0) | ((last_child) ? 0x1 : 0))
 
+/* The shared cache finds styles for nodes whose parents have the same
+ * style but are different nodes, like rows in a list that get recycled
+ * or children of different boxes. Only styles that don't depend on the
+ * parent's declaration are stored. It is bounded and evicts the least
+ * recently used entries. */
+#define GTK_CSS_SHARED_STYLE_CACHE_SIZE 1024
+
+typedef struct _GtkCssSharedStyle GtkCssSharedStyle;
+
+struct _GtkCssSharedStyle {
+  GtkStyleProvider *provider;
+  GtkCssStyle      *parent_style;
+  gpointer          packed_decl;
+  GtkCssStyle      *style;
+  GList             link;
+};
+
+static GHashTable *shared_styles;
+static GQueue shared_styles_lru = G_QUEUE_INIT;
+static guint shared_styles_hits;
+static guint shared_styles_misses;
+
 GtkCssNodeStyleCache *
 gtk_css_node_style_cache_new (GtkCssStyle *style)
 {
@@ -180,3 +202,154 @@ gtk_css_node_style_cache_lookup (GtkCssNodeStyleCache        *parent,
   return gtk_css_node_style_cache_ref (result);
 }
 
+
+static guint
+gtk_css_shared_style_hash (gconstpointer item)
+{
+  const GtkCssSharedStyle *shared = item;
+
+  return gtk_css_node_style_cache_decl_hash (shared->packed_decl)
+         ^ g_direct_hash (shared->parent_style)
+         ^ g_direct_hash (shared->provider);
+}
+
+static gboolean
+gtk_css_shared_style_equal (gconstpointer item1,
+                            gconstpointer item2)
+{
+  const GtkCssSharedStyle *shared1 = item1;
+  const GtkCssSharedStyle *shared2 = item2;
+
+  return shared1->provider == shared2->provider &&
+         shared1->parent_style == shared2->parent_style &&
+         gtk_css_node_style_cache_decl_equal (shared1->packed_decl, shared2->packed_decl);
+}
+
+static void
+gtk_css_shared_style_free (gpointer data)
+{
+  GtkCssSharedStyle *shared = data;
+
+  g_queue_unlink (&shared_styles_lru, &shared->link);
+
+  g_object_unref (shared->provider);
+  g_object_unref (shared->parent_style);
+  gtk_css_node_style_cache_decl_free (shared->packed_decl);
+  g_object_unref (shared->style);
+
+  g_slice_free (GtkCssSharedStyle, shared);
+}
+
+/**
+ * gtk_css_node_style_cache_lookup_shared:
+ * @provider: the style provider of the node
+ * @parent_style: the style of the node's parent
+ * @decl: the node's declaration
+ * @is_first: if the node is the first child
+ * @is_last: if the node is the last child
+ *
+ * Looks up a style that was computed for a node with the same
+ * declaration and position in any parent with @parent_style.
+ *
+ * Returns: (nullable) (transfer none): the style or %NULL
+ */
+GtkCssStyle *
+gtk_css_node_style_cache_lookup_shared (GtkStyleProvider            *provider,
+                                        GtkCssStyle                 *parent_style,
+                                        const GtkCssNodeDeclaration *decl,
+                                        gboolean                     is_first,
+                                        gboolean                     is_last)
+{
+  GtkCssSharedStyle key, *result;
+
+  if (shared_styles == NULL)
+    {
+      shared_styles_misses++;
+      return NULL;
+    }
+
+  key.provider = provider;
+  key.parent_style = parent_style;
+  key.packed_decl = PACK (decl, is_first, is_last);
+
+  result = g_hash_table_lookup (shared_styles, &key);
+  if (result == NULL)
+    {
+      shared_styles_misses++;
+      return NULL;
+    }
+
+  shared_styles_hits++;
+
+  g_queue_unlink (&shared_styles_lru, &result->link);
+  g_queue_push_head_link (&shared_styles_lru, &result->link);
+
+  return result->style;
+}
+
+void
+gtk_css_node_style_cache_insert_shared (GtkStyleProvider      *provider,
+                                        GtkCssStyle           *parent_style,
+                                        GtkCssNodeDeclaration *decl,
+                                        gboolean               is_first,
+                                        gboolean               is_last,
+                                        GtkCssStyle           *style)
+{
+  GtkCssSharedStyle *shared;
+
+  if (!gtk_css_style_is_static (parent_style) ||
+      !may_be_stored_in_cache (style))
+    return;
+
+  /* The key only has the style of the parent, not its declaration or
+   * anything further up. A parent can keep its style when its classes
+   * or state change, so styles depending on those must not be shared.
+   */
+  if (gtk_css_static_style_get_change (GTK_CSS_STATIC_STYLE (style)) &
+      (GTK_CSS_CHANGE_ANY_PARENT | GTK_CSS_CHANGE_ANY_PARENT_SIBLING))
+    return;
+
+  if (shared_styles == NULL)
+    shared_styles = g_hash_table_new_full (gtk_css_shared_style_hash,
+                                           gtk_css_shared_style_equal,
+                                           gtk_css_shared_style_free,
+                                           NULL);
+
+  shared = g_slice_new (GtkCssSharedStyle);
+  shared->provider = g_object_ref (provider);
+  shared->parent_style = g_object_ref (parent_style);
+  shared->packed_decl = PACK (gtk_css_node_declaration_ref (decl), is_first, is_last);
+  shared->style = g_object_ref (style);
+  shared->link = (GList) { shared, NULL, NULL };
+
+  /* Replaces and frees an equal entry, which also unlinks it */
+  g_hash_table_replace (shared_styles, shared, shared);
+  g_queue_push_head_link (&shared_styles_lru, &shared->link);
+
+  while (shared_styles_lru.length > GTK_CSS_SHARED_STYLE_CACHE_SIZE)
+    g_hash_table_remove (shared_styles, shared_styles_lru.tail->data);
+}
+
+/**
+ * gtk_css_node_style_cache_clear_shared:
+ *
+ * Drops all shared styles. Styles are keyed by their provider,
+ * so this needs to happen whenever the output of a style provider
+ * changes.
+ */
+void
+gtk_css_node_style_cache_clear_shared (void)
+{
+  if (shared_styles)
+    g_hash_table_remove_all (shared_styles);
+}
+
+void
+gtk_css_node_style_cache_get_statistics (guint *n_hits,
+                                         guint *n_misses,
+                                         guint *n_entries)
+{
+  *n_hits = shared_styles_hits;
+  *n_misses = shared_styles_misses;
+  *n_entries = shared_styles_lru.length;
+}
@@ -24,6 +24,7 @@
 #include "gtk/css/gtkcssparserprivate.h"
 #include "gtkbitmaskprivate.h"
 #include "gtkcssarrayvalueprivate.h"
+#include "gtkcssbinaryprivate.h"
 #include "gtkcsscolorvalueprivate.h"
 #include "gtkcsskeyframesprivate.h"
 #include "gtkcssselectorprivate.h"
@@ -94,6 +95,7 @@ struct _GtkCssProviderClass
 
 typedef struct GtkCssRuleset GtkCssRuleset;
 typedef struct _GtkCssScanner GtkCssScanner;
+typedef struct _GtkCssRecording GtkCssRecording;
 typedef struct _PropertyValue PropertyValue;
 typedef enum ParserScope ParserScope;
 typedef enum ParserSymbol ParserSymbol;
@@ -118,6 +120,27 @@ struct _GtkCssScanner
   GtkCssProvider *provider;
   GtkCssParser *parser;
   GtkCssScanner *parent;
+  GBytes *bytes;
+};
+
+/* The source text of everything that was parsed while loading, so it
+ * can be written to the stylesheet cache. See gtk_css_provider_precompile().
+ */
+struct _GtkCssRecording
+{
+  gboolean failed; /* something went wrong, don't cache the result */
+
+  GByteArray *dependencies;
+  guint n_dependencies;
+  GByteArray *colors;
+  guint n_colors;
+  GByteArray *keyframes;
+  guint n_keyframes;
+  GByteArray *declarations;
+  GHashTable *declaration_indices;
+
+  GArray *block; /* declaration indices of the ruleset being parsed */
+  GHashTable *blocks; /* PropertyValue *styles => GArray of declaration indices */
 };
 
 struct _GtkCssProviderPrivate
@@ -131,6 +154,8 @@ struct _GtkCssProviderPrivate
   GtkCssSelectorTree *tree;
   GResource *resource;
   char *path;
+
+  GtkCssRecording *recording;
 };
 
 enum {
@@ -301,17 +326,51 @@ gtk_css_ruleset_add (GtkCssRuleset       *ruleset,
     }
 
   ruleset->styles[i].value = value;
-  if (gtk_keep_css_sections)
+  if (gtk_keep_css_sections && section)
     ruleset->styles[i].section = gtk_css_section_ref (section);
   else
     ruleset->styles[i].section = NULL;
 }
 
+/* Adds a parsed value, splitting up values of shorthand properties */
+static void
+gtk_css_ruleset_add_value (GtkCssRuleset    *ruleset,
+                           GtkStyleProperty *property,
+                           GtkCssValue      *value,
+                           GtkCssSection    *section)
+{
+  if (GTK_IS_CSS_SHORTHAND_PROPERTY (property))
+    {
+      GtkCssShorthandProperty *shorthand = GTK_CSS_SHORTHAND_PROPERTY (property);
+      guint i;
+
+      for (i = 0; i < _gtk_css_shorthand_property_get_n_subproperties (shorthand); i++)
+        {
+          GtkCssStyleProperty *child = _gtk_css_shorthand_property_get_subproperty (shorthand, i);
+          GtkCssValue *sub = _gtk_css_array_value_get_nth (value, i);
+
+          gtk_css_ruleset_add (ruleset, child, _gtk_css_value_ref (sub), section);
+        }
+
+      _gtk_css_value_unref (value);
+    }
+  else if (GTK_IS_CSS_STYLE_PROPERTY (property))
+    {
+      gtk_css_ruleset_add (ruleset, GTK_CSS_STYLE_PROPERTY (property), value, section);
+    }
+  else
+    {
+      g_assert_not_reached ();
+      _gtk_css_value_unref (value);
+    }
+}
+
 static void
 gtk_css_scanner_destroy (GtkCssScanner *scanner)
 {
   g_object_unref (scanner->provider);
   gtk_css_parser_unref (scanner->parser);
+  g_bytes_unref (scanner->bytes);
 
   g_slice_free (GtkCssScanner, scanner);
 }
@@ -332,8 +391,12 @@ gtk_css_scanner_parser_error (GtkCssParser         *parser,
                               gpointer              user_data)
 {
   GtkCssScanner *scanner = user_data;
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (scanner->provider);
   GtkCssSection *section;
 
+  if (priv->recording)
+    priv->recording->failed = TRUE;
+
   section = gtk_css_section_new (gtk_css_parser_get_file (parser),
                                  start,
                                  end);
@@ -356,6 +419,7 @@ gtk_css_scanner_new (GtkCssProvider *provider,
   g_object_ref (provider);
   scanner->provider = provider;
   scanner->parent = parent;
+  scanner->bytes = g_bytes_ref (bytes);
 
   scanner->parser = gtk_css_parser_new_for_bytes (bytes,
                                                   file,
@@ -383,6 +447,165 @@ gtk_css_scanner_would_recurse (GtkCssScanner *scanner,
   return FALSE;
 }
 
+static gsize
+gtk_css_scanner_get_text_start (GtkCssScanner *scanner)
+{
+  /* advance the location over whitespace */
+  gtk_css_parser_get_token (scanner->parser);
+
+  return gtk_css_parser_get_start_location (scanner->parser)->bytes;
+}
+
+/* Returns the text from @start up to the current token */
+static char *
+gtk_css_scanner_get_text (GtkCssScanner *scanner,
+                          gsize          start)
+{
+  const char *data;
+  gsize end;
+
+  data = g_bytes_get_data (scanner->bytes, NULL);
+  end = gtk_css_parser_get_start_location (scanner->parser)->bytes;
+  g_assert (start <= end && end <= g_bytes_get_size (scanner->bytes));
+
+  return g_strchomp (g_strndup (data + start, end - start));
+}
+
+static char *
+gtk_css_scanner_get_uri (GtkCssScanner *scanner)
+{
+  GFile *file = gtk_css_parser_get_file (scanner->parser);
+
+  if (file == NULL)
+    return g_strdup ("");
+
+  return g_file_get_uri (file);
+}
+
+static GtkCssRecording *
+gtk_css_recording_new (void)
+{
+  GtkCssRecording *recording;
+
+  recording = g_slice_new0 (GtkCssRecording);
+  recording->dependencies = g_byte_array_new ();
+  recording->colors = g_byte_array_new ();
+  recording->keyframes = g_byte_array_new ();
+  recording->declarations = g_byte_array_new ();
+  recording->declaration_indices = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  recording->block = g_array_new (FALSE, FALSE, sizeof (guint32));
+  recording->blocks = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify) g_array_unref);
+
+  return recording;
+}
+
+static void
+gtk_css_recording_free (GtkCssRecording *recording)
+{
+  g_byte_array_unref (recording->dependencies);
+  g_byte_array_unref (recording->colors);
+  g_byte_array_unref (recording->keyframes);
+  g_byte_array_unref (recording->declarations);
+  g_hash_table_unref (recording->declaration_indices);
+  g_array_unref (recording->block);
+  g_hash_table_unref (recording->blocks);
+
+  g_slice_free (GtkCssRecording, recording);
+}
+
+static void
+gtk_css_recording_add_dependency (GtkCssRecording *recording,
+                                  GFile           *file,
+                                  GBytes          *bytes)
+{
+  char *uri, *checksum;
+
+  uri = g_file_get_uri (file);
+  checksum = g_compute_checksum_for_bytes (G_CHECKSUM_SHA256, bytes);
+
+  gtk_css_binary_write_string (recording->dependencies, uri);
+  gtk_css_binary_write_string (recording->dependencies, checksum);
+  recording->n_dependencies++;
+
+  g_free (checksum);
+  g_free (uri);
+}
+
+/* Records a named definition, like a color or keyframes, whose value
+ * starts at @start and ends at the current token.
+ */
+static void
+gtk_css_recording_add_named (GByteArray    *data,
+                             guint         *n_items,
+                             GtkCssScanner *scanner,
+                             const char    *name,
+                             gsize          start)
+{
+  char *uri, *text;
+
+  uri = gtk_css_scanner_get_uri (scanner);
+  text = gtk_css_scanner_get_text (scanner, start);
+
+  gtk_css_binary_write_string (data, name);
+  gtk_css_binary_write_string (data, uri);
+  gtk_css_binary_write_string (data, text);
+  (*n_items)++;
+
+  g_free (text);
+  g_free (uri);
+}
+
+static void
+gtk_css_recording_add_declaration (GtkCssRecording  *recording,
+                                   GtkCssScanner    *scanner,
+                                   GtkStyleProperty *property,
+                                   gsize             start)
+{
+  char *uri, *text, *key;
+  guint32 index;
+
+  uri = gtk_css_scanner_get_uri (scanner);
+  text = gtk_css_scanner_get_text (scanner, start);
+  key = g_strconcat (property->name, "\n", uri, "\n", text, NULL);
+
+  /* Themes repeat the same declarations a lot, so only keep them once */
+  index = GPOINTER_TO_UINT (g_hash_table_lookup (recording->declaration_indices, key));
+  if (index == 0)
+    {
+      gtk_css_binary_write_string (recording->declarations, property->name);
+      gtk_css_binary_write_string (recording->declarations, uri);
+      gtk_css_binary_write_string (recording->declarations, text);
+
+      index = g_hash_table_size (recording->declaration_indices) + 1;
+      g_hash_table_insert (recording->declaration_indices, key, GUINT_TO_POINTER (index));
+    }
+  else
+    g_free (key);
+
+  index--;
+  g_array_append_val (recording->block, index);
+
+  g_free (text);
+  g_free (uri);
+}
+
+/* Associates the declarations recorded since the last call with
+ * the styles of the ruleset they were parsed into.
+ */
+static void
+gtk_css_recording_end_block (GtkCssRecording *recording,
+                             PropertyValue   *styles)
+{
+  if (styles == NULL)
+    {
+      g_array_set_size (recording->block, 0);
+      return;
+    }
+
+  g_hash_table_insert (recording->blocks, styles, recording->block);
+  recording->block = g_array_new (FALSE, FALSE, sizeof (guint32));
+}
+
 static void
 gtk_css_provider_init (GtkCssProvider *css_provider)
 {
@@ -584,11 +807,26 @@ css_provider_commit (GtkCssProvider  *css_provider,
 }
 
 static void
-gtk_css_provider_reset (GtkCssProvider *css_provider)
+gtk_css_provider_clear_styles (GtkCssProvider *css_provider)
 {
   GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (css_provider);
   guint i;
 
+  g_hash_table_remove_all (priv->symbolic_colors);
+  g_hash_table_remove_all (priv->keyframes);
+
+  for (i = 0; i < priv->rulesets->len; i++)
+    gtk_css_ruleset_clear (&g_array_index (priv->rulesets, GtkCssRuleset, i));
+  g_array_set_size (priv->rulesets, 0);
+  _gtk_css_selector_tree_free (priv->tree);
+  priv->tree = NULL;
+}
+
+static void
+gtk_css_provider_reset (GtkCssProvider *css_provider)
+{
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (css_provider);
+
   if (priv->resource)
     {
       g_resources_unregister (priv->resource);
@@ -602,14 +840,7 @@ gtk_css_provider_reset (GtkCssProvider *css_provider)
       priv->path = NULL;
     }
 
-  g_hash_table_remove_all (priv->symbolic_colors);
-  g_hash_table_remove_all (priv->keyframes);
-
-  for (i = 0; i < priv->rulesets->len; i++)
-    gtk_css_ruleset_clear (&g_array_index (priv->rulesets, GtkCssRuleset, i));
-  g_array_set_size (priv->rulesets, 0);
-  _gtk_css_selector_tree_free (priv->tree);
-  priv->tree = NULL;
+  gtk_css_provider_clear_styles (css_provider);
 }
 
 static gboolean
@@ -688,6 +919,7 @@ parse_color_definition (GtkCssScanner *scanner)
 {
   GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (scanner->provider);
   GtkCssValue *color;
+  gsize start;
   char *name;
 
   if (!gtk_css_parser_try_at_keyword (scanner->parser, "define-color"))
@@ -697,6 +929,7 @@ parse_color_definition (GtkCssScanner *scanner)
   if (name == NULL)
     return TRUE;
 
+  start = gtk_css_scanner_get_text_start (scanner);
   color = _gtk_css_color_value_parse (scanner->parser);
   if (color == NULL)
     {
@@ -713,6 +946,9 @@ parse_color_definition (GtkCssScanner *scanner)
       return TRUE;
     }
 
+  if (priv->recording)
+    gtk_css_recording_add_named (priv->recording->colors, &priv->recording->n_colors, scanner, name, start);
+
   g_hash_table_insert (priv->symbolic_colors, name, color);
 
   return TRUE;
@@ -723,6 +959,7 @@ parse_keyframes (GtkCssScanner *scanner)
 {
   GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (scanner->provider);
   GtkCssKeyframes *keyframes;
+  gsize start;
   char *name;
 
   if (!gtk_css_parser_try_at_keyword (scanner->parser, "keyframes"))
@@ -740,13 +977,22 @@ parse_keyframes (GtkCssScanner *scanner)
 
   gtk_css_parser_end_block_prelude (scanner->parser);
 
+  start = gtk_css_scanner_get_text_start (scanner);
   keyframes = _gtk_css_keyframes_parse (scanner->parser);
-  if (keyframes != NULL)
-    g_hash_table_insert (priv->keyframes, name, keyframes);
 
   if (!gtk_css_parser_has_token (scanner->parser, GTK_CSS_TOKEN_EOF))
     gtk_css_parser_error_syntax (scanner->parser, "Expected '}' after declarations");
 
+  if (keyframes != NULL)
+    {
+      if (priv->recording)
+        gtk_css_recording_add_named (priv->recording->keyframes, &priv->recording->n_keyframes, scanner, name, start);
+
+      g_hash_table_insert (priv->keyframes, name, keyframes);
+    }
+  else
+    g_free (name);
+
   return TRUE;
 }
 
@@ -789,7 +1035,9 @@ static void
 parse_declaration (GtkCssScanner *scanner,
                    GtkCssRuleset *ruleset)
 {
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (scanner->provider);
   GtkStyleProperty *property;
+  gsize value_start;
   char *name;
 
   /* advance the location over whitespace */
@@ -820,6 +1068,7 @@ parse_declaration (GtkCssScanner *scanner,
           goto out;
         }
 
+      value_start = gtk_css_scanner_get_text_start (scanner);
       value = _gtk_style_property_parse_value (property, scanner->parser);
 
       if (value == NULL)
@@ -840,31 +1089,10 @@ parse_declaration (GtkCssScanner *scanner,
       else
         section = NULL;
 
-      if (GTK_IS_CSS_SHORTHAND_PROPERTY (property))
-        {
-          GtkCssShorthandProperty *shorthand = GTK_CSS_SHORTHAND_PROPERTY (property);
-          guint i;
-
-          for (i = 0; i < _gtk_css_shorthand_property_get_n_subproperties (shorthand); i++)
-            {
-              GtkCssStyleProperty *child = _gtk_css_shorthand_property_get_subproperty (shorthand, i);
-              GtkCssValue *sub = _gtk_css_array_value_get_nth (value, i);
-              
-              gtk_css_ruleset_add (ruleset, child, _gtk_css_value_ref (sub), section);
-            }
-          
-            _gtk_css_value_unref (value);
-        }
-      else if (GTK_IS_CSS_STYLE_PROPERTY (property))
-        {
+      gtk_css_ruleset_add_value (ruleset, property, value, section);
 
-          gtk_css_ruleset_add (ruleset, GTK_CSS_STYLE_PROPERTY (property), value, section);
-        }
-      else
-        {
-          g_assert_not_reached ();
-          _gtk_css_value_unref (value);
-        }
+      if (priv->recording)
+        gtk_css_recording_add_declaration (priv->recording, scanner, property, value_start);
 
       g_clear_pointer (&section, gtk_css_section_unref);
     }
@@ -892,6 +1120,7 @@ parse_declarations (GtkCssScanner *scanner,
 static void
 parse_ruleset (GtkCssScanner *scanner)
 {
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (scanner->provider);
   GtkCssSelectors selectors;
   GtkCssRuleset ruleset = { 0, };
 
@@ -922,6 +1151,9 @@ parse_ruleset (GtkCssScanner *scanner)
 
   gtk_css_parser_end_block (scanner->parser);
 
+  if (priv->recording)
+    gtk_css_recording_end_block (priv->recording, ruleset.styles);
+
   css_provider_commit (scanner->provider, &selectors, &ruleset);
   gtk_css_ruleset_clear (&ruleset);
 
@@ -1012,6 +1244,571 @@ gtk_css_provider_postprocess (GtkCssProvider *css_provider)
   gdk_profiler_end_mark (before, "create selector tree", NULL);
 }
 
+/* Precompiled stylesheets
+ *
+ * To avoid parsing big themes in every process, the result of loading
+ * a file can be stored in a binary format and loaded again without
+ * parsing selectors, resolving imports, sorting rules or building the
+ * selector tree. It contains:
+ *
+ * - the URIs and checksums of the file and all files it imports
+ * - the source text of all colors, keyframes and declarations, with
+ *   the URI of the file they came from
+ * - the declarations of the styles of every ruleset
+ * - the selector tree
+ *
+ * Values are kept as text, because printing a value does not always
+ * produce something that parses back into the same value. Themes repeat
+ * the same declarations a lot though, so every distinct one is only
+ * parsed once.
+ */
+#define GTK_CSS_PRECOMPILED_VERSION 1
+#define GTK_CSS_PRECOMPILED_BYTE_ORDER 0x01020304
+
+static const char gtk_css_precompiled_magic[8] = { '\x89', 'G', 'T', 'K', 'C', 'S', 'S', '\n' };
+
+static gboolean
+gtk_css_provider_bytes_are_precompiled (GBytes *bytes)
+{
+  gsize size;
+  const guchar *data = g_bytes_get_data (bytes, &size);
+
+  return size >= sizeof (gtk_css_precompiled_magic) &&
+         memcmp (data, gtk_css_precompiled_magic, sizeof (gtk_css_precompiled_magic)) == 0;
+}
+
+static guint32
+gtk_css_provider_get_ruleset_index (gpointer match,
+                                    gpointer user_data)
+{
+  GArray *rulesets = user_data;
+
+  return (GtkCssRuleset *) match - (GtkCssRuleset *) rulesets->data;
+}
+
+static GBytes *
+gtk_css_provider_write_precompiled (GtkCssProvider  *self,
+                                    GtkCssRecording *recording)
+{
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (self);
+  GHashTable *block_indices;
+  GPtrArray *blocks;
+  GByteArray *data;
+  guint i, j;
+
+  /* Rulesets created from the same selector list share their styles,
+   * and so do the blocks they are stored as.
+   */
+  block_indices = g_hash_table_new (NULL, NULL);
+  blocks = g_ptr_array_new ();
+  for (i = 0; i < priv->rulesets->len; i++)
+    {
+      GtkCssRuleset *ruleset = &g_array_index (priv->rulesets, GtkCssRuleset, i);
+      GArray *block;
+
+      if (g_hash_table_contains (block_indices, ruleset->styles))
+        continue;
+
+      block = g_hash_table_lookup (recording->blocks, ruleset->styles);
+      if (block == NULL)
+        {
+          g_ptr_array_unref (blocks);
+          g_hash_table_unref (block_indices);
+          return NULL;
+        }
+
+      g_hash_table_insert (block_indices, ruleset->styles, GUINT_TO_POINTER (blocks->len));
+      g_ptr_array_add (blocks, block);
+    }
+
+  data = g_byte_array_new ();
+  g_byte_array_append (data, (const guint8 *) gtk_css_precompiled_magic, sizeof (gtk_css_precompiled_magic));
+  gtk_css_binary_write_uint (data, GTK_CSS_PRECOMPILED_VERSION);
+  gtk_css_binary_write_uint (data, GTK_CSS_PRECOMPILED_BYTE_ORDER);
+
+  gtk_css_binary_write_uint (data, recording->n_dependencies);
+  g_byte_array_append (data, recording->dependencies->data, recording->dependencies->len);
+  gtk_css_binary_write_uint (data, recording->n_colors);
+  g_byte_array_append (data, recording->colors->data, recording->colors->len);
+  gtk_css_binary_write_uint (data, recording->n_keyframes);
+  g_byte_array_append (data, recording->keyframes->data, recording->keyframes->len);
+  gtk_css_binary_write_uint (data, g_hash_table_size (recording->declaration_indices));
+  g_byte_array_append (data, recording->declarations->data, recording->declarations->len);
+
+  gtk_css_binary_write_uint (data, blocks->len);
+  for (i = 0; i < blocks->len; i++)
+    {
+      GArray *block = g_ptr_array_index (blocks, i);
+
+      gtk_css_binary_write_uint (data, block->len);
+      for (j = 0; j < block->len; j++)
+        gtk_css_binary_write_uint (data, g_array_index (block, guint32, j));
+    }
+
+  gtk_css_binary_write_uint (data, priv->rulesets->len);
+  for (i = 0; i < priv->rulesets->len; i++)
+    {
+      GtkCssRuleset *ruleset = &g_array_index (priv->rulesets, GtkCssRuleset, i);
+
+      gtk_css_binary_write_uint (data, GPOINTER_TO_UINT (g_hash_table_lookup (block_indices, ruleset->styles)));
+    }
+
+  _gtk_css_selector_tree_serialize (priv->tree, data, gtk_css_provider_get_ruleset_index, priv->rulesets);
+
+  g_ptr_array_unref (blocks);
+  g_hash_table_unref (block_indices);
+
+  return g_byte_array_free_to_bytes (data);
+}
+
+static void
+gtk_css_precompiled_parser_error (GtkCssParser         *parser,
+                                  const GtkCssLocation *start,
+                                  const GtkCssLocation *end,
+                                  const GError         *error,
+                                  gpointer              user_data)
+{
+  gboolean *failed = user_data;
+
+  *failed = TRUE;
+}
+
+/* Values that don't parse the same way anymore make the whole
+ * stylesheet fail to load, so errors are not emitted here but
+ * when the source is parsed instead.
+ */
+static GtkCssParser *
+gtk_css_precompiled_parser_new (const char *uri,
+                                const char *text,
+                                gboolean   *failed)
+{
+  GtkCssParser *parser;
+  GBytes *bytes;
+  GFile *file;
+
+  file = uri[0] ? g_file_new_for_uri (uri) : NULL;
+  bytes = g_bytes_new_static (text, strlen (text));
+
+  parser = gtk_css_parser_new_for_bytes (bytes,
+                                         file,
+                                         NULL,
+                                         gtk_css_precompiled_parser_error,
+                                         failed,
+                                         NULL);
+
+  g_bytes_unref (bytes);
+  g_clear_object (&file);
+
+  return parser;
+}
+
+static gboolean
+gtk_css_precompiled_parser_finish (GtkCssParser *parser,
+                                   gboolean     *failed)
+{
+  if (!gtk_css_parser_has_token (parser, GTK_CSS_TOKEN_EOF))
+    *failed = TRUE;
+
+  gtk_css_parser_unref (parser);
+
+  return !*failed;
+}
+
+static gboolean
+gtk_css_precompiled_dependency_is_current (const char *uri,
+                                           const char *checksum)
+{
+  GFile *file;
+  GBytes *bytes;
+  char *current;
+  gboolean result;
+
+  file = g_file_new_for_uri (uri);
+  bytes = g_file_load_bytes (file, NULL, NULL, NULL);
+  g_object_unref (file);
+  if (bytes == NULL)
+    return FALSE;
+
+  current = g_compute_checksum_for_bytes (G_CHECKSUM_SHA256, bytes);
+  result = g_str_equal (current, checksum);
+
+  g_free (current);
+  g_bytes_unref (bytes);
+
+  return result;
+}
+
+static gpointer
+gtk_css_provider_get_precompiled_ruleset (guint32                   index,
+                                          const GtkCssSelectorTree *tree,
+                                          gpointer                  user_data)
+{
+  GArray *rulesets = user_data;
+  GtkCssRuleset *ruleset;
+
+  if (index >= rulesets->len)
+    return NULL;
+
+  ruleset = &g_array_index (rulesets, GtkCssRuleset, index);
+  ruleset->selector_match = (GtkCssSelectorTree *) tree;
+
+  return ruleset;
+}
+
+/* Loads a stylesheet created by gtk_css_provider_write_precompiled().
+ * If @checksum is set, the stylesheet must have been created from a
+ * file with that checksum, and the imported files are checked for
+ * changes. The stylesheet is rejected if any of them changed.
+ *
+ * If anything fails, %FALSE is returned and nothing is loaded.
+ */
+static gboolean
+gtk_css_provider_load_precompiled (GtkCssProvider *self,
+                                   GBytes         *bytes,
+                                   const char     *checksum)
+{
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (self);
+  GtkCssBinaryReader reader;
+  GtkStyleProperty **properties = NULL;
+  GtkCssValue **values = NULL;
+  GtkCssRuleset *blocks = NULL;
+  guint32 i, j, n, n_declarations = 0, n_blocks = 0;
+  gboolean failed = FALSE;
+
+#ifdef VERIFY_TREE
+  /* verifying needs the selectors, which aren't stored */
+  return FALSE;
+#endif
+
+  if (!gtk_css_provider_bytes_are_precompiled (bytes))
+    return FALSE;
+
+  gtk_css_binary_reader_init (&reader, g_bytes_get_data (bytes, NULL), g_bytes_get_size (bytes));
+  reader.pos = sizeof (gtk_css_precompiled_magic);
+
+  if (gtk_css_binary_reader_read_uint (&reader) != GTK_CSS_PRECOMPILED_VERSION ||
+      gtk_css_binary_reader_read_uint (&reader) != GTK_CSS_PRECOMPILED_BYTE_ORDER)
+    return FALSE;
+
+  /* The first dependency is the file itself */
+  n = gtk_css_binary_reader_read_uint (&reader);
+  if (checksum && n == 0)
+    return FALSE;
+  for (i = 0; i < n && !reader.error; i++)
+    {
+      const char *dep_uri = gtk_css_binary_reader_read_string (&reader);
+      const char *dep_checksum = gtk_css_binary_reader_read_string (&reader);
+
+      if (checksum == NULL || reader.error)
+        continue;
+
+      if (i == 0 ? !g_str_equal (dep_checksum, checksum)
+                 : !gtk_css_precompiled_dependency_is_current (dep_uri, dep_checksum))
+        return FALSE;
+    }
+
+  n = gtk_css_binary_reader_read_uint (&reader);
+  for (i = 0; i < n && !reader.error && !failed; i++)
+    {
+      const char *name = gtk_css_binary_reader_read_string (&reader);
+      const char *uri = gtk_css_binary_reader_read_string (&reader);
+      const char *text = gtk_css_binary_reader_read_string (&reader);
+      GtkCssParser *parser;
+      GtkCssValue *color;
+
+      if (reader.error)
+        break;
+
+      parser = gtk_css_precompiled_parser_new (uri, text, &failed);
+      color = _gtk_css_color_value_parse (parser);
+      if (color == NULL)
+        failed = TRUE;
+
+      if (gtk_css_precompiled_parser_finish (parser, &failed))
+        g_hash_table_insert (priv->symbolic_colors, g_strdup (name), color);
+      else
+        g_clear_pointer (&color, _gtk_css_value_unref);
+    }
+
+  n = gtk_css_binary_reader_read_uint (&reader);
+  for (i = 0; i < n && !reader.error && !failed; i++)
+    {
+      const char *name = gtk_css_binary_reader_read_string (&reader);
+      const char *uri = gtk_css_binary_reader_read_string (&reader);
+      const char *text = gtk_css_binary_reader_read_string (&reader);
+      GtkCssKeyframes *keyframes;
+      GtkCssParser *parser;
+
+      if (reader.error)
+        break;
+
+      parser = gtk_css_precompiled_parser_new (uri, text, &failed);
+      keyframes = _gtk_css_keyframes_parse (parser);
+      if (keyframes == NULL)
+        failed = TRUE;
+
+      if (gtk_css_precompiled_parser_finish (parser, &failed))
+        g_hash_table_insert (priv->keyframes, g_strdup (name), keyframes);
+      else
+        g_clear_pointer (&keyframes, _gtk_css_keyframes_unref);
+    }
+
+  /* every declaration takes at least 3 empty strings */
+  n = gtk_css_binary_reader_read_uint (&reader);
+  if (reader.error || failed || n > (reader.size - reader.pos) / (6 * sizeof (guint32)))
+    goto fail;
+
+  properties = g_new0 (GtkStyleProperty *, n);
+  values = g_new0 (GtkCssValue *, n);
+  for (n_declarations = 0; n_declarations < n; n_declarations++)
+    {
+      const char *name = gtk_css_binary_reader_read_string (&reader);
+      const char *uri = gtk_css_binary_reader_read_string (&reader);
+      const char *text = gtk_css_binary_reader_read_string (&reader);
+      GtkStyleProperty *property;
+      GtkCssParser *parser;
+      GtkCssValue *value;
+
+      if (reader.error)
+        goto fail;
+
+      property = _gtk_style_property_lookup (name);
+      if (property == NULL)
+        goto fail;
+
+      parser = gtk_css_precompiled_parser_new (uri, text, &failed);
+      value = _gtk_style_property_parse_value (property, parser);
+      if (value == NULL)
+        failed = TRUE;
+
+      if (!gtk_css_precompiled_parser_finish (parser, &failed))
+        {
+          g_clear_pointer (&value, _gtk_css_value_unref);
+          goto fail;
+        }
+
+      properties[n_declarations] = property;
+      values[n_declarations] = value;
+    }
+
+  n = gtk_css_binary_reader_read_uint (&reader);
+  if (reader.error || n > (reader.size - reader.pos) / (2 * sizeof (guint32)))
+    goto fail;
+
+  n_blocks = n;
+  blocks = g_new0 (GtkCssRuleset, n_blocks);
+  for (i = 0; i < n_blocks; i++)
+    {
+      guint32 n_styles = gtk_css_binary_reader_read_uint (&reader);
+
+      if (n_styles == 0)
+        goto fail;
+
+      for (j = 0; j < n_styles; j++)
+        {
+          guint32 index = gtk_css_binary_reader_read_uint (&reader);
+
+          if (reader.error || index >= n_declarations)
+            goto fail;
+
+          gtk_css_ruleset_add_value (&blocks[i],
+                                     properties[index],
+                                     _gtk_css_value_ref (values[index]),
+                                     NULL);
+        }
+    }
+
+  n = gtk_css_binary_reader_read_uint (&reader);
+  if (reader.error || n > (reader.size - reader.pos) / sizeof (guint32))
+    goto fail;
+
+  g_array_set_size (priv->rulesets, n);
+  memset (priv->rulesets->data, 0, n * sizeof (GtkCssRuleset));
+  for (i = 0; i < n; i++)
+    {
+      guint32 index = gtk_css_binary_reader_read_uint (&reader);
+
+      if (index >= n_blocks)
+        goto fail;
+
+      /* The first ruleset takes over the styles */
+      gtk_css_ruleset_init_copy (&g_array_index (priv->rulesets, GtkCssRuleset, i),
+                                 &blocks[index],
+                                 NULL);
+    }
+
+  if (!_gtk_css_selector_tree_deserialize (&reader,
+                                           &priv->tree,
+                                           gtk_css_provider_get_precompiled_ruleset,
+                                           priv->rulesets) ||
+      reader.pos != reader.size)
+    goto fail;
+
+  for (i = 0; i < n_blocks; i++)
+    gtk_css_ruleset_clear (&blocks[i]);
+  g_free (blocks);
+  for (i = 0; i < n_declarations; i++)
+    _gtk_css_value_unref (values[i]);
+  g_free (values);
+  g_free (properties);
+
+  return TRUE;
+
+fail:
+  for (i = 0; i < n_blocks; i++)
+    gtk_css_ruleset_clear (&blocks[i]);
+  g_free (blocks);
+  for (i = 0; i < n_declarations; i++)
+    _gtk_css_value_unref (values[i]);
+  g_free (values);
+  g_free (properties);
+
+  gtk_css_provider_clear_styles (self);
+
+  return FALSE;
+}
+
+static void
+gtk_css_provider_parse (GtkCssProvider *self,
+                        GtkCssScanner  *parent,
+                        GFile          *file,
+                        GBytes         *bytes)
+{
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (self);
+  GtkCssScanner *scanner;
+
+  if (parent != NULL && priv->recording)
+    gtk_css_recording_add_dependency (priv->recording, file, bytes);
+
+  scanner = gtk_css_scanner_new (self,
+                                 parent,
+                                 file,
+                                 bytes);
+
+  parse_stylesheet (scanner);
+
+  gtk_css_scanner_destroy (scanner);
+
+  if (parent == NULL)
+    gtk_css_provider_postprocess (self);
+}
+
+/* Loads @bytes and returns their precompiled form, or %NULL if
+ * there were any problems.
+ */
+static GBytes *
+gtk_css_provider_parse_precompiled (GtkCssProvider *self,
+                                    GFile          *file,
+                                    GBytes         *bytes)
+{
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (self);
+  GBytes *result;
+
+  priv->recording = gtk_css_recording_new ();
+  gtk_css_recording_add_dependency (priv->recording, file, bytes);
+
+  gtk_css_provider_parse (self, NULL, file, bytes);
+
+  if (priv->recording->failed)
+    result = NULL;
+  else
+    result = gtk_css_provider_write_precompiled (self, priv->recording);
+
+  g_clear_pointer (&priv->recording, gtk_css_recording_free);
+
+  return result;
+}
+
+static gboolean
+gtk_css_provider_use_cache (void)
+{
+  static int use_cache = -1;
+
+  if (use_cache < 0)
+    use_cache = g_getenv ("GTK_CSS_NO_CACHE") == NULL;
+
+  /* sections are not stored */
+  return use_cache && !gtk_keep_css_sections;
+}
+
+/* There is one cache file per URI, so changes to a file replace its
+ * cache file instead of adding more of them. The contents are checked
+ * when loading.
+ */
+static char *
+gtk_css_provider_get_cache_path (GFile *file)
+{
+  GChecksum *checksum;
+  guint32 version[4] = { GTK_MAJOR_VERSION, GTK_MINOR_VERSION, GTK_MICRO_VERSION, GTK_CSS_PRECOMPILED_VERSION };
+  char *uri, *filename, *path;
+
+  uri = g_file_get_uri (file);
+
+  /* Property parsing changes between versions, so include those */
+  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  g_checksum_update (checksum, (const guchar *) version, sizeof (version));
+  g_checksum_update (checksum, (const guchar *) uri, strlen (uri) + 1);
+
+  filename = g_strconcat (g_checksum_get_string (checksum), ".bin", NULL);
+  path = g_build_filename (g_get_user_cache_dir (), "gtk-4.0", "css", filename, NULL);
+
+  g_free (filename);
+  g_free (uri);
+  g_checksum_free (checksum);
+
+  return path;
+}
+
+/* Loads a stylesheet from the cache if it is there and up to date,
+ * or parses it and adds it to the cache.
+ */
+static void
+gtk_css_provider_load_cached (GtkCssProvider *self,
+                              GFile          *file,
+                              GBytes         *bytes)
+{
+  GBytes *precompiled;
+  char *path, *dir;
+  char *contents;
+  gsize length;
+
+  path = gtk_css_provider_get_cache_path (file);
+
+  if (g_file_get_contents (path, &contents, &length, NULL))
+    {
+      char *checksum;
+      gboolean loaded;
+
+      checksum = g_compute_checksum_for_bytes (G_CHECKSUM_SHA256, bytes);
+      precompiled = g_bytes_new_take (contents, length);
+      loaded = gtk_css_provider_load_precompiled (self, precompiled, checksum);
+      g_bytes_unref (precompiled);
+      g_free (checksum);
+
+      if (loaded)
+        {
+          g_free (path);
+          return;
+        }
+    }
+
+  precompiled = gtk_css_provider_parse_precompiled (self, file, bytes);
+  if (precompiled)
+    {
+      dir = g_path_get_dirname (path);
+      /* Failing to write the cache is fine, we'll try again next time */
+      if (g_mkdir_with_parents (dir, 0700) == 0)
+        g_file_set_contents (path,
+                             g_bytes_get_data (precompiled, NULL),
+                             g_bytes_get_size (precompiled),
+                             NULL);
+      g_free (dir);
+      g_bytes_unref (precompiled);
+    }
+
+  g_free (path);
+}
+
 static void
 gtk_css_provider_load_internal (GtkCssProvider *self,
                                 GtkCssScanner  *parent,
@@ -1052,19 +1849,36 @@ gtk_css_provider_load_internal (GtkCssProvider *self,
 
   if (bytes)
     {
-      GtkCssScanner *scanner;
-
-      scanner = gtk_css_scanner_new (self,
-                                     parent,
-                                     file,
-                                     bytes);
-
-      parse_stylesheet (scanner);
-
-      gtk_css_scanner_destroy (scanner);
+      if (gtk_css_provider_bytes_are_precompiled (bytes))
+        {
+          /* Precompiled stylesheets, like ones compiled into resources,
+           * are trusted to be up to date.
+           */
+          if (parent != NULL)
+            {
+              gtk_css_parser_error (parent->parser,
+                                    GTK_CSS_PARSER_ERROR_IMPORT,
+                                    gtk_css_parser_get_block_location (parent->parser),
+                                    gtk_css_parser_get_end_location (parent->parser),
+                                    "Cannot import precompiled stylesheets");
+            }
+          else if (!gtk_css_provider_load_precompiled (self, bytes, NULL))
+            {
+              GtkCssLocation empty = { 0, };
+              GtkCssSection *section = gtk_css_section_new (file, &empty, &empty);
+              GError *error = g_error_new_literal (GTK_CSS_PARSER_ERROR,
+                                                   GTK_CSS_PARSER_ERROR_FAILED,
+                                                   "Invalid precompiled stylesheet");
 
-      if (parent == NULL)
-        gtk_css_provider_postprocess (self);
+              gtk_css_style_provider_emit_error (GTK_STYLE_PROVIDER (self), section, error);
+              g_error_free (error);
+              gtk_css_section_unref (section);
+            }
+        }
+      else if (parent == NULL && file != NULL && gtk_css_provider_use_cache ())
+        gtk_css_provider_load_cached (self, file, bytes);
+      else
+        gtk_css_provider_parse (self, parent, file, bytes);
 
       g_bytes_unref (bytes);
     }
@@ -1192,6 +2006,58 @@ gtk_css_provider_load_from_resource (GtkCssProvider *css_provider,
   g_object_unref (file);
 }
 
+/*<private>
+ * gtk_css_provider_precompile:
+ * @css_provider: a #GtkCssProvider
+ * @file: the file to load
+ *
+ * Loads @file into @css_provider like gtk_css_provider_load_from_file()
+ * and returns a precompiled form of it. Precompiled stylesheets can be
+ * loaded with any of the loading functions, for example from resources,
+ * and are trusted to match the files they were created from.
+ *
+ * Returns: (nullable): the precompiled stylesheet or %NULL if it could
+ *   not be loaded without errors
+ */
+GBytes *
+gtk_css_provider_precompile (GtkCssProvider *css_provider,
+                             GFile          *file)
+{
+  GBytes *bytes, *result;
+  GError *error = NULL;
+
+  g_return_val_if_fail (GTK_IS_CSS_PROVIDER (css_provider), NULL);
+  g_return_val_if_fail (G_IS_FILE (file), NULL);
+
+  gtk_css_provider_reset (css_provider);
+
+  bytes = g_file_load_bytes (file, NULL, NULL, &error);
+  if (bytes == NULL)
+    {
+      GtkCssLocation empty = { 0, };
+      GtkCssSection *section = gtk_css_section_new (file, &empty, &empty);
+
+      gtk_css_style_provider_emit_error (GTK_STYLE_PROVIDER (css_provider), section, error);
+      gtk_css_section_unref (section);
+      g_error_free (error);
+      result = NULL;
+    }
+  else if (gtk_css_provider_bytes_are_precompiled (bytes))
+    {
+      result = gtk_css_provider_load_precompiled (css_provider, bytes, NULL) ? g_bytes_ref (bytes) : NULL;
+      g_bytes_unref (bytes);
+    }
+  else
+    {
+      result = gtk_css_provider_parse_precompiled (css_provider, file, bytes);
+      g_bytes_unref (bytes);
+    }
+
+  gtk_style_provider_changed (GTK_STYLE_PROVIDER (css_provider));
+
+  return result;
+}
+
 char *
 _gtk_get_theme_dir (void)
 {
@@ -28,6 +28,10 @@ const char *_gtk_css_provider_get_theme_dir (GtkCssProvider *provider);
 
 void   gtk_css_provider_set_keep_css_sections (void);
 
+GDK_AVAILABLE_IN_ALL
+GBytes *gtk_css_provider_precompile (GtkCssProvider *css_provider,
+                                     GFile          *file);
+
 G_END_DECLS
 
 #endif /* __GTK_CSS_PROVIDER_PRIVATE_H__ */
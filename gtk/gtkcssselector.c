@@ -126,6 +126,26 @@ struct _GtkCssSelectorTree
   gint32 matches_offset; /* pointers that we return as matches if selector matches */
 };
 
+/* The top level of the tree is indexed by selector when that selector is
+ * a name, class or id, so matching a node only visits the rules that can
+ * match its declaration, plus all top level rules with other selectors.
+ * The index is stored right in front of the root of the tree.
+ */
+typedef struct _GtkCssSelectorBuckets GtkCssSelectorBuckets;
+struct _GtkCssSelectorBuckets
+{
+  GHashTable *rules;                    /* GtkCssSelector => GtkCssSelectorTree */
+  const GtkCssSelectorTree **others;    /* NULL-terminated */
+};
+
+G_STATIC_ASSERT (sizeof (GtkCssSelectorBuckets) % sizeof (gpointer) == 0);
+
+static inline GtkCssSelectorBuckets *
+gtk_css_selector_tree_get_buckets (const GtkCssSelectorTree *tree)
+{
+  return (GtkCssSelectorBuckets *) ((guint8 *) tree - sizeof (GtkCssSelectorBuckets));
+}
+
 static gboolean
 gtk_css_selector_equal (const GtkCssSelector *a,
 			const GtkCssSelector *b)
@@ -1927,20 +1947,110 @@ gtk_css_selector_tree_match (const GtkCssSelectorTree      *tree,
   return TRUE;
 }
 
+static gboolean
+gtk_css_selector_is_bucketed (const GtkCssSelector *selector)
+{
+  return selector->class == &GTK_CSS_SELECTOR_NAME ||
+         selector->class == &GTK_CSS_SELECTOR_CLASS ||
+         selector->class == &GTK_CSS_SELECTOR_ID;
+}
+
+static void
+gtk_css_selector_tree_init_buckets (GtkCssSelectorTree *tree)
+{
+  GtkCssSelectorBuckets *buckets = gtk_css_selector_tree_get_buckets (tree);
+  const GtkCssSelectorTree *iter;
+  GPtrArray *others;
+
+  buckets->rules = g_hash_table_new ((GHashFunc) gtk_css_selector_hash_one,
+                                     (GEqualFunc) gtk_css_selector_equal);
+  others = g_ptr_array_new ();
+
+  for (iter = tree;
+       iter != NULL;
+       iter = gtk_css_selector_tree_get_sibling (iter))
+    {
+      /* The builder never puts the same selector on one level twice,
+       * but don't lose rules if a deserialized tree does. */
+      if (gtk_css_selector_is_bucketed (&iter->selector) &&
+          !g_hash_table_contains (buckets->rules, &iter->selector))
+        g_hash_table_insert (buckets->rules, (gpointer) &iter->selector, (gpointer) iter);
+      else
+        g_ptr_array_add (others, (gpointer) iter);
+    }
+
+  g_ptr_array_add (others, NULL);
+  buckets->others = (const GtkCssSelectorTree **) g_ptr_array_free (others, FALSE);
+}
+
+static inline void
+gtk_css_selector_tree_add_candidate (const GtkCssSelectorBuckets *buckets,
+                                     const GtkCssSelector        *key,
+                                     GtkCssSelectorMatches       *candidates)
+{
+  const GtkCssSelectorTree *tree;
+
+  tree = g_hash_table_lookup (buckets->rules, key);
+  if (tree)
+    gtk_css_selector_matches_append (candidates, (gpointer) tree);
+}
+
+/* Collects the top level rules of @tree that may match @node */
+static void
+gtk_css_selector_tree_get_candidates (const GtkCssSelectorTree *tree,
+                                      GtkCssNode               *node,
+                                      GtkCssSelectorMatches    *candidates)
+{
+  const GtkCssSelectorBuckets *buckets = gtk_css_selector_tree_get_buckets (tree);
+  GtkCssSelector key;
+  const GQuark *classes;
+  guint i, n_classes;
+
+  key.name.class = &GTK_CSS_SELECTOR_NAME;
+  key.name.name = gtk_css_node_get_name (node);
+  gtk_css_selector_tree_add_candidate (buckets, &key, candidates);
+
+  key.id.name = gtk_css_node_get_id (node);
+  if (key.id.name)
+    {
+      key.id.class = &GTK_CSS_SELECTOR_ID;
+      gtk_css_selector_tree_add_candidate (buckets, &key, candidates);
+    }
+
+  classes = gtk_css_node_list_classes (node, &n_classes);
+  key.style_class.class = &GTK_CSS_SELECTOR_CLASS;
+  for (i = 0; i < n_classes; i++)
+    {
+      key.style_class.style_class = classes[i];
+      gtk_css_selector_tree_add_candidate (buckets, &key, candidates);
+    }
+
+  for (i = 0; buckets->others[i] != NULL; i++)
+    gtk_css_selector_matches_append (candidates, (gpointer) buckets->others[i]);
+}
+
 void
 _gtk_css_selector_tree_match_all (const GtkCssSelectorTree     *tree,
                                   const GtkCountingBloomFilter *filter,
                                   GtkCssNode                   *node,
                                   GtkCssSelectorMatches        *out_tree_rules)
 {
-  const GtkCssSelectorTree *iter;
+  GtkCssSelectorMatches candidates;
+  guint i;
 
-  for (iter = tree;
-       iter != NULL;
-       iter = gtk_css_selector_tree_get_sibling (iter))
+  if (tree == NULL)
+    return;
+
+  gtk_css_selector_matches_init (&candidates);
+  gtk_css_selector_tree_get_candidates (tree, node, &candidates);
+
+  for (i = 0; i < gtk_css_selector_matches_get_size (&candidates); i++)
     {
-      gtk_css_selector_tree_match (iter, filter, FALSE, node, out_tree_rules);
+      gtk_css_selector_tree_match (gtk_css_selector_matches_get (&candidates, i),
+                                   filter, FALSE, node, out_tree_rules);
     }
+
+  gtk_css_selector_matches_clear (&candidates);
 }
 
 gboolean
@@ -1956,9 +2066,28 @@ gtk_css_selector_tree_get_change_all (const GtkCssSelectorTree     *tree,
 {
   GtkCssChange change = 0;
 
-  for (; tree != NULL;
-       tree = gtk_css_selector_tree_get_sibling (tree))
-    change |= gtk_css_selector_tree_get_change (tree, filter, node, FALSE);
+  if (tree != NULL && node != NULL)
+    {
+      GtkCssSelectorMatches candidates;
+      guint i;
+
+      /* Top level rules with a name, class or id that doesn't
+       * match the node don't contribute any change */
+      gtk_css_selector_matches_init (&candidates);
+      gtk_css_selector_tree_get_candidates (tree, node, &candidates);
+
+      for (i = 0; i < gtk_css_selector_matches_get_size (&candidates); i++)
+        change |= gtk_css_selector_tree_get_change (gtk_css_selector_matches_get (&candidates, i),
+                                                    filter, node, FALSE);
+
+      gtk_css_selector_matches_clear (&candidates);
+    }
+  else
+    {
+      for (; tree != NULL;
+           tree = gtk_css_selector_tree_get_sibling (tree))
+        change |= gtk_css_selector_tree_get_change (tree, filter, node, FALSE);
+    }
 
   /* Never return reserved bit set */
   return change & ~GTK_CSS_CHANGE_RESERVED_BIT;
@@ -2070,10 +2199,17 @@ _gtk_css_selector_tree_match_print (const GtkCssSelectorTree *tree,
 void
 _gtk_css_selector_tree_free (GtkCssSelectorTree *tree)
 {
+  GtkCssSelectorBuckets *buckets;
+
   if (tree == NULL)
     return;
 
-  g_free (tree);
+  buckets = gtk_css_selector_tree_get_buckets (tree);
+  g_hash_table_unref (buckets->rules);
+  g_free (buckets->others);
+
+  /* The buckets are at the start of the allocation */
+  g_free (buckets);
 }
 
 
@@ -2279,7 +2415,12 @@ _gtk_css_selector_tree_builder_build (GtkCssSelectorTreeBuilder *builder)
   guint i;
   GtkCssSelectorRuleSetInfo **infos_array;
 
+  if (builder->infos->len == 0)
+    return NULL;
+
+  /* Leave room for the buckets in front of the tree */
   array = g_byte_array_new ();
+  g_byte_array_set_size (array, sizeof (GtkCssSelectorBuckets));
 
   infos_array = g_alloca (sizeof (GtkCssSelectorRuleSetInfo *) * builder->infos->len);
   for (i = 0; i < builder->infos->len; i++)
@@ -2293,7 +2434,7 @@ _gtk_css_selector_tree_builder_build (GtkCssSelectorTreeBuilder *builder)
   /* shrink to final size */
   data = g_realloc (data, len);
 
-  tree = (GtkCssSelectorTree *)data;
+  tree = (GtkCssSelectorTree *) (data + sizeof (GtkCssSelectorBuckets));
 
   fixup_offsets (tree, data);
 
@@ -2306,6 +2447,8 @@ _gtk_css_selector_tree_builder_build (GtkCssSelectorTreeBuilder *builder)
 	*info->selector_match = (GtkCssSelectorTree *)(data + GPOINTER_TO_UINT (*info->selector_match));
     }
 
+  gtk_css_selector_tree_init_buckets (tree);
+
 
 #ifdef PRINT_TREE
   {
@@ -2318,3 +2461,331 @@ _gtk_css_selector_tree_builder_build (GtkCssSelectorTreeBuilder *builder)
 
   return tree;
 }
+
+/* Serializing trees
+ *
+ * The tree is stored as the number of nodes followed by one record per
+ * node, in the same depth-first order that the builder uses, so the root
+ * is the first node and parents come before their children and siblings.
+ * A record is:
+ *
+ * - the index of the selector class in selector_classes
+ * - the data of the selector: the name for names, classes and ids,
+ *   the flags for states and the type, a and b for positions
+ * - the node indices of the parent, previous and sibling nodes
+ * - the number of matches followed by their indices
+ *
+ * Quarks are stored as strings and matches are stored as indices that
+ * the caller maps to its own data.
+ */
+static const GtkCssSelectorClass * const selector_classes[] = {
+  &GTK_CSS_SELECTOR_DESCENDANT,
+  &GTK_CSS_SELECTOR_CHILD,
+  &GTK_CSS_SELECTOR_SIBLING,
+  &GTK_CSS_SELECTOR_ADJACENT,
+  &GTK_CSS_SELECTOR_ANY,
+  &GTK_CSS_SELECTOR_NOT_ANY,
+  &GTK_CSS_SELECTOR_NAME,
+  &GTK_CSS_SELECTOR_NOT_NAME,
+  &GTK_CSS_SELECTOR_CLASS,
+  &GTK_CSS_SELECTOR_NOT_CLASS,
+  &GTK_CSS_SELECTOR_ID,
+  &GTK_CSS_SELECTOR_NOT_ID,
+  &GTK_CSS_SELECTOR_PSEUDOCLASS_STATE,
+  &GTK_CSS_SELECTOR_NOT_PSEUDOCLASS_STATE,
+  &GTK_CSS_SELECTOR_PSEUDOCLASS_POSITION,
+  &GTK_CSS_SELECTOR_NOT_PSEUDOCLASS_POSITION,
+};
+
+#define NO_INDEX G_MAXUINT32
+
+static void
+collect_tree_nodes (const GtkCssSelectorTree *tree,
+                    GPtrArray                *nodes)
+{
+  while (tree != NULL)
+    {
+      g_ptr_array_add (nodes, (gpointer) tree);
+      collect_tree_nodes (gtk_css_selector_tree_get_previous (tree), nodes);
+      tree = gtk_css_selector_tree_get_sibling (tree);
+    }
+}
+
+static guint32
+lookup_tree_node (GHashTable               *indices,
+                  const GtkCssSelectorTree *tree)
+{
+  if (tree == NULL)
+    return NO_INDEX;
+
+  return GPOINTER_TO_UINT (g_hash_table_lookup (indices, tree)) - 1;
+}
+
+static guint32
+lookup_selector_class (const GtkCssSelectorClass *class)
+{
+  guint32 i;
+
+  for (i = 0; i < G_N_ELEMENTS (selector_classes); i++)
+    {
+      if (selector_classes[i] == class)
+        return i;
+    }
+
+  g_assert_not_reached ();
+  return NO_INDEX;
+}
+
+static void
+gtk_css_selector_serialize (const GtkCssSelector *selector,
+                            GByteArray           *data)
+{
+  gtk_css_binary_write_uint (data, lookup_selector_class (selector->class));
+
+  if (selector->class == &GTK_CSS_SELECTOR_NAME ||
+      selector->class == &GTK_CSS_SELECTOR_NOT_NAME)
+    gtk_css_binary_write_string (data, g_quark_to_string (selector->name.name));
+  else if (selector->class == &GTK_CSS_SELECTOR_CLASS ||
+           selector->class == &GTK_CSS_SELECTOR_NOT_CLASS)
+    gtk_css_binary_write_string (data, g_quark_to_string (selector->style_class.style_class));
+  else if (selector->class == &GTK_CSS_SELECTOR_ID ||
+           selector->class == &GTK_CSS_SELECTOR_NOT_ID)
+    gtk_css_binary_write_string (data, g_quark_to_string (selector->id.name));
+  else if (selector->class == &GTK_CSS_SELECTOR_PSEUDOCLASS_STATE ||
+           selector->class == &GTK_CSS_SELECTOR_NOT_PSEUDOCLASS_STATE)
+    gtk_css_binary_write_uint (data, selector->state.state);
+  else if (selector->class == &GTK_CSS_SELECTOR_PSEUDOCLASS_POSITION ||
+           selector->class == &GTK_CSS_SELECTOR_NOT_PSEUDOCLASS_POSITION)
+    {
+      gtk_css_binary_write_uint (data, selector->position.type);
+      gtk_css_binary_write_uint (data, (gint32) selector->position.a);
+      gtk_css_binary_write_uint (data, (gint32) selector->position.b);
+    }
+}
+
+static gboolean
+gtk_css_selector_deserialize (GtkCssSelector     *selector,
+                              GtkCssBinaryReader *reader)
+{
+  guint32 class_index;
+
+  class_index = gtk_css_binary_reader_read_uint (reader);
+  if (class_index >= G_N_ELEMENTS (selector_classes))
+    return FALSE;
+
+  selector->class = selector_classes[class_index];
+
+  if (selector->class == &GTK_CSS_SELECTOR_NAME ||
+      selector->class == &GTK_CSS_SELECTOR_NOT_NAME)
+    selector->name.name = g_quark_from_string (gtk_css_binary_reader_read_string (reader));
+  else if (selector->class == &GTK_CSS_SELECTOR_CLASS ||
+           selector->class == &GTK_CSS_SELECTOR_NOT_CLASS)
+    selector->style_class.style_class = g_quark_from_string (gtk_css_binary_reader_read_string (reader));
+  else if (selector->class == &GTK_CSS_SELECTOR_ID ||
+           selector->class == &GTK_CSS_SELECTOR_NOT_ID)
+    selector->id.name = g_quark_from_string (gtk_css_binary_reader_read_string (reader));
+  else if (selector->class == &GTK_CSS_SELECTOR_PSEUDOCLASS_STATE ||
+           selector->class == &GTK_CSS_SELECTOR_NOT_PSEUDOCLASS_STATE)
+    selector->state.state = gtk_css_binary_reader_read_uint (reader);
+  else if (selector->class == &GTK_CSS_SELECTOR_PSEUDOCLASS_POSITION ||
+           selector->class == &GTK_CSS_SELECTOR_NOT_PSEUDOCLASS_POSITION)
+    {
+      guint32 type = gtk_css_binary_reader_read_uint (reader);
+
+      if (type > POSITION_ONLY)
+        return FALSE;
+
+      selector->position.type = type;
+      selector->position.a = (gint32) gtk_css_binary_reader_read_uint (reader);
+      selector->position.b = (gint32) gtk_css_binary_reader_read_uint (reader);
+    }
+
+  return !reader->error;
+}
+
+/*<private>
+ * _gtk_css_selector_tree_serialize:
+ * @tree: (nullable): the tree to serialize
+ * @data: the array to append the serialized tree to
+ * @match_index: function returning the index to store for a match
+ * @user_data: data to pass to @match_index
+ *
+ * Appends @tree to @data so it can be recreated with
+ * _gtk_css_selector_tree_deserialize() without building it again.
+ **/
+void
+_gtk_css_selector_tree_serialize (const GtkCssSelectorTree        *tree,
+                                  GByteArray                      *data,
+                                  GtkCssSelectorTreeSerializeFunc  match_index,
+                                  gpointer                         user_data)
+{
+  GHashTable *indices;
+  GPtrArray *nodes;
+  guint i;
+
+  nodes = g_ptr_array_new ();
+  collect_tree_nodes (tree, nodes);
+
+  indices = g_hash_table_new (NULL, NULL);
+  for (i = 0; i < nodes->len; i++)
+    g_hash_table_insert (indices, g_ptr_array_index (nodes, i), GUINT_TO_POINTER (i + 1));
+
+  gtk_css_binary_write_uint (data, nodes->len);
+
+  for (i = 0; i < nodes->len; i++)
+    {
+      const GtkCssSelectorTree *node = g_ptr_array_index (nodes, i);
+      gpointer *matches;
+      guint32 n_matches;
+
+      gtk_css_selector_serialize (&node->selector, data);
+
+      gtk_css_binary_write_uint (data, lookup_tree_node (indices, gtk_css_selector_tree_get_parent (node)));
+      gtk_css_binary_write_uint (data, lookup_tree_node (indices, gtk_css_selector_tree_get_previous (node)));
+      gtk_css_binary_write_uint (data, lookup_tree_node (indices, gtk_css_selector_tree_get_sibling (node)));
+
+      matches = gtk_css_selector_tree_get_matches (node);
+      for (n_matches = 0; matches && matches[n_matches]; n_matches++)
+        ;
+
+      gtk_css_binary_write_uint (data, n_matches);
+      for (n_matches = 0; matches && matches[n_matches]; n_matches++)
+        gtk_css_binary_write_uint (data, match_index (matches[n_matches], user_data));
+    }
+
+  g_hash_table_unref (indices);
+  g_ptr_array_unref (nodes);
+}
+
+static gint32
+relative_offset (const gsize *offsets,
+                 guint32      from,
+                 guint32      to)
+{
+  if (to == NO_INDEX)
+    return GTK_CSS_SELECTOR_TREE_EMPTY_OFFSET;
+
+  return (gint32) offsets[to] - (gint32) offsets[from];
+}
+
+/*<private>
+ * _gtk_css_selector_tree_deserialize:
+ * @reader: the reader to read the tree from
+ * @out_tree: (out) (transfer full) (nullable): return location for the tree
+ * @get_match: function returning the match for a stored index
+ * @user_data: data to pass to @get_match
+ *
+ * Recreates a tree that was stored with _gtk_css_selector_tree_serialize().
+ *
+ * @get_match is called with every node that has matches, so callers can
+ * remember the node that matches their data.
+ *
+ * Returns: %TRUE if the tree could be read
+ **/
+gboolean
+_gtk_css_selector_tree_deserialize (GtkCssBinaryReader                *reader,
+                                    GtkCssSelectorTree               **out_tree,
+                                    GtkCssSelectorTreeDeserializeFunc  get_match,
+                                    gpointer                           user_data)
+{
+  GtkCssSelectorTree *tree;
+  GtkCssSelector selector;
+  gsize *offsets;
+  gsize start, size;
+  guint32 i, j, n_nodes;
+  guint8 *data;
+
+  *out_tree = NULL;
+
+  n_nodes = gtk_css_binary_reader_read_uint (reader);
+  if (reader->error)
+    return FALSE;
+  if (n_nodes == 0)
+    return TRUE;
+  /* every record takes at least 5 words */
+  if (n_nodes > (reader->size - reader->pos) / (5 * sizeof (guint32)))
+    return FALSE;
+
+  /* First pass: validate and lay out the nodes */
+  start = reader->pos;
+  offsets = g_new (gsize, n_nodes);
+  /* Leave room for the buckets in front of the tree */
+  size = sizeof (GtkCssSelectorBuckets);
+  for (i = 0; i < n_nodes; i++)
+    {
+      guint32 parent, previous, sibling, n_matches;
+
+      if (!gtk_css_selector_deserialize (&selector, reader))
+        goto fail;
+
+      parent = gtk_css_binary_reader_read_uint (reader);
+      previous = gtk_css_binary_reader_read_uint (reader);
+      sibling = gtk_css_binary_reader_read_uint (reader);
+      n_matches = gtk_css_binary_reader_read_uint (reader);
+
+      /* Enforce the depth-first order so the tree can't contain loops */
+      if ((parent != NO_INDEX && parent >= i) ||
+          (previous != NO_INDEX && (previous <= i || previous >= n_nodes)) ||
+          (sibling != NO_INDEX && (sibling <= i || sibling >= n_nodes)) ||
+          n_matches > (reader->size - reader->pos) / sizeof (guint32))
+        goto fail;
+
+      for (j = 0; j < n_matches; j++)
+        gtk_css_binary_reader_read_uint (reader);
+
+      offsets[i] = size;
+      size += sizeof (GtkCssSelectorTree);
+      if (n_matches > 0)
+        size += (n_matches + 1) * sizeof (gpointer);
+
+      if (reader->error || size > G_MAXINT32)
+        goto fail;
+    }
+
+  /* Second pass: create the nodes */
+  reader->pos = start;
+  data = g_malloc0 (size);
+  for (i = 0; i < n_nodes; i++)
+    {
+      guint32 n_matches;
+
+      tree = (GtkCssSelectorTree *) (data + offsets[i]);
+
+      gtk_css_selector_deserialize (&tree->selector, reader);
+      tree->parent_offset = relative_offset (offsets, i, gtk_css_binary_reader_read_uint (reader));
+      tree->previous_offset = relative_offset (offsets, i, gtk_css_binary_reader_read_uint (reader));
+      tree->sibling_offset = relative_offset (offsets, i, gtk_css_binary_reader_read_uint (reader));
+
+      n_matches = gtk_css_binary_reader_read_uint (reader);
+      if (n_matches > 0)
+        {
+          gpointer *matches = (gpointer *) (tree + 1);
+
+          tree->matches_offset = sizeof (GtkCssSelectorTree);
+          for (j = 0; j < n_matches; j++)
+            {
+              matches[j] = get_match (gtk_css_binary_reader_read_uint (reader), tree, user_data);
+              if (matches[j] == NULL)
+                {
+                  g_free (data);
+                  goto fail;
+                }
+            }
+          matches[n_matches] = NULL;
+        }
+      else
+        tree->matches_offset = GTK_CSS_SELECTOR_TREE_EMPTY_OFFSET;
+    }
+
+  *out_tree = (GtkCssSelectorTree *) (data + offsets[0]);
+  g_free (offsets);
+
+  gtk_css_selector_tree_init_buckets (*out_tree);
+
+  return TRUE;
+
+fail:
+  g_free (offsets);
+  reader->error = TRUE;
+  return FALSE;
+}
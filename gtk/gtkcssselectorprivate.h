@@ -22,6 +22,7 @@
 #include "gtk/css/gtkcsstokenizerprivate.h"
 #include "gtk/css/gtkcssparserprivate.h"
 #include "gtk/gtkcountingbloomfilterprivate.h"
+#include "gtk/gtkcssbinaryprivate.h"
 #include "gtk/gtkcsstypesprivate.h"
 
 #define GDK_ARRAY_ELEMENT_TYPE gpointer
@@ -36,6 +37,12 @@ typedef union _GtkCssSelector GtkCssSelector;
 typedef struct _GtkCssSelectorTree GtkCssSelectorTree;
 typedef struct _GtkCssSelectorTreeBuilder GtkCssSelectorTreeBuilder;
 
+typedef guint32  (* GtkCssSelectorTreeSerializeFunc)   (gpointer                  match,
+                                                        gpointer                  user_data);
+typedef gpointer (* GtkCssSelectorTreeDeserializeFunc) (guint32                   index,
+                                                        const GtkCssSelectorTree *tree,
+                                                        gpointer                  user_data);
+
 GtkCssSelector *  _gtk_css_selector_parse           (GtkCssParser           *parser);
 void              _gtk_css_selector_free            (GtkCssSelector         *selector);
 
@@ -71,6 +78,15 @@ void                       _gtk_css_selector_tree_builder_add   (GtkCssSelectorT
 GtkCssSelectorTree *       _gtk_css_selector_tree_builder_build (GtkCssSelectorTreeBuilder *builder);
 void                       _gtk_css_selector_tree_builder_free  (GtkCssSelectorTreeBuilder *builder);
 
+void         _gtk_css_selector_tree_serialize        (const GtkCssSelectorTree          *tree,
+                                                      GByteArray                        *data,
+                                                      GtkCssSelectorTreeSerializeFunc    match_index,
+                                                      gpointer                           user_data);
+gboolean     _gtk_css_selector_tree_deserialize      (GtkCssBinaryReader                *reader,
+                                                      GtkCssSelectorTree               **out_tree,
+                                                      GtkCssSelectorTreeDeserializeFunc  get_match,
+                                                      gpointer                           user_data);
+
 G_END_DECLS
 
 #endif /* __GTK_CSS_SELECTOR_PRIVATE_H__ */
@@ -38,6 +38,7 @@
 #include "gtkstylepropertyprivate.h"
 #include "gtkstyleproviderprivate.h"
 #include "gtkcssdimensionvalueprivate.h"
+#include "gdkprofilerprivate.h"
 
 static void gtk_css_static_style_compute_value (GtkCssStaticStyle *style,
                                                 GtkStyleProvider  *provider,
@@ -213,6 +214,8 @@ gtk_css_ ## NAME ## _values_new_compute (GtkCssStaticStyle *sstyle, \
                                           lookup->values[id].value, \
                                           lookup->values[id].section); \
     } \
+\
+  style->NAME = (GtkCss ## TYPE ## Values *)gtk_css_values_intern ((GtkCssValues *)style->NAME); \
 } \
 static GtkBitmask * gtk_css_ ## NAME ## _values_mask; \
 static GtkCssValues * gtk_css_ ## NAME ## _initial_values; \
@@ -982,24 +985,80 @@ gtk_css_lookup_resolve (GtkCssLookup      *lookup,
     gtk_css_other_values_new_compute (sstyle, provider, parent_style, lookup);
 }
 
+/* Time spent matching selectors on the main thread, for the profiler */
+static gint64 matching_time;
+static guint matched_nodes;
+
 GtkCssStyle *
 gtk_css_static_style_new_compute (GtkStyleProvider             *provider,
                                   const GtkCountingBloomFilter *filter,
                                   GtkCssNode                   *node,
                                   GtkCssChange                  change)
 {
-  GtkCssStaticStyle *result;
+  GtkCssStyle *result;
   GtkCssLookup lookup;
-  GtkCssNode *parent;
 
   _gtk_css_lookup_init (&lookup);
 
   if (node)
-    gtk_style_provider_lookup (provider,
-                               filter,
-                               node,
-                               &lookup,
-                               change == 0 ? &change : NULL);
+    {
+      gint64 before G_GNUC_UNUSED;
+
+      before = GDK_PROFILER_IS_RUNNING ? GDK_PROFILER_CURRENT_TIME : 0;
+
+      gtk_style_provider_lookup (provider,
+                                 filter,
+                                 node,
+                                 &lookup,
+                                 change == 0 ? &change : NULL);
+
+      if (GDK_PROFILER_IS_RUNNING)
+        {
+          matching_time += GDK_PROFILER_CURRENT_TIME - before;
+          matched_nodes++;
+        }
+    }
+
+  result = gtk_css_static_style_new_for_lookup (provider, node, &lookup, change);
+
+  _gtk_css_lookup_destroy (&lookup);
+
+  return result;
+}
+
+/*
+ * gtk_css_static_style_take_matching_time:
+ * @n_nodes: (out): the number of nodes that were matched
+ *
+ * Returns the time gtk_css_static_style_new_compute() spent matching
+ * selectors since the last call, while the profiler was running.
+ *
+ * Returns: the time spent matching
+ */
+gint64
+gtk_css_static_style_take_matching_time (guint *n_nodes)
+{
+  gint64 result = matching_time;
+
+  *n_nodes = matched_nodes;
+  matching_time = 0;
+  matched_nodes = 0;
+
+  return result;
+}
+
+/* Computes a style from the result of gtk_style_provider_lookup().
+ * This is split from the matching so that the lookup can be done
+ * ahead of time, see gtk_css_node_validate().
+ */
+GtkCssStyle *
+gtk_css_static_style_new_for_lookup (GtkStyleProvider *provider,
+                                     GtkCssNode       *node,
+                                     GtkCssLookup     *lookup,
+                                     GtkCssChange      change)
+{
+  GtkCssStaticStyle *result;
+  GtkCssNode *parent;
 
   result = g_object_new (GTK_TYPE_CSS_STATIC_STYLE, NULL);
 
@@ -1010,13 +1069,11 @@ gtk_css_static_style_new_compute (GtkStyleProvider             *provider,
   else
     parent = NULL;
 
-  gtk_css_lookup_resolve (&lookup,
+  gtk_css_lookup_resolve (lookup,
                           provider,
                           result,
                           parent ? gtk_css_node_get_style (parent) : NULL);
 
-  _gtk_css_lookup_destroy (&lookup);
-
   return GTK_CSS_STYLE (result);
 }
 
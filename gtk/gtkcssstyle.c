@@ -39,6 +39,8 @@
 #include "gtkstylepropertyprivate.h"
 #include "gtkstyleproviderprivate.h"
 
+#include <string.h>
+
 G_DEFINE_ABSTRACT_TYPE (GtkCssStyle, gtk_css_style, G_TYPE_OBJECT)
 
 static GtkCssSection *
@@ -712,12 +714,107 @@ GtkCssValues *gtk_css_values_ref (GtkCssValues *values)
   return values;
 }
 
+/* Interning
+ *
+ * Computed value groups that contain the same values are shared, so the
+ * many nodes that end up with the same border or font only keep a
+ * single copy. Groups are compared by the pointers of their values,
+ * which is cheap and catches groups computed from the same declarations.
+ *
+ * Interned groups must not be modified. The table does not hold a
+ * reference, groups remove themselves when they are freed.
+ */
+static GHashTable *interned_values;
+
+static guint
+gtk_css_values_hash (gconstpointer data)
+{
+  const GtkCssValues *values = data;
+  GtkCssValue **v = GET_VALUES (values);
+  guint hash = values->type;
+  int i;
+
+  for (i = 0; i < N_VALUES (values->type); i++)
+    hash = (hash << 5) - hash + (guint) (GPOINTER_TO_SIZE (v[i]) >> 4);
+
+  return hash;
+}
+
+static gboolean
+gtk_css_values_equal (gconstpointer data1,
+                      gconstpointer data2)
+{
+  const GtkCssValues *values1 = data1;
+  const GtkCssValues *values2 = data2;
+
+  return values1->type == values2->type &&
+         memcmp (GET_VALUES (values1),
+                 GET_VALUES (values2),
+                 N_VALUES (values1->type) * sizeof (GtkCssValue *)) == 0;
+}
+
+/* Consumes @values and returns either it or a new reference
+ * to an equal group that is already in use.
+ */
+GtkCssValues *
+gtk_css_values_intern (GtkCssValues *values)
+{
+  GtkCssValues *existing;
+
+  if (G_UNLIKELY (interned_values == NULL))
+    interned_values = g_hash_table_new (gtk_css_values_hash, gtk_css_values_equal);
+
+  existing = g_hash_table_lookup (interned_values, values);
+  if (existing)
+    {
+      gtk_css_values_unref (values);
+      return gtk_css_values_ref (existing);
+    }
+
+  values->interned = TRUE;
+  g_hash_table_add (interned_values, values);
+
+  return values;
+}
+
+/* For the inspector. Every user of an interned group past the first
+ * one counts as a copy of the group that was saved.
+ */
+void
+gtk_css_values_get_statistics (guint *n_groups,
+                               guint *n_users,
+                               gsize *n_bytes_saved)
+{
+  GHashTableIter iter;
+  gpointer key;
+
+  *n_groups = 0;
+  *n_users = 0;
+  *n_bytes_saved = 0;
+
+  if (interned_values == NULL)
+    return;
+
+  g_hash_table_iter_init (&iter, interned_values);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      GtkCssValues *values = key;
+
+      *n_groups += 1;
+      *n_users += values->ref_count;
+      *n_bytes_saved += (values->ref_count - 1) * VALUES_SIZE (values->type);
+    }
+}
+
 static void
 gtk_css_values_free (GtkCssValues *values)
 {
   int i;
   GtkCssValue **v = GET_VALUES (values);
 
+  if (values->interned)
+    g_hash_table_remove (interned_values, values);
+
   for (i = 0; i < N_VALUES (values->type); i++)
     {
       if (v[i])
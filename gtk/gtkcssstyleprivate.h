@@ -75,7 +75,8 @@ typedef struct _GtkCssOtherValues GtkCssOtherValues;
 
 struct _GtkCssValues {
   int ref_count;
-  GtkCssValuesType type;
+  guint type : 8; /* GtkCssValuesType */
+  guint interned : 1;
 };
 
 struct _GtkCssCoreValues {
@@ -269,6 +270,11 @@ GtkCssValues *gtk_css_values_new   (GtkCssValuesType  type);
 GtkCssValues *gtk_css_values_ref   (GtkCssValues     *values);
 void          gtk_css_values_unref (GtkCssValues     *values);
 GtkCssValues *gtk_css_values_copy  (GtkCssValues     *values);
+GtkCssValues *gtk_css_values_intern (GtkCssValues    *values);
+
+void          gtk_css_values_get_statistics (guint *n_groups,
+                                             guint *n_users,
+                                             gsize *n_bytes_saved);
 
 void gtk_css_core_values_compute_changes_and_affects (GtkCssStyle *style1,
                                                       GtkCssStyle *style2,
@@ -53,6 +53,8 @@ typedef enum {
   GTK_DEBUG_CONSTRAINTS     = 1 << 15,
   GTK_DEBUG_BUILDER_OBJECTS = 1 << 16,
   GTK_DEBUG_A11Y            = 1 << 17,
+  GTK_DEBUG_CSS_SERIAL      = 1 << 18,
+  GTK_DEBUG_CSS             = 1 << 19,
 } GtkDebugFlags;
 
 #ifdef G_ENABLE_DEBUG
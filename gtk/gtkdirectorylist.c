@@ -19,11 +19,13 @@
 
 #include "config.h"
 
-#include "gtkdirectorylist.h"
+#include "gtkdirectorylistprivate.h"
 
 #include "gtkintl.h"
 #include "gtkprivate.h"
 
+#include <string.h>
+
 /**
  * SECTION:gtkdirectorylist
  * @title: GtkDirectoryList
@@ -50,14 +52,27 @@
  * This means you do not need access to the #GtkDirectoryList but can access
  * the #GFile directly from the #GFileInfo when operating with a #GtkListView
  * or similar.
+ *
+ * Files that have been loaded are not added one batch at a time, but
+ * announced together about once per frame, so that loading large
+ * directories does not cause a flood of #GListModel::items-changed
+ * emissions.
+ *
+ * For large directories, gtk_directory_list_set_compact() can be used to
+ * store only the queried attributes in a compact form and create the
+ * #GFileInfos only when they are requested.
  */
 
 /* random number that everyone else seems to use, too */
 #define FILES_PER_QUERY 100
 
+/* how often loaded files get added to the model, about once per frame */
+#define FLUSH_INTERVAL_MS 16
+
 enum {
   PROP_0,
   PROP_ATTRIBUTES,
+  PROP_COMPACT,
   PROP_ERROR,
   PROP_FILE,
   PROP_IO_PRIORITY,
@@ -74,13 +89,31 @@ struct _GtkDirectoryList
   GFile *file;
   GFileMonitor *monitor;
   gboolean monitored;
+  gboolean compact;
   int io_priority;
 
   GCancellable *cancellable;
   GError *error; /* Error while loading */
-  GSequence *items; /* Use GPtrArray or GListStore here? */
+  GPtrArray *items; /* GFileInfos or compact entries */
+  guint n_announced; /* items we emitted ::items-changed for, the rest is pending */
+  guint flush_cb;
+
+  /* for compact entries */
+  GPtrArray *attribute_names; /* id => attribute name */
+  GHashTable *attribute_ids; /* attribute name => id + 1 */
+  GHashTable *infos; /* compact entry => GWeakRef to its GFileInfo */
 };
 
+/* Compact entries are a single allocation containing the basename of
+ * the file followed by the number of attributes as guint16 and then
+ * the attributes, each as guint16 id, a guint8 GFileAttributeType and
+ * the value.
+ *
+ * The GFileInfos created from them are tracked with weak refs so that
+ * asking for the same item again returns the same GFileInfo. Infos can
+ * be finalized on any thread, so they don't get to call back.
+ */
+
 struct _GtkDirectoryListClass
 {
   GObjectClass parent_class;
@@ -99,7 +132,307 @@ gtk_directory_list_get_n_items (GListModel *list)
 {
   GtkDirectoryList *self = GTK_DIRECTORY_LIST (list);
 
-  return g_sequence_get_length (self->items);
+  return self->n_announced;
+}
+
+static guint16
+gtk_directory_list_get_attribute_id (GtkDirectoryList *self,
+                                     const char       *attribute)
+{
+  gpointer id;
+
+  id = g_hash_table_lookup (self->attribute_ids, attribute);
+  if (id)
+    return GPOINTER_TO_UINT (id) - 1;
+
+  g_ptr_array_add (self->attribute_names, g_strdup (attribute));
+  g_hash_table_insert (self->attribute_ids,
+                       g_ptr_array_index (self->attribute_names, self->attribute_names->len - 1),
+                       GUINT_TO_POINTER (self->attribute_names->len));
+
+  return self->attribute_names->len - 1;
+}
+
+static void
+append_data (GByteArray *data,
+             gconstpointer value,
+             gsize       size)
+{
+  g_byte_array_append (data, value, size);
+}
+
+static void
+append_string (GByteArray *data,
+               const char *string)
+{
+  append_data (data, string, strlen (string) + 1);
+}
+
+gpointer
+gtk_directory_list_compact_info (GtkDirectoryList *self,
+                                 GFile            *file,
+                                 GFileInfo        *info)
+{
+  GByteArray *data;
+  char **attributes;
+  char *basename;
+  guint16 n_attributes;
+  gsize n_pos;
+  guint i;
+
+  data = g_byte_array_new ();
+
+  basename = g_file_get_basename (file);
+  append_string (data, basename);
+  g_free (basename);
+
+  n_pos = data->len;
+  n_attributes = 0;
+  append_data (data, &n_attributes, sizeof (guint16));
+
+  attributes = g_file_info_list_attributes (info, NULL);
+  for (i = 0; attributes[i] && n_attributes < G_MAXUINT16; i++)
+    {
+      GFileAttributeType type;
+      guint16 id;
+      guint8 type8;
+
+      type = g_file_info_get_attribute_type (info, attributes[i]);
+      if (type == G_FILE_ATTRIBUTE_TYPE_INVALID)
+        continue;
+      if (type == G_FILE_ATTRIBUTE_TYPE_OBJECT &&
+          !G_IS_ICON (g_file_info_get_attribute_object (info, attributes[i])))
+        continue;
+      if (self->attribute_names->len >= G_MAXUINT16 &&
+          !g_hash_table_contains (self->attribute_ids, attributes[i]))
+        continue;
+
+      id = gtk_directory_list_get_attribute_id (self, attributes[i]);
+      type8 = type;
+      append_data (data, &id, sizeof (guint16));
+      append_data (data, &type8, sizeof (guint8));
+
+      switch (type)
+        {
+        case G_FILE_ATTRIBUTE_TYPE_STRING:
+          append_string (data, g_file_info_get_attribute_string (info, attributes[i]));
+          break;
+
+        case G_FILE_ATTRIBUTE_TYPE_BYTE_STRING:
+          append_string (data, g_file_info_get_attribute_byte_string (info, attributes[i]));
+          break;
+
+        case G_FILE_ATTRIBUTE_TYPE_BOOLEAN:
+          {
+            guint8 b = g_file_info_get_attribute_boolean (info, attributes[i]) ? 1 : 0;
+            append_data (data, &b, sizeof (guint8));
+          }
+          break;
+
+        case G_FILE_ATTRIBUTE_TYPE_UINT32:
+          {
+            guint32 u = g_file_info_get_attribute_uint32 (info, attributes[i]);
+            append_data (data, &u, sizeof (guint32));
+          }
+          break;
+
+        case G_FILE_ATTRIBUTE_TYPE_INT32:
+          {
+            gint32 v = g_file_info_get_attribute_int32 (info, attributes[i]);
+            append_data (data, &v, sizeof (gint32));
+          }
+          break;
+
+        case G_FILE_ATTRIBUTE_TYPE_UINT64:
+          {
+            guint64 u = g_file_info_get_attribute_uint64 (info, attributes[i]);
+            append_data (data, &u, sizeof (guint64));
+          }
+          break;
+
+        case G_FILE_ATTRIBUTE_TYPE_INT64:
+          {
+            gint64 v = g_file_info_get_attribute_int64 (info, attributes[i]);
+            append_data (data, &v, sizeof (gint64));
+          }
+          break;
+
+        case G_FILE_ATTRIBUTE_TYPE_OBJECT:
+          {
+            char *icon = g_icon_to_string (G_ICON (g_file_info_get_attribute_object (info, attributes[i])));
+            append_string (data, icon ? icon : "");
+            g_free (icon);
+          }
+          break;
+
+        case G_FILE_ATTRIBUTE_TYPE_STRINGV:
+          {
+            char **strv = g_file_info_get_attribute_stringv (info, attributes[i]);
+            guint16 j, n = strv ? MIN (g_strv_length (strv), G_MAXUINT16) : 0;
+
+            append_data (data, &n, sizeof (guint16));
+            for (j = 0; j < n; j++)
+              append_string (data, strv[j]);
+          }
+          break;
+
+        case G_FILE_ATTRIBUTE_TYPE_INVALID:
+        default:
+          g_assert_not_reached ();
+          break;
+        }
+
+      n_attributes++;
+    }
+  g_strfreev (attributes);
+
+  memcpy (data->data + n_pos, &n_attributes, sizeof (guint16));
+
+  return g_byte_array_free (data, FALSE);
+}
+
+#define READ(type, p) G_STMT_START{ \
+  memcpy (&type##_value, p, sizeof (type)); \
+  p += sizeof (type); \
+}G_STMT_END
+
+GFileInfo *
+gtk_directory_list_expand_info (GtkDirectoryList *self,
+                                gpointer          entry)
+{
+  const guchar *p = entry;
+  const char *basename;
+  guint16 guint16_value, i, n_attributes;
+  guint8 guint8_value;
+  guint32 guint32_value;
+  gint32 gint32_value;
+  guint64 guint64_value;
+  gint64 gint64_value;
+  GFileInfo *info;
+  GFile *file;
+
+  info = g_file_info_new ();
+
+  basename = (const char *) p;
+  p += strlen (basename) + 1;
+
+  READ (guint16, p);
+  n_attributes = guint16_value;
+
+  for (i = 0; i < n_attributes; i++)
+    {
+      const char *attribute;
+      GFileAttributeType type;
+
+      READ (guint16, p);
+      attribute = g_ptr_array_index (self->attribute_names, guint16_value);
+      READ (guint8, p);
+      type = guint8_value;
+
+      switch (type)
+        {
+        case G_FILE_ATTRIBUTE_TYPE_STRING:
+          g_file_info_set_attribute_string (info, attribute, (const char *) p);
+          p += strlen ((const char *) p) + 1;
+          break;
+
+        case G_FILE_ATTRIBUTE_TYPE_BYTE_STRING:
+          g_file_info_set_attribute_byte_string (info, attribute, (const char *) p);
+          p += strlen ((const char *) p) + 1;
+          break;
+
+        case G_FILE_ATTRIBUTE_TYPE_BOOLEAN:
+          READ (guint8, p);
+          g_file_info_set_attribute_boolean (info, attribute, guint8_value);
+          break;
+
+        case G_FILE_ATTRIBUTE_TYPE_UINT32:
+          READ (guint32, p);
+          g_file_info_set_attribute_uint32 (info, attribute, guint32_value);
+          break;
+
+        case G_FILE_ATTRIBUTE_TYPE_INT32:
+          READ (gint32, p);
+          g_file_info_set_attribute_int32 (info, attribute, gint32_value);
+          break;
+
+        case G_FILE_ATTRIBUTE_TYPE_UINT64:
+          READ (guint64, p);
+          g_file_info_set_attribute_uint64 (info, attribute, guint64_value);
+          break;
+
+        case G_FILE_ATTRIBUTE_TYPE_INT64:
+          READ (gint64, p);
+          g_file_info_set_attribute_int64 (info, attribute, gint64_value);
+          break;
+
+        case G_FILE_ATTRIBUTE_TYPE_OBJECT:
+          {
+            GIcon *icon = g_icon_new_for_string ((const char *) p, NULL);
+            if (icon)
+              {
+                g_file_info_set_attribute_object (info, attribute, G_OBJECT (icon));
+                g_object_unref (icon);
+              }
+            p += strlen ((const char *) p) + 1;
+          }
+          break;
+
+        case G_FILE_ATTRIBUTE_TYPE_STRINGV:
+          {
+            const char **strv;
+            guint16 j;
+
+            READ (guint16, p);
+            strv = g_new (const char *, guint16_value + 1);
+            for (j = 0; j < guint16_value; j++)
+              {
+                strv[j] = (const char *) p;
+                p += strlen ((const char *) p) + 1;
+              }
+            strv[j] = NULL;
+            g_file_info_set_attribute_stringv (info, attribute, (char **) strv);
+            g_free (strv);
+          }
+          break;
+
+        case G_FILE_ATTRIBUTE_TYPE_INVALID:
+        default:
+          g_assert_not_reached ();
+          break;
+        }
+    }
+
+  file = g_file_get_child (self->file, basename);
+  g_file_info_set_attribute_object (info, "standard::file", G_OBJECT (file));
+  g_object_unref (file);
+
+  return info;
+}
+
+#undef READ
+
+static void
+weak_ref_free (gpointer data)
+{
+  GWeakRef *ref = data;
+
+  g_weak_ref_clear (ref);
+  g_free (ref);
+}
+
+/* The entry is going away, so it can't return its info anymore */
+static void
+gtk_directory_list_forget_info (GtkDirectoryList *self,
+                                gpointer          entry)
+{
+  g_hash_table_remove (self->infos, entry);
+}
+
+static void
+gtk_directory_list_forget_infos (GtkDirectoryList *self)
+{
+  g_hash_table_remove_all (self->infos);
 }
 
 static gpointer
@@ -107,14 +440,35 @@ gtk_directory_list_get_item (GListModel *list,
                              guint       position)
 {
   GtkDirectoryList *self = GTK_DIRECTORY_LIST (list);
-  GSequenceIter *iter;
-
-  iter = g_sequence_get_iter_at_pos (self->items, position);
+  gpointer entry;
+  GFileInfo *info;
+  GWeakRef *ref;
 
-  if (g_sequence_iter_is_end (iter))
+  if (position >= self->n_announced)
     return NULL;
+
+  entry = g_ptr_array_index (self->items, position);
+  if (!self->compact)
+    return g_object_ref (entry);
+
+  ref = g_hash_table_lookup (self->infos, entry);
+  if (ref)
+    {
+      info = g_weak_ref_get (ref);
+      if (info)
+        return info;
+    }
   else
-    return g_object_ref (g_sequence_get (iter));
+    {
+      ref = g_new (GWeakRef, 1);
+      g_weak_ref_init (ref, NULL);
+      g_hash_table_insert (self->infos, entry, ref);
+    }
+
+  info = gtk_directory_list_expand_info (self, entry);
+  g_weak_ref_set (ref, info);
+
+  return info;
 }
 
 static void
@@ -142,6 +496,10 @@ gtk_directory_list_set_property (GObject      *object,
       gtk_directory_list_set_attributes (self, g_value_get_string (value));
       break;
 
+    case PROP_COMPACT:
+      gtk_directory_list_set_compact (self, g_value_get_boolean (value));
+      break;
+
     case PROP_FILE:
       gtk_directory_list_set_file (self, g_value_get_object (value));
       break;
@@ -174,6 +532,10 @@ gtk_directory_list_get_property (GObject     *object,
       g_value_set_string (value, self->attributes);
       break;
 
+    case PROP_COMPACT:
+      g_value_set_boolean (value, self->compact);
+      break;
+
     case PROP_ERROR:
       g_value_set_boxed (value, self->error);
       break;
@@ -237,11 +599,27 @@ gtk_directory_list_dispose (GObject *object)
   g_clear_pointer (&self->attributes, g_free);
 
   g_clear_error (&self->error);
-  g_clear_pointer (&self->items, g_sequence_free);
+  g_clear_handle_id (&self->flush_cb, g_source_remove);
+  gtk_directory_list_forget_infos (self);
+  g_ptr_array_set_size (self->items, 0);
+  self->n_announced = 0;
 
   G_OBJECT_CLASS (gtk_directory_list_parent_class)->dispose (object);
 }
 
+static void
+gtk_directory_list_finalize (GObject *object)
+{
+  GtkDirectoryList *self = GTK_DIRECTORY_LIST (object);
+
+  g_ptr_array_unref (self->items);
+  g_ptr_array_unref (self->attribute_names);
+  g_hash_table_unref (self->attribute_ids);
+  g_hash_table_unref (self->infos);
+
+  G_OBJECT_CLASS (gtk_directory_list_parent_class)->finalize (object);
+}
+
 static void
 gtk_directory_list_class_init (GtkDirectoryListClass *class)
 {
@@ -250,6 +628,7 @@ gtk_directory_list_class_init (GtkDirectoryListClass *class)
   gobject_class->set_property = gtk_directory_list_set_property;
   gobject_class->get_property = gtk_directory_list_get_property;
   gobject_class->dispose = gtk_directory_list_dispose;
+  gobject_class->finalize = gtk_directory_list_finalize;
 
   /**
    * GtkDirectoryList:attributes:
@@ -263,6 +642,18 @@ gtk_directory_list_class_init (GtkDirectoryListClass *class)
                            NULL,
                            GTK_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY);
 
+  /**
+   * GtkDirectoryList:compact:
+   *
+   * %TRUE if the queried attributes are stored in a compact form
+   */
+  properties[PROP_COMPACT] =
+      g_param_spec_boolean ("compact",
+                            P_("compact"),
+                            P_("TRUE if the queried attributes are stored in a compact form"),
+                            FALSE,
+                            GTK_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY);
+
   /**
    * GtkDirectoryList:error:
    *
@@ -329,7 +720,10 @@ gtk_directory_list_class_init (GtkDirectoryListClass *class)
 static void
 gtk_directory_list_init (GtkDirectoryList *self)
 {
-  self->items = g_sequence_new (g_object_unref);
+  self->items = g_ptr_array_new_with_free_func (g_object_unref);
+  self->attribute_names = g_ptr_array_new_with_free_func (g_free);
+  self->attribute_ids = g_hash_table_new (g_str_hash, g_str_equal);
+  self->infos = g_hash_table_new_full (NULL, NULL, NULL, weak_ref_free);
   self->io_priority = G_PRIORITY_DEFAULT;
   self->monitored = TRUE;
 }
@@ -356,20 +750,72 @@ gtk_directory_list_new (const char *attributes,
                        NULL);
 }
 
-static void
-gtk_directory_list_clear_items (GtkDirectoryList *self)
+static gboolean
+gtk_directory_list_flush_cb (gpointer data)
 {
+  GtkDirectoryList *self = data;
   guint n_items;
 
-  n_items = g_sequence_get_length (self->items);
+  self->flush_cb = 0;
+
+  n_items = self->items->len - self->n_announced;
   if (n_items > 0)
     {
-      g_sequence_remove_range (g_sequence_get_begin_iter (self->items),
-                               g_sequence_get_end_iter (self->items));
+      self->n_announced = self->items->len;
+      g_list_model_items_changed (G_LIST_MODEL (self), self->n_announced - n_items, 0, n_items);
+    }
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Emits ::items-changed for all pending items */
+static void
+gtk_directory_list_flush (GtkDirectoryList *self)
+{
+  g_clear_handle_id (&self->flush_cb, g_source_remove);
+  gtk_directory_list_flush_cb (self);
+}
 
-      g_list_model_items_changed (G_LIST_MODEL (self), 0, n_items, 0);
+/* takes ownership of info */
+static void
+gtk_directory_list_add_info (GtkDirectoryList *self,
+                             GFile            *file,
+                             GFileInfo        *info)
+{
+  if (self->compact)
+    {
+      g_ptr_array_add (self->items, gtk_directory_list_compact_info (self, file, info));
+      g_object_unref (info);
+    }
+  else
+    {
+      g_file_info_set_attribute_object (info, "standard::file", G_OBJECT (file));
+      g_ptr_array_add (self->items, info);
     }
 
+  if (self->flush_cb == 0)
+    {
+      self->flush_cb = g_timeout_add (FLUSH_INTERVAL_MS, gtk_directory_list_flush_cb, self);
+      g_source_set_name_by_id (self->flush_cb, "[gtk] gtk_directory_list_flush_cb");
+    }
+}
+
+static void
+gtk_directory_list_clear_items (GtkDirectoryList *self)
+{
+  guint n_items;
+
+  g_clear_handle_id (&self->flush_cb, g_source_remove);
+  n_items = self->n_announced;
+
+  gtk_directory_list_forget_infos (self);
+  g_ptr_array_unref (self->items);
+  self->items = g_ptr_array_new_with_free_func (self->compact ? g_free : g_object_unref);
+  self->n_announced = 0;
+
+  if (n_items > 0)
+    g_list_model_items_changed (G_LIST_MODEL (self), 0, n_items, 0);
+
   if (self->error)
     {
       g_clear_error (&self->error);
@@ -394,7 +840,6 @@ gtk_directory_list_got_files_cb (GObject      *source,
   GFileEnumerator *enumerator = G_FILE_ENUMERATOR (source);
   GError *error = NULL;
   GList *l, *files;
-  guint n;
 
   files = g_file_enumerator_next_files_finish (enumerator, res, &error);
 
@@ -412,6 +857,8 @@ gtk_directory_list_got_files_cb (GObject      *source,
                                      gtk_directory_list_enumerator_closed_cb,
                                      NULL);
 
+      gtk_directory_list_flush (self);
+
       g_object_freeze_notify (G_OBJECT (self));
 
       g_clear_object (&self->cancellable);
@@ -427,7 +874,6 @@ gtk_directory_list_got_files_cb (GObject      *source,
       return;
     }
 
-  n = 0;
   for (l = files; l; l = l->next)
     {
       GFileInfo *info;
@@ -435,10 +881,8 @@ gtk_directory_list_got_files_cb (GObject      *source,
 
       info = l->data;
       file = g_file_enumerator_get_child (enumerator, info);
-      g_file_info_set_attribute_object (info, "standard::file", G_OBJECT (file));
+      gtk_directory_list_add_info (self, file, info);
       g_object_unref (file);
-      g_sequence_append (self->items, info);
-      n++;
     }
   g_list_free (files);
 
@@ -448,9 +892,6 @@ gtk_directory_list_got_files_cb (GObject      *source,
                                       self->cancellable,
                                       gtk_directory_list_got_files_cb,
                                       self);
-
-  if (n > 0)
-    g_list_model_items_changed (G_LIST_MODEL (self), g_sequence_get_length (self->items) - n, 0, n);
 }
 
 static void
@@ -526,16 +967,49 @@ got_new_file_info_cb (GObject      *source,
   GFile *file = G_FILE (source);
   GtkDirectoryList *self = GTK_DIRECTORY_LIST (data);
   GFileInfo *info;
-  guint position;
 
   info = g_file_query_info_finish (file, res, NULL);
   if (!info)
     return;
 
-  g_file_info_set_attribute_object (info, "standard::file", G_OBJECT (file));
-  position = g_sequence_get_length (self->items);
-  g_sequence_append (self->items, info);
-  g_list_model_items_changed (G_LIST_MODEL (self), position, 0, 1);
+  gtk_directory_list_add_info (self, file, info);
+}
+
+static guint
+gtk_directory_list_find_file (GtkDirectoryList *self,
+                              GFile            *file)
+{
+  char *basename = NULL;
+  guint i;
+
+  if (self->compact)
+    {
+      if (!g_file_has_parent (file, self->file))
+        return G_MAXUINT;
+      basename = g_file_get_basename (file);
+    }
+
+  for (i = 0; i < self->items->len; i++)
+    {
+      gpointer entry = g_ptr_array_index (self->items, i);
+
+      if (self->compact)
+        {
+          /* compact entries start with the basename */
+          if (g_str_equal (entry, basename))
+            break;
+        }
+      else
+        {
+          GFile *f = G_FILE (g_file_info_get_attribute_object (entry, "standard::file"));
+          if (g_file_equal (f, file))
+            break;
+        }
+    }
+
+  g_free (basename);
+
+  return i < self->items->len ? i : G_MAXUINT;
 }
 
 static void
@@ -546,50 +1020,56 @@ got_existing_file_info_cb (GObject      *source,
   GFile *file = G_FILE (source);
   GtkDirectoryList *self = GTK_DIRECTORY_LIST (data);
   GFileInfo *info;
-  GSequenceIter *iter;
+  guint position;
 
   info = g_file_query_info_finish (file, res, NULL);
   if (!info)
     return;
 
-  g_file_info_set_attribute_object (info, "standard::file", G_OBJECT (file));
+  gtk_directory_list_flush (self);
 
-  for (iter = g_sequence_get_begin_iter (self->items);
-       !g_sequence_iter_is_end (iter);
-       iter = g_sequence_iter_next (iter))
+  position = gtk_directory_list_find_file (self, file);
+  if (position == G_MAXUINT)
     {
-      GFileInfo *item = g_sequence_get (iter);
-      GFile *f = G_FILE (g_file_info_get_attribute_object (item, "standard::file"));
-      if (g_file_equal (f, file))
-        {
-          guint position = g_sequence_iter_get_position (iter);
-          g_sequence_set (iter, g_object_ref (info));
-          g_list_model_items_changed (G_LIST_MODEL (self), position, 1, 1);
-          break;
-        }
+      g_object_unref (info);
+      return;
+    }
+
+  if (self->compact)
+    {
+      gtk_directory_list_forget_info (self, g_ptr_array_index (self->items, position));
+      g_free (g_ptr_array_index (self->items, position));
+      g_ptr_array_index (self->items, position) = gtk_directory_list_compact_info (self, file, info);
+      g_object_unref (info);
     }
+  else
+    {
+      g_file_info_set_attribute_object (info, "standard::file", G_OBJECT (file));
+      g_object_unref (g_ptr_array_index (self->items, position));
+      g_ptr_array_index (self->items, position) = info;
+    }
+
+  g_list_model_items_changed (G_LIST_MODEL (self), position, 1, 1);
 }
 
 static void
 gtk_directory_list_remove_file (GtkDirectoryList *self,
                                 GFile            *file)
 {
-  GSequenceIter *iter;
+  guint position;
 
-  for (iter = g_sequence_get_begin_iter (self->items);
-       !g_sequence_iter_is_end (iter);
-       iter = g_sequence_iter_next (iter))
-    {
-      GFileInfo *item = g_sequence_get (iter);
-      GFile *f = G_FILE (g_file_info_get_attribute_object (item, "standard::file"));
-      if (g_file_equal (f, file))
-        {
-          guint position = g_sequence_iter_get_position (iter);
-          g_sequence_remove (iter);
-          g_list_model_items_changed (G_LIST_MODEL (self), position, 1, 0);
-          break;
-        }
-    }
+  gtk_directory_list_flush (self);
+
+  position = gtk_directory_list_find_file (self, file);
+  if (position == G_MAXUINT)
+    return;
+
+  if (self->compact)
+    gtk_directory_list_forget_info (self, g_ptr_array_index (self->items, position));
+  g_ptr_array_remove_index (self->items, position);
+  self->n_announced--;
+
+  g_list_model_items_changed (G_LIST_MODEL (self), position, 1, 0);
 }
 
 static void
@@ -750,6 +1230,62 @@ gtk_directory_list_get_attributes (GtkDirectoryList *self)
   return self->attributes;
 }
 
+/**
+ * gtk_directory_list_set_compact:
+ * @self: a #GtkDirectoryList
+ * @compact: %TRUE to store files compactly
+ *
+ * Sets whether the directory list stores the loaded files in a
+ * compact form.
+ *
+ * Usually, @self keeps the #GFileInfo of every file around. When
+ * storing files compactly, only the values of the attributes queried
+ * via gtk_directory_list_set_attributes() are kept, and #GFileInfos
+ * are created when they are requested and freed again when they are
+ * no longer used. This uses a lot less memory for large directories.
+ *
+ * Note that changes to the #GFileInfos will not be kept in this case.
+ * Object attributes other than #GIcons are not stored.
+ *
+ * Changing this restarts the enumeration.
+ */
+void
+gtk_directory_list_set_compact (GtkDirectoryList *self,
+                                gboolean          compact)
+{
+  g_return_if_fail (GTK_IS_DIRECTORY_LIST (self));
+
+  if (self->compact == compact)
+    return;
+
+  g_object_freeze_notify (G_OBJECT (self));
+
+  self->compact = compact;
+
+  gtk_directory_list_start_loading (self);
+
+  g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_COMPACT]);
+
+  g_object_thaw_notify (G_OBJECT (self));
+}
+
+/**
+ * gtk_directory_list_get_compact:
+ * @self: a #GtkDirectoryList
+ *
+ * Returns whether the files are stored in a compact form.
+ * See gtk_directory_list_set_compact().
+ *
+ * Returns: %TRUE if files are stored compactly
+ */
+gboolean
+gtk_directory_list_get_compact (GtkDirectoryList *self)
+{
+  g_return_val_if_fail (GTK_IS_DIRECTORY_LIST (self), FALSE);
+
+  return self->compact;
+}
+
 /**
  * gtk_directory_list_set_io_priority:
  * @self: a #GtkDirectoryList
@@ -804,7 +1340,7 @@ gtk_directory_list_get_io_priority (GtkDirectoryList *self)
  *
  * Files will be added to @self from time to time while loading is
  * going on. The order in which are added is undefined and may change
- * in between runs.
+ * in between runs. All files have been added once loading finished.
  *
  * Returns: %TRUE if @self is loading
  */
@@ -52,6 +52,11 @@ void                    gtk_directory_list_set_attributes       (GtkDirectoryLis
 GDK_AVAILABLE_IN_ALL
 const char *            gtk_directory_list_get_attributes       (GtkDirectoryList       *self);
 GDK_AVAILABLE_IN_ALL
+void                    gtk_directory_list_set_compact          (GtkDirectoryList       *self,
+                                                                 gboolean                compact);
+GDK_AVAILABLE_IN_ALL
+gboolean                gtk_directory_list_get_compact          (GtkDirectoryList       *self);
+GDK_AVAILABLE_IN_ALL
 void                    gtk_directory_list_set_io_priority      (GtkDirectoryList       *self,
                                                                  int                     io_priority);
 GDK_AVAILABLE_IN_ALL
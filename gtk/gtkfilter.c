@@ -37,6 +37,10 @@
  * or not by calling gtk_filter_match() for each item and only keeping the
  * ones that the function returns %TRUE for.
  *
+ * When many items need to be checked, gtk_filter_match_items() allows
+ * filters to check them all at once, so that for example combined
+ * filters only need to look at items that aren't ruled out yet.
+ *
  * Filters may change what items they match through their lifetime. In that
  * case, they will emit the #GtkFilter::changed signal to notify that previous
  * filter results are no longer valid and that items should be checked again
@@ -74,6 +78,32 @@ gtk_filter_default_get_strictness (GtkFilter *self)
   return GTK_FILTER_MATCH_SOME;
 }
 
+static GtkBitset *
+gtk_filter_default_match_items (GtkFilter  *self,
+                                GListModel *model,
+                                GtkBitset  *positions)
+{
+  GtkBitset *result;
+  GtkBitsetIter iter;
+  guint pos;
+
+  result = gtk_bitset_new_empty ();
+
+  for (gtk_bitset_iter_init_first (&iter, positions, &pos);
+       gtk_bitset_iter_is_valid (&iter);
+       gtk_bitset_iter_next (&iter, &pos))
+    {
+      gpointer item = g_list_model_get_item (model, pos);
+
+      if (gtk_filter_match (self, item))
+        gtk_bitset_add (result, pos);
+
+      g_object_unref (item);
+    }
+
+  return result;
+}
+
 static void
 gtk_filter_class_init (GtkFilterClass *class)
 {
@@ -81,6 +111,7 @@ gtk_filter_class_init (GtkFilterClass *class)
 
   class->match = gtk_filter_default_match;
   class->get_strictness = gtk_filter_default_get_strictness;
+  class->match_items = gtk_filter_default_match_items;
 
   /**
    * GtkFilter::changed:
@@ -134,6 +165,52 @@ gtk_filter_match (GtkFilter *self,
   return GTK_FILTER_GET_CLASS (self)->match (self, item);
 }
 
+/**
+ * gtk_filter_match_items:
+ * @self: a #GtkFilter
+ * @model: the model containing the items to check
+ * @positions: the positions of the items in @model to check
+ *
+ * Checks the items at the given @positions of @model and returns
+ * the positions of the ones that are matched by the filter.
+ *
+ * This gives the same result as calling gtk_filter_match() on every
+ * item, but filters can implement it more efficiently.
+ *
+ * Returns: (transfer full): a new #GtkBitset containing the positions
+ *     of the matched items
+ */
+GtkBitset *
+gtk_filter_match_items (GtkFilter  *self,
+                        GListModel *model,
+                        GtkBitset  *positions)
+{
+  g_return_val_if_fail (GTK_IS_FILTER (self), NULL);
+  g_return_val_if_fail (G_IS_LIST_MODEL (model), NULL);
+  g_return_val_if_fail (positions != NULL, NULL);
+
+  switch (gtk_filter_get_strictness (self))
+    {
+    case GTK_FILTER_MATCH_NONE:
+      return gtk_bitset_new_empty ();
+
+    case GTK_FILTER_MATCH_ALL:
+      return gtk_bitset_copy (positions);
+
+    case GTK_FILTER_MATCH_SOME:
+      break;
+
+    default:
+      g_assert_not_reached ();
+      break;
+    }
+
+  if (gtk_bitset_is_empty (positions))
+    return gtk_bitset_new_empty ();
+
+  return GTK_FILTER_GET_CLASS (self)->match_items (self, model, positions);
+}
+
 /**
  * gtk_filter_get_strictness:
  * @self: a #GtkFilter
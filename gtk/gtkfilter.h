@@ -25,6 +25,7 @@
 #endif
 
 #include <gdk/gdk.h>
+#include <gtk/gtkbitset.h>
 
 G_BEGIN_DECLS
 
@@ -92,9 +93,11 @@ struct _GtkFilterClass
 
   /* optional */
   GtkFilterMatch        (* get_strictness)                      (GtkFilter              *self);
+  GtkBitset *           (* match_items)                         (GtkFilter              *self,
+                                                                 GListModel             *model,
+                                                                 GtkBitset              *positions);
 
   /* Padding for future expansion */
-  void (*_gtk_reserved1) (void);
   void (*_gtk_reserved2) (void);
   void (*_gtk_reserved3) (void);
   void (*_gtk_reserved4) (void);
@@ -108,6 +111,10 @@ GDK_AVAILABLE_IN_ALL
 gboolean                gtk_filter_match                        (GtkFilter              *self,
                                                                  gpointer                item);
 GDK_AVAILABLE_IN_ALL
+GtkBitset *             gtk_filter_match_items                  (GtkFilter              *self,
+                                                                 GListModel             *model,
+                                                                 GtkBitset              *positions);
+GDK_AVAILABLE_IN_ALL
 GtkFilterMatch          gtk_filter_get_strictness               (GtkFilter              *self);
 
 /* for filter implementations */
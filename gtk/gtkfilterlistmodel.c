@@ -24,6 +24,7 @@
 #include "gtkbitset.h"
 #include "gtkintl.h"
 #include "gtkprivate.h"
+#include "gtkstringfilterprivate.h"
 
 /**
  * SECTION:gtkfilterlistmodel
@@ -62,6 +63,8 @@ struct _GtkFilterListModel
   GtkBitset *matches; /* NULL if strictness != GTK_FILTER_MATCH_SOME */
   GtkBitset *pending; /* not yet filtered items or NULL if all filtered */
   guint pending_cb; /* idle callback handle */
+
+  GtkStringFilterIndex *string_index; /* if filter is a GtkStringFilter */
 };
 
 struct _GtkFilterListModelClass
@@ -139,48 +142,48 @@ gtk_filter_list_model_model_init (GListModelInterface *iface)
 G_DEFINE_TYPE_WITH_CODE (GtkFilterListModel, gtk_filter_list_model, G_TYPE_OBJECT,
                          G_IMPLEMENT_INTERFACE (G_TYPE_LIST_MODEL, gtk_filter_list_model_model_init))
 
-static gboolean
-gtk_filter_list_model_run_filter_on_item (GtkFilterListModel *self,
-                                          guint               position)
+static GtkBitset *
+gtk_filter_list_model_match_items (GtkFilterListModel *self,
+                                   GtkBitset          *items)
 {
-  gpointer item;
-  gboolean visible;
-
   /* all other cases should have beeen optimized away */
   g_assert (self->strictness == GTK_FILTER_MATCH_SOME);
 
-  item = g_list_model_get_item (self->model, position);
-  visible = gtk_filter_match (self->filter, item);
-  g_object_unref (item);
+  if (self->string_index)
+    return gtk_string_filter_index_match_items (self->string_index, self->model, items);
 
-  return visible;
+  return gtk_filter_match_items (self->filter, self->model, items);
 }
 
 static void
 gtk_filter_list_model_run_filter (GtkFilterListModel *self,
                                   guint               n_steps)
 {
-  GtkBitsetIter iter;
-  guint i, pos;
-  gboolean more;
+  GtkBitset *items, *matches;
 
   g_return_if_fail (GTK_IS_FILTER_LIST_MODEL (self));
   
   if (self->pending == NULL)
     return;
 
-  for (i = 0, more = gtk_bitset_iter_init_first (&iter, self->pending, &pos);
-       i < n_steps && more;
-       i++, more = gtk_bitset_iter_next (&iter, &pos))
+  if (gtk_bitset_get_size (self->pending) > n_steps)
     {
-      if (gtk_filter_list_model_run_filter_on_item (self, pos))
-        gtk_bitset_add (self->matches, pos);
-    }
+      guint pos = gtk_bitset_get_nth (self->pending, n_steps);
 
-  if (more)
-    gtk_bitset_remove_range_closed (self->pending, 0, pos - 1);
+      items = gtk_bitset_copy (self->pending);
+      gtk_bitset_remove_range_closed (items, pos, G_MAXUINT);
+      gtk_bitset_remove_range_closed (self->pending, 0, pos - 1);
+    }
   else
-    g_clear_pointer (&self->pending, gtk_bitset_unref);
+    {
+      items = g_steal_pointer (&self->pending);
+    }
+
+  matches = gtk_filter_list_model_match_items (self, items);
+  gtk_bitset_union (self->matches, matches);
+  gtk_bitset_unref (matches);
+  gtk_bitset_unref (items);
+
   g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_PENDING]);
 
   return;
@@ -243,6 +246,9 @@ static void
 gtk_filter_list_model_start_filtering (GtkFilterListModel *self,
                                        GtkBitset          *items)
 {
+  if (self->string_index)
+    gtk_string_filter_index_restrict (self->string_index, items);
+
   if (self->pending)
     {
       gtk_bitset_union (self->pending, items);
@@ -281,6 +287,9 @@ gtk_filter_list_model_items_changed_cb (GListModel         *model,
 {
   guint filter_removed, filter_added;
 
+  if (self->string_index)
+    gtk_string_filter_index_splice (self->string_index, position, removed, added);
+
   switch (self->strictness)
     {
     case GTK_FILTER_MATCH_NONE:
@@ -389,10 +398,21 @@ gtk_filter_list_model_clear_model (GtkFilterListModel *self)
   gtk_filter_list_model_stop_filtering (self);
   g_signal_handlers_disconnect_by_func (self->model, gtk_filter_list_model_items_changed_cb, self);
   g_clear_object (&self->model);
+  g_clear_pointer (&self->string_index, gtk_string_filter_index_free);
   if (self->matches)
     gtk_bitset_remove_all (self->matches);
 }
 
+static void
+gtk_filter_list_model_update_string_index (GtkFilterListModel *self)
+{
+  g_clear_pointer (&self->string_index, gtk_string_filter_index_free);
+
+  if (self->model && GTK_IS_STRING_FILTER (self->filter))
+    self->string_index = gtk_string_filter_index_new (GTK_STRING_FILTER (self->filter),
+                                                      g_list_model_get_n_items (self->model));
+}
+
 static void
 gtk_filter_list_model_refilter (GtkFilterListModel *self,
                                 GtkFilterChange     change)
@@ -532,6 +552,7 @@ gtk_filter_list_model_clear_filter (GtkFilterListModel *self)
 
   g_signal_handlers_disconnect_by_func (self->filter, gtk_filter_list_model_filter_changed_cb, self);
   g_clear_object (&self->filter);
+  g_clear_pointer (&self->string_index, gtk_string_filter_index_free);
 }
 
 static void
@@ -665,6 +686,7 @@ gtk_filter_list_model_set_filter (GtkFilterListModel *self,
   if (filter)
     {
       self->filter = g_object_ref (filter);
+      gtk_filter_list_model_update_string_index (self);
       g_signal_connect (filter, "changed", G_CALLBACK (gtk_filter_list_model_filter_changed_cb), self);
       gtk_filter_list_model_filter_changed_cb (filter, GTK_FILTER_CHANGE_DIFFERENT, self);
     }
@@ -725,6 +747,7 @@ gtk_filter_list_model_set_model (GtkFilterListModel *self,
   if (model)
     {
       self->model = g_object_ref (model);
+      gtk_filter_list_model_update_string_index (self);
       g_signal_connect (model, "items-changed", G_CALLBACK (gtk_filter_list_model_items_changed_cb), self);
       if (removed == 0)
         {
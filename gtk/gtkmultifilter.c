@@ -244,6 +244,35 @@ gtk_any_filter_match (GtkFilter *filter,
   return FALSE;
 }
 
+static GtkBitset *
+gtk_any_filter_match_items (GtkFilter  *filter,
+                            GListModel *model,
+                            GtkBitset  *positions)
+{
+  GtkMultiFilter *self = GTK_MULTI_FILTER (filter);
+  GtkBitset *result, *remaining;
+  guint i;
+
+  result = gtk_bitset_new_empty ();
+  remaining = gtk_bitset_copy (positions);
+
+  /* Only check items no previous filter matched */
+  for (i = 0; i < gtk_filters_get_size (&self->filters) && !gtk_bitset_is_empty (remaining); i++)
+    {
+      GtkFilter *child = gtk_filters_get (&self->filters, i);
+      GtkBitset *matches;
+
+      matches = gtk_filter_match_items (child, model, remaining);
+      gtk_bitset_union (result, matches);
+      gtk_bitset_subtract (remaining, matches);
+      gtk_bitset_unref (matches);
+    }
+
+  gtk_bitset_unref (remaining);
+
+  return result;
+}
+
 static GtkFilterMatch
 gtk_any_filter_get_strictness (GtkFilter *filter)
 {
@@ -283,6 +312,7 @@ gtk_any_filter_class_init (GtkAnyFilterClass *class)
   multi_filter_class->removal_change = GTK_FILTER_CHANGE_MORE_STRICT;
 
   filter_class->match = gtk_any_filter_match;
+  filter_class->match_items = gtk_any_filter_match_items;
   filter_class->get_strictness = gtk_any_filter_get_strictness;
 }
 
@@ -342,6 +372,31 @@ gtk_every_filter_match (GtkFilter *filter,
   return TRUE;
 }
 
+static GtkBitset *
+gtk_every_filter_match_items (GtkFilter  *filter,
+                              GListModel *model,
+                              GtkBitset  *positions)
+{
+  GtkMultiFilter *self = GTK_MULTI_FILTER (filter);
+  GtkBitset *result;
+  guint i;
+
+  result = gtk_bitset_copy (positions);
+
+  /* Only check items all previous filters matched */
+  for (i = 0; i < gtk_filters_get_size (&self->filters) && !gtk_bitset_is_empty (result); i++)
+    {
+      GtkFilter *child = gtk_filters_get (&self->filters, i);
+      GtkBitset *matches;
+
+      matches = gtk_filter_match_items (child, model, result);
+      gtk_bitset_intersect (result, matches);
+      gtk_bitset_unref (matches);
+    }
+
+  return result;
+}
+
 static GtkFilterMatch
 gtk_every_filter_get_strictness (GtkFilter *filter)
 {
@@ -381,6 +436,7 @@ gtk_every_filter_class_init (GtkEveryFilterClass *class)
   multi_filter_class->removal_change = GTK_FILTER_CHANGE_LESS_STRICT;
 
   filter_class->match = gtk_every_filter_match;
+  filter_class->match_items = gtk_every_filter_match_items;
   filter_class->get_strictness = gtk_every_filter_get_strictness;
 }
 
@@ -33,8 +33,16 @@
  *
  * GtkMultiSelection is an implementation of the #GtkSelectionModel interface
  * that allows selecting multiple elements.
+ *
+ * Small selections follow their items when the underlying model moves them.
+ * Large selections are kept by position, so selecting or unselecting large
+ * ranges stays cheap, until the model replaces selected items, as happens
+ * when it is reordered. From then on, the selected items are tracked, too.
  */
 
+/* Selections up to this size always track their items */
+#define MAX_TRACKED_ITEMS 1024
+
 struct _GtkMultiSelection
 {
   GObject parent_instance;
@@ -42,7 +50,8 @@ struct _GtkMultiSelection
   GListModel *model;
 
   GtkBitset *selected;
-  GHashTable *items; /* item => position */
+  GHashTable *items; /* item => position or NULL if not tracking items */
+  guint track_items : 1; /* the model replaced selected items before */
 };
 
 struct _GtkMultiSelectionClass
@@ -115,6 +124,34 @@ gtk_multi_selection_get_selection_in_range (GtkSelectionModel *model,
   return gtk_bitset_ref (self->selected);
 }
 
+static gboolean
+gtk_multi_selection_should_track_items (GtkMultiSelection *self)
+{
+  return self->track_items ||
+         gtk_bitset_get_size (self->selected) <= MAX_TRACKED_ITEMS;
+}
+
+static void
+gtk_multi_selection_start_tracking_items (GtkMultiSelection *self)
+{
+  GtkBitsetIter iter;
+  guint pos;
+  gboolean more;
+
+  g_assert (self->items == NULL);
+
+  self->items = g_hash_table_new_full (NULL, NULL, g_object_unref, NULL);
+
+  for (more = gtk_bitset_iter_init_first (&iter, self->selected, &pos);
+       more;
+       more = gtk_bitset_iter_next (&iter, &pos))
+    {
+      g_hash_table_insert (self->items,
+                           g_list_model_get_item (self->model, pos),
+                           GUINT_TO_POINTER (pos));
+    }
+}
+
 static void
 gtk_multi_selection_toggle_selection (GtkMultiSelection *self,
                                       GtkBitset         *changes)
@@ -127,6 +164,17 @@ gtk_multi_selection_toggle_selection (GtkMultiSelection *self,
 
   gtk_bitset_difference (self->selected, changes);
 
+  if (!gtk_multi_selection_should_track_items (self))
+    {
+      g_clear_pointer (&self->items, g_hash_table_unref);
+      return;
+    }
+  else if (self->items == NULL)
+    {
+      gtk_multi_selection_start_tracking_items (self);
+      return;
+    }
+
   selected = gtk_bitset_copy (changes);
   gtk_bitset_intersect (selected, self->selected);
 
@@ -211,11 +259,10 @@ G_DEFINE_TYPE_EXTENDED (GtkMultiSelection, gtk_multi_selection, G_TYPE_OBJECT, 0
                                                gtk_multi_selection_selection_model_init))
 
 static void
-gtk_multi_selection_items_changed_cb (GListModel        *model,
-                                      guint              position,
-                                      guint              removed,
-                                      guint              added,
-                                      GtkMultiSelection *self)
+gtk_multi_selection_update_items (GtkMultiSelection *self,
+                                  guint              position,
+                                  guint              removed,
+                                  guint              added)
 {
   GHashTableIter iter;
   gpointer item, pos_pointer;
@@ -251,7 +298,7 @@ gtk_multi_selection_items_changed_cb (GListModel        *model,
 
   for (i = position; pending != NULL && i < position + added; i++)
     {
-      item = g_list_model_get_item (model, i);
+      item = g_list_model_get_item (self->model, i);
       if (g_hash_table_contains (pending, item))
         {
           gtk_bitset_add (self->selected, i);
@@ -267,6 +314,66 @@ gtk_multi_selection_items_changed_cb (GListModel        *model,
     }
 
   g_clear_pointer (&pending, g_hash_table_unref);
+}
+
+/* Keeps the selection of replaced items by position */
+static void
+gtk_multi_selection_update_positions (GtkMultiSelection *self,
+                                      guint              position,
+                                      guint              removed,
+                                      guint              added)
+{
+  GtkBitset *kept;
+  guint n_kept;
+
+  n_kept = MIN (removed, added);
+  if (n_kept == 0)
+    {
+      gtk_bitset_splice (self->selected, position, removed, added);
+      return;
+    }
+
+  kept = gtk_bitset_new_range (position, n_kept);
+  gtk_bitset_intersect (kept, self->selected);
+  gtk_bitset_splice (self->selected, position, removed, added);
+  gtk_bitset_union (self->selected, kept);
+  gtk_bitset_unref (kept);
+}
+
+static void
+gtk_multi_selection_update (GtkMultiSelection *self,
+                            guint              position,
+                            guint              removed,
+                            guint              added)
+{
+  if (self->items)
+    {
+      gtk_multi_selection_update_items (self, position, removed, added);
+      return;
+    }
+
+  gtk_multi_selection_update_positions (self, position, removed, added);
+
+  if (gtk_multi_selection_should_track_items (self))
+    gtk_multi_selection_start_tracking_items (self);
+}
+
+static void
+gtk_multi_selection_items_changed_cb (GListModel        *model,
+                                      guint              position,
+                                      guint              removed,
+                                      guint              added,
+                                      GtkMultiSelection *self)
+{
+  /* The model replaced selected items we did not track, most likely
+   * because it was reordered. They keep their selection by position
+   * this time, but from now on we track the selected items so we can
+   * find them again. */
+  if (self->items == NULL && removed > 0 && added > 0 &&
+      gtk_bitset_get_size_in_range (self->selected, position, position + removed - 1) > 0)
+    self->track_items = TRUE;
+
+  gtk_multi_selection_update (self, position, removed, added);
 
   g_list_model_items_changed (G_LIST_MODEL (self), position, removed, added);
 }
@@ -421,7 +528,7 @@ void
 gtk_multi_selection_set_model (GtkMultiSelection *self,
                                GListModel        *model)
 {
-  guint n_items_before;
+  guint n_items_before, n_items_after;
 
   g_return_if_fail (GTK_IS_MULTI_SELECTION (self));
   g_return_if_fail (model == NULL || G_IS_LIST_MODEL (model));
@@ -439,16 +546,15 @@ gtk_multi_selection_set_model (GtkMultiSelection *self,
                         "items-changed",
                         G_CALLBACK (gtk_multi_selection_items_changed_cb),
                         self);
-      gtk_multi_selection_items_changed_cb (self->model,
-                                            0,
-                                            n_items_before,
-                                            g_list_model_get_n_items (model),
-                                            self);
+      n_items_after = g_list_model_get_n_items (model);
+      gtk_multi_selection_update (self, 0, n_items_before, n_items_after);
+      g_list_model_items_changed (G_LIST_MODEL (self), 0, n_items_before, n_items_after);
     }
   else
     {
       gtk_bitset_remove_all (self->selected);
-      g_hash_table_remove_all (self->items);
+      if (self->items)
+        g_hash_table_remove_all (self->items);
       g_list_model_items_changed (G_LIST_MODEL (self), 0, n_items_before, 0);
     }
 
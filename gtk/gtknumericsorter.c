@@ -25,7 +25,9 @@
 #include "gtksorterprivate.h"
 #include "gtktypebuiltins.h"
 
+#include <limits.h>
 #include <math.h>
+#include <string.h>
 
 /**
  * SECTION:gtknumericsorter
@@ -144,6 +146,82 @@ COMPARE_FUNCS(gulong)
 COMPARE_FUNCS(gint64)
 COMPARE_FUNCS(guint64)
 
+/* Radix keys are the numbers as big endian unsigned integers of the
+ * same size. Signed numbers get their sign bit flipped, negative
+ * floating point numbers get all bits inverted, which makes them order
+ * like unsigned numbers.
+ * Descending radix keys are the inverted ascending ones.
+ */
+static inline void
+gtk_numeric_sort_keys_write_radix_key (guint64  bits,
+                                       gsize    size,
+                                       gboolean descending,
+                                       guchar  *radix_key)
+{
+  gsize i;
+
+  if (descending)
+    bits = ~bits;
+
+  for (i = 0; i < size; i++)
+    radix_key[i] = bits >> (8 * (size - 1 - i));
+}
+
+#define RADIX_FUNC(type, name, is_signed, descending) \
+static void \
+gtk_ ## type ## _sort_keys_get_radix_key_ ## name (GtkSortKeys   *keys, \
+                                                   gconstpointer  key_memory, \
+                                                   guchar        *radix_key) \
+{ \
+  guint64 bits = *(type *) key_memory; \
+\
+  if (is_signed) \
+    bits ^= G_GUINT64_CONSTANT (1) << (8 * sizeof (type) - 1); \
+\
+  gtk_numeric_sort_keys_write_radix_key (bits, sizeof (type), descending, radix_key); \
+}
+#define RADIX_FUNCS(type, is_signed) \
+  RADIX_FUNC(type, ascending, is_signed, FALSE) \
+  RADIX_FUNC(type, descending, is_signed, TRUE)
+
+#define FLOAT_RADIX_FUNC(type, int_type, name, descending) \
+static void \
+gtk_ ## type ## _sort_keys_get_radix_key_ ## name (GtkSortKeys   *keys, \
+                                                   gconstpointer  key_memory, \
+                                                   guchar        *radix_key) \
+{ \
+  type num = *(type *) key_memory; \
+  int_type bits; \
+\
+  if (num == 0) \
+    num = 0; /* -0.0 compares equal to 0.0 */ \
+\
+  memcpy (&bits, &num, sizeof (type)); \
+\
+  if (isnan (num)) \
+    bits = ~(int_type) 0; /* NaNs compare equal and sort last */ \
+  else if (bits >> (8 * sizeof (type) - 1)) \
+    bits = ~bits; \
+  else \
+    bits ^= (int_type) 1 << (8 * sizeof (type) - 1); \
+\
+  gtk_numeric_sort_keys_write_radix_key (bits, sizeof (type), descending, radix_key); \
+}
+#define FLOAT_RADIX_FUNCS(type, int_type) \
+  FLOAT_RADIX_FUNC(type, int_type, ascending, FALSE) \
+  FLOAT_RADIX_FUNC(type, int_type, descending, TRUE)
+
+RADIX_FUNCS(char, CHAR_MIN < 0)
+RADIX_FUNCS(guchar, FALSE)
+RADIX_FUNCS(int, TRUE)
+RADIX_FUNCS(guint, FALSE)
+FLOAT_RADIX_FUNCS(float, guint32)
+FLOAT_RADIX_FUNCS(double, guint64)
+RADIX_FUNCS(long, TRUE)
+RADIX_FUNCS(gulong, FALSE)
+RADIX_FUNCS(gint64, TRUE)
+RADIX_FUNCS(guint64, FALSE)
+
 G_GNUC_BEGIN_IGNORE_DEPRECATIONS
 
 #define NUMERIC_SORT_KEYS(TYPE, key_type, type, default_value) \
@@ -174,7 +252,8 @@ static const GtkSortKeysClass GTK_ASCENDING_ ## TYPE ## _SORT_KEYS_CLASS = \
   gtk_ ## key_type ## _sort_keys_compare_ascending, \
   gtk_ ## type ## _sort_keys_is_compatible, \
   gtk_ ## type ## _sort_keys_init_key, \
-  NULL \
+  NULL, \
+  gtk_ ## key_type ## _sort_keys_get_radix_key_ascending \
 }; \
 \
 static const GtkSortKeysClass GTK_DESCENDING_ ## TYPE ## _SORT_KEYS_CLASS = \
@@ -183,7 +262,8 @@ static const GtkSortKeysClass GTK_DESCENDING_ ## TYPE ## _SORT_KEYS_CLASS = \
   gtk_ ## key_type ## _sort_keys_compare_descending, \
   gtk_ ## type ## _sort_keys_is_compatible, \
   gtk_ ## type ## _sort_keys_init_key, \
-  NULL \
+  NULL, \
+  gtk_ ## key_type ## _sort_keys_get_radix_key_descending \
 }; \
 \
 static gboolean \
@@ -329,6 +409,10 @@ gtk_numeric_sort_keys_new (GtkNumericSorter *self)
     }
 
   result->expression = gtk_expression_ref (self->expression);
+  result->keys.threadsafe = TRUE;
+  result->keys.init_threadsafe = gtk_sort_keys_expression_is_threadsafe (self->expression);
+  result->keys.radix_size = result->keys.key_size;
+  result->keys.radix_exact = TRUE;
 
   return (GtkSortKeys *) result;
 }
@@ -95,6 +95,97 @@ gtk_sort_keys_needs_clear_key (GtkSortKeys *self)
   return self->klass->clear_key != NULL;
 }
 
+/*<private>
+ * gtk_sort_keys_is_threadsafe:
+ * @self: a #GtkSortKeys
+ *
+ * Checks if initialized keys may be compared from threads other
+ * than the main thread.
+ *
+ * Returns: %TRUE if keys can be compared in threads
+ **/
+gboolean
+gtk_sort_keys_is_threadsafe (GtkSortKeys *self)
+{
+  return self->threadsafe;
+}
+
+/*<private>
+ * gtk_sort_keys_is_init_threadsafe:
+ * @self: a #GtkSortKeys
+ *
+ * Checks if gtk_sort_keys_init_key() may be called from a thread
+ * other than the main thread, provided the main thread does not
+ * touch the items at the same time.
+ *
+ * Returns: %TRUE if keys can be initialized in threads
+ **/
+gboolean
+gtk_sort_keys_is_init_threadsafe (GtkSortKeys *self)
+{
+  return self->init_threadsafe;
+}
+
+/*<private>
+ * gtk_sort_keys_get_radix_size:
+ * @self: a #GtkSortKeys
+ *
+ * Gets the size of the radix keys of @self.
+ *
+ * A radix key is a byte string that can be created from a key
+ * via gtk_sort_keys_get_radix_key(). Comparing radix keys with memcmp()
+ * orders them the same way as comparing the keys, so they can be
+ * sorted with a radix sort instead of by comparison.
+ *
+ * If the radix key is only a prefix of the key, equal radix keys
+ * need to be compared as keys, see gtk_sort_keys_is_radix_exact().
+ *
+ * Returns: the size of radix keys or 0 if @self does not support them
+ **/
+gsize
+gtk_sort_keys_get_radix_size (GtkSortKeys *self)
+{
+  if (self->klass->get_radix_key == NULL)
+    return 0;
+
+  return self->radix_size;
+}
+
+/*<private>
+ * gtk_sort_keys_is_radix_exact:
+ * @self: a #GtkSortKeys
+ *
+ * Checks if equal radix keys mean that the keys compare equal.
+ *
+ * Returns: %TRUE if sorting by radix keys is enough
+ **/
+gboolean
+gtk_sort_keys_is_radix_exact (GtkSortKeys *self)
+{
+  return self->radix_exact;
+}
+
+/*<private>
+ * gtk_sort_keys_expression_is_threadsafe:
+ * @expression: (nullable): a #GtkExpression
+ *
+ * Checks if @expression can be evaluated outside of the main thread.
+ *
+ * This is only the case for constants. Property lookups run the
+ * get_property() implementation of the item and closures run
+ * application code, neither of which is required to be threadsafe.
+ *
+ * Returns: %TRUE if @expression may be evaluated in threads
+ **/
+gboolean
+gtk_sort_keys_expression_is_threadsafe (GtkExpression *expression)
+{
+  if (expression == NULL)
+    return TRUE;
+
+  return G_TYPE_CHECK_INSTANCE_TYPE (expression, GTK_TYPE_CONSTANT_EXPRESSION);
+}
+
 static void
 gtk_equal_sort_keys_free (GtkSortKeys *keys)
 {
@@ -143,8 +234,14 @@ static const GtkSortKeysClass GTK_EQUAL_SORT_KEYS_CLASS =
 GtkSortKeys *
 gtk_sort_keys_new_equal (void)
 {
-  return gtk_sort_keys_new (GtkSortKeys,
-                            &GTK_EQUAL_SORT_KEYS_CLASS,
-                            0, 1);
+  GtkSortKeys *result;
+
+  result = gtk_sort_keys_new (GtkSortKeys,
+                              &GTK_EQUAL_SORT_KEYS_CLASS,
+                              0, 1);
+  result->threadsafe = TRUE;
+  result->init_threadsafe = TRUE;
+
+  return result;
 }
 
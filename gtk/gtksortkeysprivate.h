@@ -20,6 +20,7 @@
 
 #include <gdk/gdk.h>
 #include <gtk/gtkenums.h>
+#include <gtk/gtkexpression.h>
 #include <gtk/gtksorter.h>
 
 typedef struct _GtkSortKeys GtkSortKeys;
@@ -32,6 +33,12 @@ struct _GtkSortKeys
 
   gsize key_size;
   gsize key_align; /* must be power of 2 */
+
+  gboolean threadsafe; /* keys may be compared from other threads */
+  gboolean init_threadsafe; /* init_key() may be called from other threads */
+
+  gsize radix_size; /* size of radix keys or 0 if keys can't be radix sorted */
+  gboolean radix_exact; /* equal radix keys mean equal keys */
 };
 
 struct _GtkSortKeysClass
@@ -48,6 +55,10 @@ struct _GtkSortKeysClass
                                                                  gpointer                key_memory);
   void                  (* clear_key)                           (GtkSortKeys            *self,
                                                                  gpointer                key_memory);
+
+  void                  (* get_radix_key)                       (GtkSortKeys            *self,
+                                                                 gconstpointer           key_memory,
+                                                                 guchar                 *radix_key);
 };
 
 GtkSortKeys *           gtk_sort_keys_alloc                     (const GtkSortKeysClass *klass,
@@ -67,6 +78,12 @@ GCompareDataFunc        gtk_sort_keys_get_key_compare_func      (GtkSortKeys
 gboolean                gtk_sort_keys_is_compatible             (GtkSortKeys            *self,
                                                                  GtkSortKeys            *other);
 gboolean                gtk_sort_keys_needs_clear_key           (GtkSortKeys            *self);
+gboolean                gtk_sort_keys_is_threadsafe             (GtkSortKeys            *self);
+gboolean                gtk_sort_keys_is_init_threadsafe        (GtkSortKeys            *self);
+gsize                   gtk_sort_keys_get_radix_size            (GtkSortKeys            *self);
+gboolean                gtk_sort_keys_is_radix_exact            (GtkSortKeys            *self);
+
+gboolean                gtk_sort_keys_expression_is_threadsafe  (GtkExpression          *expression);
 
 #define GTK_SORT_KEYS_ALIGN(_size,_align) (((_size) + (_align) - 1) & ~((_align) - 1))
 static inline int
@@ -93,5 +110,13 @@ gtk_sort_keys_clear_key (GtkSortKeys *self,
     self->klass->clear_key (self, key_memory);
 }
 
+static inline void
+gtk_sort_keys_get_radix_key (GtkSortKeys   *self,
+                             gconstpointer  key_memory,
+                             guchar        *radix_key)
+{
+  self->klass->get_radix_key (self, key_memory, radix_key);
+}
+
 #endif /* __GTK_SORT_KEYS_PRIVATE_H__ */
 
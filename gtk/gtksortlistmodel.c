@@ -25,8 +25,11 @@
 #include "gtkintl.h"
 #include "gtkprivate.h"
 #include "gtksorterprivate.h"
+#include "gtksortkeysprivate.h"
 #include "timsort/gtktimsortprivate.h"
 
+#include <string.h>
+
 /* The maximum amount of items to merge for a single merge step
  *
  * Making this smaller will result in more steps, which has more overhead and slows
@@ -52,6 +55,28 @@
  */
 #define GTK_SORT_STEP_TIME_US (1000) /* 1 millisecond */
 
+/* The minimum amount of items handed to a single thread when sorting
+ * threaded
+ *
+ * Smaller chunks spread the work over more threads, but every chunk
+ * adds a merge pass over its items in the end and the overhead of
+ * waking up a thread.
+ */
+#define GTK_SORT_THREADED_CHUNK_SIZE (512)
+
+/* The minimum amount of items to use a radix sort for
+ *
+ * Every pass of a radix sort has to walk the 256 buckets, so for few
+ * items comparison sorting is faster.
+ */
+#define GTK_SORT_RADIX_MIN_ITEMS (1024)
+
+/* The maximum size of radix keys we sort by
+ *
+ * Every byte is a pass over all items.
+ */
+#define GTK_SORT_RADIX_MAX_SIZE (16)
+
 /**
  * SECTION:gtksortlistmodel
  * @title: GtkSortListModel
@@ -65,6 +90,9 @@
  * sorting long lists doesn't block the UI. See
  * gtk_sort_list_model_set_incremental() for details.
  *
+ * Alternatively, sorting can be spread over multiple threads. See
+ * gtk_sort_list_model_set_threaded() for details.
+ *
  * #GtkSortListModel is a generic model and because of that it
  * cannot take advantage of any external knowledge when sorting.
  * If you run into performance issues with #GtkSortListModel, it
@@ -78,6 +106,7 @@ enum {
   PROP_MODEL,
   PROP_PENDING,
   PROP_SORTER,
+  PROP_THREADED,
   NUM_PROPERTIES
 };
 
@@ -88,6 +117,7 @@ struct _GtkSortListModel
   GListModel *model;
   GtkSorter *sorter;
   gboolean incremental;
+  gboolean threaded;
 
   GtkTimSort sort; /* ongoing sort operation */
   guint sort_cb; /* 0 or current ongoing sort callback */
@@ -302,6 +332,444 @@ sort_func (gconstpointer a,
   return *sa < *sb ? -1 : 1;
 }
 
+static void
+gtk_sort_list_model_find_changes (GtkSortListModel *self,
+                                  gpointer         *unsorted,
+                                  guint            *out_position,
+                                  guint            *out_n_items)
+{
+  guint start, end;
+
+  for (start = 0; start < self->n_items; start++)
+    {
+      if (unsorted[start] != self->positions[start])
+        break;
+    }
+  for (end = self->n_items; end > start; end--)
+    {
+      if (unsorted[end - 1] != self->positions[end - 1])
+        break;
+    }
+
+  *out_position = end > start ? start : 0;
+  *out_n_items = end - start;
+}
+
+/* Threaded sorting
+ *
+ * The main thread fetches the items that still need keys, then the
+ * keys get initialized, consecutive chunks of the positions get sorted
+ * in parallel and the sorted chunks are merged pairwise, again in
+ * parallel. The main thread helps out and waits for all of it, so
+ * nobody ever sees a half-sorted model and ::items-changed is emitted
+ * only once.
+ *
+ * This requires sort keys that can be compared in threads, see
+ * gtk_sort_keys_is_threadsafe(). Keys are only initialized in
+ * parallel if gtk_sort_keys_is_init_threadsafe() allows it.
+ */
+typedef struct _GtkSortJobs GtkSortJobs;
+typedef struct _GtkSortJob GtkSortJob;
+
+struct _GtkSortJob
+{
+  GtkSortJobs *jobs;
+  guint index;
+};
+
+struct _GtkSortJobs
+{
+  void (* func) (GtkSortJobs *jobs,
+                 guint        index);
+
+  GMutex mutex;
+  GCond cond;
+  guint n_pending;
+
+  GtkSortListModel *self;
+  guint n_chunks;
+  gsize *bounds; /* n_chunks + 1 chunk boundaries */
+
+  /* for initializing keys */
+  guint *missing;
+  gpointer *items;
+
+  /* for sorting and merging */
+  gpointer *src;
+  gpointer *dest;
+  guint width; /* number of chunks in each sorted run */
+};
+
+static void
+gtk_sort_job_run (gpointer data,
+                  gpointer unused)
+{
+  GtkSortJob *job = data;
+  GtkSortJobs *jobs = job->jobs;
+
+  jobs->func (jobs, job->index);
+
+  g_mutex_lock (&jobs->mutex);
+  jobs->n_pending--;
+  if (jobs->n_pending == 0)
+    g_cond_signal (&jobs->cond);
+  g_mutex_unlock (&jobs->mutex);
+}
+
+static GThreadPool *
+gtk_sort_jobs_get_thread_pool (void)
+{
+  static GThreadPool *pool = NULL;
+
+  if (g_once_init_enter (&pool))
+    {
+      GThreadPool *new_pool;
+
+      new_pool = g_thread_pool_new (gtk_sort_job_run,
+                                    NULL,
+                                    MAX (1, g_get_num_processors () - 1),
+                                    FALSE,
+                                    NULL);
+      g_once_init_leave (&pool, new_pool);
+    }
+
+  return pool;
+}
+
+static void
+gtk_sort_jobs_set_chunks (GtkSortJobs *jobs,
+                          gsize        n_items)
+{
+  guint i;
+
+  jobs->n_chunks = CLAMP (n_items / GTK_SORT_THREADED_CHUNK_SIZE, 1, g_get_num_processors ());
+  jobs->bounds = g_renew (gsize, jobs->bounds, jobs->n_chunks + 1);
+  for (i = 0; i <= jobs->n_chunks; i++)
+    jobs->bounds[i] = n_items * i / jobs->n_chunks;
+}
+
+static void
+gtk_sort_jobs_run (GtkSortJobs *jobs,
+                   void       (* func) (GtkSortJobs *, guint),
+                   guint         n_jobs)
+{
+  GtkSortJob *job_data;
+  GThreadPool *pool;
+  guint i;
+
+  jobs->func = func;
+
+  if (n_jobs == 1)
+    {
+      func (jobs, 0);
+      return;
+    }
+
+  pool = gtk_sort_jobs_get_thread_pool ();
+  job_data = g_new (GtkSortJob, n_jobs);
+  jobs->n_pending = n_jobs - 1;
+
+  for (i = 1; i < n_jobs; i++)
+    {
+      job_data[i].jobs = jobs;
+      job_data[i].index = i;
+      g_thread_pool_push (pool, &job_data[i], NULL);
+    }
+
+  /* Do our share while waiting */
+  func (jobs, 0);
+
+  g_mutex_lock (&jobs->mutex);
+  while (jobs->n_pending > 0)
+    g_cond_wait (&jobs->cond, &jobs->mutex);
+  g_mutex_unlock (&jobs->mutex);
+
+  g_free (job_data);
+}
+
+static void
+gtk_sort_jobs_init_keys (GtkSortJobs *jobs,
+                         guint        index)
+{
+  GtkSortListModel *self = jobs->self;
+  gsize i;
+
+  for (i = jobs->bounds[index]; i < jobs->bounds[index + 1]; i++)
+    gtk_sort_keys_init_key (self->sort_keys, jobs->items[i], key_from_pos (self, jobs->missing[i]));
+}
+
+static void
+gtk_sort_jobs_sort_chunk (GtkSortJobs *jobs,
+                          guint        index)
+{
+  gtk_tim_sort (jobs->src + jobs->bounds[index],
+                jobs->bounds[index + 1] - jobs->bounds[index],
+                sizeof (gpointer),
+                sort_func,
+                jobs->self->sort_keys);
+}
+
+static void
+gtk_sort_jobs_merge_runs (GtkSortJobs *jobs,
+                          guint        index)
+{
+  GtkSortKeys *sort_keys = jobs->self->sort_keys;
+  gpointer *src = jobs->src;
+  gpointer *dest = jobs->dest;
+  gsize l, l_end, r, r_end, out;
+
+  l = jobs->bounds[MIN (2 * index * jobs->width, jobs->n_chunks)];
+  r = jobs->bounds[MIN ((2 * index + 1) * jobs->width, jobs->n_chunks)];
+  r_end = jobs->bounds[MIN ((2 * index + 2) * jobs->width, jobs->n_chunks)];
+  l_end = r;
+  out = l;
+
+  while (l < l_end && r < r_end)
+    {
+      if (sort_func (&src[l], &src[r], sort_keys) < 0)
+        dest[out++] = src[l++];
+      else
+        dest[out++] = src[r++];
+    }
+
+  memcpy (&dest[out], &src[l], (l_end - l) * sizeof (gpointer));
+  out += l_end - l;
+  memcpy (&dest[out], &src[r], (r_end - r) * sizeof (gpointer));
+}
+
+static gboolean
+gtk_sort_list_model_should_sort_threaded (GtkSortListModel *self)
+{
+  return self->threaded &&
+         self->sort_keys != NULL &&
+         gtk_sort_keys_is_threadsafe (self->sort_keys);
+}
+
+static void
+gtk_sort_list_model_sort_threaded (GtkSortListModel *self,
+                                   guint            *out_position,
+                                   guint            *out_n_items)
+{
+  GtkSortJobs jobs = { NULL, };
+  gpointer *unsorted;
+
+  g_mutex_init (&jobs.mutex);
+  g_cond_init (&jobs.cond);
+  jobs.self = self;
+
+  if (!gtk_bitset_is_empty (self->missing_keys))
+    {
+      GtkBitsetIter iter;
+      gsize i, n_missing;
+      guint pos;
+
+      n_missing = gtk_bitset_get_size (self->missing_keys);
+      jobs.missing = g_new (guint, n_missing);
+      jobs.items = g_new (gpointer, n_missing);
+
+      /* Models don't need to be threadsafe, so get the items here */
+      i = 0;
+      for (gtk_bitset_iter_init_first (&iter, self->missing_keys, &pos);
+           gtk_bitset_iter_is_valid (&iter);
+           gtk_bitset_iter_next (&iter, &pos))
+        {
+          jobs.missing[i] = pos;
+          jobs.items[i] = g_list_model_get_item (self->model, pos);
+          i++;
+        }
+
+      if (gtk_sort_keys_is_init_threadsafe (self->sort_keys))
+        {
+          gtk_sort_jobs_set_chunks (&jobs, n_missing);
+          gtk_sort_jobs_run (&jobs, gtk_sort_jobs_init_keys, jobs.n_chunks);
+        }
+      else
+        {
+          for (i = 0; i < n_missing; i++)
+            gtk_sort_keys_init_key (self->sort_keys, jobs.items[i], key_from_pos (self, jobs.missing[i]));
+        }
+
+      for (i = 0; i < n_missing; i++)
+        g_object_unref (jobs.items[i]);
+      g_free (jobs.items);
+      g_free (jobs.missing);
+
+      gtk_bitset_remove_all (self->missing_keys);
+    }
+
+  unsorted = g_new (gpointer, self->n_items);
+  memcpy (unsorted, self->positions, self->n_items * sizeof (gpointer));
+
+  jobs.src = self->positions;
+  jobs.dest = g_new (gpointer, self->n_items);
+
+  gtk_sort_jobs_set_chunks (&jobs, self->n_items);
+  gtk_sort_jobs_run (&jobs, gtk_sort_jobs_sort_chunk, jobs.n_chunks);
+
+  for (jobs.width = 1; jobs.width < jobs.n_chunks; jobs.width *= 2)
+    {
+      gpointer *tmp;
+
+      gtk_sort_jobs_run (&jobs, gtk_sort_jobs_merge_runs,
+                         (jobs.n_chunks + 2 * jobs.width - 1) / (2 * jobs.width));
+
+      tmp = jobs.src;
+      jobs.src = jobs.dest;
+      jobs.dest = tmp;
+    }
+
+  self->positions = jobs.src;
+  g_free (jobs.dest);
+  g_free (jobs.bounds);
+  g_mutex_clear (&jobs.mutex);
+  g_cond_clear (&jobs.cond);
+
+  gtk_sort_list_model_find_changes (self, unsorted, out_position, out_n_items);
+
+  g_free (unsorted);
+}
+
+/* Radix sorting
+ *
+ * If the sort keys can produce radix keys, a full sort is done as a
+ * LSD radix sort on them. That takes a fixed number of passes over the
+ * items instead of O(n log n) comparisons.
+ * The radix sort is stable and starts out with the items in model order,
+ * so ties are broken just like in sort_func(). If the radix keys are only
+ * prefixes of the keys, runs of equal radix keys get sorted by comparing
+ * their keys afterwards.
+ */
+static gboolean
+gtk_sort_list_model_should_sort_radix (GtkSortListModel *self)
+{
+  gsize runs[GTK_TIM_SORT_MAX_PENDING + 1];
+  gsize radix_size;
+
+  if (self->sort_keys == NULL ||
+      self->n_items < GTK_SORT_RADIX_MIN_ITEMS)
+    return FALSE;
+
+  radix_size = gtk_sort_keys_get_radix_size (self->sort_keys);
+  if (radix_size == 0 || radix_size > GTK_SORT_RADIX_MAX_SIZE)
+    return FALSE;
+
+  /* Merging presorted runs is cheaper than sorting from scratch */
+  gtk_tim_sort_get_runs (&self->sort, runs);
+  return runs[0] == 0;
+}
+
+static void
+gtk_sort_list_model_sort_radix (GtkSortListModel *self,
+                                guint            *out_position,
+                                guint            *out_n_items)
+{
+  gsize radix_size = gtk_sort_keys_get_radix_size (self->sort_keys);
+  gpointer *unsorted;
+  guchar *radix_keys;
+  gsize *counts;
+  guint *src, *dest;
+  guint i;
+  gsize b;
+
+  if (!gtk_bitset_is_empty (self->missing_keys))
+    {
+      GtkBitsetIter iter;
+      guint pos;
+
+      for (gtk_bitset_iter_init_first (&iter, self->missing_keys, &pos);
+           gtk_bitset_iter_is_valid (&iter);
+           gtk_bitset_iter_next (&iter, &pos))
+        {
+          gpointer item = g_list_model_get_item (self->model, pos);
+          gtk_sort_keys_init_key (self->sort_keys, item, key_from_pos (self, pos));
+          g_object_unref (item);
+        }
+
+      gtk_bitset_remove_all (self->missing_keys);
+    }
+
+  /* Create the radix keys and count the byte values for every pass at once */
+  radix_keys = g_malloc_n (self->n_items, radix_size);
+  counts = g_new0 (gsize, radix_size * 256);
+  for (i = 0; i < self->n_items; i++)
+    {
+      guchar *radix_key = radix_keys + i * radix_size;
+
+      gtk_sort_keys_get_radix_key (self->sort_keys, key_from_pos (self, i), radix_key);
+      for (b = 0; b < radix_size; b++)
+        counts[b * 256 + radix_key[b]]++;
+    }
+
+  src = g_new (guint, self->n_items);
+  dest = g_new (guint, self->n_items);
+  for (i = 0; i < self->n_items; i++)
+    src[i] = i;
+
+  for (b = radix_size; b-- > 0; )
+    {
+      gsize *count = counts + b * 256;
+      gsize c, sum;
+      guint *tmp;
+
+      /* All items have the same byte here, so the pass would not change anything */
+      if (count[radix_keys[b]] == self->n_items)
+        continue;
+
+      sum = 0;
+      for (c = 0; c < 256; c++)
+        {
+          gsize n = count[c];
+          count[c] = sum;
+          sum += n;
+        }
+
+      for (i = 0; i < self->n_items; i++)
+        dest[count[radix_keys[src[i] * radix_size + b]]++] = src[i];
+
+      tmp = src;
+      src = dest;
+      dest = tmp;
+    }
+
+  unsorted = g_new (gpointer, self->n_items);
+  memcpy (unsorted, self->positions, self->n_items * sizeof (gpointer));
+
+  for (i = 0; i < self->n_items; i++)
+    self->positions[i] = key_from_pos (self, src[i]);
+
+  if (!gtk_sort_keys_is_radix_exact (self->sort_keys))
+    {
+      guint start, end;
+
+      for (start = 0; start < self->n_items; start = end)
+        {
+          for (end = start + 1; end < self->n_items; end++)
+            {
+              if (memcmp (radix_keys + src[start] * radix_size,
+                          radix_keys + src[end] * radix_size,
+                          radix_size) != 0)
+                break;
+            }
+
+          if (end - start > 1)
+            gtk_tim_sort (self->positions + start,
+                          end - start,
+                          sizeof (gpointer),
+                          sort_func,
+                          self->sort_keys);
+        }
+    }
+
+  g_free (src);
+  g_free (dest);
+  g_free (counts);
+  g_free (radix_keys);
+
+  gtk_sort_list_model_find_changes (self, unsorted, out_position, out_n_items);
+
+  g_free (unsorted);
+}
+
 static gboolean
 gtk_sort_list_model_start_sorting (GtkSortListModel *self,
                                    gsize            *runs)
@@ -319,7 +787,7 @@ gtk_sort_list_model_start_sorting (GtkSortListModel *self,
   if (self->incremental)
     gtk_tim_sort_set_max_merge_size (&self->sort, GTK_SORT_MAX_MERGE_SIZE);
 
-  if (!self->incremental)
+  if (!self->incremental || gtk_sort_list_model_should_sort_threaded (self))
     return FALSE;
 
   self->sort_cb = g_idle_add (gtk_sort_list_model_sort_cb, self);
@@ -332,6 +800,22 @@ gtk_sort_list_model_finish_sorting (GtkSortListModel *self,
                                     guint            *pos,
                                     guint            *n_items)
 {
+  if (gtk_sort_list_model_should_sort_threaded (self))
+    {
+      gtk_tim_sort_finish (&self->sort);
+      gtk_sort_list_model_sort_threaded (self, pos, n_items);
+      gtk_sort_list_model_stop_sorting (self, NULL);
+      return;
+    }
+
+  if (gtk_sort_list_model_should_sort_radix (self))
+    {
+      gtk_sort_list_model_sort_radix (self, pos, n_items);
+      gtk_tim_sort_finish (&self->sort);
+      gtk_sort_list_model_stop_sorting (self, NULL);
+      return;
+    }
+
   gtk_tim_sort_set_max_merge_size (&self->sort, 0);
 
   gtk_sort_list_model_sort_step (self, TRUE, pos, n_items);
@@ -640,6 +1124,10 @@ gtk_sort_list_model_set_property (GObject      *object,
       gtk_sort_list_model_set_sorter (self, g_value_get_object (value));
       break;
 
+    case PROP_THREADED:
+      gtk_sort_list_model_set_threaded (self, g_value_get_boolean (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -672,6 +1160,10 @@ gtk_sort_list_model_get_property (GObject     *object,
       g_value_set_object (value, self->sorter);
       break;
 
+    case PROP_THREADED:
+      g_value_set_boolean (value, self->threaded);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -822,6 +1314,18 @@ gtk_sort_list_model_class_init (GtkSortListModelClass *class)
                             GTK_TYPE_SORTER,
                             GTK_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY);
 
+  /**
+   * GtkSortListModel:threaded:
+   *
+   * If the model should sort items using multiple threads
+   */
+  properties[PROP_THREADED] =
+      g_param_spec_boolean ("threaded",
+                            P_("Threaded"),
+                            P_("Sort items using multiple threads"),
+                            FALSE,
+                            GTK_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY);
+
   g_object_class_install_properties (gobject_class, NUM_PROPERTIES, properties);
 }
 
@@ -1026,6 +1530,70 @@ gtk_sort_list_model_get_incremental (GtkSortListModel *self)
   return self->incremental;
 }
 
+/**
+ * gtk_sort_list_model_set_threaded:
+ * @self: a #GtkSortListModel
+ * @threaded: %TRUE to sort using multiple threads
+ *
+ * Sets the sort model to spread sorting over multiple threads.
+ *
+ * When threaded sorting is enabled, the items are sorted in parallel.
+ * The main thread still waits for the sort to complete, but on machines
+ * with multiple cores this can be many times faster than sorting on the
+ * main thread alone.
+ *
+ * This only works with sorters that can compare items without running
+ * application code, like a #GtkStringSorter or a #GtkNumericSorter.
+ * Other sorters, like a #GtkCustomSorter, make the model sort on the
+ * main thread as usual. Items are always retrieved from the model and
+ * their properties are always read on the main thread.
+ *
+ * When threaded sorting is possible, it takes precedence over
+ * #GtkSortListModel:incremental.
+ *
+ * By default, threaded sorting is disabled.
+ */
+void
+gtk_sort_list_model_set_threaded (GtkSortListModel *self,
+                                  gboolean          threaded)
+{
+  g_return_if_fail (GTK_IS_SORT_LIST_MODEL (self));
+
+  if (self->threaded == threaded)
+    return;
+
+  self->threaded = threaded;
+
+  if (gtk_sort_list_model_should_sort_threaded (self) &&
+      gtk_sort_list_model_is_sorting (self))
+    {
+      guint pos, n_items;
+
+      gtk_sort_list_model_finish_sorting (self, &pos, &n_items);
+      if (n_items)
+        g_list_model_items_changed (G_LIST_MODEL (self), pos, n_items, n_items);
+    }
+
+  g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_THREADED]);
+}
+
+/**
+ * gtk_sort_list_model_get_threaded:
+ * @self: a #GtkSortListModel
+ *
+ * Returns whether threaded sorting was enabled via
+ * gtk_sort_list_model_set_threaded().
+ *
+ * Returns: %TRUE if threaded sorting is enabled
+ */
+gboolean
+gtk_sort_list_model_get_threaded (GtkSortListModel *self)
+{
+  g_return_val_if_fail (GTK_IS_SORT_LIST_MODEL (self), FALSE);
+
+  return self->threaded;
+}
+
 /**
  * gtk_sort_list_model_get_pending:
  * @self: a #GtkSortListModel
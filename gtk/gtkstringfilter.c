@@ -19,7 +19,7 @@
 
 #include "config.h"
 
-#include "gtkstringfilter.h"
+#include "gtkstringfilterprivate.h"
 
 #include "gtkintl.h"
 #include "gtktypebuiltins.h"
@@ -35,6 +35,13 @@
  *
  * GtkStringFilter has several different modes of comparison - it
  * can match the whole string, just a prefix, or any substring.
+ *
+ * When used with a #GtkFilterListModel, the prepared strings of all
+ * items are cached together with an index of the trigrams they
+ * contain, so that changing the search term only has to look at
+ * items that can still match. This assumes the strings do not change
+ * while items are in the model without the model emitting
+ * #GListModel::items-changed for them.
  */
 
 struct _GtkStringFilter
@@ -48,6 +55,19 @@ struct _GtkStringFilter
   GtkStringFilterMatchMode match_mode;
 
   GtkExpression *expression;
+
+  guint generation; /* changes whenever prepared strings would change */
+};
+
+struct _GtkStringFilterIndex
+{
+  GtkStringFilter *filter;
+  guint generation;
+
+  GPtrArray *strings; /* prepared strings by position, NULL if none */
+  GtkBitset *unindexed; /* positions not yet prepared */
+  GHashTable *trigrams; /* trigram => GtkBitset of positions */
+  guint stale_from; /* trigrams of positions from here on are outdated */
 };
 
 enum {
@@ -93,26 +113,28 @@ gtk_string_filter_has_search (GtkStringFilter *self)
   return self->search_prepared != NULL;
 }
 
-static gboolean
-gtk_string_filter_match (GtkFilter *filter,
-                         gpointer   item)
+static char *
+gtk_string_filter_prepare_item (GtkStringFilter *self,
+                                gpointer         item)
 {
-  GtkStringFilter *self = GTK_STRING_FILTER (filter);
   GValue value = G_VALUE_INIT;
   char *prepared;
-  const char *s;
-  gboolean result;
-
-  if (!gtk_string_filter_has_search (self))
-    return TRUE;
 
   if (self->expression == NULL ||
       !gtk_expression_evaluate (self->expression, item, &value))
-    return FALSE;
-  s = g_value_get_string (&value);
-  prepared = gtk_string_filter_prepare (self, s);
-  if (prepared == NULL)
-    return FALSE;
+    return NULL;
+
+  prepared = gtk_string_filter_prepare (self, g_value_get_string (&value));
+  g_value_unset (&value);
+
+  return prepared;
+}
+
+static gboolean
+gtk_string_filter_match_prepared (GtkStringFilter *self,
+                                  const char      *prepared)
+{
+  gboolean result;
 
   switch (self->match_mode)
     {
@@ -130,11 +152,65 @@ gtk_string_filter_match (GtkFilter *filter,
     }
 
 #if 0
-  g_print ("%s (%s) %s %s (%s)\n", s, prepared, result ? "==" : "!=", self->search, self->search_prepared);
+  g_print ("%s %s %s (%s)\n", prepared, result ? "==" : "!=", self->search, self->search_prepared);
 #endif
 
+  return result;
+}
+
+static gboolean
+gtk_string_filter_match (GtkFilter *filter,
+                         gpointer   item)
+{
+  GtkStringFilter *self = GTK_STRING_FILTER (filter);
+  char *prepared;
+  gboolean result;
+
+  if (!gtk_string_filter_has_search (self))
+    return TRUE;
+
+  prepared = gtk_string_filter_prepare_item (self, item);
+  if (prepared == NULL)
+    return FALSE;
+
+  result = gtk_string_filter_match_prepared (self, prepared);
+
   g_free (prepared);
-  g_value_unset (&value);
+
+  return result;
+}
+
+static GtkBitset *
+gtk_string_filter_match_items (GtkFilter  *filter,
+                               GListModel *model,
+                               GtkBitset  *positions)
+{
+  GtkStringFilter *self = GTK_STRING_FILTER (filter);
+  GtkBitset *result;
+  GtkBitsetIter iter;
+  guint pos;
+
+  result = gtk_bitset_new_empty ();
+
+  for (gtk_bitset_iter_init_first (&iter, positions, &pos);
+       gtk_bitset_iter_is_valid (&iter);
+       gtk_bitset_iter_next (&iter, &pos))
+    {
+      gpointer item;
+      char *prepared;
+
+      item = g_list_model_get_item (model, pos);
+      prepared = gtk_string_filter_prepare_item (self, item);
+      g_object_unref (item);
+
+      if (prepared == NULL)
+        continue;
+
+      if (gtk_string_filter_match_prepared (self, prepared))
+        gtk_bitset_add (result, pos);
+
+      g_free (prepared);
+    }
 
   return result;
 }
@@ -236,6 +312,7 @@ gtk_string_filter_class_init (GtkStringFilterClass *class)
   GObjectClass *object_class = G_OBJECT_CLASS (class);
 
   filter_class->match = gtk_string_filter_match;
+  filter_class->match_items = gtk_string_filter_match_items;
   filter_class->get_strictness = gtk_string_filter_get_strictness;
 
   object_class->get_property = gtk_string_filter_get_property;
@@ -422,6 +499,7 @@ gtk_string_filter_set_expression (GtkStringFilter *self,
 
   g_clear_pointer (&self->expression, gtk_expression_unref);
   self->expression = gtk_expression_ref (expression);
+  self->generation++;
 
   if (gtk_string_filter_has_search (self))
     gtk_filter_changed (GTK_FILTER (self), GTK_FILTER_CHANGE_DIFFERENT);
@@ -462,6 +540,7 @@ gtk_string_filter_set_ignore_case (GtkStringFilter *self,
     return;
 
   self->ignore_case = ignore_case;
+  self->generation++;
 
   if (self->search)
     {
@@ -539,3 +618,303 @@ gtk_string_filter_set_match_mode (GtkStringFilter *self,
 }
 
                                                                  
+
+/* The index caches the prepared strings of all items in a model by
+ * position and keeps a bitset of positions for every trigram - 3
+ * consecutive bytes - found in those strings.
+ *
+ * Every match requires the prepared string to contain the trigrams
+ * of the prepared search string, so intersecting their bitsets gives
+ * the only positions that can possibly match. The remaining ones are
+ * then checked against the cached strings.
+ *
+ * Strings get prepared lazily when an item is first matched, so the
+ * index is built as a side effect of filtering the model the first
+ * time.
+ *
+ * Changes to the model only shift the cached strings. The trigrams
+ * of all positions after the first change are rebuilt from them the
+ * next time the index is used, so a change doesn't have to touch
+ * the bitsets of all trigrams.
+ */
+
+#define TRIGRAM(s) GUINT_TO_POINTER (((guint) (guchar) (s)[0] << 16) | \
+                                     ((guint) (guchar) (s)[1] << 8) | \
+                                     ((guint) (guchar) (s)[2]))
+
+static void
+gtk_string_filter_index_reset (GtkStringFilterIndex *index)
+{
+  guint n_items = index->strings->len;
+
+  g_ptr_array_set_size (index->strings, 0);
+  g_ptr_array_set_size (index->strings, n_items);
+  gtk_bitset_unref (index->unindexed);
+  index->unindexed = gtk_bitset_new_range (0, n_items);
+  g_hash_table_remove_all (index->trigrams);
+  index->stale_from = G_MAXUINT;
+
+  index->generation = index->filter->generation;
+}
+
+static void
+gtk_string_filter_index_validate (GtkStringFilterIndex *index)
+{
+  if (index->generation != index->filter->generation)
+    gtk_string_filter_index_reset (index);
+}
+
+static void
+gtk_string_filter_index_add_trigrams (GtkStringFilterIndex *index,
+                                      guint                 position,
+                                      const char           *prepared)
+{
+  gsize i;
+
+  for (i = 0; prepared[i] && prepared[i + 1] && prepared[i + 2]; i++)
+    {
+      GtkBitset *positions;
+
+      positions = g_hash_table_lookup (index->trigrams, TRIGRAM (prepared + i));
+      if (positions == NULL)
+        {
+          positions = gtk_bitset_new_empty ();
+          g_hash_table_insert (index->trigrams, TRIGRAM (prepared + i), positions);
+        }
+
+      gtk_bitset_add (positions, position);
+    }
+}
+
+static void
+gtk_string_filter_index_add (GtkStringFilterIndex *index,
+                             guint                 position,
+                             gpointer              item)
+{
+  char *prepared;
+
+  prepared = gtk_string_filter_prepare_item (index->filter, item);
+  g_free (g_ptr_array_index (index->strings, position));
+  g_ptr_array_index (index->strings, position) = prepared;
+  gtk_bitset_remove (index->unindexed, position);
+
+  /* stale trigrams get rebuilt from the string later */
+  if (prepared == NULL || position >= index->stale_from)
+    return;
+
+  gtk_string_filter_index_add_trigrams (index, position, prepared);
+}
+
+static void
+gtk_string_filter_index_update_trigrams (GtkStringFilterIndex *index)
+{
+  GHashTableIter iter;
+  gpointer positions;
+  guint i;
+
+  if (index->stale_from == G_MAXUINT)
+    return;
+
+  g_hash_table_iter_init (&iter, index->trigrams);
+  while (g_hash_table_iter_next (&iter, NULL, &positions))
+    {
+      gtk_bitset_remove_range_closed (positions, index->stale_from, G_MAXUINT);
+      if (gtk_bitset_is_empty (positions))
+        g_hash_table_iter_remove (&iter);
+    }
+
+  for (i = index->stale_from; i < index->strings->len; i++)
+    {
+      const char *prepared = g_ptr_array_index (index->strings, i);
+
+      if (prepared)
+        gtk_string_filter_index_add_trigrams (index, i, prepared);
+    }
+
+  index->stale_from = G_MAXUINT;
+}
+
+/*<private>
+ * gtk_string_filter_index_new:
+ * @filter: the filter to index strings for
+ * @n_items: the number of items in the model
+ *
+ * Creates an index for the items of a model with @n_items items.
+ * The index must be kept up to date via gtk_string_filter_index_splice().
+ *
+ * Returns: a new index
+ */
+GtkStringFilterIndex *
+gtk_string_filter_index_new (GtkStringFilter *filter,
+                             guint            n_items)
+{
+  GtkStringFilterIndex *index;
+
+  index = g_slice_new0 (GtkStringFilterIndex);
+  index->filter = g_object_ref (filter);
+  index->strings = g_ptr_array_new_full (n_items, g_free);
+  g_ptr_array_set_size (index->strings, n_items);
+  index->unindexed = gtk_bitset_new_range (0, n_items);
+  index->trigrams = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify) gtk_bitset_unref);
+  index->stale_from = G_MAXUINT;
+  index->generation = filter->generation;
+
+  return index;
+}
+
+void
+gtk_string_filter_index_free (GtkStringFilterIndex *index)
+{
+  g_object_unref (index->filter);
+  g_ptr_array_unref (index->strings);
+  gtk_bitset_unref (index->unindexed);
+  g_hash_table_unref (index->trigrams);
+
+  g_slice_free (GtkStringFilterIndex, index);
+}
+
+/*<private>
+ * gtk_string_filter_index_splice:
+ * @index: a #GtkStringFilterIndex
+ * @position: position of the change
+ * @removed: number of removed items
+ * @added: number of added items
+ *
+ * Updates the index for a #GListModel::items-changed emission
+ * of the indexed model. Added items will be indexed when they
+ * are first matched.
+ *
+ * This only shifts the cached strings, the trigrams of the changed
+ * positions are updated by the next gtk_string_filter_index_restrict().
+ */
+void
+gtk_string_filter_index_splice (GtkStringFilterIndex *index,
+                                guint                 position,
+                                guint                 removed,
+                                guint                 added)
+{
+  guint n_after;
+
+  g_return_if_fail (position + removed <= index->strings->len);
+
+  if (removed > 0)
+    g_ptr_array_remove_range (index->strings, position, removed);
+  if (added > 0)
+    {
+      n_after = index->strings->len - position;
+      g_ptr_array_set_size (index->strings, index->strings->len + added);
+      memmove (index->strings->pdata + position + added,
+               index->strings->pdata + position,
+               n_after * sizeof (gpointer));
+      memset (index->strings->pdata + position, 0, added * sizeof (gpointer));
+    }
+
+  gtk_bitset_splice (index->unindexed, position, removed, added);
+  if (added > 0)
+    gtk_bitset_add_range (index->unindexed, position, added);
+
+  if (removed > 0 || added > 0)
+    index->stale_from = MIN (index->stale_from, position);
+}
+
+/*<private>
+ * gtk_string_filter_index_restrict:
+ * @index: a #GtkStringFilterIndex
+ * @positions: the positions to check
+ *
+ * Removes all positions from @positions that are known to not
+ * match the current search term of the filter.
+ */
+void
+gtk_string_filter_index_restrict (GtkStringFilterIndex *index,
+                                  GtkBitset            *positions)
+{
+  GtkStringFilter *self = index->filter;
+  GtkBitset *candidates = NULL;
+  const char *search;
+  gsize i;
+
+  gtk_string_filter_index_validate (index);
+
+  if (!gtk_string_filter_has_search (self) ||
+      self->expression == NULL)
+    return;
+
+  /* search term is too short */
+  search = self->search_prepared;
+  if (!search[0] || !search[1] || !search[2])
+    return;
+
+  gtk_string_filter_index_update_trigrams (index);
+
+  for (i = 0; search[i] && search[i + 1] && search[i + 2]; i++)
+    {
+      GtkBitset *trigram_positions;
+
+      trigram_positions = g_hash_table_lookup (index->trigrams, TRIGRAM (search + i));
+      if (trigram_positions == NULL)
+        {
+          g_clear_pointer (&candidates, gtk_bitset_unref);
+          candidates = gtk_bitset_new_empty ();
+          break;
+        }
+
+      if (candidates == NULL)
+        candidates = gtk_bitset_copy (trigram_positions);
+      else
+        gtk_bitset_intersect (candidates, trigram_positions);
+    }
+
+  gtk_bitset_union (candidates, index->unindexed);
+  gtk_bitset_intersect (positions, candidates);
+  gtk_bitset_unref (candidates);
+}
+
+/*<private>
+ * gtk_string_filter_index_match_items:
+ * @index: a #GtkStringFilterIndex
+ * @model: the indexed model
+ * @positions: the positions of the items to match
+ *
+ * Matches the items like gtk_filter_match_items() would, but uses
+ * the cached strings for items that were matched before.
+ *
+ * Returns: (transfer full): the positions of the matched items
+ */
+GtkBitset *
+gtk_string_filter_index_match_items (GtkStringFilterIndex *index,
+                                     GListModel           *model,
+                                     GtkBitset            *positions)
+{
+  GtkStringFilter *self = index->filter;
+  GtkBitset *result;
+  GtkBitsetIter iter;
+  guint pos;
+
+  gtk_string_filter_index_validate (index);
+
+  if (!gtk_string_filter_has_search (self))
+    return gtk_bitset_copy (positions);
+
+  result = gtk_bitset_new_empty ();
+
+  for (gtk_bitset_iter_init_first (&iter, positions, &pos);
+       gtk_bitset_iter_is_valid (&iter);
+       gtk_bitset_iter_next (&iter, &pos))
+    {
+      const char *prepared;
+
+      if (gtk_bitset_contains (index->unindexed, pos))
+        {
+          gpointer item = g_list_model_get_item (model, pos);
+          gtk_string_filter_index_add (index, pos, item);
+          g_object_unref (item);
+        }
+
+      prepared = g_ptr_array_index (index->strings, pos);
+      if (prepared && gtk_string_filter_match_prepared (self, prepared))
+        gtk_bitset_add (result, pos);
+    }
+
+  return result;
+}
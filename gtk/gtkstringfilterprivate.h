@@ -0,0 +1,41 @@
+/*
+ * Copyright © 2020 Benjamin Otte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GTK_STRING_FILTER_PRIVATE_H__
+#define __GTK_STRING_FILTER_PRIVATE_H__
+
+#include <gtk/gtkstringfilter.h>
+
+#include "gtk/gtkbitset.h"
+
+typedef struct _GtkStringFilterIndex GtkStringFilterIndex;
+
+GtkStringFilterIndex *  gtk_string_filter_index_new             (GtkStringFilter        *filter,
+                                                                 guint                   n_items);
+void                    gtk_string_filter_index_free            (GtkStringFilterIndex   *index);
+
+void                    gtk_string_filter_index_splice          (GtkStringFilterIndex   *index,
+                                                                 guint                   position,
+                                                                 guint                   removed,
+                                                                 guint                   added);
+void                    gtk_string_filter_index_restrict        (GtkStringFilterIndex   *index,
+                                                                 GtkBitset              *positions);
+GtkBitset *             gtk_string_filter_index_match_items     (GtkStringFilterIndex   *index,
+                                                                 GListModel             *model,
+                                                                 GtkBitset              *positions);
+
+#endif /* __GTK_STRING_FILTER_PRIVATE_H__ */
@@ -39,6 +39,10 @@
  * GtkStringList is well-suited for any place where you would
  * typically use a `char*[]`, but need a list model.
  *
+ * The strings are stored compactly, and the #GtkStringObject wrapping
+ * a string is only created when the item is requested from the model.
+ * It is kept only as long as somebody holds a reference to it.
+ *
  * # GtkStringList as GtkBuildable
  *
  * The GtkStringList implementation of the GtkBuildable interface
@@ -60,10 +64,75 @@
 
  */
 
-#define GDK_ARRAY_ELEMENT_TYPE GtkStringObject *
-#define GDK_ARRAY_NAME objects
-#define GDK_ARRAY_TYPE_NAME Objects
-#define GDK_ARRAY_FREE_FUNC g_object_unref
+/* Strings are copied into blocks of this size, strings larger than
+ * a quarter of it get their own block.
+ * Blocks are never reallocated, so string pointers stay valid.
+ * Strings passed to gtk_string_list_take() are kept as they are,
+ * without a block.
+ */
+#define STRING_BLOCK_SIZE (64 * 1024)
+
+typedef struct _StringBlock StringBlock;
+typedef struct _StringEntry StringEntry;
+
+struct _StringBlock
+{
+  gsize ref_count; /* strings using the block + 1 while it is being filled */
+  gsize used;
+  gsize size;
+  char data[];
+};
+
+struct _StringEntry
+{
+  const char *string;
+  StringBlock *block; /* or NULL if the entry owns string */
+  /* the GtkStringObject for the item, while it is alive. Objects can
+   * be finalized on any thread, so they don't get to call back. */
+  GWeakRef *object;
+};
+
+static StringBlock *
+string_block_new (gsize size)
+{
+  StringBlock *block;
+
+  block = g_malloc (sizeof (StringBlock) + size);
+  block->ref_count = 1;
+  block->used = 0;
+  block->size = size;
+
+  return block;
+}
+
+static void
+string_block_unref (StringBlock *block)
+{
+  block->ref_count--;
+  if (block->ref_count == 0)
+    g_free (block);
+}
+
+static void
+string_entry_clear (StringEntry *entry)
+{
+  if (entry->block)
+    string_block_unref (entry->block);
+  else
+    g_free ((char *) entry->string);
+
+  if (entry->object)
+    {
+      g_weak_ref_clear (entry->object);
+      g_free (entry->object);
+    }
+}
+
+#define GDK_ARRAY_ELEMENT_TYPE StringEntry
+#define GDK_ARRAY_NAME string_entries
+#define GDK_ARRAY_TYPE_NAME StringEntries
+#define GDK_ARRAY_BY_VALUE 1
+#define GDK_ARRAY_FREE_FUNC string_entry_clear
 #include "gdk/gdkarrayimpl.c"
 
 struct _GtkStringObject
@@ -177,7 +246,8 @@ struct _GtkStringList
 {
   GObject parent_instance;
 
-  Objects items;
+  StringEntries items;
+  StringBlock *block; /* the block new strings are added to */
 };
 
 struct _GtkStringListClass
@@ -196,7 +266,7 @@ gtk_string_list_get_n_items (GListModel *list)
 {
   GtkStringList *self = GTK_STRING_LIST (list);
 
-  return objects_get_size (&self->items);
+  return string_entries_get_size (&self->items);
 }
 
 static gpointer
@@ -204,11 +274,29 @@ gtk_string_list_get_item (GListModel *list,
                           guint       position)
 {
   GtkStringList *self = GTK_STRING_LIST (list);
+  GtkStringObject *object;
+  StringEntry *entry;
 
-  if (position >= objects_get_size (&self->items))
+  if (position >= string_entries_get_size (&self->items))
     return NULL;
 
-  return g_object_ref (objects_get (&self->items, position));
+  entry = string_entries_index (&self->items, position);
+  if (entry->object)
+    {
+      object = g_weak_ref_get (entry->object);
+      if (object)
+        return object;
+    }
+  else
+    {
+      entry->object = g_new (GWeakRef, 1);
+      g_weak_ref_init (entry->object, NULL);
+    }
+
+  object = gtk_string_object_new (entry->string);
+  g_weak_ref_set (entry->object, object);
+
+  return object;
 }
 
 static void
@@ -390,12 +478,44 @@ G_DEFINE_TYPE_WITH_CODE (GtkStringList, gtk_string_list, G_TYPE_OBJECT,
                          G_IMPLEMENT_INTERFACE (G_TYPE_LIST_MODEL,
                                                 gtk_string_list_model_init))
 
+static void
+gtk_string_list_add_string (GtkStringList *self,
+                            StringEntry   *entry,
+                            const char    *string)
+{
+  StringBlock *block;
+  gsize len;
+
+  len = strlen (string) + 1;
+
+  if (len > STRING_BLOCK_SIZE / 4)
+    {
+      block = string_block_new (len);
+    }
+  else
+    {
+      if (self->block == NULL || self->block->size - self->block->used < len)
+        {
+          g_clear_pointer (&self->block, string_block_unref);
+          self->block = string_block_new (STRING_BLOCK_SIZE);
+        }
+      block = self->block;
+      block->ref_count++;
+    }
+
+  entry->string = memcpy (block->data + block->used, string, len);
+  entry->block = block;
+  entry->object = NULL;
+  block->used += len;
+}
+
 static void
 gtk_string_list_dispose (GObject *object)
 {
   GtkStringList *self = GTK_STRING_LIST (object);
 
-  objects_clear (&self->items);
+  string_entries_clear (&self->items);
+  g_clear_pointer (&self->block, string_block_unref);
 
   G_OBJECT_CLASS (gtk_string_list_parent_class)->dispose (object);
 }
@@ -411,7 +531,7 @@ gtk_string_list_class_init (GtkStringListClass *class)
 static void
 gtk_string_list_init (GtkStringList *self)
 {
-  objects_init (&self->items);
+  string_entries_init (&self->items);
 }
 
 /**
@@ -448,7 +568,8 @@ gtk_string_list_new (const char * const *strings)
  * gtk_string_list_remove(), because it only emits
  * #GListModel::items-changed once for the change.
  *
- * This function copies the strings in @additions.
+ * This function copies the strings in @additions. No memory is
+ * allocated per string.
  *
  * The parameters @position and @n_removals must be correct (ie:
  * @position + @n_removals must be less than or equal to the length
@@ -464,18 +585,20 @@ gtk_string_list_splice (GtkStringList      *self,
 
   g_return_if_fail (GTK_IS_STRING_LIST (self));
   g_return_if_fail (position + n_removals >= position); /* overflow */
-  g_return_if_fail (position + n_removals <= objects_get_size (&self->items));
+  g_return_if_fail (position + n_removals <= string_entries_get_size (&self->items));
 
   if (additions)
     n_additions = g_strv_length ((char **) additions);
   else
     n_additions = 0;
 
-  objects_splice (&self->items, position, n_removals, NULL, n_additions);
+  string_entries_splice (&self->items, position, n_removals, NULL, n_additions);
 
   for (i = 0; i < n_additions; i++)
     {
-      *objects_index (&self->items, position + i) = gtk_string_object_new (additions[i]);
+      gtk_string_list_add_string (self,
+                                  string_entries_index (&self->items, position + i),
+                                  additions[i]);
     }
 
   if (n_removals || n_additions)
@@ -496,11 +619,14 @@ void
 gtk_string_list_append (GtkStringList *self,
                         const char    *string)
 {
+  StringEntry entry;
+
   g_return_if_fail (GTK_IS_STRING_LIST (self));
 
-  objects_append (&self->items, gtk_string_object_new (string));
+  gtk_string_list_add_string (self, &entry, string);
+  string_entries_append (&self->items, &entry);
 
-  g_list_model_items_changed (G_LIST_MODEL (self), objects_get_size (&self->items) - 1, 0, 1);
+  g_list_model_items_changed (G_LIST_MODEL (self), string_entries_get_size (&self->items) - 1, 0, 1);
 }
 
 /**
@@ -522,11 +648,16 @@ void
 gtk_string_list_take (GtkStringList *self,
                       char          *string)
 {
+  StringEntry entry;
+
   g_return_if_fail (GTK_IS_STRING_LIST (self));
 
-  objects_append (&self->items, gtk_string_object_new_take (string));
+  entry.string = string;
+  entry.block = NULL;
+  entry.object = NULL;
+  string_entries_append (&self->items, &entry);
 
-  g_list_model_items_changed (G_LIST_MODEL (self), objects_get_size (&self->items) - 1, 0, 1);
+  g_list_model_items_changed (G_LIST_MODEL (self), string_entries_get_size (&self->items) - 1, 0, 1);
 }
 
 /**
@@ -565,8 +696,8 @@ gtk_string_list_get_string (GtkStringList *self,
 {
   g_return_val_if_fail (GTK_IS_STRING_LIST (self), NULL);
 
-  if (position >= objects_get_size (&self->items))
+  if (position >= string_entries_get_size (&self->items))
     return NULL;
 
-  return objects_get (&self->items, position)->string;
+  return string_entries_get (&self->items, position)->string;
 }
@@ -187,6 +187,31 @@ gtk_string_sort_keys_clear_key (GtkSortKeys *keys,
   g_free (*key);
 }
 
+/* Collation keys have arbitrary length, so the radix key is only
+ * a prefix, padded with 0 bytes. NULL keys sort last.
+ */
+#define GTK_STRING_SORT_KEYS_RADIX_SIZE 8
+
+static void
+gtk_string_sort_keys_get_radix_key (GtkSortKeys   *keys,
+                                    gconstpointer  key_memory,
+                                    guchar        *radix_key)
+{
+  const char *key = *(const char **) key_memory;
+  gsize i;
+
+  if (key == NULL)
+    {
+      memset (radix_key, 0xFF, GTK_STRING_SORT_KEYS_RADIX_SIZE);
+      return;
+    }
+
+  for (i = 0; i < GTK_STRING_SORT_KEYS_RADIX_SIZE && key[i]; i++)
+    radix_key[i] = key[i];
+
+  memset (radix_key + i, 0, GTK_STRING_SORT_KEYS_RADIX_SIZE - i);
+}
+
 static const GtkSortKeysClass GTK_STRING_SORT_KEYS_CLASS =
 {
   gtk_string_sort_keys_free,
@@ -194,6 +219,7 @@ static const GtkSortKeysClass GTK_STRING_SORT_KEYS_CLASS =
   gtk_string_sort_keys_is_compatible,
   gtk_string_sort_keys_init_key,
   gtk_string_sort_keys_clear_key,
+  gtk_string_sort_keys_get_radix_key
 };
 
 static GtkSortKeys *
@@ -211,6 +237,10 @@ gtk_string_sort_keys_new (GtkStringSorter *self)
 
   result->expression = gtk_expression_ref (self->expression);
   result->ignore_case = self->ignore_case;
+  result->keys.threadsafe = TRUE;
+  result->keys.init_threadsafe = gtk_sort_keys_expression_is_threadsafe (self->expression);
+  result->keys.radix_size = GTK_STRING_SORT_KEYS_RADIX_SIZE;
+  result->keys.radix_exact = FALSE;
 
   return (GtkSortKeys *) result;
 }
@@ -19,6 +19,7 @@
 
 #include "gtkstyleproviderprivate.h"
 
+#include "gtkcssnodeprivate.h"
 #include "gtkintl.h"
 #include "gtkprivate.h"
 
@@ -120,6 +121,11 @@ gtk_style_provider_changed (GtkStyleProvider *provider)
 {
   gtk_internal_return_if_fail (GTK_IS_STYLE_PROVIDER (provider));
 
+  /* Lookups done ahead of time point into the old style sheets */
+  gtk_css_node_invalidate_prefetched_matches ();
+  /* Shared styles are keyed by provider */
+  gtk_css_node_style_cache_clear_shared ();
+
   g_signal_emit (provider, signals[CHANGED], 0);
 }
 
@@ -33,13 +33,22 @@
  *
  * #GtkTreeListModel is a #GListModel implementation that can expand rows
  * by creating new child list models on demand.
+ *
+ * When #GtkTreeListModel:autoexpand is used on large trees, the model can
+ * be set up to expand rows incrementally. See
+ * gtk_tree_list_model_set_incremental() for details.
  */
 
+/* how much time to spend expanding rows in one go in incremental mode */
+#define EXPAND_TIME_BUDGET (2 * G_TIME_SPAN_MILLISECOND)
+
 enum {
   PROP_0,
   PROP_AUTOEXPAND,
+  PROP_INCREMENTAL,
   PROP_MODEL,
   PROP_PASSTHROUGH,
+  PROP_PENDING,
   NUM_PROPERTIES
 };
 
@@ -55,6 +64,7 @@ struct _TreeNode
     TreeNode *parent;
     GtkTreeListModel *list;
   };
+  GList *pending_link; /* link in the model's pending queue if waiting to be autoexpanded */
 
   guint empty : 1;
   guint is_root : 1;
@@ -76,7 +86,11 @@ struct _GtkTreeListModel
   gpointer user_data;
   GDestroyNotify user_destroy;
 
+  GQueue pending; /* TreeNodes waiting to be autoexpanded */
+  guint pending_cb; /* idle callback handle */
+
   guint autoexpand : 1;
+  guint incremental : 1;
   guint passthrough : 1;
 };
 
@@ -362,6 +376,9 @@ tree_node_get_row (TreeNode *node)
 static guint
 gtk_tree_list_model_expand_node (GtkTreeListModel *self,
                                  TreeNode         *node);
+static guint
+gtk_tree_list_model_autoexpand_node (GtkTreeListModel *self,
+                                     TreeNode         *node);
 
 static void
 gtk_tree_list_model_items_changed_cb (GListModel *model,
@@ -425,7 +442,7 @@ gtk_tree_list_model_items_changed_cb (GListModel *model,
     {
       for (i = 0; i < added; i++)
         {
-          tree_added += gtk_tree_list_model_expand_node (self, child);
+          tree_added += gtk_tree_list_model_autoexpand_node (self, child);
           child = gtk_rb_tree_node_get_next (child);
         }
     }
@@ -440,11 +457,25 @@ gtk_tree_list_model_items_changed_cb (GListModel *model,
 
 static void gtk_tree_list_row_destroy (GtkTreeListRow *row);
 
+static void
+gtk_tree_list_model_unqueue_node (GtkTreeListModel *self,
+                                  TreeNode         *node)
+{
+  if (node->pending_link == NULL)
+    return;
+
+  g_queue_delete_link (&self->pending, node->pending_link);
+  node->pending_link = NULL;
+}
+
 static void
 gtk_tree_list_model_clear_node (gpointer data)
 {
   TreeNode *node = data;
 
+  if (node->pending_link)
+    gtk_tree_list_model_unqueue_node (tree_node_get_tree_list_model (node), node);
+
   if (node->row)
     gtk_tree_list_row_destroy (node->row);
 
@@ -512,7 +543,7 @@ gtk_tree_list_model_init_node (GtkTreeListModel *list,
       node = gtk_rb_tree_insert_after (self->children, node);
       node->parent = self;
       if (list->autoexpand)
-        gtk_tree_list_model_expand_node (list, node);
+        gtk_tree_list_model_autoexpand_node (list, node);
     }
 }
 
@@ -522,6 +553,8 @@ gtk_tree_list_model_expand_node (GtkTreeListModel *self,
 {
   GListModel *model;
 
+  gtk_tree_list_model_unqueue_node (self, node);
+
   if (node->empty)
     return 0;
   
@@ -546,6 +579,8 @@ gtk_tree_list_model_collapse_node (GtkTreeListModel *self,
 {      
   guint n_items;
 
+  gtk_tree_list_model_unqueue_node (self, node);
+
   if (node->model == NULL)
     return 0;
 
@@ -559,6 +594,86 @@ gtk_tree_list_model_collapse_node (GtkTreeListModel *self,
   return n_items;
 }
 
+static void
+gtk_tree_list_model_stop_expanding (GtkTreeListModel *self)
+{
+  gboolean notify_pending = !g_queue_is_empty (&self->pending);
+
+  while (!g_queue_is_empty (&self->pending))
+    {
+      TreeNode *node = g_queue_pop_head (&self->pending);
+      node->pending_link = NULL;
+    }
+  g_clear_handle_id (&self->pending_cb, g_source_remove);
+
+  if (notify_pending)
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_PENDING]);
+}
+
+/* Expands pending nodes until the queue is empty or end_time is reached.
+ * Pass -1 as end_time to expand everything. */
+static void
+gtk_tree_list_model_run_expand (GtkTreeListModel *self,
+                                gint64            end_time)
+{
+  while (!g_queue_is_empty (&self->pending))
+    {
+      TreeNode *node;
+      guint n_items;
+
+      node = g_queue_peek_head (&self->pending);
+      n_items = gtk_tree_list_model_expand_node (self, node);
+      if (n_items > 0)
+        g_list_model_items_changed (G_LIST_MODEL (self), tree_node_get_position (node) + 1, 0, n_items);
+
+      if (end_time >= 0 && g_get_monotonic_time () >= end_time)
+        break;
+    }
+}
+
+static gboolean
+gtk_tree_list_model_run_expand_cb (gpointer data)
+{
+  GtkTreeListModel *self = data;
+
+  gtk_tree_list_model_run_expand (self, g_get_monotonic_time () + EXPAND_TIME_BUDGET);
+
+  if (g_queue_is_empty (&self->pending))
+    {
+      self->pending_cb = 0;
+      g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_PENDING]);
+      return G_SOURCE_REMOVE;
+    }
+
+  g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_PENDING]);
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* Expands a node that was added while autoexpanding. In incremental
+ * mode, the node is queued instead and 0 is returned. */
+static guint
+gtk_tree_list_model_autoexpand_node (GtkTreeListModel *self,
+                                     TreeNode         *node)
+{
+  if (!self->incremental)
+    return gtk_tree_list_model_expand_node (self, node);
+
+  if (node->empty || node->model != NULL || node->pending_link != NULL)
+    return 0;
+
+  g_queue_push_tail (&self->pending, node);
+  node->pending_link = self->pending.tail;
+
+  if (self->pending_cb == 0)
+    {
+      self->pending_cb = g_idle_add (gtk_tree_list_model_run_expand_cb, self);
+      g_source_set_name_by_id (self->pending_cb, "[gtk] gtk_tree_list_model_run_expand_cb");
+      g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_PENDING]);
+    }
+
+  return 0;
+}
 
 static GType
 gtk_tree_list_model_get_item_type (GListModel *list)
@@ -625,6 +740,10 @@ gtk_tree_list_model_set_property (GObject      *object,
       gtk_tree_list_model_set_autoexpand (self, g_value_get_boolean (value));
       break;
 
+    case PROP_INCREMENTAL:
+      gtk_tree_list_model_set_incremental (self, g_value_get_boolean (value));
+      break;
+
     case PROP_PASSTHROUGH:
       self->passthrough = g_value_get_boolean (value);
       break;
@@ -649,6 +768,10 @@ gtk_tree_list_model_get_property (GObject     *object,
       g_value_set_boolean (value, self->autoexpand);
       break;
 
+    case PROP_INCREMENTAL:
+      g_value_set_boolean (value, self->incremental);
+      break;
+
     case PROP_MODEL:
       g_value_set_object (value, self->root_node.model);
       break;
@@ -657,6 +780,10 @@ gtk_tree_list_model_get_property (GObject     *object,
       g_value_set_boolean (value, self->passthrough);
       break;
 
+    case PROP_PENDING:
+      g_value_set_uint (value, gtk_tree_list_model_get_pending (self));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -668,7 +795,9 @@ gtk_tree_list_model_finalize (GObject *object)
 {
   GtkTreeListModel *self = GTK_TREE_LIST_MODEL (object);
 
+  g_clear_handle_id (&self->pending_cb, g_source_remove);
   gtk_tree_list_model_clear_node (&self->root_node);
+  g_assert (g_queue_is_empty (&self->pending));
   if (self->user_destroy)
     self->user_destroy (self->user_data);
 
@@ -696,6 +825,18 @@ gtk_tree_list_model_class_init (GtkTreeListModelClass *class)
                             FALSE,
                             GTK_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY);
 
+  /**
+   * GtkTreeListModel:incremental:
+   *
+   * If autoexpanded rows should be expanded incrementally
+   */
+  properties[PROP_INCREMENTAL] =
+      g_param_spec_boolean ("incremental",
+                            P_("Incremental"),
+                            P_("Expand rows incrementally"),
+                            FALSE,
+                            GTK_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY);
+
   /**
    * GtkTreeListModel:model:
    *
@@ -722,6 +863,18 @@ gtk_tree_list_model_class_init (GtkTreeListModelClass *class)
                             FALSE,
                             GTK_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_EXPLICIT_NOTIFY);
 
+  /**
+   * GtkTreeListModel:pending:
+   *
+   * Number of rows waiting to be autoexpanded
+   */
+  properties[PROP_PENDING] =
+      g_param_spec_uint ("pending",
+                         P_("Pending"),
+                         P_("Number of rows waiting to be autoexpanded"),
+                         0, G_MAXUINT, 0,
+                         GTK_PARAM_READABLE | G_PARAM_EXPLICIT_NOTIFY);
+
   g_object_class_install_properties (gobject_class, NUM_PROPERTIES, properties);
 }
 
@@ -730,6 +883,7 @@ gtk_tree_list_model_init (GtkTreeListModel *self)
 {
   self->root_node.list = self;
   self->root_node.is_root = TRUE;
+  g_queue_init (&self->pending);
 }
 
 /**
@@ -820,6 +974,9 @@ gtk_tree_list_model_get_passthrough (GtkTreeListModel *self)
  * If set to %TRUE, the model will recursively expand all rows that
  * get added to the model. This can be either rows added by changes
  * to the underlying models or via gtk_tree_list_row_set_expanded().
+ *
+ * Turning autoexpand off stops an ongoing incremental expansion. Rows
+ * that have already been expanded stay expanded.
  **/
 void
 gtk_tree_list_model_set_autoexpand (GtkTreeListModel *self,
@@ -832,6 +989,9 @@ gtk_tree_list_model_set_autoexpand (GtkTreeListModel *self,
 
   self->autoexpand = autoexpand;
 
+  if (!autoexpand)
+    gtk_tree_list_model_stop_expanding (self);
+
   g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_AUTOEXPAND]);
 }
 
@@ -853,6 +1013,88 @@ gtk_tree_list_model_get_autoexpand (GtkTreeListModel *self)
   return self->autoexpand;
 }
 
+/**
+ * gtk_tree_list_model_set_incremental:
+ * @self: a #GtkTreeListModel
+ * @incremental: %TRUE to enable incremental expansion
+ *
+ * When incremental expansion is enabled, rows that are expanded because
+ * of #GtkTreeListModel:autoexpand will not have their children expanded
+ * immediately. Instead, the children are queued and expanded in an idle
+ * handler that only runs for a short time per main loop iteration. This
+ * of course means that the descendants of a row only appear over time.
+ *
+ * Rows expanded explicitly with gtk_tree_list_row_set_expanded() still
+ * have their direct children added immediately.
+ *
+ * When expanding large trees blocks the UI, you might consider turning
+ * this on.
+ *
+ * By default, incremental expansion is disabled.
+ *
+ * See gtk_tree_list_model_get_pending() for progress information
+ * about an ongoing incremental expansion.
+ **/
+void
+gtk_tree_list_model_set_incremental (GtkTreeListModel *self,
+                                     gboolean          incremental)
+{
+  g_return_if_fail (GTK_IS_TREE_LIST_MODEL (self));
+
+  if (self->incremental == incremental)
+    return;
+
+  self->incremental = incremental;
+
+  if (!incremental)
+    {
+      gtk_tree_list_model_run_expand (self, -1);
+      gtk_tree_list_model_stop_expanding (self);
+    }
+
+  g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_INCREMENTAL]);
+}
+
+/**
+ * gtk_tree_list_model_get_incremental:
+ * @self: a #GtkTreeListModel
+ *
+ * Returns whether incremental expansion was enabled via
+ * gtk_tree_list_model_set_incremental().
+ *
+ * Returns: %TRUE if incremental expansion is enabled
+ **/
+gboolean
+gtk_tree_list_model_get_incremental (GtkTreeListModel *self)
+{
+  g_return_val_if_fail (GTK_IS_TREE_LIST_MODEL (self), FALSE);
+
+  return self->incremental;
+}
+
+/**
+ * gtk_tree_list_model_get_pending:
+ * @self: a #GtkTreeListModel
+ *
+ * Returns the number of rows that are waiting to be autoexpanded.
+ *
+ * You can use this value to check if @self is still busy expanding
+ * rows by comparing the return value to 0. Note that expanding a row
+ * may queue more rows, so this number can grow while expanding.
+ *
+ * If no expansion is ongoing - in particular when
+ * #GtkTreeListModel:incremental is %FALSE - this function returns 0.
+ *
+ * Returns: The number of rows waiting to be expanded
+ **/
+guint
+gtk_tree_list_model_get_pending (GtkTreeListModel *self)
+{
+  g_return_val_if_fail (GTK_IS_TREE_LIST_MODEL (self), 0);
+
+  return g_queue_get_length (&self->pending);
+}
+
 /**
  * gtk_tree_list_model_get_row:
  * @self: a #GtkTreeListModel
@@ -1192,12 +1434,16 @@ gtk_tree_list_row_set_expanded (GtkTreeListRow *self,
   if (self->node == NULL)
     return;
 
+  list = tree_node_get_tree_list_model (self->node);
+
+  /* don't autoexpand rows that were explicitly collapsed */
+  if (!expanded)
+    gtk_tree_list_model_unqueue_node (list, self->node);
+
   was_expanded = self->node->children != NULL;
   if (was_expanded == expanded)
     return;
 
-  list = tree_node_get_tree_list_model (self->node);
-
   if (expanded)
     {
       n_items = gtk_tree_list_model_expand_node (list, self->node);
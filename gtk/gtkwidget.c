@@ -81,6 +81,7 @@
 #include "gdk/gdkprofilerprivate.h"
 #include "gsk/gskdebugprivate.h"
 #include "gsk/gskrendererprivate.h"
+#include "gsk/gskrendernodeprivate.h"
 
 #include <cairo-gobject.h>
 #include <locale.h>
@@ -11472,6 +11473,10 @@ gtk_widget_do_snapshot (GtkWidget *widget,
   gtk_widget_push_paintables (widget);
 
   render_node = gtk_widget_create_render_node (widget, snapshot);
+  /* The node is kept around after this frame, so move it out of the
+   * frame's arena before it gets appended to the parent */
+  if (render_node)
+    render_node = gsk_render_node_promote (render_node);
   /* This can happen when nested drawing happens and a widget contains itself
    * or when we replace a clipped area */
   g_clear_pointer (&priv->render_node, gsk_render_node_unref);
@@ -11520,6 +11525,8 @@ gtk_widget_render (GtkWidget            *widget,
   if (renderer == NULL)
     return;
 
+  gsk_render_node_arena_push ();
+
   snapshot = gtk_snapshot_new ();
   gtk_native_get_surface_transform (GTK_NATIVE (widget), &x, &y);
   gtk_snapshot_translate (snapshot, &GRAPHENE_POINT_INIT (x, y));
@@ -11546,6 +11553,8 @@ gtk_widget_render (GtkWidget            *widget,
 
       gdk_profiler_end_mark (before_render, "widget render", "");
     }
+
+  gsk_render_node_arena_pop ();
 }
 
 static void
@@ -33,6 +33,7 @@
 #include "gtkbox.h"
 #include "gtkbinlayout.h"
 #include "gtkmediafileprivate.h"
+#include "gtkcssstyleprivate.h"
 
 
 #ifdef GDK_WINDOWING_X11
@@ -79,6 +80,7 @@ struct _GtkInspectorGeneral
   GtkWidget *gsk_renderer;
   GtkWidget *pango_fontmap;
   GtkWidget *media_backend;
+  GtkWidget *css_values;
   GtkWidget *gl_version;
   GtkWidget *gl_vendor;
   GtkWidget *vk_device;
@@ -663,6 +665,23 @@ init_media (GtkInspectorGeneral *gen)
   gtk_label_set_label (GTK_LABEL (gen->media_backend), name);
 }
 
+static void
+init_css_values (GtkInspectorGeneral *gen)
+{
+  guint n_groups, n_users;
+  gsize n_bytes_saved;
+  char *size, *text;
+
+  gtk_css_values_get_statistics (&n_groups, &n_users, &n_bytes_saved);
+
+  size = g_format_size (n_bytes_saved);
+  text = g_strdup_printf (_("%u shared by %u styles, %s saved"), n_groups, n_users, size);
+  gtk_label_set_label (GTK_LABEL (gen->css_values), text);
+
+  g_free (text);
+  g_free (size);
+}
+
 static void populate_seats (GtkInspectorGeneral *gen);
 
 static void
@@ -922,6 +941,17 @@ gtk_inspector_general_constructed (GObject *object)
    g_signal_connect (gen->device_box, "keynav-failed", G_CALLBACK (keynav_failed), gen);
 }
 
+static void
+gtk_inspector_general_map (GtkWidget *widget)
+{
+  GtkInspectorGeneral *gen = GTK_INSPECTOR_GENERAL (widget);
+
+  GTK_WIDGET_CLASS (gtk_inspector_general_parent_class)->map (widget);
+
+  /* The numbers change all the time, so update them when shown */
+  init_css_values (gen);
+}
+
 static void
 gtk_inspector_general_dispose (GObject *object)
 {
@@ -950,6 +980,8 @@ gtk_inspector_general_class_init (GtkInspectorGeneralClass *klass)
   object_class->constructed = gtk_inspector_general_constructed;
   object_class->dispose = gtk_inspector_general_dispose;
 
+  widget_class->map = gtk_inspector_general_map;
+
   gtk_widget_class_set_template_from_resource (widget_class, "/org/gtk/libgtk/inspector/general.ui");
   gtk_widget_class_bind_template_child (widget_class, GtkInspectorGeneral, swin);
   gtk_widget_class_bind_template_child (widget_class, GtkInspectorGeneral, box);
@@ -964,6 +996,7 @@ gtk_inspector_general_class_init (GtkInspectorGeneralClass *klass)
   gtk_widget_class_bind_template_child (widget_class, GtkInspectorGeneral, gsk_renderer);
   gtk_widget_class_bind_template_child (widget_class, GtkInspectorGeneral, pango_fontmap);
   gtk_widget_class_bind_template_child (widget_class, GtkInspectorGeneral, media_backend);
+  gtk_widget_class_bind_template_child (widget_class, GtkInspectorGeneral, css_values);
   gtk_widget_class_bind_template_child (widget_class, GtkInspectorGeneral, gl_version);
   gtk_widget_class_bind_template_child (widget_class, GtkInspectorGeneral, gl_vendor);
   gtk_widget_class_bind_template_child (widget_class, GtkInspectorGeneral, vk_device);
@@ -996,6 +1029,7 @@ gtk_inspector_general_set_display (GtkInspectorGeneral *gen,
   init_display (gen);
   init_pango (gen);
   init_media (gen);
+  init_css_values (gen);
   init_gl (gen);
   init_vulkan (gen);
   init_device (gen);
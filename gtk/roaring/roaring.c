@@ -3508,9 +3508,93 @@ void bitset_container_set_range(bitset_container_t *bitset, uint32_t begin,
 }
 
 
+#ifdef ROARING_AVX2_DISPATCH
+/* GTK: runtime dispatched AVX2 kernels for builds that don't enable AVX2 */
+
+static inline bool croaring_avx2(void) {
+    static int supported = -1;
+    if (supported < 0) {
+        __builtin_cpu_init();
+        supported = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return supported;
+}
+
+ROARING_TARGET_AVX2
+static inline __m256i croaring_avx2_popcount256(__m256i v) {
+    const __m256i lookup = _mm256_setr_epi8(
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    const __m256i lo = _mm256_and_si256(v, low_mask);
+    const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+    const __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                                           _mm256_shuffle_epi8(lookup, hi));
+    return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+
+ROARING_TARGET_AVX2
+static inline int croaring_avx2_sum256(__m256i total) {
+    return (int)(_mm256_extract_epi64(total, 0) + _mm256_extract_epi64(total, 1) +
+                 _mm256_extract_epi64(total, 2) + _mm256_extract_epi64(total, 3));
+}
+
+ROARING_TARGET_AVX2
+static int bitset_container_compute_cardinality_avx2(const uint64_t *array) {
+    __m256i total = _mm256_setzero_si256();
+    for (size_t i = 0; i < BITSET_CONTAINER_SIZE_IN_WORDS; i += 4) {
+        __m256i v = _mm256_lddqu_si256((const __m256i *)(array + i));
+        total = _mm256_add_epi64(total, croaring_avx2_popcount256(v));
+    }
+    return croaring_avx2_sum256(total);
+}
+
+ROARING_TARGET_AVX2
+static bool bitset_container_intersect_avx2(const uint64_t *array_1,
+                                            const uint64_t *array_2) {
+    for (size_t i = 0; i < BITSET_CONTAINER_SIZE_IN_WORDS; i += 4) {
+        __m256i A1 = _mm256_lddqu_si256((const __m256i *)(array_1 + i));
+        __m256i A2 = _mm256_lddqu_si256((const __m256i *)(array_2 + i));
+        if (!_mm256_testz_si256(A1, A2)) return true;
+    }
+    return false;
+}
+
+/* Computes the operation into out (if not NULL) and returns the
+   cardinality of the result (if count is set) */
+#define BITSET_CONTAINER_AVX2_FN(opname, avx_intrinsic)                      \
+ROARING_TARGET_AVX2                                                          \
+static int bitset_container_##opname##_avx2(const uint64_t *array_1,         \
+                                            const uint64_t *array_2,         \
+                                            uint64_t *out, bool count) {     \
+    __m256i total = _mm256_setzero_si256();                                  \
+    for (size_t i = 0; i < BITSET_CONTAINER_SIZE_IN_WORDS; i += 4) {         \
+        __m256i A1 = _mm256_lddqu_si256((const __m256i *)(array_1 + i));     \
+        __m256i A2 = _mm256_lddqu_si256((const __m256i *)(array_2 + i));     \
+        __m256i AO = avx_intrinsic(A2, A1);                                  \
+        if (out) _mm256_storeu_si256((__m256i *)(out + i), AO);              \
+        if (count)                                                           \
+            total = _mm256_add_epi64(total, croaring_avx2_popcount256(AO));  \
+    }                                                                        \
+    return count ? croaring_avx2_sum256(total) : BITSET_UNKNOWN_CARDINALITY; \
+}
+
+BITSET_CONTAINER_AVX2_FN(or,     _mm256_or_si256)
+BITSET_CONTAINER_AVX2_FN(and,    _mm256_and_si256)
+BITSET_CONTAINER_AVX2_FN(xor,    _mm256_xor_si256)
+BITSET_CONTAINER_AVX2_FN(andnot, _mm256_andnot_si256)
+#define bitset_container_union_avx2 bitset_container_or_avx2
+#define bitset_container_intersection_avx2 bitset_container_and_avx2
+
+#define CROARING_AVX2_DISPATCH(expr) if (croaring_avx2()) return expr
+#else
+#define CROARING_AVX2_DISPATCH(expr)
+#endif
+
 bool bitset_container_intersect(const bitset_container_t *src_1,
                                   const bitset_container_t *src_2) {
 	// could vectorize, but this is probably already quite fast in practice
+    CROARING_AVX2_DISPATCH(bitset_container_intersect_avx2(src_1->array, src_2->array));
     const uint64_t * __restrict__ array_1 = src_1->array;
     const uint64_t * __restrict__ array_2 = src_2->array;
 	for (int i = 0; i < BITSET_CONTAINER_SIZE_IN_WORDS; i ++) {
@@ -3559,6 +3643,7 @@ int bitset_container_compute_cardinality(const bitset_container_t *bitset) {
 
 /* Get the number of bits set (force computation) */
 int bitset_container_compute_cardinality(const bitset_container_t *bitset) {
+    CROARING_AVX2_DISPATCH(bitset_container_compute_cardinality_avx2(bitset->array));
     const uint64_t *array = bitset->array;
     int32_t sum = 0;
     for (int i = 0; i < BITSET_CONTAINER_SIZE_IN_WORDS; i += 4) {
@@ -3751,6 +3836,8 @@ int bitset_container_##opname##_justcard(const bitset_container_t *src_1,     \
 int bitset_container_##opname(const bitset_container_t *src_1,            \
                               const bitset_container_t *src_2,            \
                               bitset_container_t *dst) {                  \
+    CROARING_AVX2_DISPATCH(dst->cardinality = bitset_container_##opname##_avx2( \
+        src_1->array, src_2->array, dst->array, true));                   \
     const uint64_t * __restrict__ array_1 = src_1->array;                 \
     const uint64_t * __restrict__ array_2 = src_2->array;                 \
     uint64_t *out = dst->array;                                           \
@@ -3769,6 +3856,8 @@ int bitset_container_##opname(const bitset_container_t *src_1,            \
 int bitset_container_##opname##_nocard(const bitset_container_t *src_1,   \
                                        const bitset_container_t *src_2,   \
                                        bitset_container_t *dst) {         \
+    CROARING_AVX2_DISPATCH(dst->cardinality = bitset_container_##opname##_avx2( \
+        src_1->array, src_2->array, dst->array, false));                  \
     const uint64_t * __restrict__ array_1 = src_1->array;                 \
     const uint64_t * __restrict__ array_2 = src_2->array;                 \
     uint64_t *out = dst->array;                                           \
@@ -3780,6 +3869,8 @@ int bitset_container_##opname##_nocard(const bitset_container_t *src_1,   \
 }                                                                         \
 int bitset_container_##opname##_justcard(const bitset_container_t *src_1, \
                               const bitset_container_t *src_2) {          \
+    CROARING_AVX2_DISPATCH(bitset_container_##opname##_avx2(              \
+        src_1->array, src_2->array, NULL, true));                         \
     const uint64_t * __restrict__ array_1 = src_1->array;                 \
     const uint64_t * __restrict__ array_2 = src_2->array;                 \
     int32_t sum = 0;                                                      \
@@ -137,6 +137,15 @@ enum {
 #define ROARING_VECTOR_OPERATIONS_ENABLED  // vector unions (optimization)
 #endif
 
+// GTK: if we were not compiled for AVX2, build AVX2 versions of the
+// bitset container kernels anyway and pick them at runtime when the
+// processor supports them
+#if defined(IS_X64) && !defined(USEAVX) && !defined(DISABLEAVX) && \
+    !defined(_MSC_VER) && (defined(__GNUC__) || defined(__clang__))
+#define ROARING_AVX2_DISPATCH
+#define ROARING_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
 #endif  // DISABLE_X64
 
 #ifdef _MSC_VER
@@ -0,0 +1,90 @@
+/*
+ * GTK is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * GTK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GTK; see the file COPYING.  If not,
+ * see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include <glib/gi18n.h>
+#include <gtk/gtk.h>
+#include "gtkcssproviderprivate.h"
+
+static void G_GNUC_NORETURN
+usage (void)
+{
+  g_print (_("Usage:\n"
+             "  gtk4-css-precompile FILE OUTPUT\n"
+             "\n"
+             "Write a precompiled form of a CSS file that GtkCssProvider\n"
+             "can load without parsing it.\n"));
+  exit (1);
+}
+
+static void
+parsing_error_cb (GtkCssProvider *provider,
+                  GtkCssSection  *section,
+                  const GError   *error,
+                  gpointer        user_data)
+{
+  char *location;
+
+  location = gtk_css_section_to_string (section);
+  g_printerr ("%s: %s\n", location, error->message);
+  g_free (location);
+}
+
+int
+main (int argc, char *argv[])
+{
+  GtkCssProvider *provider;
+  GFile *file;
+  GBytes *bytes;
+  GError *error = NULL;
+
+  g_set_prgname ("gtk4-css-precompile");
+
+  gtk_init ();
+
+  if (argc != 3)
+    usage ();
+
+  provider = gtk_css_provider_new ();
+  g_signal_connect (provider, "parsing-error", G_CALLBACK (parsing_error_cb), NULL);
+
+  file = g_file_new_for_commandline_arg (argv[1]);
+  bytes = gtk_css_provider_precompile (provider, file);
+  g_object_unref (file);
+  g_object_unref (provider);
+
+  if (bytes == NULL)
+    {
+      g_printerr (_("Could not precompile %s\n"), argv[1]);
+      return 1;
+    }
+
+  if (!g_file_set_contents (argv[2],
+                            g_bytes_get_data (bytes, NULL),
+                            g_bytes_get_size (bytes),
+                            &error))
+    {
+      g_printerr (_("Could not write %s: %s\n"), argv[2], error->message);
+      g_error_free (error);
+      g_bytes_unref (bytes);
+      return 1;
+    }
+
+  g_bytes_unref (bytes);
+
+  return 0;
+}
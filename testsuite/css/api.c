@@ -19,6 +19,21 @@
  */
 
 #include <gtk/gtk.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "gtk/gtkcssproviderprivate.h"
+
+static const char *imported_css =
+  "@define-color accent #3584e4;\n"
+  "@keyframes spin { from { opacity: 0; } to { opacity: 1; } }\n"
+  ".imported { color: @accent; }\n";
+static const char *main_css =
+  "@import url(\"imported.css\");\n"
+  "button, .button { margin: 1px 2px; border: 1px solid alpha(@accent, 0.5); }\n"
+  "label:hover > .a ~ #b:nth-child(2n+1) { animation: spin 1s infinite; }\n"
+  "window:not(.backdrop) { background-image: linear-gradient(to top, red, @accent); }\n"
+  "*:disabled { color: mix(red, blue, 0.5); }\n";
 
 static void
 gtk_css_provider_load_data_not_null_terminated (void)
@@ -33,15 +48,216 @@ gtk_css_provider_load_data_not_null_terminated (void)
   g_object_unref (p);
 }
 
+static char *
+load_file_to_string (GFile *file)
+{
+  GtkCssProvider *p;
+  char *result;
+
+  p = gtk_css_provider_new ();
+  gtk_css_provider_load_from_file (p, file);
+  result = gtk_css_provider_to_string (p);
+  g_object_unref (p);
+
+  return result;
+}
+
+static void
+remove_dir (const char *path)
+{
+  const char *name;
+  GDir *dir;
+
+  dir = g_dir_open (path, 0, NULL);
+  if (dir == NULL)
+    return;
+
+  while ((name = g_dir_read_name (dir)))
+    {
+      char *child = g_build_filename (path, name, NULL);
+
+      if (g_file_test (child, G_FILE_TEST_IS_DIR))
+        remove_dir (child);
+      else
+        g_unlink (child);
+      g_free (child);
+    }
+  g_dir_close (dir);
+
+  g_rmdir (path);
+}
+
+static guint
+count_cache_files (void)
+{
+  char *path;
+  GDir *dir;
+  guint n;
+
+  path = g_build_filename (g_get_user_cache_dir (), "gtk-4.0", "css", NULL);
+  dir = g_dir_open (path, 0, NULL);
+  g_free (path);
+  if (dir == NULL)
+    return 0;
+
+  for (n = 0; g_dir_read_name (dir); n++)
+    ;
+  g_dir_close (dir);
+
+  return n;
+}
+
+static void
+gtk_css_provider_load_file_cached (void)
+{
+  char *dir, *path, *parsed, *cached, *changed, *changed_main, *cached_main;
+  GFile *file;
+
+  dir = g_dir_make_tmp ("css-cache-XXXXXX", NULL);
+  g_assert_nonnull (dir);
+
+  path = g_build_filename (dir, "imported.css", NULL);
+  g_assert_true (g_file_set_contents (path, imported_css, -1, NULL));
+  g_free (path);
+  path = g_build_filename (dir, "main.css", NULL);
+  g_assert_true (g_file_set_contents (path, main_css, -1, NULL));
+  file = g_file_new_for_path (path);
+  g_free (path);
+
+  g_assert_cmpuint (count_cache_files (), ==, 0);
+
+  parsed = load_file_to_string (file);
+  g_assert_cmpuint (count_cache_files (), ==, 1);
+
+  cached = load_file_to_string (file);
+  g_assert_cmpstr (parsed, ==, cached);
+  g_assert_cmpuint (count_cache_files (), ==, 1);
+
+  /* changing an imported file invalidates the cache */
+  path = g_build_filename (dir, "imported.css", NULL);
+  g_assert_true (g_file_set_contents (path, ".imported { color: green; }", -1, NULL));
+  g_free (path);
+
+  changed = load_file_to_string (file);
+  g_assert_cmpstr (parsed, !=, changed);
+  g_assert_null (strstr (changed, "@define-color accent"));
+  g_assert_cmpuint (count_cache_files (), ==, 1);
+
+  /* changing the file itself replaces its cache file */
+  path = g_build_filename (dir, "main.css", NULL);
+  g_assert_true (g_file_set_contents (path, "@import url(\"imported.css\");\nlabel { margin: 3px; }", -1, NULL));
+  g_free (path);
+
+  changed_main = load_file_to_string (file);
+  g_assert_nonnull (strstr (changed_main, "margin: 3px"));
+  g_assert_cmpuint (count_cache_files (), ==, 1);
+
+  cached_main = load_file_to_string (file);
+  g_assert_cmpstr (cached_main, ==, changed_main);
+
+  g_free (cached_main);
+  g_free (changed_main);
+  g_free (changed);
+  g_free (cached);
+  g_free (parsed);
+  g_object_unref (file);
+  remove_dir (dir);
+  g_free (dir);
+}
+
+static void
+count_parsing_errors (GtkCssProvider *provider,
+                      GtkCssSection  *section,
+                      const GError   *error,
+                      guint          *n_errors)
+{
+  (*n_errors)++;
+}
+
+static void
+gtk_css_provider_precompile_roundtrip (void)
+{
+  GtkCssProvider *p;
+  char *dir, *path, *parsed, *compiled, *loaded;
+  GBytes *bytes;
+  GFile *file;
+  guint n_errors = 0;
+
+  dir = g_dir_make_tmp ("css-precompile-XXXXXX", NULL);
+  g_assert_nonnull (dir);
+
+  path = g_build_filename (dir, "imported.css", NULL);
+  g_assert_true (g_file_set_contents (path, imported_css, -1, NULL));
+  g_free (path);
+  path = g_build_filename (dir, "main.css", NULL);
+  g_assert_true (g_file_set_contents (path, main_css, -1, NULL));
+  file = g_file_new_for_path (path);
+  g_free (path);
+
+  parsed = load_file_to_string (file);
+
+  p = gtk_css_provider_new ();
+  bytes = gtk_css_provider_precompile (p, file);
+  g_assert_nonnull (bytes);
+  compiled = gtk_css_provider_to_string (p);
+  g_assert_cmpstr (compiled, ==, parsed);
+  g_object_unref (p);
+
+  /* precompiled data doesn't need the files it was created from */
+  path = g_build_filename (dir, "imported.css", NULL);
+  g_unlink (path);
+  g_free (path);
+
+  p = gtk_css_provider_new ();
+  g_signal_connect (p, "parsing-error", G_CALLBACK (count_parsing_errors), &n_errors);
+  gtk_css_provider_load_from_data (p, g_bytes_get_data (bytes, NULL), g_bytes_get_size (bytes));
+  loaded = gtk_css_provider_to_string (p);
+  g_assert_cmpstr (loaded, ==, parsed);
+  g_assert_cmpuint (n_errors, ==, 0);
+  g_object_unref (p);
+  g_bytes_unref (bytes);
+
+  /* the import is missing now, so there's nothing to precompile */
+  p = gtk_css_provider_new ();
+  g_signal_connect (p, "parsing-error", G_CALLBACK (count_parsing_errors), &n_errors);
+  bytes = gtk_css_provider_precompile (p, file);
+  g_assert_null (bytes);
+  g_assert_cmpuint (n_errors, >, 0);
+  g_object_unref (p);
+
+  g_free (loaded);
+  g_free (compiled);
+  g_free (parsed);
+  g_object_unref (file);
+  remove_dir (dir);
+  g_free (dir);
+}
 
 int
 main (int argc, char *argv[])
 {
+  char *cache_dir;
+  int result;
+
+  /* don't use the cache of the user */
+  cache_dir = g_dir_make_tmp ("css-api-XXXXXX", NULL);
+  g_setenv ("XDG_CACHE_HOME", cache_dir, TRUE);
+  g_unsetenv ("GTK_CSS_NO_CACHE");
+
   gtk_test_init (&argc, &argv, NULL);
 
   g_test_add_func ("/gtk_css_provider_load_data/not_null_terminated",
       gtk_css_provider_load_data_not_null_terminated);
+  g_test_add_func ("/gtk_css_provider_load_file/cached",
+      gtk_css_provider_load_file_cached);
+  g_test_add_func ("/gtk_css_provider_precompile/roundtrip",
+      gtk_css_provider_precompile_roundtrip);
+
+  result = g_test_run ();
+
+  remove_dir (cache_dir);
+  g_free (cache_dir);
 
-  return g_test_run ();
+  return result;
 }
 
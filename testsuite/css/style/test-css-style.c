@@ -215,6 +215,258 @@ add_test_for_file (GFile *file)
   g_free (path);
 }
 
+#define assert_color(widget, expected) G_STMT_START{ \
+  GdkRGBA color, expected_color; \
+  char *str; \
+  gtk_style_context_get_color (gtk_widget_get_style_context (widget), &color); \
+  gdk_rgba_parse (&expected_color, expected); \
+  str = gdk_rgba_to_string (&color); \
+  if (!gdk_rgba_equal (&color, &expected_color)) \
+    g_assertion_message_cmpstr (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+        #widget " color", str, "==", expected); \
+  g_free (str); \
+}G_STMT_END
+
+/* Styles are shared between children of different parents with the
+ * same style. Changing the parent's classes or the parent itself
+ * must not leave children with a style that was computed for
+ * another parent.
+ */
+static void
+test_shared_parent_change (void)
+{
+  GtkCssProvider *provider;
+  GtkWidget *window, *box, *box1, *box2, *label1, *label2;
+
+  provider = gtk_css_provider_new ();
+  gtk_css_provider_load_from_data (provider,
+                                   "label { color: blue; }\n"
+                                   "box.highlight > label { color: red; }\n"
+                                   ".outer:hover box > label { color: green; }\n",
+                                   -1);
+  gtk_style_context_add_provider_for_display (gdk_display_get_default (),
+                                              GTK_STYLE_PROVIDER (provider),
+                                              GTK_STYLE_PROVIDER_PRIORITY_FORCE);
+
+  window = gtk_window_new ();
+  box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
+  gtk_widget_add_css_class (box, "outer");
+  gtk_window_set_child (GTK_WINDOW (window), box);
+  box1 = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
+  gtk_box_append (GTK_BOX (box), box1);
+  box2 = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
+  gtk_box_append (GTK_BOX (box), box2);
+  label1 = gtk_label_new ("1");
+  gtk_box_append (GTK_BOX (box1), label1);
+  label2 = gtk_label_new ("2");
+  gtk_box_append (GTK_BOX (box2), label2);
+
+  assert_color (label1, "blue");
+  assert_color (label2, "blue");
+
+  gtk_widget_add_css_class (box1, "highlight");
+  assert_color (label1, "red");
+  assert_color (label2, "blue");
+
+  gtk_widget_add_css_class (box2, "highlight");
+  gtk_widget_remove_css_class (box1, "highlight");
+  assert_color (label1, "blue");
+  assert_color (label2, "red");
+
+  g_object_ref (label1);
+  gtk_box_remove (GTK_BOX (box1), label1);
+  gtk_box_append (GTK_BOX (box2), label1);
+  g_object_unref (label1);
+  assert_color (label1, "red");
+
+  g_object_ref (label2);
+  gtk_box_remove (GTK_BOX (box2), label2);
+  gtk_box_append (GTK_BOX (box1), label2);
+  g_object_unref (label2);
+  assert_color (label2, "blue");
+
+  /* changes further up */
+  gtk_widget_remove_css_class (box2, "highlight");
+  gtk_widget_set_state_flags (box, GTK_STATE_FLAG_PRELIGHT, FALSE);
+  assert_color (label1, "green");
+  assert_color (label2, "green");
+
+  gtk_widget_unset_state_flags (box, GTK_STATE_FLAG_PRELIGHT);
+  assert_color (label1, "blue");
+  assert_color (label2, "blue");
+
+  gtk_window_destroy (GTK_WINDOW (window));
+
+  gtk_style_context_remove_provider_for_display (gdk_display_get_default (),
+                                                 GTK_STYLE_PROVIDER (provider));
+  g_object_unref (provider);
+}
+
+/* Selectors for the children of a node with many invalid children
+ * are matched ahead of time on worker threads. Changes that happen
+ * while the children are validated, here from the first child's
+ * css_changed, must not be missed.
+ */
+#define N_PREFETCH_CHILDREN 64
+
+typedef GtkWidget TestChild;
+typedef GtkWidgetClass TestChildClass;
+
+static GType test_child_get_type (void);
+G_DEFINE_TYPE (TestChild, test_child, GTK_TYPE_WIDGET)
+
+static GtkWidget *trigger_widget;
+static GtkWidget *class_target;
+static GtkCssProvider *late_provider;
+static gboolean triggered;
+
+static void
+test_child_css_changed (GtkWidget         *widget,
+                        GtkCssStyleChange *change)
+{
+  GTK_WIDGET_CLASS (test_child_parent_class)->css_changed (widget, change);
+
+  if (widget != trigger_widget || triggered)
+    return;
+
+  triggered = TRUE;
+  gtk_widget_add_css_class (class_target, "a");
+  gtk_css_provider_load_from_data (late_provider,
+                                   "child:nth-child(50) { background-color: yellow; }",
+                                   -1);
+}
+
+static void
+test_child_class_init (TestChildClass *klass)
+{
+  klass->css_changed = test_child_css_changed;
+
+  gtk_widget_class_set_css_name (klass, "child");
+}
+
+static void
+test_child_init (TestChild *self)
+{
+}
+
+static gboolean
+count_frames (GtkWidget     *widget,
+              GdkFrameClock *frame_clock,
+              gpointer       data)
+{
+  guint *n_frames = data;
+
+  (*n_frames)++;
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+wait_for_frames (GtkWidget *widget,
+                 guint      n)
+{
+  guint n_frames = 0;
+  guint id;
+
+  id = gtk_widget_add_tick_callback (widget, count_frames, &n_frames, NULL);
+  while (n_frames < n)
+    g_main_context_iteration (NULL, TRUE);
+  gtk_widget_remove_tick_callback (widget, id);
+}
+
+static char *
+run_prefetch (gboolean serial)
+{
+  GtkCssProvider *provider;
+  GtkWidget *window, *box;
+  GtkWidget *children[N_PREFETCH_CHILDREN];
+  GtkDebugFlags flags;
+  char *result;
+  guint i;
+
+  flags = gtk_get_debug_flags ();
+  if (serial)
+    gtk_set_debug_flags (flags | GTK_DEBUG_CSS_SERIAL);
+  else
+    gtk_set_debug_flags (flags & ~GTK_DEBUG_CSS_SERIAL);
+
+  provider = gtk_css_provider_new ();
+  gtk_css_provider_load_from_data (provider,
+                                   "child { color: blue; }\n"
+                                   "box.flip child { color: green; }\n"
+                                   "box.flip child.a { color: red; }\n",
+                                   -1);
+  gtk_style_context_add_provider_for_display (gdk_display_get_default (),
+                                              GTK_STYLE_PROVIDER (provider),
+                                              GTK_STYLE_PROVIDER_PRIORITY_FORCE);
+  late_provider = gtk_css_provider_new ();
+  gtk_style_context_add_provider_for_display (gdk_display_get_default (),
+                                              GTK_STYLE_PROVIDER (late_provider),
+                                              GTK_STYLE_PROVIDER_PRIORITY_FORCE);
+
+  window = gtk_window_new ();
+  box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
+  gtk_window_set_child (GTK_WINDOW (window), box);
+  for (i = 0; i < N_PREFETCH_CHILDREN; i++)
+    {
+      children[i] = g_object_new (test_child_get_type (), NULL);
+      gtk_box_append (GTK_BOX (box), children[i]);
+    }
+
+  gtk_widget_show (window);
+  while (!gtk_widget_get_mapped (window))
+    g_main_context_iteration (NULL, TRUE);
+  wait_for_frames (window, 2);
+
+  /* invalidates all children at once */
+  trigger_widget = children[0];
+  class_target = children[40];
+  triggered = FALSE;
+  gtk_widget_add_css_class (box, "flip");
+
+  while (!triggered)
+    g_main_context_iteration (NULL, TRUE);
+  wait_for_frames (window, 3);
+
+  assert_color (children[0], "green");
+  assert_color (children[40], "red");
+  assert_color (children[41], "green");
+
+  result = gtk_style_context_to_string (gtk_widget_get_style_context (window),
+                                        GTK_STYLE_CONTEXT_PRINT_RECURSE |
+                                        GTK_STYLE_CONTEXT_PRINT_SHOW_STYLE);
+  g_assert_nonnull (strstr (result, "background-color: rgb(255,255,0)"));
+
+  trigger_widget = NULL;
+  class_target = NULL;
+  gtk_window_destroy (GTK_WINDOW (window));
+
+  gtk_style_context_remove_provider_for_display (gdk_display_get_default (),
+                                                 GTK_STYLE_PROVIDER (late_provider));
+  g_clear_object (&late_provider);
+  gtk_style_context_remove_provider_for_display (gdk_display_get_default (),
+                                                 GTK_STYLE_PROVIDER (provider));
+  g_object_unref (provider);
+
+  gtk_set_debug_flags (flags);
+
+  return result;
+}
+
+static void
+test_prefetch_changes (void)
+{
+  char *serial, *prefetched;
+
+  serial = run_prefetch (TRUE);
+  prefetched = run_prefetch (FALSE);
+
+  g_assert_cmpstr (prefetched, ==, serial);
+
+  g_free (prefetched);
+  g_free (serial);
+}
+
 static int
 compare_files (gconstpointer a, gconstpointer b)
 {
@@ -296,6 +548,9 @@ main (int argc, char **argv)
   gtk_test_init (&argc, &argv);
   g_object_set (gtk_settings_get_default (), "gtk-font-name", "Sans", NULL);
 
+  g_test_add_func ("/style/shared-cache/parent-change", test_shared_parent_change);
+  g_test_add_func ("/style/prefetch/changes", test_prefetch_changes);
+
   if (argc < 2)
     {
       const char *basedir;
@@ -0,0 +1,289 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <gtk/gtk.h>
+
+#include <math.h>
+
+/* Tests for loading malformed data in the binary render node format.
+ * Criticals are fatal in tests, so these also check that invalid values
+ * never make it into the node constructors.
+ */
+
+static void
+count_errors (const GskParseLocation *start,
+              const GskParseLocation *end,
+              const GError           *error,
+              gpointer                user_data)
+{
+  guint *n_errors = user_data;
+
+  g_assert_true (g_error_matches (error, GSK_SERIALIZATION_ERROR, GSK_SERIALIZATION_INVALID_DATA));
+
+  (*n_errors)++;
+}
+
+static guint32
+float_to_word (float f)
+{
+  guint32 u;
+
+  memcpy (&u, &f, sizeof (float));
+
+  return u;
+}
+
+/* Serializes @node and replaces the only word with value @old by @new */
+static GBytes *
+serialize_and_replace (GskRenderNode *node,
+                       guint32        old,
+                       guint32        new)
+{
+  GBytes *bytes;
+  guint32 *words;
+  gsize i, n_words, pos;
+
+  bytes = gsk_render_node_serialize_binary (node);
+  words = g_bytes_unref_to_data (bytes, &n_words);
+  n_words /= 4;
+
+  pos = G_MAXSIZE;
+  for (i = 0; i < n_words; i++)
+    {
+      if (words[i] != old)
+        continue;
+
+      g_assert_cmpuint (pos, ==, G_MAXSIZE);
+      pos = i;
+    }
+  g_assert_cmpuint (pos, !=, G_MAXSIZE);
+
+  words[pos] = new;
+
+  return g_bytes_new_take (words, n_words * 4);
+}
+
+static void
+assert_invalid (GBytes *bytes)
+{
+  GskRenderNode *node;
+  guint n_errors = 0;
+
+  node = gsk_render_node_deserialize (bytes, count_errors, &n_errors);
+
+  g_assert_null (node);
+  g_assert_cmpuint (n_errors, ==, 1);
+}
+
+static GskRenderNode *
+linear_gradient_node (void)
+{
+  return gsk_linear_gradient_node_new (&GRAPHENE_RECT_INIT (0, 0, 50, 50),
+                                       &GRAPHENE_POINT_INIT (0, 0),
+                                       &GRAPHENE_POINT_INIT (50, 50),
+                                       (GskColorStop[]) {
+                                         { 0.3125, { 1, 0, 0, 1 } },
+                                         { 0.6875, { 0, 0, 1, 1 } },
+                                       },
+                                       2);
+}
+
+static GskRenderNode *
+radial_gradient_node (void)
+{
+  return gsk_radial_gradient_node_new (&GRAPHENE_RECT_INIT (0, 0, 50, 50),
+                                       &GRAPHENE_POINT_INIT (25, 25),
+                                       13.5, 17.5,
+                                       0.1875, 0.8125,
+                                       (GskColorStop[]) {
+                                         { 0, { 1, 0, 0, 1 } },
+                                         { 1, { 0, 0, 1, 1 } },
+                                       },
+                                       2);
+}
+
+static void
+test_valid (void)
+{
+  GskRenderNode *node, *loaded;
+  GBytes *bytes;
+
+  node = linear_gradient_node ();
+  bytes = gsk_render_node_serialize_binary (node);
+  loaded = gsk_render_node_deserialize (bytes, NULL, NULL);
+  g_assert_nonnull (loaded);
+  g_assert_cmpint (gsk_render_node_get_node_type (loaded), ==, GSK_LINEAR_GRADIENT_NODE);
+  gsk_render_node_unref (loaded);
+  g_bytes_unref (bytes);
+  gsk_render_node_unref (node);
+
+  node = radial_gradient_node ();
+  bytes = gsk_render_node_serialize_binary (node);
+  loaded = gsk_render_node_deserialize (bytes, NULL, NULL);
+  g_assert_nonnull (loaded);
+  g_assert_cmpint (gsk_render_node_get_node_type (loaded), ==, GSK_RADIAL_GRADIENT_NODE);
+  gsk_render_node_unref (loaded);
+  g_bytes_unref (bytes);
+  gsk_render_node_unref (node);
+}
+
+static void
+test_color_stops (void)
+{
+  GskRenderNode *node;
+  GBytes *bytes;
+
+  node = linear_gradient_node ();
+
+  /* not increasing */
+  bytes = serialize_and_replace (node, float_to_word (0.6875), float_to_word (0.125));
+  assert_invalid (bytes);
+  g_bytes_unref (bytes);
+
+  /* larger than 1 */
+  bytes = serialize_and_replace (node, float_to_word (0.6875), float_to_word (1.5));
+  assert_invalid (bytes);
+  g_bytes_unref (bytes);
+
+  /* negative */
+  bytes = serialize_and_replace (node, float_to_word (0.3125), float_to_word (-0.5));
+  assert_invalid (bytes);
+  g_bytes_unref (bytes);
+
+  /* not a number */
+  bytes = serialize_and_replace (node, float_to_word (0.3125), float_to_word (NAN));
+  assert_invalid (bytes);
+  g_bytes_unref (bytes);
+
+  /* too few */
+  bytes = serialize_and_replace (node, 2, 1);
+  assert_invalid (bytes);
+  g_bytes_unref (bytes);
+
+  gsk_render_node_unref (node);
+}
+
+static void
+test_radii (void)
+{
+  GskRenderNode *node;
+  GBytes *bytes;
+
+  node = radial_gradient_node ();
+
+  bytes = serialize_and_replace (node, float_to_word (13.5), float_to_word (-13.5));
+  assert_invalid (bytes);
+  g_bytes_unref (bytes);
+
+  bytes = serialize_and_replace (node, float_to_word (17.5), float_to_word (0));
+  assert_invalid (bytes);
+  g_bytes_unref (bytes);
+
+  bytes = serialize_and_replace (node, float_to_word (0.1875), float_to_word (-0.1875));
+  assert_invalid (bytes);
+  g_bytes_unref (bytes);
+
+  /* end before start */
+  bytes = serialize_and_replace (node, float_to_word (0.8125), float_to_word (0.0625));
+  assert_invalid (bytes);
+  g_bytes_unref (bytes);
+
+  gsk_render_node_unref (node);
+}
+
+static void
+test_blend_mode (void)
+{
+  GskRenderNode *node, *bottom, *top;
+  GBytes *bytes;
+
+  bottom = gsk_color_node_new (&(GdkRGBA) { 1, 0, 0, 1 }, &GRAPHENE_RECT_INIT (0, 0, 50, 50));
+  top = gsk_color_node_new (&(GdkRGBA) { 0, 0, 1, 1 }, &GRAPHENE_RECT_INIT (10, 10, 50, 50));
+  node = gsk_blend_node_new (bottom, top, GSK_BLEND_MODE_LUMINOSITY);
+
+  bytes = serialize_and_replace (node, GSK_BLEND_MODE_LUMINOSITY, GSK_BLEND_MODE_LUMINOSITY + 1);
+  assert_invalid (bytes);
+  g_bytes_unref (bytes);
+
+  gsk_render_node_unref (node);
+  gsk_render_node_unref (top);
+  gsk_render_node_unref (bottom);
+}
+
+/* Identity transforms are written as "none", which parses to NULL */
+static void
+test_identity_transform (void)
+{
+  GskRenderNode *node, *child, *loaded;
+  GskTransform *transform;
+  GBytes *bytes;
+
+  child = gsk_color_node_new (&(GdkRGBA) { 1, 0, 0, 1 }, &GRAPHENE_RECT_INIT (0, 0, 50, 50));
+  transform = gsk_transform_new ();
+  node = gsk_transform_node_new (child, transform);
+
+  bytes = gsk_render_node_serialize_binary (node);
+  loaded = gsk_render_node_deserialize (bytes, NULL, NULL);
+  g_assert_nonnull (loaded);
+  g_assert_cmpint (gsk_render_node_get_node_type (loaded), ==, GSK_TRANSFORM_NODE);
+  g_assert_cmpint (gsk_transform_get_category (gsk_transform_node_get_transform (loaded)), ==, GSK_TRANSFORM_CATEGORY_IDENTITY);
+
+  gsk_render_node_unref (loaded);
+  g_bytes_unref (bytes);
+  gsk_render_node_unref (node);
+  gsk_transform_unref (transform);
+  gsk_render_node_unref (child);
+}
+
+static void
+test_truncated (void)
+{
+  GskRenderNode *node;
+  GBytes *bytes, *truncated;
+  gsize i, size;
+
+  node = radial_gradient_node ();
+  bytes = gsk_render_node_serialize_binary (node);
+  size = g_bytes_get_size (bytes);
+
+  /* shorter data isn't recognized as binary */
+  for (i = 8; i < size; i++)
+    {
+      truncated = g_bytes_new (g_bytes_get_data (bytes, NULL), i);
+      assert_invalid (truncated);
+      g_bytes_unref (truncated);
+    }
+
+  g_bytes_unref (bytes);
+  gsk_render_node_unref (node);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  gtk_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/binary/valid", test_valid);
+  g_test_add_func ("/binary/color-stops", test_color_stops);
+  g_test_add_func ("/binary/radii", test_radii);
+  g_test_add_func ("/binary/blend-mode", test_blend_mode);
+  g_test_add_func ("/binary/identity-transform", test_identity_transform);
+  g_test_add_func ("/binary/truncated", test_truncated);
+
+  return g_test_run ();
+}
@@ -156,6 +156,38 @@ deserialize_error_func (const GskParseLocation *start,
   g_string_append_c (errors, '\n');
 }
 
+/* Checks that going through the binary format doesn't change the node */
+static gboolean
+binary_roundtrip_matches (GskRenderNode *node,
+                          GBytes        *expected)
+{
+  GskRenderNode *roundtrip;
+  GBytes *binary, *bytes;
+  gboolean result;
+
+  binary = gsk_render_node_serialize_binary (node);
+  roundtrip = gsk_render_node_deserialize (binary, NULL, NULL);
+  g_bytes_unref (binary);
+
+  if (roundtrip == NULL)
+    {
+      g_print ("Failed to load the binary serialization\n");
+      return FALSE;
+    }
+
+  bytes = gsk_render_node_serialize (roundtrip);
+  gsk_render_node_unref (roundtrip);
+
+  result = g_bytes_equal (bytes, expected);
+  if (!result)
+    g_print ("Binary serialization doesn't match:\n%s\n",
+             (const char *) g_bytes_get_data (bytes, NULL));
+
+  g_bytes_unref (bytes);
+
+  return result;
+}
+
 static gboolean
 parse_node_file (GFile *file, gboolean generate)
 {
@@ -180,6 +212,10 @@ parse_node_file (GFile *file, gboolean generate)
   node = gsk_render_node_deserialize (bytes, deserialize_error_func, errors);
   g_bytes_unref (bytes);
   bytes = gsk_render_node_serialize (node);
+
+  if (!generate && !binary_roundtrip_matches (node, bytes))
+    result = FALSE;
+
   gsk_render_node_unref (node);
 
   if (generate)
@@ -555,6 +555,110 @@ test_splice_overflow (void)
   g_assert_true (gtk_bitset_equals (set, compare));
 }
 
+/* Benchmarks, run with -m perf */
+
+#define PERF_N_ITEMS (4 * 1000 * 1000)
+#define PERF_N_RUNS 20
+
+/* every third item, so the containers are bitsets */
+static GtkBitset *
+create_perf_bitset (void)
+{
+  GtkBitset *set;
+
+  set = gtk_bitset_new_empty ();
+  gtk_bitset_add_rectangle (set, 0, 1, PERF_N_ITEMS / 3, 3);
+
+  return set;
+}
+
+static void
+test_perf_select_all (void)
+{
+  GtkBitset *selected, *all;
+  guint i;
+
+  selected = create_perf_bitset ();
+
+  g_test_timer_start ();
+
+  for (i = 0; i < PERF_N_RUNS; i++)
+    {
+      all = gtk_bitset_copy (selected);
+      gtk_bitset_add_range (all, 0, PERF_N_ITEMS);
+      g_assert_cmpuint (gtk_bitset_get_size (all), ==, PERF_N_ITEMS);
+      gtk_bitset_difference (all, selected);
+      g_assert_cmpuint (gtk_bitset_get_size (all), ==, PERF_N_ITEMS - PERF_N_ITEMS / 3);
+      gtk_bitset_unref (all);
+    }
+
+  g_test_minimized_result (g_test_timer_elapsed () / PERF_N_RUNS,
+                           "select all of %u items: %gs",
+                           PERF_N_ITEMS, g_test_timer_last ());
+
+  gtk_bitset_unref (selected);
+}
+
+static void
+test_perf_set_algebra (void)
+{
+  GtkBitset *set1, *set2, *result;
+  guint64 size = 0;
+  guint i;
+
+  set1 = create_perf_bitset ();
+  set2 = gtk_bitset_new_empty ();
+  gtk_bitset_add_rectangle (set2, 0, 1, PERF_N_ITEMS / 2, 2);
+
+  g_test_timer_start ();
+
+  for (i = 0; i < PERF_N_RUNS; i++)
+    {
+      result = gtk_bitset_copy (set1);
+      gtk_bitset_union (result, set2);
+      size += gtk_bitset_get_size (result);
+      gtk_bitset_intersect (result, set1);
+      size += gtk_bitset_get_size (result);
+      gtk_bitset_subtract (result, set2);
+      size += gtk_bitset_get_size (result);
+      gtk_bitset_unref (result);
+    }
+
+  g_test_minimized_result (g_test_timer_elapsed () / PERF_N_RUNS,
+                           "union, intersect and subtract of %u items: %gs",
+                           PERF_N_ITEMS, g_test_timer_last ());
+  g_assert_cmpuint (size, >, 0);
+
+  gtk_bitset_unref (set1);
+  gtk_bitset_unref (set2);
+}
+
+static void
+test_perf_shift (void)
+{
+  GtkBitset *set;
+  guint i;
+
+  set = create_perf_bitset ();
+
+  g_test_timer_start ();
+
+  for (i = 0; i < PERF_N_RUNS; i++)
+    {
+      gtk_bitset_shift_right (set, 1);
+      gtk_bitset_shift_left (set, 1);
+      gtk_bitset_splice (set, 0, 0, 3);
+      gtk_bitset_splice (set, 0, 3, 0);
+    }
+
+  g_test_minimized_result (g_test_timer_elapsed () / PERF_N_RUNS,
+                           "shifting %u items: %gs",
+                           PERF_N_ITEMS, g_test_timer_last ());
+  g_assert_cmpuint (gtk_bitset_get_size (set), ==, PERF_N_ITEMS / 3);
+
+  gtk_bitset_unref (set);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -576,5 +680,12 @@ main (int argc, char *argv[])
   g_test_add_func ("/bitset/iter", test_iter);
   g_test_add_func ("/bitset/splice-overflow", test_splice_overflow);
 
+  if (g_test_perf ())
+    {
+      g_test_add_func ("/bitset/perf/select-all", test_perf_select_all);
+      g_test_add_func ("/bitset/perf/set-algebra", test_perf_set_algebra);
+      g_test_add_func ("/bitset/perf/shift", test_perf_shift);
+    }
+
   return g_test_run ();
 }
@@ -0,0 +1,322 @@
+/* 
+ * Copyright (C) 2020, Red Hat, Inc.
+ * Authors: Benjamin Otte <otte@gnome.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <locale.h>
+
+#include <gtk/gtk.h>
+
+static GQuark number_quark;
+static GQuark changes_quark;
+
+static guint
+get (GListModel *model,
+     guint       position)
+{
+  GObject *object = g_list_model_get_item (model, position);
+  guint number;
+  g_assert (object != NULL);
+  number = GPOINTER_TO_UINT (g_object_get_qdata (object, number_quark));
+  g_object_unref (object);
+  return number;
+}
+
+static char *
+model_to_string (GListModel *model)
+{
+  GString *string = g_string_new (NULL);
+  guint i;
+
+  for (i = 0; i < g_list_model_get_n_items (model); i++)
+    {
+      if (i > 0)
+        g_string_append (string, " ");
+      g_string_append_printf (string, "%u", get (model, i));
+    }
+
+  return g_string_free (string, FALSE);
+}
+
+static GListStore *
+new_store (guint start,
+           guint end,
+           guint step);
+
+static GObject *
+make_object (guint number)
+{
+  GObject *object;
+
+  /* 0 cannot be differentiated from NULL, so don't use it */
+  g_assert (number != 0);
+
+  object = g_object_new (G_TYPE_OBJECT, NULL);
+  g_object_set_qdata (object, number_quark, GUINT_TO_POINTER (number));
+
+  return object;
+}
+
+static void
+add (GListStore *store,
+     guint       number)
+{
+  GObject *object = make_object (number);
+  g_list_store_append (store, object);
+  g_object_unref (object);
+}
+
+#define assert_model(model, expected) G_STMT_START{ \
+  char *s = model_to_string (G_LIST_MODEL (model)); \
+  if (!g_str_equal (s, expected)) \
+     g_assertion_message_cmpstr (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+         #model " == " #expected, s, "==", expected); \
+  g_free (s); \
+}G_STMT_END
+
+#define assert_changes(model, expected) G_STMT_START{ \
+  GString *changes = g_object_get_qdata (G_OBJECT (model), changes_quark); \
+  if (!g_str_equal (changes->str, expected)) \
+     g_assertion_message_cmpstr (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+         #model " == " #expected, changes->str, "==", expected); \
+  g_string_set_size (changes, 0); \
+}G_STMT_END
+
+static GListStore *
+new_empty_store (void)
+{
+  return g_list_store_new (G_TYPE_OBJECT);
+}
+
+static GListStore *
+new_store (guint start,
+           guint end,
+           guint step)
+{
+  GListStore *store = new_empty_store ();
+  guint i;
+
+  for (i = start; i <= end; i += step)
+    add (store, i);
+
+  return store;
+}
+
+static void
+items_changed (GListModel *model,
+               guint       position,
+               guint       removed,
+               guint       added,
+               GString    *changes)
+{
+  g_assert (removed != 0 || added != 0);
+
+  if (changes->len)
+    g_string_append (changes, ", ");
+
+  if (removed == 1 && added == 0)
+    {
+      g_string_append_printf (changes, "-%u", position);
+    }
+  else if (removed == 0 && added == 1)
+    {
+      g_string_append_printf (changes, "+%u", position);
+    }
+  else
+    {
+      g_string_append_printf (changes, "%u", position);
+      if (removed > 0)
+        g_string_append_printf (changes, "-%u", removed);
+      if (added > 0)
+        g_string_append_printf (changes, "+%u", added);
+    }
+}
+
+static void
+free_changes (gpointer data)
+{
+  GString *changes = data;
+
+  /* all changes must have been checked via assert_changes() before */
+  g_assert_cmpstr (changes->str, ==, "");
+
+  g_string_free (changes, TRUE);
+}
+
+static GtkCoalesceListModel *
+new_model (GListStore *store)
+{
+  GtkCoalesceListModel *result;
+  GString *changes;
+
+  if (store)
+    g_object_ref (store);
+  result = gtk_coalesce_list_model_new (G_LIST_MODEL (store));
+
+  changes = g_string_new ("");
+  g_object_set_qdata_full (G_OBJECT(result), changes_quark, changes, free_changes);
+  g_signal_connect (result, "items-changed", G_CALLBACK (items_changed), changes);
+
+  return result;
+}
+
+static void
+test_create_empty (void)
+{
+  GtkCoalesceListModel *coalesce;
+
+  coalesce = new_model (NULL);
+  assert_model (coalesce, "");
+  assert_changes (coalesce, "");
+
+  g_object_unref (coalesce);
+}
+
+static void
+test_create (void)
+{
+  GtkCoalesceListModel *coalesce;
+  GListStore *store;
+  
+  store = new_store (1, 5, 2);
+  coalesce = new_model (store);
+  assert_model (coalesce, "1 3 5");
+  assert_changes (coalesce, "");
+  g_assert_false (gtk_coalesce_list_model_get_pending (coalesce));
+
+  g_object_unref (store);
+  assert_model (coalesce, "1 3 5");
+  assert_changes (coalesce, "");
+
+  g_object_unref (coalesce);
+}
+
+static void
+test_set_model (void)
+{
+  GtkCoalesceListModel *coalesce;
+  GListStore *store;
+  
+  coalesce = new_model (NULL);
+  assert_model (coalesce, "");
+  assert_changes (coalesce, "");
+
+  store = new_store (1, 7, 2);
+  gtk_coalesce_list_model_set_model (coalesce, G_LIST_MODEL (store));
+  assert_model (coalesce, "1 3 5 7");
+  assert_changes (coalesce, "0+4");
+
+  add (store, 9);
+  g_assert_true (gtk_coalesce_list_model_get_pending (coalesce));
+  gtk_coalesce_list_model_set_model (coalesce, NULL);
+  g_assert_false (gtk_coalesce_list_model_get_pending (coalesce));
+  assert_model (coalesce, "");
+  assert_changes (coalesce, "0-4");
+
+  g_object_unref (store);
+  g_object_unref (coalesce);
+}
+
+static void
+test_coalesce (void)
+{
+  GtkCoalesceListModel *coalesce;
+  GListStore *store;
+  gpointer item;
+  guint i;
+  
+  store = new_store (1, 5, 1);
+  coalesce = new_model (store);
+
+  for (i = 6; i <= 15; i++)
+    add (store, i);
+  assert_model (coalesce, "1 2 3 4 5");
+  assert_changes (coalesce, "");
+  g_assert_true (gtk_coalesce_list_model_get_pending (coalesce));
+
+  gtk_coalesce_list_model_flush (coalesce);
+  assert_model (coalesce, "1 2 3 4 5 6 7 8 9 10 11 12 13 14 15");
+  assert_changes (coalesce, "5+10");
+  g_assert_false (gtk_coalesce_list_model_get_pending (coalesce));
+
+  /* separate changes stay separate */
+  g_list_store_remove (store, 0);
+  add (store, 16);
+  gtk_coalesce_list_model_flush (coalesce);
+  assert_model (coalesce, "2 3 4 5 6 7 8 9 10 11 12 13 14 15 16");
+  assert_changes (coalesce, "-0, +14");
+
+  /* changes that undo each other vanish */
+  add (store, 17);
+  g_list_store_remove (store, 15);
+  item = g_list_model_get_item (G_LIST_MODEL (store), 3);
+  g_list_store_remove (store, 3);
+  g_list_store_insert (store, 3, item);
+  g_object_unref (item);
+  gtk_coalesce_list_model_flush (coalesce);
+  assert_model (coalesce, "2 3 4 5 6 7 8 9 10 11 12 13 14 15 16");
+  assert_changes (coalesce, "3-1+1");
+
+  g_list_store_remove_all (store);
+  gtk_coalesce_list_model_flush (coalesce);
+  assert_model (coalesce, "");
+  assert_changes (coalesce, "0-15");
+
+  g_object_unref (store);
+  g_object_unref (coalesce);
+}
+
+static void
+test_main_loop (void)
+{
+  GtkCoalesceListModel *coalesce;
+  GListStore *store;
+  guint i;
+  
+  store = new_store (1, 3, 1);
+  coalesce = new_model (store);
+
+  for (i = 4; i <= 100; i++)
+    add (store, i);
+  assert_changes (coalesce, "");
+
+  while (gtk_coalesce_list_model_get_pending (coalesce))
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (coalesce)), ==, 100);
+  assert_changes (coalesce, "3+97");
+
+  g_object_unref (store);
+  g_object_unref (coalesce);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  setlocale (LC_ALL, "C");
+
+  number_quark = g_quark_from_static_string ("Hell and fire was spawned to be released.");
+  changes_quark = g_quark_from_static_string ("What did I see? Can I believe what I saw?");
+
+  g_test_add_func ("/coalescelistmodel/create_empty", test_create_empty);
+  g_test_add_func ("/coalescelistmodel/create", test_create);
+  g_test_add_func ("/coalescelistmodel/set-model", test_set_model);
+  g_test_add_func ("/coalescelistmodel/coalesce", test_coalesce);
+  g_test_add_func ("/coalescelistmodel/main-loop", test_main_loop);
+
+  return g_test_run ();
+}
@@ -0,0 +1,599 @@
+/* GtkDirectoryList tests.
+ *
+ * Copyright (C) 2020, Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtk/gtk.h>
+
+#include <glib/gstdio.h>
+
+#include "gtk/gtkdirectorylistprivate.h"
+
+#define N_FILES 300
+
+/* must match FLUSH_INTERVAL_MS in gtkdirectorylist.c */
+#define FLUSH_INTERVAL_MS 16
+
+typedef struct {
+  guint n_items; /* what the model announced so far */
+  guint n_changes;
+  gint64 start_time;
+} Tracker;
+
+static void
+tracker_items_changed (GListModel *model,
+                       guint       position,
+                       guint       removed,
+                       guint       added,
+                       Tracker    *tracker)
+{
+  guint i;
+
+  g_assert_cmpuint (removed + added, >, 0);
+  g_assert_cmpuint (position + removed, <=, tracker->n_items);
+
+  tracker->n_items = tracker->n_items - removed + added;
+  tracker->n_changes++;
+
+  /* Items must only become visible once they are announced */
+  g_assert_cmpuint (g_list_model_get_n_items (model), ==, tracker->n_items);
+
+  for (i = position; i < position + added; i++)
+    {
+      GFileInfo *info = g_list_model_get_item (model, i);
+
+      g_assert_nonnull (info);
+      g_assert_true (G_IS_FILE (g_file_info_get_attribute_object (info, "standard::file")));
+      g_object_unref (info);
+    }
+}
+
+static void
+tracker_notify_loading (GtkDirectoryList *list,
+                        GParamSpec       *pspec,
+                        Tracker          *tracker)
+{
+  /* All pending files are announced before loading finishes */
+  if (!gtk_directory_list_is_loading (list) && gtk_directory_list_get_error (list) == NULL)
+    g_assert_cmpuint (tracker->n_items, ==, N_FILES);
+}
+
+static void
+tracker_connect (Tracker          *tracker,
+                 GtkDirectoryList *list)
+{
+  tracker->n_items = g_list_model_get_n_items (G_LIST_MODEL (list));
+  tracker->n_changes = 0;
+  tracker->start_time = g_get_monotonic_time ();
+
+  g_signal_connect (list, "items-changed", G_CALLBACK (tracker_items_changed), tracker);
+}
+
+static char *
+create_directory (guint n_files)
+{
+  GError *error = NULL;
+  char *dir;
+  guint i;
+
+  dir = g_dir_make_tmp ("gtk-directorylist-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  for (i = 0; i < n_files; i++)
+    {
+      char *name = g_strdup_printf ("file%u", i);
+      char *path = g_build_filename (dir, name, NULL);
+      char *contents = g_strnfill (i, 'x');
+
+      g_file_set_contents (path, contents, -1, &error);
+      g_assert_no_error (error);
+
+      g_free (contents);
+      g_free (path);
+      g_free (name);
+    }
+
+  return dir;
+}
+
+static void
+remove_directory (const char *dir)
+{
+  GDir *d;
+  const char *name;
+
+  d = g_dir_open (dir, 0, NULL);
+  g_assert_nonnull (d);
+  while ((name = g_dir_read_name (d)))
+    {
+      char *path = g_build_filename (dir, name, NULL);
+      g_unlink (path);
+      g_free (path);
+    }
+  g_dir_close (d);
+
+  g_rmdir (dir);
+}
+
+static gboolean
+timeout_cb (gpointer data)
+{
+  g_assert_not_reached ();
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+wait_for_loading (GtkDirectoryList *list)
+{
+  guint timeout;
+
+  timeout = g_timeout_add_seconds (10, timeout_cb, NULL);
+  while (gtk_directory_list_is_loading (list))
+    g_main_context_iteration (NULL, TRUE);
+  g_source_remove (timeout);
+
+  g_assert_no_error (gtk_directory_list_get_error (list));
+}
+
+static GFileInfo *
+find_info (GListModel *model,
+           const char *name)
+{
+  guint i;
+
+  for (i = 0; i < g_list_model_get_n_items (model); i++)
+    {
+      GFileInfo *info = g_list_model_get_item (model, i);
+
+      if (g_str_equal (g_file_info_get_name (info), name))
+        return info;
+
+      g_object_unref (info);
+    }
+
+  return NULL;
+}
+
+static void
+assert_infos_equal (GFileInfo *expected,
+                    GFileInfo *info)
+{
+  char **attributes;
+  guint i;
+
+  attributes = g_file_info_list_attributes (expected, NULL);
+  for (i = 0; attributes[i]; i++)
+    {
+      GFileAttributeType type = g_file_info_get_attribute_type (expected, attributes[i]);
+
+      if (type == G_FILE_ATTRIBUTE_TYPE_OBJECT)
+        {
+          GObject *object = g_file_info_get_attribute_object (expected, attributes[i]);
+
+          if (G_IS_ICON (object))
+            {
+              g_assert_cmpint (g_file_info_get_attribute_type (info, attributes[i]), ==, type);
+              g_assert_true (g_icon_equal (G_ICON (object),
+                                           G_ICON (g_file_info_get_attribute_object (info, attributes[i]))));
+            }
+          else if (G_IS_FILE (object))
+            {
+              g_assert_true (g_file_equal (G_FILE (object),
+                                           G_FILE (g_file_info_get_attribute_object (info, attributes[i]))));
+            }
+          else
+            {
+              /* other objects are not stored */
+              g_assert_false (g_file_info_has_attribute (info, attributes[i]));
+            }
+        }
+      else
+        {
+          char *expected_value, *value;
+
+          g_assert_cmpint (g_file_info_get_attribute_type (info, attributes[i]), ==, type);
+
+          expected_value = g_file_info_get_attribute_as_string (expected, attributes[i]);
+          value = g_file_info_get_attribute_as_string (info, attributes[i]);
+          g_assert_cmpstr (value, ==, expected_value);
+          g_free (value);
+          g_free (expected_value);
+        }
+    }
+  g_strfreev (attributes);
+}
+
+static void
+test_compact_roundtrip (void)
+{
+  const char *strv[] = { "one", "", "three", NULL };
+  const char *empty_strv[] = { NULL };
+  GtkDirectoryList *list;
+  GFile *dir, *file;
+  GFileInfo *info, *expanded;
+  GIcon *icon;
+  GObject *object;
+  gpointer entry;
+
+  dir = g_file_new_for_path (g_get_tmp_dir ());
+  list = g_object_new (GTK_TYPE_DIRECTORY_LIST,
+                       "monitored", FALSE,
+                       "compact", TRUE,
+                       "file", dir,
+                       NULL);
+  file = g_file_get_child (dir, "roundtrip");
+
+  info = g_file_info_new ();
+  g_file_info_set_attribute_string (info, "test::string", "Grüße");
+  g_file_info_set_attribute_string (info, "test::empty-string", "");
+  g_file_info_set_attribute_byte_string (info, "test::byte-string", "\xff\xfe not utf-8");
+  g_file_info_set_attribute_boolean (info, "test::true", TRUE);
+  g_file_info_set_attribute_boolean (info, "test::false", FALSE);
+  g_file_info_set_attribute_uint32 (info, "test::uint32", G_MAXUINT32);
+  g_file_info_set_attribute_int32 (info, "test::int32", G_MININT32);
+  g_file_info_set_attribute_uint64 (info, "test::uint64", G_MAXUINT64);
+  g_file_info_set_attribute_int64 (info, "test::int64", G_MININT64);
+  icon = g_themed_icon_new_with_default_fallbacks ("text-x-generic-symbolic");
+  g_file_info_set_attribute_object (info, "test::icon", G_OBJECT (icon));
+  g_object_unref (icon);
+  icon = g_file_icon_new (file);
+  g_file_info_set_attribute_object (info, "test::file-icon", G_OBJECT (icon));
+  g_object_unref (icon);
+  object = g_object_new (G_TYPE_OBJECT, NULL);
+  g_file_info_set_attribute_object (info, "test::object", object);
+  g_object_unref (object);
+  g_file_info_set_attribute_stringv (info, "test::stringv", (char **) strv);
+  g_file_info_set_attribute_stringv (info, "test::empty-stringv", (char **) empty_strv);
+
+  entry = gtk_directory_list_compact_info (list, file, info);
+  expanded = gtk_directory_list_expand_info (list, entry);
+
+  assert_infos_equal (info, expanded);
+  g_assert_false (g_file_info_has_attribute (expanded, "test::object"));
+  g_assert_true (g_file_equal (file, G_FILE (g_file_info_get_attribute_object (expanded, "standard::file"))));
+
+  /* attribute ids are shared between entries */
+  g_object_unref (expanded);
+  g_free (entry);
+  entry = gtk_directory_list_compact_info (list, file, info);
+  expanded = gtk_directory_list_expand_info (list, entry);
+  assert_infos_equal (info, expanded);
+
+  g_object_unref (expanded);
+  g_free (entry);
+  g_object_unref (info);
+  g_object_unref (file);
+  g_object_unref (list);
+  g_object_unref (dir);
+}
+
+static void
+test_compact_files (void)
+{
+  GtkDirectoryList *list, *compact;
+  char *path;
+  GFile *dir;
+  GFileInfo *info, *compact_info, *again;
+  guint i;
+
+  path = create_directory (N_FILES);
+  dir = g_file_new_for_path (path);
+
+  list = gtk_directory_list_new ("standard::*,time::*,unix::*,access::*,owner::*", dir);
+  compact = gtk_directory_list_new ("standard::*,time::*,unix::*,access::*,owner::*", dir);
+  gtk_directory_list_set_compact (compact, TRUE);
+  wait_for_loading (list);
+  wait_for_loading (compact);
+
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (list)), ==, N_FILES);
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (compact)), ==, N_FILES);
+
+  for (i = 0; i < N_FILES; i++)
+    {
+      info = g_list_model_get_item (G_LIST_MODEL (list), i);
+      compact_info = find_info (G_LIST_MODEL (compact), g_file_info_get_name (info));
+      g_assert_nonnull (compact_info);
+
+      assert_infos_equal (info, compact_info);
+
+      /* asking again gives the same info as long as it is alive */
+      again = find_info (G_LIST_MODEL (compact), g_file_info_get_name (info));
+      g_assert_true (again == compact_info);
+
+      g_object_unref (again);
+      g_object_unref (compact_info);
+      g_object_unref (info);
+    }
+
+  g_object_unref (compact);
+  g_object_unref (list);
+
+  remove_directory (path);
+  g_object_unref (dir);
+  g_free (path);
+}
+
+static gpointer
+unref_infos_thread (gpointer data)
+{
+  g_ptr_array_unref (data);
+
+  return NULL;
+}
+
+/* Infos can be released on other threads and outlive the list */
+static void
+test_compact_threads (void)
+{
+  GtkDirectoryList *list;
+  GPtrArray *infos;
+  GThread *thread;
+  GFileInfo *info;
+  char *path;
+  GFile *dir;
+  guint i, run;
+
+  path = create_directory (N_FILES);
+  dir = g_file_new_for_path (path);
+
+  list = gtk_directory_list_new ("standard::name", dir);
+  gtk_directory_list_set_compact (list, TRUE);
+  wait_for_loading (list);
+
+  for (run = 0; run < 10; run++)
+    {
+      infos = g_ptr_array_new_with_free_func (g_object_unref);
+      for (i = 0; i < N_FILES; i++)
+        g_ptr_array_add (infos, g_list_model_get_item (G_LIST_MODEL (list), i));
+
+      thread = g_thread_new ("unref infos", unref_infos_thread, infos);
+
+      for (i = 0; i < N_FILES; i++)
+        {
+          info = g_list_model_get_item (G_LIST_MODEL (list), i);
+          g_assert_true (G_IS_FILE_INFO (info));
+          g_assert_nonnull (g_file_info_get_name (info));
+          g_object_unref (info);
+        }
+
+      g_thread_join (thread);
+    }
+
+  info = g_list_model_get_item (G_LIST_MODEL (list), 0);
+  g_object_unref (list);
+  g_assert_nonnull (g_file_info_get_name (info));
+  g_object_unref (info);
+
+  remove_directory (path);
+  g_object_unref (dir);
+  g_free (path);
+}
+
+static void
+test_batching (gconstpointer data)
+{
+  gboolean compact = GPOINTER_TO_UINT (data);
+  GtkDirectoryList *list;
+  Tracker tracker;
+  char *path;
+  GFile *dir;
+  gint64 elapsed_ms;
+
+  path = create_directory (N_FILES);
+  dir = g_file_new_for_path (path);
+
+  list = g_object_new (GTK_TYPE_DIRECTORY_LIST,
+                       "attributes", "standard::name,standard::size",
+                       "compact", compact,
+                       "monitored", FALSE,
+                       NULL);
+  tracker_connect (&tracker, list);
+  g_signal_connect (list, "notify::loading", G_CALLBACK (tracker_notify_loading), &tracker);
+
+  gtk_directory_list_set_file (list, dir);
+  /* nothing is announced before the first flush */
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (list)), ==, 0);
+  g_assert_cmpuint (tracker.n_changes, ==, 0);
+
+  wait_for_loading (list);
+  elapsed_ms = (g_get_monotonic_time () - tracker.start_time) / 1000;
+
+  g_assert_cmpuint (tracker.n_items, ==, N_FILES);
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (list)), ==, N_FILES);
+
+  /* at most one emission per flush interval, plus the one when loading finishes */
+  g_assert_cmpuint (tracker.n_changes, <=, elapsed_ms / FLUSH_INTERVAL_MS + 2);
+
+  g_object_unref (list);
+
+  remove_directory (path);
+  g_object_unref (dir);
+  g_free (path);
+}
+
+static void
+test_restart (void)
+{
+  GtkDirectoryList *list;
+  Tracker tracker;
+  char *path;
+  GFile *dir;
+  guint i;
+
+  path = create_directory (N_FILES);
+  dir = g_file_new_for_path (path);
+
+  list = g_object_new (GTK_TYPE_DIRECTORY_LIST,
+                       "attributes", "standard::name",
+                       "monitored", FALSE,
+                       "file", dir,
+                       NULL);
+  tracker_connect (&tracker, list);
+
+  /* Restart loading while files may still be pending. Files of the
+   * previous run must never show up.
+   */
+  for (i = 0; i < 4; i++)
+    {
+      while (g_main_context_iteration (NULL, FALSE));
+
+      if (i % 2)
+        gtk_directory_list_set_compact (list, !gtk_directory_list_get_compact (list));
+      else
+        gtk_directory_list_set_attributes (list, i == 0 ? "standard::*" : "standard::name");
+
+      g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (list)), ==, 0);
+      g_assert_cmpuint (tracker.n_items, ==, 0);
+    }
+
+  wait_for_loading (list);
+  g_assert_cmpuint (tracker.n_items, ==, N_FILES);
+
+  /* and once loading is done */
+  gtk_directory_list_set_compact (list, !gtk_directory_list_get_compact (list));
+  g_assert_cmpuint (tracker.n_items, ==, 0);
+  wait_for_loading (list);
+  g_assert_cmpuint (tracker.n_items, ==, N_FILES);
+
+  g_object_unref (list);
+
+  remove_directory (path);
+  g_object_unref (dir);
+  g_free (path);
+}
+
+static void
+create_file (const char *dir,
+             const char *name)
+{
+  char *path;
+  FILE *f;
+
+  /* not g_file_set_contents(), we don't want to see the temporary file */
+  path = g_build_filename (dir, name, NULL);
+  f = g_fopen (path, "w");
+  g_assert_nonnull (f);
+  fclose (f);
+  g_free (path);
+}
+
+static void
+delete_file (const char *dir,
+             const char *name)
+{
+  char *path;
+
+  path = g_build_filename (dir, name, NULL);
+  g_assert_cmpint (g_unlink (path), ==, 0);
+  g_free (path);
+}
+
+static gboolean
+has_file (GtkDirectoryList *list,
+          const char       *name)
+{
+  GFileInfo *info;
+
+  info = find_info (G_LIST_MODEL (list), name);
+  if (info == NULL)
+    return FALSE;
+
+  g_object_unref (info);
+  return TRUE;
+}
+
+static void
+wait_for_file (GtkDirectoryList *list,
+               const char       *name,
+               gboolean          exists)
+{
+  guint timeout;
+
+  timeout = g_timeout_add_seconds (10, timeout_cb, NULL);
+  while (has_file (list, name) != exists)
+    g_main_context_iteration (NULL, TRUE);
+  g_source_remove (timeout);
+}
+
+static void
+test_monitor (gconstpointer data)
+{
+  gboolean compact = GPOINTER_TO_UINT (data);
+  GtkDirectoryList *list;
+  Tracker tracker;
+  char *path;
+  GFile *dir;
+
+  path = create_directory (N_FILES);
+  dir = g_file_new_for_path (path);
+
+  list = g_object_new (GTK_TYPE_DIRECTORY_LIST,
+                       "attributes", "standard::name",
+                       "compact", compact,
+                       "file", dir,
+                       NULL);
+  wait_for_loading (list);
+  tracker_connect (&tracker, list);
+
+  create_file (path, "new1");
+  wait_for_file (list, "new1", TRUE);
+  g_assert_cmpuint (tracker.n_items, ==, N_FILES + 1);
+
+  delete_file (path, "file0");
+  wait_for_file (list, "file0", FALSE);
+  g_assert_cmpuint (tracker.n_items, ==, N_FILES);
+
+  /* A removal right after a creation must announce the pending
+   * file before removing the other one.
+   */
+  create_file (path, "new2");
+  delete_file (path, "file1");
+  wait_for_file (list, "new2", TRUE);
+  wait_for_file (list, "file1", FALSE);
+  g_assert_cmpuint (tracker.n_items, ==, N_FILES);
+
+  create_file (path, "new3");
+  delete_file (path, "new3");
+  wait_for_file (list, "new3", FALSE);
+  create_file (path, "new4");
+  wait_for_file (list, "new4", TRUE);
+  g_assert_false (has_file (list, "new3"));
+  g_assert_cmpuint (tracker.n_items, ==, N_FILES + 1);
+
+  g_object_unref (list);
+
+  remove_directory (path);
+  g_object_unref (dir);
+  g_free (path);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/directorylist/compact/roundtrip", test_compact_roundtrip);
+  g_test_add_func ("/directorylist/compact/files", test_compact_files);
+  g_test_add_func ("/directorylist/compact/threads", test_compact_threads);
+  g_test_add_data_func ("/directorylist/batching", GUINT_TO_POINTER (FALSE), test_batching);
+  g_test_add_data_func ("/directorylist/batching-compact", GUINT_TO_POINTER (TRUE), test_batching);
+  g_test_add_func ("/directorylist/restart", test_restart);
+  g_test_add_data_func ("/directorylist/monitor", GUINT_TO_POINTER (FALSE), test_monitor);
+  g_test_add_data_func ("/directorylist/monitor-compact", GUINT_TO_POINTER (TRUE), test_monitor);
+
+  return g_test_run ();
+}
@@ -393,6 +393,73 @@ test_every_dispose (void)
   g_object_unref (filter2);
 }
 
+static void
+assert_match_items (GtkFilter  *filter,
+                    GListModel *model)
+{
+  GtkBitset *positions, *matches;
+  guint i, n_items;
+
+  n_items = g_list_model_get_n_items (model);
+  positions = gtk_bitset_new_range (0, n_items);
+  matches = gtk_filter_match_items (filter, model, positions);
+
+  for (i = 0; i < n_items; i++)
+    {
+      gpointer item = g_list_model_get_item (model, i);
+      g_assert_cmpint (gtk_filter_match (filter, item), ==, gtk_bitset_contains (matches, i));
+      g_object_unref (item);
+    }
+
+  gtk_bitset_unref (matches);
+  gtk_bitset_unref (positions);
+}
+
+static void
+test_match_items (void)
+{
+  GtkFilterListModel *model;
+  GtkFilter *any, *every, *filter;
+  GListModel *store;
+
+  every = GTK_FILTER (gtk_every_filter_new ());
+  filter = GTK_FILTER (gtk_custom_filter_new (divisible_by, GUINT_TO_POINTER (3), NULL));
+  gtk_multi_filter_append (GTK_MULTI_FILTER (every), filter);
+  filter = GTK_FILTER (gtk_string_filter_new (
+               gtk_cclosure_expression_new (G_TYPE_STRING,
+                                            NULL,
+                                            0, NULL,
+                                            G_CALLBACK (get_string),
+                                            NULL, NULL)));
+  gtk_string_filter_set_search (GTK_STRING_FILTER (filter), "1");
+  gtk_multi_filter_append (GTK_MULTI_FILTER (every), filter);
+
+  any = GTK_FILTER (gtk_any_filter_new ());
+  gtk_multi_filter_append (GTK_MULTI_FILTER (any), every);
+  filter = GTK_FILTER (gtk_bool_filter_new (
+               gtk_cclosure_expression_new (G_TYPE_BOOLEAN,
+                                            NULL,
+                                            0, NULL,
+                                            G_CALLBACK (divisible_by),
+                                            GUINT_TO_POINTER (5), NULL)));
+  gtk_multi_filter_append (GTK_MULTI_FILTER (any), filter);
+
+  model = new_model (100, any);
+  assert_model (model, "5 10 12 15 18 20 21 25 30 35 40 45 50 51 55 60 65 70 75 80 81 85 90 95 100");
+
+  store = gtk_filter_list_model_get_model (model);
+  assert_match_items (every, store);
+  assert_match_items (filter, store);
+  assert_match_items (any, store);
+
+  gtk_bool_filter_set_invert (GTK_BOOL_FILTER (filter), TRUE);
+  assert_match_items (filter, store);
+  assert_match_items (any, store);
+
+  g_object_unref (model);
+  g_object_unref (any);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -407,6 +474,7 @@ main (int argc, char *argv[])
   g_test_add_func ("/filter/string/properties", test_string_properties);
   g_test_add_func ("/filter/bool/simple", test_bool_simple);
   g_test_add_func ("/filter/every/dispose", test_every_dispose);
+  g_test_add_func ("/filter/match-items", test_match_items);
 
   return g_test_run ();
 }
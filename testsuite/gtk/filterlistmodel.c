@@ -376,6 +376,78 @@ test_incremental (void)
   g_object_unref (filter);
 }
 
+static char *
+get_number_string (GObject *object)
+{
+  return g_strdup_printf ("%u", GPOINTER_TO_UINT (g_object_get_qdata (object, number_quark)));
+}
+
+static void
+test_string_filter (void)
+{
+  GtkFilterListModel *filter;
+  GtkStringFilter *string_filter;
+  GListStore *store;
+
+  filter = new_model (1000, NULL, NULL);
+  store = G_LIST_STORE (gtk_filter_list_model_get_model (filter));
+  string_filter = gtk_string_filter_new (gtk_cclosure_expression_new (G_TYPE_STRING,
+                                                                      NULL,
+                                                                      0, NULL,
+                                                                      G_CALLBACK (get_number_string),
+                                                                      NULL, NULL));
+  gtk_string_filter_set_search (string_filter, "12");
+  gtk_filter_list_model_set_filter (filter, GTK_FILTER (string_filter));
+  assert_model (filter, "12 112 120 121 122 123 124 125 126 127 128 129 212 312 412 512 612 712 812 912");
+  ignore_changes (filter);
+
+  /* more strict */
+  gtk_string_filter_set_search (string_filter, "123");
+  assert_model (filter, "123");
+  ignore_changes (filter);
+
+  /* different */
+  gtk_string_filter_set_search (string_filter, "999");
+  assert_model (filter, "999");
+  assert_changes (filter, "0-1+1");
+
+  /* the index must follow changes of the model */
+  g_list_store_remove (store, 0);
+  add (store, 1999);
+  assert_model (filter, "999 1999");
+  assert_changes (filter, "+1");
+
+  /* including changes in front of indexed items */
+  g_list_store_remove (store, 0);
+  g_list_store_remove (store, 0);
+  assert_model (filter, "999 1999");
+  assert_changes (filter, "");
+
+  gtk_string_filter_set_search (string_filter, "199");
+  assert_model (filter, "199 1999");
+  ignore_changes (filter);
+
+  gtk_string_filter_set_search (string_filter, "999");
+  assert_model (filter, "999 1999");
+  ignore_changes (filter);
+
+  gtk_string_filter_set_match_mode (string_filter, GTK_STRING_FILTER_MATCH_MODE_PREFIX);
+  assert_model (filter, "999");
+  assert_changes (filter, "-1");
+
+  /* less strict */
+  gtk_string_filter_set_search (string_filter, "99");
+  assert_model (filter, "99 990 991 992 993 994 995 996 997 998 999");
+  ignore_changes (filter);
+
+  gtk_string_filter_set_ignore_case (string_filter, FALSE);
+  assert_model (filter, "99 990 991 992 993 994 995 996 997 998 999");
+  assert_changes (filter, "");
+
+  g_object_unref (string_filter);
+  g_object_unref (filter);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -389,6 +461,7 @@ main (int argc, char *argv[])
   g_test_add_func ("/filterlistmodel/empty_set_filter", test_empty_set_filter);
   g_test_add_func ("/filterlistmodel/change_filter", test_change_filter);
   g_test_add_func ("/filterlistmodel/incremental", test_incremental);
+  g_test_add_func ("/filterlistmodel/string_filter", test_string_filter);
 
   return g_test_run ();
 }
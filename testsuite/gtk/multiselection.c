@@ -670,6 +670,226 @@ test_set_model (void)
   g_object_unref (selection);
 }
 
+static void
+reverse (GListStore *store)
+{
+  guint i, n_items;
+  gpointer *items;
+
+  n_items = g_list_model_get_n_items (G_LIST_MODEL (store));
+  items = g_new (gpointer, n_items);
+  for (i = 0; i < n_items; i++)
+    items[n_items - i - 1] = g_list_model_get_item (G_LIST_MODEL (store), i);
+
+  g_list_store_splice (store, 0, n_items, items, n_items);
+
+  for (i = 0; i < n_items; i++)
+    g_object_unref (items[i]);
+  g_free (items);
+}
+
+/* Test that the selection follows the items when the model
+ * replaces them, as happens when it is reordered.
+ */
+static void
+test_reorder (void)
+{
+  GtkSelectionModel *selection;
+  GListStore *store;
+  gboolean ret;
+
+  store = new_store (1, 5, 1);
+  selection = new_model (store);
+
+  ret = gtk_selection_model_select_item (selection, 0, FALSE);
+  g_assert_true (ret);
+  assert_selection (selection, "1");
+  assert_selection_changes (selection, "0:1");
+
+  insert (store, 0, 99);
+  assert_changes (selection, "+0");
+  assert_selection (selection, "1");
+
+  g_list_store_remove (store, 0);
+  assert_changes (selection, "-0");
+  assert_selection (selection, "1");
+
+  reverse (store);
+  assert_changes (selection, "0-5+5");
+  assert_selection (selection, "1");
+
+  reverse (store);
+  assert_changes (selection, "0-5+5");
+  assert_selection (selection, "1");
+
+  ret = gtk_selection_model_select_item (selection, 4, FALSE);
+  g_assert_true (ret);
+  assert_selection (selection, "1 5");
+  assert_selection_changes (selection, "4:1");
+
+  reverse (store);
+  assert_changes (selection, "0-5+5");
+  assert_selection (selection, "5 1");
+
+  g_object_unref (store);
+  g_object_unref (selection);
+}
+
+/* Test that a large selection keeps its positions when the model
+ * replaces selected items the first time, and follows its items after.
+ */
+static void
+test_reorder_large (void)
+{
+  GtkSelectionModel *selection;
+  GListStore *store;
+  gboolean ret;
+
+  store = new_store (1, 2000, 1);
+  selection = new_model (store);
+
+  ret = gtk_selection_model_select_range (selection, 0, 1500, FALSE);
+  g_assert_true (ret);
+  assert_selection_changes (selection, "0:1500");
+
+  insert (store, 0, 9999);
+  assert_changes (selection, "+0");
+  g_assert_false (gtk_selection_model_is_selected (selection, 0));
+  g_assert_true (gtk_selection_model_is_selected (selection, 1500));
+  g_assert_false (gtk_selection_model_is_selected (selection, 1501));
+
+  g_list_store_remove (store, 0);
+  assert_changes (selection, "-0");
+
+  reverse (store);
+  assert_changes (selection, "0-2000+2000");
+  g_assert_cmpuint (get (G_LIST_MODEL (selection), 0), ==, 2000);
+  g_assert_true (gtk_selection_model_is_selected (selection, 0));
+  g_assert_true (gtk_selection_model_is_selected (selection, 1499));
+  g_assert_false (gtk_selection_model_is_selected (selection, 1500));
+
+  reverse (store);
+  assert_changes (selection, "0-2000+2000");
+  g_assert_false (gtk_selection_model_is_selected (selection, 0));
+  g_assert_false (gtk_selection_model_is_selected (selection, 499));
+  g_assert_true (gtk_selection_model_is_selected (selection, 500));
+  g_assert_true (gtk_selection_model_is_selected (selection, 1999));
+
+  g_object_unref (store);
+  g_object_unref (selection);
+}
+
+static GtkSelectionModel *
+new_large_model (guint n_items)
+{
+  GtkSelectionModel *selection;
+  GListStore *store;
+  gpointer *items;
+  guint i;
+
+  items = g_new (gpointer, n_items);
+  for (i = 0; i < n_items; i++)
+    items[i] = g_object_new (G_TYPE_OBJECT, NULL);
+
+  store = g_list_store_new (G_TYPE_OBJECT);
+  g_list_store_splice (store, 0, 0, items, n_items);
+
+  for (i = 0; i < n_items; i++)
+    g_object_unref (items[i]);
+  g_free (items);
+
+  selection = GTK_SELECTION_MODEL (gtk_multi_selection_new (G_LIST_MODEL (store)));
+
+  return selection;
+}
+
+static void
+test_select_all_large (void)
+{
+  guint n = g_test_perf () ? 1000000 : 1000;
+  GtkSelectionModel *selection;
+  GtkBitset *selected;
+  double elapsed;
+
+  selection = new_large_model (n);
+
+  g_test_timer_start ();
+
+  gtk_selection_model_select_all (selection);
+  gtk_selection_model_unselect_all (selection);
+
+  elapsed = g_test_timer_elapsed ();
+  if (g_test_perf ())
+    g_test_minimized_result (elapsed, "selecting and unselecting all of %u items: %gsec", n, elapsed);
+
+  selected = gtk_selection_model_get_selection (selection);
+  g_assert_true (gtk_bitset_is_empty (selected));
+  gtk_bitset_unref (selected);
+
+  g_object_unref (selection);
+}
+
+static void
+test_invert_large (void)
+{
+  guint n = g_test_perf () ? 1000000 : 1000;
+  GtkSelectionModel *selection;
+  GtkBitset *selected, *mask;
+  double elapsed;
+
+  selection = new_large_model (n);
+  selected = gtk_bitset_new_empty ();
+  gtk_bitset_add_rectangle (selected, 0, 1, n / 3, 3);
+  mask = gtk_bitset_new_range (0, n);
+  gtk_selection_model_set_selection (selection, selected, mask);
+  gtk_bitset_unref (selected);
+
+  g_test_timer_start ();
+
+  selected = gtk_selection_model_get_selection (selection);
+  gtk_bitset_difference (selected, mask);
+  gtk_selection_model_set_selection (selection, selected, mask);
+  gtk_bitset_unref (selected);
+
+  elapsed = g_test_timer_elapsed ();
+  if (g_test_perf ())
+    g_test_minimized_result (elapsed, "inverting the selection of %u items: %gsec", n, elapsed);
+
+  selected = gtk_selection_model_get_selection (selection);
+  g_assert_cmpuint (gtk_bitset_get_size (selected), ==, n - n / 3);
+  gtk_bitset_unref (selected);
+
+  gtk_bitset_unref (mask);
+  g_object_unref (selection);
+}
+
+static void
+test_select_range_large (void)
+{
+  guint n = g_test_perf () ? 1000000 : 1000;
+  GtkSelectionModel *selection;
+  double elapsed;
+  guint i;
+
+  selection = new_large_model (n);
+
+  g_test_timer_start ();
+
+  for (i = 0; i < 100; i++)
+    gtk_selection_model_select_range (selection, i * (n / 100), n / 200, FALSE);
+  gtk_selection_model_select_range (selection, 0, n / 2, TRUE);
+
+  elapsed = g_test_timer_elapsed ();
+  if (g_test_perf ())
+    g_test_minimized_result (elapsed, "selecting ranges in %u items: %gsec", n, elapsed);
+
+  g_assert_true (gtk_selection_model_is_selected (selection, 0));
+  g_assert_true (gtk_selection_model_is_selected (selection, n / 2 - 1));
+  g_assert_false (gtk_selection_model_is_selected (selection, n / 2));
+
+  g_object_unref (selection);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -691,6 +911,11 @@ main (int argc, char *argv[])
   g_test_add_func ("/multiselection/set_selection", test_set_selection);
   g_test_add_func ("/multiselection/selection-filter", test_selection_filter);
   g_test_add_func ("/multiselection/set-model", test_set_model);
+  g_test_add_func ("/multiselection/reorder", test_reorder);
+  g_test_add_func ("/multiselection/reorder-large", test_reorder_large);
+  g_test_add_func ("/multiselection/select-all-large", test_select_all_large);
+  g_test_add_func ("/multiselection/invert-large", test_invert_large);
+  g_test_add_func ("/multiselection/select-range-large", test_select_range_large);
 
   return g_test_run ();
 }
@@ -165,7 +165,7 @@ sort_list_model_new (GListModel *source,
   return model;
 }
 
-#define N_MODELS 8
+#define N_MODELS 12
 
 static char *
 create_test_name (guint id)
@@ -182,10 +182,24 @@ create_test_name (guint id)
   else
     g_string_append (s, "/construct-with-sorter");
 
-  if (id & (1 << 2))
-    g_string_append (s, "/incremental");
-  else
-    g_string_append (s, "/non-incremental");
+  switch (id >> 2)
+  {
+    case 0:
+      g_string_append (s, "/non-incremental");
+      break;
+
+    case 1:
+      g_string_append (s, "/incremental");
+      break;
+
+    case 2:
+      g_string_append (s, "/threaded");
+      break;
+
+    default:
+      g_assert_not_reached ();
+      break;
+  }
 
   return g_string_free (s, FALSE);
 }
@@ -213,6 +227,10 @@ create_sort_list_model (gconstpointer  model_id,
       gtk_sort_list_model_set_incremental (model, TRUE);
       break;
 
+    case 2:
+      gtk_sort_list_model_set_threaded (model, TRUE);
+      break;
+
     default:
       g_assert_not_reached ();
       break;
@@ -435,6 +453,82 @@ test_stability (gconstpointer model_id)
   g_object_unref (flatten);
 }
 
+static GListModel *
+create_large_source_model (guint size)
+{
+  const char letters[] = "aAbBcC";
+  GtkStringList *list;
+  char s[5];
+  guint i, j, len;
+
+  list = gtk_string_list_new (NULL);
+
+  for (i = 0; i < size; i++)
+    {
+      len = g_test_rand_int_range (1, sizeof (s));
+      for (j = 0; j < len; j++)
+        s[j] = letters[g_test_rand_int_range (0, sizeof (letters) - 1)];
+      s[len] = 0;
+      gtk_string_list_append (list, s);
+    }
+
+  return G_LIST_MODEL (list);
+}
+
+/* Sort models that are big enough to be split into multiple chunks
+ * with and without threads, and check that they agree, also when
+ * the source and the sorter change.
+ */
+static void
+test_threaded_large (void)
+{
+  GtkSortListModel *serial, *threaded;
+  GListModel *source;
+  GtkSorter *sorter;
+  GtkMultiSorter *multi;
+  guint i;
+
+  if (g_get_num_processors () < 2)
+    g_test_message ("Only one processor, the items will be sorted in a single chunk");
+
+  source = create_large_source_model (g_test_rand_int_range (2048, 8192));
+  sorter = GTK_SORTER (gtk_string_sorter_new (gtk_property_expression_new (GTK_TYPE_STRING_OBJECT, NULL, "string")));
+  serial = sort_list_model_new (source, sorter);
+  threaded = sort_list_model_new (source, sorter);
+  gtk_sort_list_model_set_threaded (threaded, TRUE);
+  g_object_unref (source);
+  assert_model_equal (G_LIST_MODEL (serial), G_LIST_MODEL (threaded));
+
+  /* resort with different keys */
+  gtk_string_sorter_set_ignore_case (GTK_STRING_SORTER (sorter), FALSE);
+  assert_model_equal (G_LIST_MODEL (serial), G_LIST_MODEL (threaded));
+
+  /* multisorters break ties with the next sorter */
+  multi = gtk_multi_sorter_new ();
+  gtk_multi_sorter_append (multi, g_object_ref (sorter));
+  gtk_multi_sorter_append (multi, GTK_SORTER (gtk_string_sorter_new (gtk_property_expression_new (GTK_TYPE_STRING_OBJECT, NULL, "string"))));
+  gtk_string_sorter_set_ignore_case (GTK_STRING_SORTER (sorter), TRUE);
+  gtk_sort_list_model_set_sorter (serial, GTK_SORTER (multi));
+  gtk_sort_list_model_set_sorter (threaded, GTK_SORTER (multi));
+  g_object_unref (multi);
+  g_object_unref (sorter);
+  assert_model_equal (G_LIST_MODEL (serial), G_LIST_MODEL (threaded));
+
+  for (i = 0; i < 5; i++)
+    {
+      source = create_large_source_model (g_test_rand_int_range (2048, 8192));
+      gtk_sort_list_model_set_model (serial, source);
+      gtk_sort_list_model_set_model (threaded, source);
+      g_object_unref (source);
+
+      ensure_updated ();
+      assert_model_equal (G_LIST_MODEL (serial), G_LIST_MODEL (threaded));
+    }
+
+  g_object_unref (threaded);
+  g_object_unref (serial);
+}
+
 static void
 add_test_for_all_models (const char    *name,
                          GTestDataFunc  test_func)
@@ -460,6 +554,7 @@ main (int argc, char *argv[])
 
   add_test_for_all_models ("two-sorters", test_two_sorters);
   add_test_for_all_models ("stability", test_stability);
+  g_test_add_func ("/sorterlistmodel/threaded/large", test_threaded_large);
 
   return g_test_run ();
 }
@@ -517,6 +517,99 @@ test_incremental_remove (void)
   g_object_unref (removed);
 }
 
+static guint
+scramble (GObject *object)
+{
+  return GPOINTER_TO_UINT (g_object_get_qdata (object, number_quark)) * 2654435761u;
+}
+
+static int
+get_int (GObject *object)
+{
+  return (int) (scramble (object) % 1000) - 500;
+}
+
+static double
+get_double (GObject *object)
+{
+  return (scramble (object) % 77) / 4.0 - 5.0;
+}
+
+static char *
+get_string (GObject *object)
+{
+  /* long common prefixes so that the radix keys don't decide the order */
+  return g_strdup_printf ("%s%u", scramble (object) % 2 ? "prefix-" : "", scramble (object) % 100);
+}
+
+static void
+assert_sorted_stably (GtkSortListModel *model,
+                      GtkSorter        *sorter)
+{
+  GListModel *list = G_LIST_MODEL (model);
+  guint i;
+
+  for (i = 1; i < g_list_model_get_n_items (list); i++)
+    {
+      gpointer a = g_list_model_get_item (list, i - 1);
+      gpointer b = g_list_model_get_item (list, i);
+
+      switch (gtk_sorter_compare (sorter, a, b))
+        {
+        case GTK_ORDERING_SMALLER:
+          break;
+        case GTK_ORDERING_EQUAL:
+          g_assert_cmpuint (get (list, i - 1), <, get (list, i));
+          break;
+        case GTK_ORDERING_LARGER:
+        default:
+          g_assert_not_reached ();
+        }
+
+      g_object_unref (a);
+      g_object_unref (b);
+    }
+}
+
+/* Test that sorters with radix keys sort the same as comparing */
+static void
+test_radix (void)
+{
+  GtkSorter *sorters[3];
+  GtkSortListModel *model;
+  GListStore *store;
+  guint i;
+
+  store = new_empty_store ();
+  for (i = 1; i <= 5000; i++)
+    add (store, i);
+
+  sorters[0] = GTK_SORTER (gtk_numeric_sorter_new (gtk_cclosure_expression_new (G_TYPE_INT, NULL, 0, NULL, (GCallback) get_int, NULL, NULL)));
+  sorters[1] = GTK_SORTER (gtk_numeric_sorter_new (gtk_cclosure_expression_new (G_TYPE_DOUBLE, NULL, 0, NULL, (GCallback) get_double, NULL, NULL)));
+  gtk_numeric_sorter_set_sort_order (GTK_NUMERIC_SORTER (sorters[1]), GTK_SORT_DESCENDING);
+  sorters[2] = GTK_SORTER (gtk_string_sorter_new (gtk_cclosure_expression_new (G_TYPE_STRING, NULL, 0, NULL, (GCallback) get_string, NULL, NULL)));
+
+  model = new_model (store);
+
+  for (i = 0; i < G_N_ELEMENTS (sorters); i++)
+    {
+      gtk_sort_list_model_set_sorter (model, sorters[i]);
+      assert_sorted_stably (model, sorters[i]);
+    }
+
+  /* changing the sort order keeps the keys */
+  gtk_numeric_sorter_set_sort_order (GTK_NUMERIC_SORTER (sorters[1]), GTK_SORT_ASCENDING);
+  gtk_sort_list_model_set_sorter (model, sorters[1]);
+  assert_sorted_stably (model, sorters[1]);
+
+  ignore_changes (model);
+
+  for (i = 0; i < G_N_ELEMENTS (sorters); i++)
+    g_object_unref (sorters[i]);
+  g_object_unref (store);
+  g_object_unref (model);
+}
+
 static void
 test_out_of_bounds_access (void)
 {
@@ -554,6 +647,7 @@ main (int argc, char *argv[])
   g_test_add_func ("/sortlistmodel/stability", test_stability);
   g_test_add_func ("/sortlistmodel/incremental/remove", test_incremental_remove);
   g_test_add_func ("/sortlistmodel/oob-access", test_out_of_bounds_access);
+  g_test_add_func ("/sortlistmodel/radix", test_radix);
 
   return g_test_run ();
 }
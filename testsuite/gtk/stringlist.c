@@ -242,6 +242,92 @@ test_take (void)
   g_object_unref (list);
 }
 
+static void
+test_items (void)
+{
+  GtkStringList *list;
+  GtkStringObject *so1, *so2;
+  char *large;
+
+  list = new_model ((const char *[]){ "a", "b", "c", NULL });
+
+  so1 = g_list_model_get_item (G_LIST_MODEL (list), 0);
+  so2 = g_list_model_get_item (G_LIST_MODEL (list), 0);
+  g_assert_true (so1 == so2);
+  g_object_unref (so2);
+
+  /* items survive their removal */
+  gtk_string_list_remove (list, 0);
+  assert_changes (list, "-0");
+  g_assert_cmpstr (gtk_string_object_get_string (so1), ==, "a");
+
+  so2 = g_list_model_get_item (G_LIST_MODEL (list), 0);
+  g_assert_true (so1 != so2);
+  g_assert_cmpstr (gtk_string_object_get_string (so2), ==, "b");
+  g_object_unref (so2);
+
+  /* strings that don't fit the shared storage */
+  large = g_strnfill (100000, 'x');
+  gtk_string_list_append (list, large);
+  assert_changes (list, "+2");
+  g_assert_cmpstr (gtk_string_list_get_string (list, 2), ==, large);
+  so2 = g_list_model_get_item (G_LIST_MODEL (list), 2);
+  g_free (large);
+
+  /* ...and the list */
+  g_object_unref (list);
+  g_assert_cmpstr (gtk_string_object_get_string (so1), ==, "a");
+  g_assert_cmpuint (strlen (gtk_string_object_get_string (so2)), ==, 100000);
+  g_object_unref (so1);
+  g_object_unref (so2);
+}
+
+static gpointer
+unref_items (gpointer data)
+{
+  GAsyncQueue *queue = data;
+  gpointer item;
+
+  while ((item = g_async_queue_pop (queue)) != queue)
+    g_object_unref (item);
+
+  return NULL;
+}
+
+/* Items may be released on other threads while the list is in use */
+static void
+test_items_threaded (void)
+{
+  GtkStringList *list;
+  GAsyncQueue *queue;
+  GThread *thread;
+  GtkStringObject *so;
+  guint i;
+
+  list = new_model ((const char *[]){ "a", "b", "c", "d", NULL });
+  queue = g_async_queue_new ();
+  thread = g_thread_new ("unref", unref_items, queue);
+
+  for (i = 0; i < 100000; i++)
+    {
+      so = g_list_model_get_item (G_LIST_MODEL (list), i % 4);
+      g_assert_cmpint (gtk_string_object_get_string (so)[0], ==, gtk_string_list_get_string (list, i % 4)[0]);
+      g_async_queue_push (queue, so);
+
+      if (i % 1000 == 0)
+        {
+          gtk_string_list_splice (list, 0, 1, NULL);
+          gtk_string_list_append (list, gtk_string_list_get_string (list, 0));
+        }
+    }
+
+  g_async_queue_push (queue, queue);
+  g_thread_join (thread);
+  g_async_queue_unref (queue);
+
+  g_object_unref (list);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -257,6 +343,8 @@ main (int argc, char *argv[])
   g_test_add_func ("/stringlist/splice", test_splice);
   g_test_add_func ("/stringlist/add_remove", test_add_remove);
   g_test_add_func ("/stringlist/take", test_take);
+  g_test_add_func ("/stringlist/items", test_items);
+  g_test_add_func ("/stringlist/items-threaded", test_items_threaded);
 
   return g_test_run ();
 }
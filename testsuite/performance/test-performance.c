@@ -11,6 +11,7 @@ typedef struct {
   const char *mark;
   const char *detail;
   gboolean do_start;
+  gboolean per_item;
   gint64 start_time;
   gint64 value;
 } Data;
@@ -32,6 +33,13 @@ callback (const SysprofCaptureFrame *frame,
             data->value = frame->time - data->start_time;
           else
             data->value = mark->duration;
+          if (data->per_item)
+            {
+              /* The detail starts with the number of items */
+              gint64 n_items = g_ascii_strtoll (mark->message, NULL, 10);
+              if (n_items > 0)
+                data->value /= n_items;
+            }
           return FALSE;
         }
     }
@@ -40,6 +48,7 @@ callback (const SysprofCaptureFrame *frame,
 }
 
 #define MILLISECONDS(v) ((v) / (1000.0 * G_TIME_SPAN_MILLISECOND))
+#define MICROSECONDS(v) ((v) / 1000.0)
 
 static int opt_rep = 10;
 static char *opt_mark;
@@ -47,6 +56,7 @@ static char *opt_detail;
 static char *opt_name;
 static char *opt_output;
 static gboolean opt_start_time;
+static gboolean opt_per_item;
 static GMainLoop *main_loop;
 static GError *failure;
 
@@ -54,6 +64,7 @@ static GOptionEntry options[] = {
   { "mark", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING, &opt_mark, "Name of the mark", "NAME" },
   { "detail", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING, &opt_detail, "Detail of the mark", "DETAIL" },
   { "start", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &opt_start_time, "Measure the start time", NULL },
+  { "per-item", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &opt_per_item, "Divide by the number of items in the detail", NULL },
   { "runs", '0', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &opt_rep, "Number of runs", "COUNT" },
   { "name", '0', G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING, &opt_name, "Name of this test", "NAME" },
   { "output", '0', G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING, &opt_output, "Directory to save syscap files", "DIRECTORY" },
@@ -201,6 +212,7 @@ main (int argc, char *argv[])
       data.mark = opt_mark ? opt_mark : "css validation";
       data.detail = opt_detail ? opt_detail : NULL;
       data.do_start = opt_start_time;
+      data.per_item = opt_per_item;
       data.start_time = sysprof_capture_reader_get_start_time (reader);
       data.value = 0;
 
@@ -260,9 +272,16 @@ main (int argc, char *argv[])
       total += values[i];
     }
 
-  g_print ("%d runs, min %g, max %g, avg %g\n",
-           count,
-           MILLISECONDS (min),
-           MILLISECONDS (max),
-           MILLISECONDS (total / count));
+  if (opt_per_item)
+    g_print ("%d runs, min %g, max %g, avg %g usec per item\n",
+             count,
+             MICROSECONDS (min),
+             MICROSECONDS (max),
+             MICROSECONDS (total / count));
+  else
+    g_print ("%d runs, min %g, max %g, avg %g\n",
+             count,
+             MILLISECONDS (min),
+             MILLISECONDS (max),
+             MILLISECONDS (total / count));
 }